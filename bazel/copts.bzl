@@ -25,6 +25,7 @@ linkopts = select({
         "-lmswsock",
         "-liphlpapi",
         "-lbcrypt",
+        "-lcrypt32",
     ],
     "//conditions:default": [],
 })
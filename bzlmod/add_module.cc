@@ -1,37 +1,25 @@
 #include "bzlmod/add_module.hh"
 
 #include <filesystem>
+#include <fstream>
+#include <iterator>
 #include <print>
 #include <algorithm>
-#include <execution>
-#define BOOST_PROCESS_VERSION 1
-#include <boost/process/v1.hpp>
+#include <array>
+#include "bzlreg/bazel_version.hh"
+#include "bzlreg/module_bazel.hh"
+#include "bzlreg/module_bazel_edit.hh"
+#include "bzlreg/util.hh"
 #include "bzlmod/get_registries.hh"
 #include "bzlmod/find_workspace_dir.hh"
-#include "bzlmod/download_module_metadata.hh"
+#include "bzlmod/registry_query.hh"
 
-namespace bp = boost::process;
 namespace fs = std::filesystem;
 
-struct registry_resolve_entry {
-	std::string_view registry;
-	std::string      module_version;
-};
-
 auto bzlmod::add_module( //
-	std::string_view dep_name
+	std::string_view dep_name,
+	bool             offline
 ) -> int {
-	auto buildozer = bp::search_path("buildozer");
-	if(buildozer.empty()) {
-		std::print(
-			stderr,
-			"[ERROR] `buildozer` is required to use `bzlmod add`. Please make sure "
-			"it's in your PATH. Buildozer may be downloaded here:\n"
-			"        https://github.com/bazelbuild/buildtools/releases\n\n"
-		);
-		return 1;
-	}
-
 	auto workspace_dir = find_workspace_dir(fs::current_path());
 
 	if(!workspace_dir) {
@@ -44,6 +32,22 @@ auto bzlmod::add_module( //
 		return 1;
 	}
 
+	auto module_bazel_path = *workspace_dir / "MODULE.bazel";
+	auto module_bazel_file = std::ifstream{module_bazel_path, std::ios::binary};
+	auto module_bazel_contents = std::string{
+		std::istreambuf_iterator<char>{module_bazel_file},
+		std::istreambuf_iterator<char>{},
+	};
+	auto module_bzl = bzlreg::module_bazel::parse(module_bazel_contents);
+	if(!module_bzl) {
+		std::println(
+			stderr,
+			"[ERROR] Unable to parse {}",
+			module_bzl.error().describe(module_bazel_path.generic_string())
+		);
+		return 1;
+	}
+
 	auto registries = get_registries(*workspace_dir);
 
 	if(!registries) {
@@ -51,95 +55,69 @@ auto bzlmod::add_module( //
 		return 1;
 	}
 
-	auto registry_resolve_entries = std::vector<registry_resolve_entry>{};
-	registry_resolve_entries.reserve(registries->size());
-	for(auto& registry : *registries) {
-		registry_resolve_entries.emplace_back(registry, "");
-	}
-
-	std::for_each(
-#ifdef __cpp_lib_parallel_algorithm
-		std::execution::par,
-#endif
-		registry_resolve_entries.begin(),
-		registry_resolve_entries.end(),
-		[&](registry_resolve_entry& entry) {
-			auto metadata_url = std::format( //
-				"{}/modules/{}/metadata.json",
-				entry.registry,
-				dep_name
-			);
-			auto metadata = bzlmod::download_module_metadata(metadata_url);
-
-			if(metadata && !metadata->versions.empty()) {
-				entry.module_version = metadata->versions.back();
-			}
-		}
+	auto dep_names = std::vector<std::string>{std::string{dep_name}};
+	auto query_results = bzlmod::query_registries(
+		*registries,
+		dep_names,
+		{.offline = offline}
 	);
+	auto& query_result = query_results.front();
 
 	auto dep_version = std::optional<std::string>{};
-
-	for(auto& entry : registry_resolve_entries) {
-		if(!entry.module_version.empty()) {
-			dep_version = entry.module_version;
-			break;
-		}
+	if(query_result) {
+		dep_version = bzlreg::latest_version(query_result->metadata);
 	}
 
 	if(!dep_version) {
 		std::println(stderr, "Failed to find {} in:", dep_name);
-		for(auto& entry : registry_resolve_entries) {
-			std::println(stderr, "\t{}", entry.registry);
+		for(auto& registry : *registries) {
+			std::println(stderr, "\t{}", registry);
+		}
+		if(offline) {
+			std::println(stderr, "Only metadata cached by earlier runs was used");
 		}
 		return 1;
 	}
 
-	// We don't care if this fails
-	bp::child{
-		bp::exe(buildozer),
-		bp::args({
-			std::format("new bazel_dep {}", dep_name),
-			"//MODULE.bazel:all",
-		}),
-		bp::std_out > bp::null,
-		bp::std_err > bp::null,
-	}
-		.wait();
-
-	auto buildozer_proc = bp::child{
-		bp::exe(buildozer),
-		bp::args({
-			std::format("set version {}", *dep_version),
-			std::format("//MODULE.bazel:{}", dep_name),
-		}),
-		bp::std_out > bp::null,
-		bp::std_err > bp::null,
-	};
-
-	buildozer_proc.wait();
-
-	auto buildozer_exit_code = buildozer_proc.exit_code();
-
-	if(buildozer_exit_code == 0) {
-		std::println( //
-			"{}@{} added",
-			dep_name,
-			*dep_version
-		);
-	} else if(buildozer_exit_code == 3) {
+	auto already_added = std::ranges::any_of(
+		module_bzl->bazel_deps,
+		[&](const bzlreg::bazel_dep& dep) {
+			return dep.name == dep_name && dep.version == *dep_version;
+		}
+	);
+	if(already_added) {
 		std::println( //
 			"{}@{} already added",
 			dep_name,
 			*dep_version
 		);
-	} else {
-		std::println( //
+		return 0;
+	}
+
+	auto versions = std::array{bzlreg::bazel_dep_version{
+		.name = dep_name,
+		.version = *dep_version,
+	}};
+	auto new_contents = bzlreg::set_bazel_dep_versions(
+		module_bazel_contents,
+		*module_bzl,
+		versions
+	);
+
+	if(!bzlreg::write_file_atomic(module_bazel_path, new_contents)) {
+		std::println(
 			stderr,
-			"buildozer exited with {}",
-			buildozer_proc.exit_code()
+			"[ERROR] Unable to write {}",
+			module_bazel_path.generic_string()
 		);
 		return 1;
 	}
 
+	std::println( //
+		"{}@{} added",
+		dep_name,
+		*dep_version
+	);
+
 	return 0;
 }
@@ -4,6 +4,7 @@
 
 namespace bzlmod {
 auto add_module( //
-	std::string_view dep_name
+	std::string_view dep_name,
+	bool             offline
 ) -> int;
 }
@@ -4,6 +4,7 @@
 #include "bzlmod/init_module.hh"
 #include "bzlmod/add_module.hh"
 #include "bzlmod/update_module.hh"
+#include "bzlmod/graph_module.hh"
 #include "bzlmod/publish_module.hh"
 
 namespace fs = std::filesystem;
@@ -14,13 +15,15 @@ Bzlmod - manage your bazel module with _ease_
 
 Usage:
 	bzlmod init [<module-dir>]
-	bzlmod add <dep-name>
-	bzlmod update
+	bzlmod add <dep-name> [--offline]
+	bzlmod update [--offline]
+	bzlmod graph [<dep-name>] [--offline]
 	bzlmod publish [--dry-run]
 	bzlmod -h | --help
 
 Options:
 	--dry-run  Do everything except submit the pull request.
+	--offline  Only use registry metadata cached by earlier runs.
 	-h --help  Show this screen.
 )"_docopt;
 
@@ -54,9 +57,15 @@ auto main(int argc, char* argv[]) -> int {
 		exit_code = bzlmod::init_module(module_dir);
 	} else if(args.get<"add">()) {
 		auto dep_name = args.get<"<dep-name>">();
-		exit_code = bzlmod::add_module(dep_name);
+		auto offline = args.get<"--offline">();
+		exit_code = bzlmod::add_module(dep_name, offline);
 	} else if(args.get<"update">()) {
-		exit_code = bzlmod::update_module();
+		auto offline = args.get<"--offline">();
+		exit_code = bzlmod::update_module(offline);
+	} else if(args.get<"graph">()) {
+		auto dep_name = args.get<"<dep-name>">();
+		auto offline = args.get<"--offline">();
+		exit_code = bzlmod::graph_module(dep_name, offline);
 	} else if(args.get<"publish">()) {
 		auto dry_run = args.get<"--dry-run">();
 		exit_code = bzlmod::publish_module(dry_run);
@@ -1,20 +1,211 @@
 #include "bzlmod/download_module_metadata.hh"
 
-#include <span>
+#include <format>
+#include <vector>
 #include "nlohmann/json.hpp"
-#include "bzlreg/download.hh"
+#include "bzlreg/http_client.hh"
+#include "bzlmod/metadata_cache.hh"
 
 using nlohmann::json;
 
+static auto parse_json( //
+	std::span<const std::byte> data
+) -> std::optional<json> {
+	auto parsed = json::parse(
+		std::span{reinterpret_cast<const char*>(data.data()), data.size()},
+		nullptr,
+		false
+	);
+	if(parsed.is_discarded()) {
+		return std::nullopt;
+	}
+	return parsed;
+}
+
+static auto read_local_module_metadata( //
+	std::string_view                      url,
+	const bzlmod::metadata_fetch_options& options
+) -> bzlmod::metadata_fetch_result {
+	auto data = std::vector<std::byte>{};
+	auto status = bzlreg::download_file_stream(
+		url,
+		[&](std::span<const std::byte> chunk) {
+			data.insert(data.end(), chunk.begin(), chunk.end());
+			return true;
+		},
+		{.stop_token = options.stop_token}
+	);
+	if(status != bzlreg::download_status::ok) {
+		return {.status = status};
+	}
+
+	auto metadata = bzlmod::parse_module_metadata(data);
+	if(!metadata) {
+		return {};
+	}
+	return {.status = status, .metadata = std::move(metadata)};
+}
+
+auto bzlmod::fetch_module_metadata(
+	std::string_view              url,
+	const metadata_fetch_options& options
+) -> metadata_fetch_result {
+	// Local registries are as fast to read as the cache
+	if(url.starts_with("file://")) {
+		return read_local_module_metadata(url, options);
+	}
+
+	auto cached = load_cached_module_metadata(url);
+	auto from_cache = [&]() -> metadata_fetch_result {
+		if(!cached) {
+			return {};
+		}
+		return {
+			.status = bzlreg::download_status::ok,
+			.metadata = std::move(cached->metadata),
+		};
+	};
+
+	if(options.offline) {
+		return from_cache();
+	}
+
+	auto request_options = bzlreg::http_request_options{
+		.accept_gzip = true,
+		.stop_token = options.stop_token,
+	};
+	if(cached && !cached->etag.empty()) {
+		request_options.headers.emplace_back("If-None-Match", cached->etag);
+	}
+	if(cached && !cached->last_modified.empty()) {
+		request_options.headers.emplace_back(
+			"If-Modified-Since",
+			cached->last_modified
+		);
+	}
+
+	auto data = std::vector<std::byte>{};
+	auto response = bzlreg::default_http_client().get(
+		url,
+		[&](std::span<const std::byte> chunk) {
+			data.insert(data.end(), chunk.begin(), chunk.end());
+			return true;
+		},
+		request_options
+	);
+
+	if(!response) {
+		// Stale metadata beats none when the registry is unreachable
+		if(options.stop_token.stop_requested()) {
+			return {};
+		}
+		return from_cache();
+	}
+
+	if(response->status == 304) {
+		return from_cache();
+	}
+
+	if(response->status == 404 || response->status == 410) {
+		return {.status = bzlreg::download_status::not_found};
+	}
+
+	if(!response->ok()) {
+		return {};
+	}
+
+	auto body = parse_json(data);
+	if(!body) {
+		return {};
+	}
+
+	try {
+		auto metadata = body->get<bzlreg::metadata_config>();
+		store_cached_module_metadata(
+			url,
+			response->header("ETag").value_or(""),
+			response->header("Last-Modified").value_or(""),
+			*body
+		);
+		return {
+			.status = bzlreg::download_status::ok,
+			.metadata = std::move(metadata),
+		};
+	} catch(const json::exception&) {
+		return {};
+	}
+}
+
+auto bzlmod::fetch_module_file(
+	std::string_view              registry,
+	std::string_view              module_name,
+	std::string_view              version,
+	const metadata_fetch_options& options
+) -> std::optional<std::string> {
+	auto url = std::format(
+		"{}/modules/{}/{}/MODULE.bazel",
+		registry,
+		module_name,
+		version
+	);
+
+	// Local registries are as fast to read as the cache
+	auto local = url.starts_with("file://");
+	if(!local) {
+		if(auto cached = load_cached_module_file(url)) {
+			return cached;
+		}
+		if(options.offline) {
+			return std::nullopt;
+		}
+	}
+
+	auto contents = std::string{};
+	auto status = bzlreg::download_file_stream(
+		url,
+		[&](std::span<const std::byte> chunk) {
+			contents.append(
+				reinterpret_cast<const char*>(chunk.data()),
+				chunk.size()
+			);
+			return true;
+		},
+		{.stop_token = options.stop_token}
+	);
+	if(status != bzlreg::download_status::ok) {
+		return std::nullopt;
+	}
+
+	if(!local) {
+		store_cached_module_file(url, contents);
+	}
+	return contents;
+}
+
 auto bzlmod::download_module_metadata( //
 	std::string_view url
 ) -> std::optional<bzlreg::metadata_config> {
-	auto data = bzlreg::download_file(url);
-	if(!data) {
+	return fetch_module_metadata(url).metadata;
+}
+
+auto bzlmod::parse_module_metadata( //
+	std::span<const std::byte> data
+) -> std::optional<bzlreg::metadata_config> {
+	auto body = parse_json(data);
+	if(!body) {
 		return std::nullopt;
 	}
 
-	bzlreg::metadata_config metadata =
-		json::parse(std::span{reinterpret_cast<char*>(data->data()), data->size()});
-	return metadata;
+	try {
+		return body->get<bzlreg::metadata_config>();
+	} catch(const json::exception&) {
+		return std::nullopt;
+	}
+}
+
+auto bzlmod::module_metadata_url( //
+	std::string_view registry,
+	std::string_view module_name
+) -> std::string {
+	return std::format("{}/modules/{}/metadata.json", registry, module_name);
 }
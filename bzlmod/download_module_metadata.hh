@@ -1,11 +1,73 @@
 #pragma once
 
+#include <cstddef>
+#include <string>
 #include <string_view>
 #include <optional>
+#include <span>
+#include <stop_token>
 #include "bzlreg/config_types.hh"
+#include "bzlreg/download.hh"
 
 namespace bzlmod {
+struct metadata_fetch_options {
+	/**
+	 * Only use metadata cached by earlier runs, never touch the network
+	 */
+	bool offline = false;
+
+	std::stop_token stop_token;
+};
+
+struct metadata_fetch_result {
+	/**
+	 * `download_status::ok` also when served from the cache
+	 */
+	bzlreg::download_status status = bzlreg::download_status::failed;
+
+	std::optional<bzlreg::metadata_config> metadata;
+};
+
+/**
+ * Fetches a module's metadata.json. Responses are cached in the user cache
+ * directory and revalidated with If-None-Match and If-Modified-Since, so an
+ * unchanged metadata.json costs one 304 round trip. The cache is also used if
+ * the registry can't be reached. file:// registries are read directly.
+ */
+auto fetch_module_metadata(
+	std::string_view              url,
+	const metadata_fetch_options& options = {}
+) -> metadata_fetch_result;
+
+/**
+ * Fetches the MODULE.bazel of `module_name` at `version` from `registry`.
+ * Published versions never change so files fetched before are read from the
+ * user cache directory without asking the registry. `std::nullopt` if the
+ * registry doesn't have it or can't be reached.
+ */
+auto fetch_module_file(
+	std::string_view              registry,
+	std::string_view              module_name,
+	std::string_view              version,
+	const metadata_fetch_options& options = {}
+) -> std::optional<std::string>;
+
 auto download_module_metadata( //
 	std::string_view url
 ) -> std::optional<bzlreg::metadata_config>;
-}
\ No newline at end of file
+
+/**
+ * Parses a downloaded metadata.json. `std::nullopt` if it isn't valid.
+ */
+auto parse_module_metadata( //
+	std::span<const std::byte> data
+) -> std::optional<bzlreg::metadata_config>;
+
+/**
+ * URL of a module's metadata.json in `registry`
+ */
+auto module_metadata_url( //
+	std::string_view registry,
+	std::string_view module_name
+) -> std::string;
+} // namespace bzlmod
@@ -0,0 +1,187 @@
+#include "bzlmod/graph_module.hh"
+
+#include <algorithm>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iterator>
+#include <print>
+#include <string>
+#include <unordered_set>
+#include "bzlreg/module_bazel.hh"
+#include "bzlmod/get_registries.hh"
+#include "bzlmod/find_workspace_dir.hh"
+#include "bzlmod/resolve_graph.hh"
+
+namespace fs = std::filesystem;
+
+/**
+ * Modules asking for a version beyond this many are summed up
+ */
+constexpr auto GRAPH_MAX_LISTED_REQUESTERS = std::size_t{3};
+
+static auto selection_reason( //
+	const bzlmod::resolved_module& module
+) -> std::string {
+	if(!module.override_kind.empty()) {
+		return std::format("pinned by {}", module.override_kind);
+	}
+
+	auto requested_versions = std::unordered_set<std::string_view>{};
+	auto requesters = std::vector<std::string_view>{};
+	for(auto&& request : module.requests) {
+		requested_versions.insert(request.version);
+		if(request.version == module.version) {
+			requesters.emplace_back(request.requester);
+		}
+	}
+
+	auto reason = std::string{};
+	if(requested_versions.size() > 1) {
+		reason = std::format(
+			"highest of {} requested versions, ",
+			requested_versions.size()
+		);
+	}
+
+	reason += "requested by ";
+	auto listed = std::min(requesters.size(), GRAPH_MAX_LISTED_REQUESTERS);
+	for(auto index = std::size_t{0}; index < listed; ++index) {
+		if(index > 0) {
+			reason += ", ";
+		}
+		reason += requesters[index];
+	}
+	if(requesters.size() > listed) {
+		reason += std::format(" and {} more", requesters.size() - listed);
+	}
+	return reason;
+}
+
+static auto print_module_requests( //
+	const bzlmod::resolved_module& module
+) -> void {
+	// Non-registry overrides have no version
+	auto module_label = module.version.empty() //
+		? module.name
+		: std::format("{}@{}", module.name, module.version);
+	std::println(
+		"{} from {}",
+		module_label,
+		module.registry.empty() ? module.override_kind : module.registry
+	);
+	std::println("{}", selection_reason(module));
+
+	auto longest_version_length = std::size_t{0};
+	for(auto&& request : module.requests) {
+		longest_version_length =
+			std::max(longest_version_length, request.version.size());
+	}
+
+	for(auto&& request : module.requests) {
+		const auto version_padding =
+			std::string(longest_version_length - request.version.size(), ' ');
+		std::println( //
+			"\t{}{} {}",
+			request.version,
+			version_padding,
+			request.requester
+		);
+	}
+}
+
+auto bzlmod::graph_module( //
+	std::string_view dep_name,
+	bool             offline
+) -> int {
+	auto workspace_dir = find_workspace_dir(fs::current_path());
+
+	if(!workspace_dir) {
+		std::print(
+			stderr,
+			"[ERROR] Cannot find bazel workspace from {}."
+			"        Did you mean `bzlmod init`?\n",
+			fs::current_path().generic_string()
+		);
+		return 1;
+	}
+
+	auto registries = get_registries(*workspace_dir);
+
+	if(!registries) {
+		std::println(stderr, "[ERROR] Unable to read .bazelrc file(s)");
+		return 1;
+	}
+
+	auto module_bazel_path = *workspace_dir / "MODULE.bazel";
+	auto module_bazel_file = std::ifstream{module_bazel_path, std::ios::binary};
+	auto module_bazel_contents = std::string{
+		std::istreambuf_iterator<char>{module_bazel_file},
+		std::istreambuf_iterator<char>{},
+	};
+	auto module_bzl = bzlreg::module_bazel::parse(module_bazel_contents);
+	if(!module_bzl) {
+		std::println(
+			stderr,
+			"[ERROR] Unable to parse {}",
+			module_bzl.error().describe(module_bazel_path.generic_string())
+		);
+		return 1;
+	}
+
+	auto modules = resolve_graph(*module_bzl, *registries, {.offline = offline});
+	if(!modules) {
+		return 1;
+	}
+
+	if(!dep_name.empty()) {
+		auto module = std::ranges::find(
+			*modules,
+			dep_name,
+			&resolved_module::name
+		);
+		if(module == modules->end()) {
+			std::println(
+				stderr,
+				"[ERROR] {} is not in the dependency graph",
+				dep_name
+			);
+			return 1;
+		}
+
+		print_module_requests(*module);
+		return 0;
+	}
+
+	auto& root = modules->front();
+	std::println(
+		"{}@{}",
+		root.name.empty() ? "<root>" : root.name,
+		root.version
+	);
+
+	auto longest_name_length = std::size_t{0};
+	auto longest_version_length = std::size_t{0};
+	for(auto&& module : std::span{*modules}.subspan(1)) {
+		longest_name_length = std::max(longest_name_length, module.name.size());
+		longest_version_length =
+			std::max(longest_version_length, module.version.size());
+	}
+
+	for(auto&& module : std::span{*modules}.subspan(1)) {
+		const auto name_padding =
+			std::string(longest_name_length - module.name.size(), ' ');
+		const auto version_padding =
+			std::string(longest_version_length - module.version.size(), ' ');
+		std::println(
+			"{}{} {}{}  {}",
+			module.name,
+			name_padding,
+			module.version,
+			version_padding,
+			selection_reason(module)
+		);
+	}
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <string_view>
+
+namespace bzlmod {
+/**
+ * Prints the modules bazel would select for the workspace and why. Only
+ * `dep_name` and the versions of it asked for are printed unless it's empty.
+ */
+auto graph_module( //
+	std::string_view dep_name,
+	bool             offline
+) -> int;
+}
@@ -0,0 +1,147 @@
+#include "bzlmod/metadata_cache.hh"
+
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include "bzlmod/user_cache_dir.hh"
+#include "bzlreg/util.hh"
+
+namespace fs = std::filesystem;
+using nlohmann::json;
+
+/**
+ * Stable across runs and platforms unlike std::hash. The URL is stored in the
+ * entry too so collisions are detected.
+ */
+static auto fnv1a_64(std::string_view str) -> std::uint64_t {
+	auto hash = std::uint64_t{0xcbf29ce484222325};
+	for(auto c : str) {
+		hash ^= static_cast<unsigned char>(c);
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+static auto cache_entry_path( //
+	std::string_view dir,
+	std::string_view url
+) -> std::optional<fs::path> {
+	auto cache_dir = bzlmod::user_cache_dir();
+	if(!cache_dir) {
+		return std::nullopt;
+	}
+	return *cache_dir / dir / std::format("{:016x}.json", fnv1a_64(url));
+}
+
+/**
+ * Written beside the entry and renamed over it so concurrent runs never read a
+ * partial entry. Failures are ignored, the cache is only an optimization.
+ */
+static auto write_cache_entry( //
+	const fs::path& path,
+	const json&     entry
+) -> void {
+	// Entries that aren't valid UTF-8 can't be stored as JSON
+	auto data = std::string{};
+	try {
+		data = entry.dump();
+	} catch(const json::exception&) {
+		return;
+	}
+
+	auto ec = std::error_code{};
+	fs::create_directories(path.parent_path(), ec);
+	if(ec) {
+		return;
+	}
+
+	bzlreg::write_file_atomic(path, data);
+}
+
+auto bzlmod::load_cached_module_metadata( //
+	std::string_view url
+) -> std::optional<cached_module_metadata> {
+	auto path = cache_entry_path("metadata", url);
+	if(!path) {
+		return std::nullopt;
+	}
+
+	auto file = std::ifstream{*path, std::ios::binary};
+	if(!file) {
+		return std::nullopt;
+	}
+
+	try {
+		auto entry = json::parse(file);
+		if(entry.at("url").get<std::string_view>() != url) {
+			return std::nullopt;
+		}
+
+		return cached_module_metadata{
+			.etag = entry.at("etag").get<std::string>(),
+			.last_modified = entry.at("last_modified").get<std::string>(),
+			.metadata = entry.at("metadata").get<bzlreg::metadata_config>(),
+		};
+	} catch(const json::exception&) {
+		return std::nullopt;
+	}
+}
+
+auto bzlmod::store_cached_module_metadata(
+	std::string_view      url,
+	std::string_view      etag,
+	std::string_view      last_modified,
+	const nlohmann::json& metadata
+) -> void {
+	auto path = cache_entry_path("metadata", url);
+	if(!path) {
+		return;
+	}
+
+	write_cache_entry(
+		*path,
+		{
+			{"url", url},
+			{"etag", etag},
+			{"last_modified", last_modified},
+			{"metadata", metadata},
+		}
+	);
+}
+
+auto bzlmod::load_cached_module_file( //
+	std::string_view url
+) -> std::optional<std::string> {
+	auto path = cache_entry_path("modules", url);
+	if(!path) {
+		return std::nullopt;
+	}
+
+	auto file = std::ifstream{*path, std::ios::binary};
+	if(!file) {
+		return std::nullopt;
+	}
+
+	try {
+		auto entry = json::parse(file);
+		if(entry.at("url").get<std::string_view>() != url) {
+			return std::nullopt;
+		}
+		return entry.at("contents").get<std::string>();
+	} catch(const json::exception&) {
+		return std::nullopt;
+	}
+}
+
+auto bzlmod::store_cached_module_file( //
+	std::string_view url,
+	std::string_view contents
+) -> void {
+	auto path = cache_entry_path("modules", url);
+	if(!path) {
+		return;
+	}
+
+	write_cache_entry(*path, {{"url", url}, {"contents", contents}});
+}
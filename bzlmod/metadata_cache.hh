@@ -0,0 +1,56 @@
+#pragma once
+
+#include <optional>
+#include <string>
+#include <string_view>
+#include "nlohmann/json.hpp"
+#include "bzlreg/config_types.hh"
+
+namespace bzlmod {
+struct cached_module_metadata {
+	/**
+	 * Validators of the cached response, sent back as If-None-Match and
+	 * If-Modified-Since. Empty if the registry didn't send them.
+	 */
+	std::string etag;
+	std::string last_modified;
+
+	bzlreg::metadata_config metadata;
+};
+
+/**
+ * Last metadata.json received from `url`, kept in the user cache directory
+ */
+auto load_cached_module_metadata( //
+	std::string_view url
+) -> std::optional<cached_module_metadata>;
+
+/**
+ * Caches the metadata.json body received from `url`. `metadata` is stored as
+ * received so fields metadata_config doesn't know about survive. Failures are
+ * ignored, the cache is only an optimization.
+ */
+auto store_cached_module_metadata(
+	std::string_view      url,
+	std::string_view      etag,
+	std::string_view      last_modified,
+	const nlohmann::json& metadata
+) -> void;
+
+/**
+ * MODULE.bazel last received from `url`. Registries never change the
+ * MODULE.bazel of a published version so cached files are used as is.
+ */
+auto load_cached_module_file( //
+	std::string_view url
+) -> std::optional<std::string>;
+
+/**
+ * Caches the MODULE.bazel received from `url`. Failures are ignored, the cache
+ * is only an optimization.
+ */
+auto store_cached_module_file( //
+	std::string_view url,
+	std::string_view contents
+) -> void;
+} // namespace bzlmod
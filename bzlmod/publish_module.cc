@@ -14,12 +14,14 @@
 #include "absl/strings/ascii.h"
 #include "nlohmann/json.hpp"
 #include "bzlmod/find_workspace_dir.hh"
+#include "bzlreg/bazel_version.hh"
 #include "bzlreg/module_bazel.hh"
 #include "bzlreg/gh_exec.hh"
 #include "bzlreg/add_module.hh"
-#include "bzlreg/download.hh"
-#include "bzlreg/decompress.hh"
-#include "bzlreg/tar_view.hh"
+#include "bzlreg/config_types.hh"
+#include "bzlreg/mirror_download.hh"
+#include "bzlreg/repository_cache.hh"
+#include "bzlreg/tar_extract.hh"
 #include "bzlreg/defer.hh"
 
 namespace fs = std::filesystem;
@@ -210,64 +212,6 @@ static auto get_git_commit_sha(const fs::path& repo_dir, std::string_view ref)
 	return std::string{absl::StripAsciiWhitespace(sha)};
 }
 
-static auto parse_version_components(std::string_view version)
-	-> std::vector<int> {
-	std::vector<int> components;
-	for(const auto& part : absl::StrSplit(version, '.')) {
-		try {
-			components.push_back(std::stoi(std::string{part}));
-		} catch(...) {
-			components.push_back(0);
-		}
-	}
-	return components;
-}
-
-static auto compare_versions(std::string_view a, std::string_view b) -> bool {
-	auto comps_a = parse_version_components(a);
-	auto comps_b = parse_version_components(b);
-	for(size_t i = 0; i < std::max(comps_a.size(), comps_b.size()); ++i) {
-		int val_a = i < comps_a.size() ? comps_a[i] : 0;
-		int val_b = i < comps_b.size() ? comps_b[i] : 0;
-		if(val_a != val_b) {
-			return val_a < val_b;
-		}
-	}
-	return a < b;
-}
-
-static auto extract_tar(bzlreg::tar_view tar_view, const fs::path& dest_dir)
-	-> bool {
-	auto ec = std::error_code{};
-	for(auto f : tar_view) {
-		auto name = f.name();
-		if(name.empty()) {
-			continue;
-		}
-		auto out_path = dest_dir / name;
-		if(name.ends_with('/')) {
-			fs::create_directories(out_path, ec);
-			continue;
-		}
-		fs::create_directories(out_path.parent_path(), ec);
-		auto out_file = std::ofstream{out_path, std::ios::binary};
-		if(!out_file) {
-			std::println(
-				stderr,
-				"ERROR: failed to open file for writing: {}",
-				out_path.generic_string()
-			);
-			return false;
-		}
-		auto contents = f.contents();
-		out_file.write(
-			reinterpret_cast<const char*>(contents.data()),
-			contents.size()
-		);
-	}
-	return true;
-}
-
 auto bzlmod::publish_module(bool dry_run) -> int {
 	// Clean up old temporary directories from previous runs
 	{
@@ -318,7 +262,16 @@ auto bzlmod::publish_module(bool dry_run) -> int {
 	};
 
 	auto module_info = bzlreg::module_bazel::parse(module_bzl_content);
-	if(!module_info || module_info->name.empty() || module_info->version.empty()) {
+	if(!module_info) {
+		std::println(
+			stderr,
+			"ERROR: {}",
+			module_info.error().describe(module_bazel_path.generic_string())
+		);
+		return 1;
+	}
+
+	if(module_info->name.empty() || module_info->version.empty()) {
 		std::println(
 			stderr,
 			"ERROR: failed to parse module name or version from MODULE.bazel"
@@ -513,10 +466,13 @@ auto bzlmod::publish_module(bool dry_run) -> int {
 
 	// Add module to registry using bzlreg
 	std::println("Adding module entry using bzlreg...");
+	// The repository cache is keyed by sha256, so with a sha256 integrity the
+	// archive add-module stores there is found again for the presubmit
 	auto add_exit_code = bzlreg::add_module({
 		.registry_dir = temp_bcr_dir,
 		.archive_url = archive_url,
 		.strip_prefix = "",
+		.algorithms = {bzlreg::integrity_algorithm::sha256},
 	});
 
 	if(add_exit_code != 0) {
@@ -564,27 +520,22 @@ auto bzlmod::publish_module(bool dry_run) -> int {
 		fs::path previous_presubmit_path;
 		auto     parent_module_dir = temp_bcr_dir / "modules" / module_name;
 		if(fs::exists(parent_module_dir)) {
-			std::vector<fs::path> candidate_paths;
+			// Presubmit of the highest other version, directories that aren't
+			// versions are skipped
+			auto previous_version = std::optional<bzlreg::bazel_version>{};
 			for(const auto& entry : fs::directory_iterator(parent_module_dir, ec)) {
 				if(entry.is_directory() && entry.path().filename() != module_version) {
 					auto path = entry.path() / "presubmit.yml";
-					if(fs::exists(path)) {
-						candidate_paths.push_back(path);
+					auto version =
+						bzlreg::bazel_version::parse(entry.path().filename().string());
+					if(!version || !fs::exists(path)) {
+						continue;
 					}
-				}
-			}
-			if(!candidate_paths.empty()) {
-				std::sort(
-					candidate_paths.begin(),
-					candidate_paths.end(),
-					[](const fs::path& a, const fs::path& b) {
-						return compare_versions(
-							a.parent_path().filename().string(),
-							b.parent_path().filename().string()
-						);
+					if(!previous_version || *version > *previous_version) {
+						previous_version = std::move(version);
+						previous_presubmit_path = path;
 					}
-				);
-				previous_presubmit_path = candidate_paths.back();
+				}
 			}
 		}
 
@@ -659,20 +610,49 @@ auto bzlmod::publish_module(bool dry_run) -> int {
 	std::println(
 		"Downloading and extracting archive for local presubmit simulation..."
 	);
-	auto compressed_data = bzlreg::download_file(archive_url);
+	// bzlreg add-module just stored the archive in the repository cache. A
+	// download is stored under its sha256 too, whatever the integrity uses.
+	auto integrity = source_json.at("integrity").get<std::string>();
+	auto repository_cache_dir = bzlreg::default_repository_cache_dir();
+	auto compressed_data = repository_cache_dir
+		? bzlreg::read_repository_cache(*repository_cache_dir, integrity)
+		: std::nullopt;
 	if(!compressed_data) {
-		std::println(stderr, "ERROR: failed to download archive for verification");
-		return 1;
-	}
-	auto decompressed_data = bzlreg::decompress_archive(*compressed_data);
-	if(decompressed_data.empty()) {
-		std::println(stderr, "ERROR: failed to decompress archive data");
-		return 1;
-	}
+		// Race the registry's mirrors against the origin
+		auto registry_config = bzlreg::bazel_registry_config{};
+		auto registry_json = json::parse(
+			std::ifstream{temp_bcr_dir / "bazel_registry.json"},
+			nullptr,
+			false
+		);
+		if(registry_json.is_object()) {
+			registry_config = registry_json.get<bzlreg::bazel_registry_config>();
+		}
 
-	auto tar_view = bzlreg::tar_view{decompressed_data};
-	fs::create_directories(temp_src_dir, ec);
-	if(!extract_tar(tar_view, temp_src_dir)) {
+		compressed_data = bzlreg::download_with_mirrors(
+			bzlreg::mirror_urls(registry_config.mirrors, archive_url),
+			integrity
+		);
+		if(!compressed_data) {
+			std::println(
+				stderr,
+				"ERROR: failed to download archive for verification"
+			);
+			return 1;
+		}
+		if(repository_cache_dir) {
+			bzlreg::write_repository_cache(
+				*repository_cache_dir,
+				integrity,
+				*compressed_data
+			);
+		}
+	}
+	auto extracted = bzlreg::extract_archive(
+		std::as_bytes(std::span{*compressed_data}),
+		{.dest_dir = temp_src_dir}
+	);
+	if(!extracted) {
 		std::println(stderr, "ERROR: failed to extract archive files");
 		return 1;
 	}
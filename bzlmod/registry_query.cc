@@ -0,0 +1,258 @@
+#include "bzlmod/registry_query.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <mutex>
+#include <stop_token>
+#include <thread>
+#include <unordered_map>
+#include "nlohmann/json.hpp"
+#include "bzlmod/download_module_metadata.hh"
+#include "bzlmod/user_cache_dir.hh"
+#include "bzlreg/util.hh"
+
+namespace fs = std::filesystem;
+using nlohmann::json;
+
+namespace {
+enum class lookup_state {
+	pending,
+	running,
+	found,
+	not_found,
+	failed,
+};
+
+struct registry_lookup {
+	std::size_t                            module_index = 0;
+	std::size_t                            registry_index = 0;
+	std::string                            url;
+	lookup_state                           state = lookup_state::pending;
+	std::stop_source                       stop_source;
+	std::optional<bzlreg::metadata_config> metadata;
+};
+
+/**
+ * Metadata URLs that answered 404 mapped to when they did in unix seconds
+ */
+class negative_cache {
+	std::optional<fs::path>                       _path;
+	std::unordered_map<std::string, std::int64_t> _misses;
+	bool                                          _modified = false;
+
+	static auto now() -> std::int64_t {
+		auto since_epoch = std::chrono::system_clock::now().time_since_epoch();
+		return std::chrono::duration_cast<std::chrono::seconds>(since_epoch)
+			.count();
+	}
+
+public:
+	explicit negative_cache(std::chrono::seconds ttl) {
+		if(ttl <= std::chrono::seconds::zero()) {
+			return;
+		}
+
+		auto cache_dir = bzlmod::user_cache_dir();
+		if(!cache_dir) {
+			return;
+		}
+		_path = *cache_dir / "registry_misses.json";
+
+		auto file = std::ifstream{*_path, std::ios::binary};
+		if(!file) {
+			return;
+		}
+
+		auto current_time = now();
+		try {
+			auto misses = json::parse(file);
+			for(auto&& [url, time] : misses.items()) {
+				auto miss_time = time.get<std::int64_t>();
+				if(
+					miss_time <= current_time &&
+					current_time - miss_time < ttl.count()
+				) {
+					_misses.emplace(url, miss_time);
+				} else {
+					_modified = true;
+				}
+			}
+		} catch(const json::exception&) {
+			// Overwritten on save
+			_misses.clear();
+			_modified = true;
+		}
+	}
+
+	auto contains(const std::string& url) const -> bool {
+		return _misses.contains(url);
+	}
+
+	auto insert(const std::string& url) -> void {
+		// Local registries are cheap to ask and change under the user's hands
+		if(!_path || url.starts_with("file://")) {
+			return;
+		}
+		_misses.insert_or_assign(url, now());
+		_modified = true;
+	}
+
+	auto erase(const std::string& url) -> void {
+		if(_misses.erase(url) > 0) {
+			_modified = true;
+		}
+	}
+
+	/**
+	 * Writes a temporary file and renames it over the cache so concurrent runs
+	 * never see a partially written cache. Failures are ignored, the cache is
+	 * only an optimization.
+	 */
+	auto save() -> void {
+		if(!_path || !_modified) {
+			return;
+		}
+
+		auto ec = std::error_code{};
+		fs::create_directories(_path->parent_path(), ec);
+		if(ec) {
+			return;
+		}
+
+		// URLs that aren't valid UTF-8 can't be stored as JSON
+		auto data = std::string{};
+		try {
+			data = json(_misses).dump();
+		} catch(const json::exception&) {
+			return;
+		}
+
+		bzlreg::write_file_atomic(*_path, data);
+	}
+};
+} // namespace
+
+auto bzlmod::query_registries(
+	std::span<const std::string>  registries,
+	std::span<const std::string>  module_names,
+	const registry_query_options& options
+) -> std::vector<std::optional<registry_module_metadata>> {
+	auto unique_names = std::vector<std::string_view>{};
+	auto name_indices = std::unordered_map<std::string_view, std::size_t>{};
+	for(const auto& name : module_names) {
+		if(name_indices.try_emplace(name, unique_names.size()).second) {
+			unique_names.emplace_back(name);
+		}
+	}
+
+	// Registry major so every module is asked of the highest priority registry
+	// before any lower priority one
+	auto lookups =
+		std::vector<registry_lookup>(registries.size() * unique_names.size());
+	auto lookup_at = [&](std::size_t registry_index, std::size_t module_index) //
+		-> registry_lookup& {
+		return lookups[registry_index * unique_names.size() + module_index];
+	};
+	for(auto r = std::size_t{0}; r < registries.size(); ++r) {
+		for(auto m = std::size_t{0}; m < unique_names.size(); ++m) {
+			auto& lookup = lookup_at(r, m);
+			lookup.module_index = m;
+			lookup.registry_index = r;
+			lookup.url = module_metadata_url(registries[r], unique_names[m]);
+		}
+	}
+
+	auto cache = negative_cache{options.negative_cache_ttl};
+	auto mutex = std::mutex{};
+	auto next_index = std::size_t{0};
+
+	auto found_in_higher_priority = [&](const registry_lookup& lookup) -> bool {
+		for(auto r = std::size_t{0}; r < lookup.registry_index; ++r) {
+			if(lookup_at(r, lookup.module_index).state == lookup_state::found) {
+				return true;
+			}
+		}
+		return false;
+	};
+
+	// Must hold `mutex`
+	auto claim_next_lookup = [&]() -> registry_lookup* {
+		while(next_index < lookups.size()) {
+			auto& lookup = lookups[next_index++];
+			if(found_in_higher_priority(lookup)) {
+				continue;
+			}
+			if(cache.contains(lookup.url)) {
+				lookup.state = lookup_state::not_found;
+				continue;
+			}
+			lookup.state = lookup_state::running;
+			return &lookup;
+		}
+		return nullptr;
+	};
+
+	auto worker = [&] {
+		auto lock = std::unique_lock{mutex};
+		while(auto lookup = claim_next_lookup()) {
+			auto stop_token = lookup->stop_source.get_token();
+			lock.unlock();
+
+			auto fetched = fetch_module_metadata(
+				lookup->url,
+				{
+					.offline = options.offline,
+					.stop_token = stop_token,
+				}
+			);
+
+			lock.lock();
+			if(fetched.metadata) {
+				lookup->state = lookup_state::found;
+				lookup->metadata = std::move(fetched.metadata);
+				cache.erase(lookup->url);
+				auto m = lookup->module_index;
+				for(auto r = lookup->registry_index + 1; r < registries.size(); ++r) {
+					lookup_at(r, m).stop_source.request_stop();
+				}
+			} else if(fetched.status == bzlreg::download_status::not_found) {
+				lookup->state = lookup_state::not_found;
+				cache.insert(lookup->url);
+			} else {
+				lookup->state = lookup_state::failed;
+			}
+		}
+	};
+
+	{
+		auto thread_count = std::min<std::size_t>(
+			std::max(options.max_concurrency, 1u),
+			lookups.size()
+		);
+		auto workers = std::vector<std::jthread>{};
+		workers.reserve(thread_count);
+		for(auto i = std::size_t{0}; i < thread_count; ++i) {
+			workers.emplace_back(worker);
+		}
+	}
+
+	cache.save();
+
+	auto results = std::vector<std::optional<registry_module_metadata>>{};
+	results.reserve(module_names.size());
+	for(const auto& name : module_names) {
+		auto module_index = name_indices.at(name);
+		auto& result = results.emplace_back();
+		for(auto r = std::size_t{0}; r < registries.size(); ++r) {
+			auto& lookup = lookup_at(r, module_index);
+			if(lookup.state == lookup_state::found) {
+				result.emplace(registries[r], *lookup.metadata);
+				break;
+			}
+		}
+	}
+	return results;
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <chrono>
+#include <optional>
+#include <span>
+#include <string>
+#include <vector>
+#include "bzlreg/config_types.hh"
+
+namespace bzlmod {
+/**
+ * Upper bound of metadata requests in flight at once
+ */
+constexpr auto REGISTRY_QUERY_MAX_CONCURRENCY = 16u;
+
+/**
+ * How long a registry not having a module is remembered between runs
+ */
+constexpr auto REGISTRY_NEGATIVE_CACHE_TTL = std::chrono::seconds{60 * 60};
+
+struct registry_query_options {
+	unsigned max_concurrency = REGISTRY_QUERY_MAX_CONCURRENCY;
+
+	/**
+	 * Zero disables the negative cache
+	 */
+	std::chrono::seconds negative_cache_ttl = REGISTRY_NEGATIVE_CACHE_TTL;
+
+	/**
+	 * Only use metadata cached by earlier runs
+	 */
+	bool offline = false;
+};
+
+struct registry_module_metadata {
+	std::string_view        registry;
+	bzlreg::metadata_config metadata;
+};
+
+/**
+ * Finds each module in the first of `registries` that has it, the same way
+ * bazel picks between multiple --registry flags. Registries are asked in
+ * priority order with up to `max_concurrency` requests in flight. Once a
+ * registry has a module, lookups of it in lower priority registries are
+ * skipped or stopped mid request. Registries answering 404 are remembered in
+ * the user cache directory for `negative_cache_ttl`. Results are in the order
+ * of `module_names` and `std::nullopt` if no registry has the module.
+ */
+auto query_registries(
+	std::span<const std::string>  registries,
+	std::span<const std::string>  module_names,
+	const registry_query_options& options = {}
+) -> std::vector<std::optional<registry_module_metadata>>;
+} // namespace bzlmod
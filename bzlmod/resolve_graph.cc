@@ -0,0 +1,383 @@
+#include "bzlmod/resolve_graph.hh"
+
+#include <algorithm>
+#include <atomic>
+#include <format>
+#include <print>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include "bzlreg/bazel_version.hh"
+#include "bzlmod/download_module_metadata.hh"
+
+using namespace std::string_view_literals;
+
+constexpr auto ROOT_REQUESTER = "<root>"sv;
+
+namespace {
+struct dep_request {
+	std::string           name;
+	std::string           version;
+	bzlreg::bazel_version parsed_version;
+};
+
+struct module_node {
+	std::string                          name;
+	std::string                          version;
+	std::optional<bzlreg::bazel_version> parsed_version;
+	std::string                          registry;
+	int                                  compatibility_level = 0;
+	std::string_view                     override_kind;
+	std::vector<dep_request>             deps;
+};
+
+struct module_override {
+	std::string_view kind;
+	std::string_view version;
+	std::string_view registry;
+};
+
+struct reached_module {
+	const module_node* selected = nullptr;
+	std::string        requester;
+	std::string        version;
+};
+} // namespace
+
+static auto module_key( //
+	std::string_view name,
+	std::string_view version
+) -> std::string {
+	return std::format("{}@{}", name, version);
+}
+
+auto bzlmod::resolve_graph(
+	const bzlreg::module_bazel&  root,
+	std::span<const std::string> registries,
+	const resolve_options&       options
+) -> std::optional<std::vector<resolved_module>> {
+	// Only overrides of the root module count, like in bazel
+	auto overrides = std::unordered_map<std::string_view, module_override>{};
+	for(auto&& override : root.single_version_overrides) {
+		if(!override.version.empty() || !override.registry.empty()) {
+			overrides.emplace(
+				override.module_name,
+				module_override{
+					.kind = "single_version_override"sv,
+					.version = override.version,
+					.registry = override.registry,
+				}
+			);
+		}
+	}
+	for(auto&& override : root.git_overrides) {
+		overrides.emplace(
+			override.module_name,
+			module_override{.kind = "git_override"sv}
+		);
+	}
+
+	auto find_override = [&](std::string_view name) -> const module_override* {
+		auto itr = overrides.find(name);
+		return itr != overrides.end() ? &itr->second : nullptr;
+	};
+
+	// Non-registry overrides have no MODULE.bazel to fetch
+	auto non_registry = [&](std::string_view name) -> bool {
+		auto override = find_override(name);
+		return override && override->kind == "git_override"sv;
+	};
+
+	auto collect_deps = [&]( //
+		const bzlreg::module_bazel& module,
+		bool                        is_root,
+		std::string_view            requester
+	) -> std::optional<std::vector<dep_request>> {
+		auto deps = std::vector<dep_request>{};
+		for(auto&& dep : module.bazel_deps) {
+			if(dep.name == root.name || (dep.dev_dependency && !is_root)) {
+				continue;
+			}
+
+			auto version = dep.version;
+			if(auto override = find_override(dep.name)) {
+				if(override->kind == "git_override"sv) {
+					version = {};
+				} else if(!override->version.empty()) {
+					version = override->version;
+				}
+			}
+
+			if(version.empty() && !non_registry(dep.name)) {
+				std::println(
+					stderr,
+					"[ERROR] {} depends on {} without a version or an override",
+					requester,
+					dep.name
+				);
+				return std::nullopt;
+			}
+
+			auto parsed_version = bzlreg::bazel_version::parse(version);
+			if(!parsed_version) {
+				std::println(
+					stderr,
+					"[ERROR] {} depends on {} with invalid version '{}'",
+					requester,
+					dep.name,
+					version
+				);
+				return std::nullopt;
+			}
+
+			deps.emplace_back(
+				std::string{dep.name},
+				std::string{version},
+				std::move(*parsed_version)
+			);
+		}
+		return deps;
+	};
+
+	auto root_deps = collect_deps(root, true, ROOT_REQUESTER);
+	if(!root_deps) {
+		return std::nullopt;
+	}
+	auto root_node = module_node{
+		.name = std::string{root.name},
+		.version = std::string{root.version},
+		.compatibility_level = root.compatibility_level,
+		.deps = std::move(*root_deps),
+	};
+
+	// Every version of every module reachable through any bazel_dep, keyed by
+	// `<name>@<version>`
+	auto nodes = std::unordered_map<std::string, module_node>{};
+	auto requests =
+		std::unordered_map<std::string, std::vector<module_request>>{};
+	auto queued = std::unordered_set<std::string>{};
+	auto frontier = std::vector<dep_request>{};
+
+	auto enqueue_deps = [&](const module_node& node, std::string_view requester) {
+		for(auto&& dep : node.deps) {
+			requests[dep.name].emplace_back(std::string{requester}, dep.version);
+			if(queued.insert(module_key(dep.name, dep.version)).second) {
+				frontier.emplace_back(dep);
+			}
+		}
+	};
+	enqueue_deps(root_node, ROOT_REQUESTER);
+
+	auto module_registries = std::unordered_map<std::string, std::string>{};
+	while(!frontier.empty()) {
+		auto level = std::exchange(frontier, {});
+
+		// Registry of every module seen for the first time on this level
+		auto names = std::vector<std::string>{};
+		for(auto&& dep : level) {
+			if(non_registry(dep.name) || module_registries.contains(dep.name)) {
+				continue;
+			}
+			auto override = find_override(dep.name);
+			if(override && !override->registry.empty()) {
+				module_registries.emplace(dep.name, override->registry);
+				continue;
+			}
+			names.emplace_back(dep.name);
+		}
+
+		if(!names.empty()) {
+			auto query_results = query_registries(
+				registries,
+				names,
+				{
+					.max_concurrency = options.max_concurrency,
+					.offline = options.offline,
+				}
+			);
+			for(auto index = std::size_t{0}; index < names.size(); ++index) {
+				if(!query_results[index]) {
+					std::println(stderr, "[ERROR] Unable to find {} in:", names[index]);
+					for(auto& registry : registries) {
+						std::println(stderr, "\t{}", registry);
+					}
+					if(options.offline) {
+						std::println(
+							stderr,
+							"Only metadata cached by earlier runs was used"
+						);
+					}
+					return std::nullopt;
+				}
+				module_registries.try_emplace(
+					names[index],
+					query_results[index]->registry
+				);
+			}
+		}
+
+		// Every MODULE.bazel of the level is fetched at once
+		auto contents = std::vector<std::optional<std::string>>(level.size());
+		auto next_index = std::atomic_size_t{0};
+		auto worker = [&] {
+			for(auto i = next_index++; i < level.size(); i = next_index++) {
+				auto& dep = level[i];
+				if(non_registry(dep.name)) {
+					continue;
+				}
+				contents[i] = fetch_module_file(
+					module_registries.at(dep.name),
+					dep.name,
+					dep.version,
+					{.offline = options.offline}
+				);
+			}
+		};
+
+		{
+			auto thread_count = std::min<std::size_t>(
+				std::max(options.max_concurrency, 1u),
+				level.size()
+			);
+			auto workers = std::vector<std::jthread>{};
+			workers.reserve(thread_count);
+			for(auto i = std::size_t{0}; i < thread_count; ++i) {
+				workers.emplace_back(worker);
+			}
+		}
+
+		for(auto index = std::size_t{0}; index < level.size(); ++index) {
+			auto& dep = level[index];
+			auto key = module_key(dep.name, dep.version);
+			auto node = module_node{
+				.name = dep.name,
+				.version = dep.version,
+				.parsed_version = dep.parsed_version,
+			};
+
+			auto override = find_override(dep.name);
+			if(
+				override &&
+				(override->kind == "git_override"sv || !override->version.empty())
+			) {
+				node.override_kind = override->kind;
+			}
+
+			if(!non_registry(dep.name)) {
+				node.registry = module_registries.at(dep.name);
+				if(!contents[index]) {
+					std::println(
+						stderr,
+						"[ERROR] Unable to fetch MODULE.bazel of {} from {}",
+						key,
+						node.registry
+					);
+					return std::nullopt;
+				}
+
+				auto module = bzlreg::module_bazel::parse(*contents[index]);
+				if(!module) {
+					std::println(
+						stderr,
+						"[ERROR] Unable to parse MODULE.bazel of {}: {}:{}: {}",
+						key,
+						module.error().line,
+						module.error().column,
+						module.error().message
+					);
+					return std::nullopt;
+				}
+
+				auto deps = collect_deps(*module, false, key);
+				if(!deps) {
+					return std::nullopt;
+				}
+				node.compatibility_level = module->compatibility_level;
+				node.deps = std::move(*deps);
+			} else {
+				// Resolving them would mean cloning the repository
+				std::println(
+					stderr,
+					"WARN: dependencies of {} are not resolved since it has a "
+					"git_override",
+					dep.name
+				);
+			}
+
+			auto& inserted = nodes.emplace(key, std::move(node)).first->second;
+			enqueue_deps(inserted, key);
+		}
+	}
+
+	// Highest version requested of every module and compatibility level
+	auto selection_key = [](const module_node& node) -> std::string {
+		return std::format("{}@{}", node.name, node.compatibility_level);
+	};
+	auto selected = std::unordered_map<std::string, const module_node*>{};
+	for(auto&& [key, node] : nodes) {
+		auto [itr, inserted] = selected.try_emplace(selection_key(node), &node);
+		if(!inserted && node.parsed_version > itr->second->parsed_version) {
+			itr->second = &node;
+		}
+	}
+
+	// Only modules reachable through selected versions are kept, and each of
+	// them may only be reached at a single compatibility level
+	auto order = std::vector<const module_node*>{&root_node};
+	auto reached = std::unordered_map<std::string_view, reached_module>{};
+	for(auto index = std::size_t{0}; index < order.size(); ++index) {
+		auto node = order[index];
+		auto requester = index == 0 //
+			? std::string{ROOT_REQUESTER}
+			: module_key(node->name, node->version);
+
+		for(auto&& dep : node->deps) {
+			auto& requested = nodes.at(module_key(dep.name, dep.version));
+			auto chosen = selected.at(selection_key(requested));
+			auto [itr, inserted] =
+				reached.try_emplace(dep.name, chosen, requester, dep.version);
+			if(inserted) {
+				order.emplace_back(chosen);
+				continue;
+			}
+
+			auto& first = itr->second;
+			if(first.selected != chosen) {
+				std::println(
+					stderr,
+					"[ERROR] {} depends on {}@{} with compatibility level {}, but {} "
+					"depends on {}@{} with compatibility level {}",
+					first.requester,
+					dep.name,
+					first.version,
+					first.selected->compatibility_level,
+					requester,
+					dep.name,
+					dep.version,
+					chosen->compatibility_level
+				);
+				return std::nullopt;
+			}
+		}
+	}
+
+	auto result = std::vector<resolved_module>{};
+	result.reserve(order.size());
+	for(auto node : order) {
+		auto& module = result.emplace_back(resolved_module{
+			.name = node->name,
+			.version = node->version,
+			.registry = node->registry,
+			.compatibility_level = node->compatibility_level,
+			.override_kind = node->override_kind,
+		});
+		if(auto itr = requests.find(node->name); itr != requests.end()) {
+			module.requests = itr->second;
+		}
+		for(auto&& dep : node->deps) {
+			module.deps.emplace_back(dep.name);
+		}
+	}
+	return result;
+}
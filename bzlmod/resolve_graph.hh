@@ -0,0 +1,83 @@
+#pragma once
+
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "bzlreg/module_bazel.hh"
+#include "bzlmod/registry_query.hh"
+
+namespace bzlmod {
+struct resolve_options {
+	/**
+	 * Upper bound of registry requests in flight at once
+	 */
+	unsigned max_concurrency = REGISTRY_QUERY_MAX_CONCURRENCY;
+
+	/**
+	 * Only use registry files cached by earlier runs
+	 */
+	bool offline = false;
+};
+
+/**
+ * A version of a module asked for by a bazel_dep of another module
+ */
+struct module_request {
+	/**
+	 * `<name>@<version>` of the module asking, `<root>` for the root module
+	 */
+	std::string requester;
+	std::string version;
+};
+
+struct resolved_module {
+	std::string name;
+	std::string version;
+
+	/**
+	 * Registry the module came from. Empty for the root module and modules
+	 * overridden with git_override.
+	 */
+	std::string registry;
+	int         compatibility_level = 0;
+
+	/**
+	 * Override in the root MODULE.bazel that decided the version, empty if the
+	 * version was selected from the requests
+	 */
+	std::string_view override_kind;
+
+	/**
+	 * Every request of the module found while walking the graph, including
+	 * those of module versions that weren't selected in the end
+	 */
+	std::vector<module_request> requests;
+
+	/**
+	 * Names of the modules this one depends on
+	 */
+	std::vector<std::string> deps;
+};
+
+/**
+ * Resolves the dependency graph of `root` the way bazel does without running
+ * it. The MODULE.bazel files of every bazel_dep are fetched from `registries`,
+ * one level of the graph at a time with the requests of a level in flight at
+ * once, and cached in the user cache directory. Minimal version selection
+ * then picks the highest version requested of each module and compatibility
+ * level. single_version_override and git_override of the root module are
+ * honored and dev dependencies of other modules are ignored. Modules with a
+ * git_override have no MODULE.bazel in a registry, so their own dependencies
+ * are left out of the graph with a warning naming them. Errors, such as
+ * one module being reachable at two compatibility levels, are printed. The
+ * root module is first in the result, followed by every selected module in
+ * breadth first order.
+ */
+auto resolve_graph(
+	const bzlreg::module_bazel&  root,
+	std::span<const std::string> registries,
+	const resolve_options&       options = {}
+) -> std::optional<std::vector<resolved_module>>;
+} // namespace bzlmod
@@ -1,70 +1,22 @@
 #include "bzlmod/update_module.hh"
 
 #include <filesystem>
+#include <fstream>
+#include <iterator>
 #include <print>
 #include <algorithm>
 #include <string_view>
-#include <execution>
-#define BOOST_PROCESS_VERSION 1
-#include <boost/process/v1.hpp>
+#include "bzlreg/bazel_version.hh"
+#include "bzlreg/module_bazel.hh"
+#include "bzlreg/module_bazel_edit.hh"
+#include "bzlreg/util.hh"
 #include "bzlmod/get_registries.hh"
 #include "bzlmod/find_workspace_dir.hh"
-#include "bzlmod/download_module_metadata.hh"
+#include "bzlmod/registry_query.hh"
 
-namespace bp = boost::process;
 namespace fs = std::filesystem;
 
-struct registry_resolve_entry {
-	std::string_view registry;
-	std::string      module_version;
-};
-
-namespace {
-struct bazel_dep_info {
-	std::string dep_name;
-	std::string dep_version;
-};
-
-static auto get_all_deps(auto buildozer) -> std::vector<bazel_dep_info> {
-	auto result = std::vector<bazel_dep_info>{};
-
-	auto stdout_pipe = bp::ipstream{};
-	auto buildozer_proc = bp::child{
-		bp::exe(buildozer),
-		bp::args({
-			"print name version",
-			"//MODULE.bazel:%bazel_dep",
-		}),
-		bp::std_out > stdout_pipe,
-		bp::std_err > bp::null,
-	};
-
-	auto line = std::string{};
-	while(std::getline(stdout_pipe, line)) {
-		auto space_idx = line.find(" ");
-		auto dep_name = line.substr(0, space_idx);
-		auto dep_version = line.substr(space_idx + 1);
-
-		result.emplace_back(dep_name, dep_version);
-	}
-
-	return result;
-}
-} // namespace
-
-auto bzlmod::update_module() -> int {
-	auto buildozer = bp::search_path("buildozer");
-	if(buildozer.empty()) {
-		std::print(
-			stderr,
-			"[ERROR] `buildozer` is required to use `bzlmod update`. Please make "
-			"sure "
-			"it's in your PATH. Buildozer may be downloaded here:\n"
-			"        https://github.com/bazelbuild/buildtools/releases\n\n"
-		);
-		return 1;
-	}
-
+auto bzlmod::update_module(bool offline) -> int {
 	auto workspace_dir = find_workspace_dir(fs::current_path());
 
 	if(!workspace_dir) {
@@ -84,113 +36,104 @@ auto bzlmod::update_module() -> int {
 		return 1;
 	}
 
-	auto deps = get_all_deps(buildozer);
-	auto longest_dep_name_length = 0;
+	auto module_bazel_path = *workspace_dir / "MODULE.bazel";
+	auto module_bazel_file = std::ifstream{module_bazel_path, std::ios::binary};
+	auto module_bazel_contents = std::string{
+		std::istreambuf_iterator<char>{module_bazel_file},
+		std::istreambuf_iterator<char>{},
+	};
+	auto module_bzl = bzlreg::module_bazel::parse(module_bazel_contents);
+	if(!module_bzl) {
+		std::println(
+			stderr,
+			"[ERROR] Unable to parse {}",
+			module_bzl.error().describe(module_bazel_path.generic_string())
+		);
+		return 1;
+	}
+
+	auto deps = module_bzl->bazel_deps;
+	auto longest_dep_name_length = std::size_t{0};
 
 	for(auto&& dep : deps) {
-		auto& dep_name = dep.dep_name;
-		if(dep_name.size() > longest_dep_name_length) {
-			longest_dep_name_length = dep_name.size();
-		}
+		longest_dep_name_length =
+			std::max(longest_dep_name_length, dep.name.size());
 	}
 
+	std::erase_if(deps, [](const bzlreg::bazel_dep& dep) {
+		return dep.version.empty();
+	});
+
+	// Every dep is looked up at once so the whole update waits on roughly one
+	// round of requests instead of one per dep and registry
+	auto dep_names = std::vector<std::string>{};
+	dep_names.reserve(deps.size());
 	for(auto&& dep : deps) {
-		auto& dep_name = dep.dep_name;
-		auto& current_dep_version = dep.dep_version;
-		if(current_dep_version.empty() || current_dep_version == "(missing)") {
-			continue;
-		}
+		dep_names.emplace_back(dep.name);
+	}
+	auto query_results = bzlmod::query_registries(
+		*registries,
+		dep_names,
+		{.offline = offline}
+	);
+
+	// Every change is applied to MODULE.bazel at once
+	auto versions = std::vector<bzlreg::bazel_dep_version>{};
+	for(auto dep_index = std::size_t{0}; dep_index < deps.size(); ++dep_index) {
+		auto& dep = deps[dep_index];
+		auto& query_result = query_results[dep_index];
 
 		const auto dep_name_padding =
-			std::string(longest_dep_name_length - dep_name.size(), ' ');
+			std::string(longest_dep_name_length - dep.name.size(), ' ');
 
-		auto registry_resolve_entries = std::vector<registry_resolve_entry>{};
-		registry_resolve_entries.reserve(registries->size());
-		for(auto& registry : *registries) {
-			registry_resolve_entries.emplace_back(registry, "");
+		auto dep_version = std::optional<std::string_view>{};
+		if(query_result) {
+			dep_version = bzlreg::latest_version(query_result->metadata);
 		}
 
-		std::for_each(
-#ifdef __cpp_lib_parallel_algorithm
-			std::execution::par,
-#endif
-			registry_resolve_entries.begin(),
-			registry_resolve_entries.end(),
-			[&](registry_resolve_entry& entry) {
-				auto metadata_url = std::format( //
-					"{}/modules/{}/metadata.json",
-					entry.registry,
-					dep_name
-				);
-				auto metadata = bzlmod::download_module_metadata(metadata_url);
-
-				if(metadata && !metadata->versions.empty()) {
-					entry.module_version = metadata->versions.back();
-				}
+		if(!dep_version) {
+			std::println(stderr, "WARN: failed to find {} in:", dep.name);
+			for(auto& registry : *registries) {
+				std::println(stderr, "\t{}", registry);
 			}
-		);
-
-		auto dep_version = std::optional<std::string>{};
-
-		for(auto& entry : registry_resolve_entries) {
-			if(!entry.module_version.empty()) {
-				dep_version = entry.module_version;
-				break;
+			if(offline) {
+				std::println(stderr, "Only metadata cached by earlier runs was used");
 			}
+			continue;
 		}
 
-		if(!dep_version) {
-			std::println(stderr, "WARN: failed to find {} in:", dep_name);
-			for(auto& entry : registry_resolve_entries) {
-				std::println(stderr, "\t{}", entry.registry);
-			}
+		// Deps already on a newer version, such as a prerelease, are kept
+		if(bzlreg::compare_versions(*dep_version, dep.version) <= 0) {
 			continue;
 		}
 
-		// We don't care if this fails
-		bp::child{
-			bp::exe(buildozer),
-			bp::args({
-				std::format("new bazel_dep {}", dep_name),
-				"//MODULE.bazel:all",
-			}),
-			bp::std_out > bp::null,
-			bp::std_err > bp::null,
-		}
-			.wait();
-
-		auto buildozer_proc = bp::child{
-			bp::exe(buildozer),
-			bp::args({
-				std::format("set version {}", *dep_version),
-				std::format("//MODULE.bazel:{}", dep_name),
-			}),
-			bp::std_out > bp::null,
-			bp::std_err > bp::null,
-		};
-
-		buildozer_proc.wait();
-
-		auto buildozer_exit_code = buildozer_proc.exit_code();
-
-		if(buildozer_exit_code == 0) {
-			std::println( //
-				"{}{} {} -> {}",
-				dep_name,
-				dep_name_padding,
-				current_dep_version,
-				*dep_version
-			);
-		} else if(buildozer_exit_code == 3) {
-			// No change
-		} else {
-			std::println( //
-				stderr,
-				"buildozer exited with {}",
-				buildozer_proc.exit_code()
-			);
-			return 1;
-		}
+		versions.emplace_back(dep.name, *dep_version);
+		std::println( //
+			"{}{} {} -> {}",
+			dep.name,
+			dep_name_padding,
+			dep.version,
+			*dep_version
+		);
+	}
+
+	if(versions.empty()) {
+		return 0;
+	}
+
+	auto new_contents = bzlreg::set_bazel_dep_versions(
+		module_bazel_contents,
+		*module_bzl,
+		versions
+	);
+
+	if(!bzlreg::write_file_atomic(module_bazel_path, new_contents)) {
+		std::println(
+			stderr,
+			"[ERROR] Unable to write {}",
+			module_bazel_path.generic_string()
+		);
+		return 1;
 	}
 
 	return 0;
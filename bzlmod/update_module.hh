@@ -1,5 +1,5 @@
 #pragma once
 
 namespace bzlmod {
-auto update_module() -> int;
+auto update_module(bool offline) -> int;
 }
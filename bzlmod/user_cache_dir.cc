@@ -0,0 +1,32 @@
+#include "bzlmod/user_cache_dir.hh"
+
+#include <cstdlib>
+
+namespace fs = std::filesystem;
+
+auto bzlmod::user_cache_dir() -> std::optional<fs::path> {
+#if defined(_WIN32)
+	auto local_app_data = std::getenv("LOCALAPPDATA");
+	if(local_app_data == nullptr || *local_app_data == '\0') {
+		return std::nullopt;
+	}
+	return fs::path{local_app_data} / "bzlmod";
+#else
+	auto home_dir = std::getenv("HOME");
+#	if defined(__APPLE__)
+	if(home_dir == nullptr || *home_dir == '\0') {
+		return std::nullopt;
+	}
+	return fs::path{home_dir} / "Library" / "Caches" / "bzlmod";
+#	else
+	auto xdg_cache_home = std::getenv("XDG_CACHE_HOME");
+	if(xdg_cache_home != nullptr && fs::path{xdg_cache_home}.is_absolute()) {
+		return fs::path{xdg_cache_home} / "bzlmod";
+	}
+	if(home_dir == nullptr || *home_dir == '\0') {
+		return std::nullopt;
+	}
+	return fs::path{home_dir} / ".cache" / "bzlmod";
+#	endif
+#endif
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <filesystem>
+#include <optional>
+
+namespace bzlmod {
+/**
+ * Directory for caches that outlive a single run: `bzlmod` inside of
+ * %LOCALAPPDATA% on Windows, ~/Library/Caches on macOS and $XDG_CACHE_HOME or
+ * ~/.cache elsewhere. Not created. `std::nullopt` if the home directory is
+ * unknown.
+ */
+auto user_cache_dir() -> std::optional<std::filesystem::path>;
+} // namespace bzlmod
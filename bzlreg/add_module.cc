@@ -3,18 +3,26 @@
 #include <string_view>
 #include <filesystem>
 #include <print>
+#include <format>
 #include <algorithm>
 #include <fstream>
 #include <chrono>
+#include <unordered_map>
+#include <future>
+#include <functional>
 #include <boost/url.hpp>
 #include <openssl/evp.h>
 #include "nlohmann/json.hpp"
 #include "absl/strings/str_split.h"
 #include "bzlreg/download.hh"
+#include "bzlreg/repository_cache.hh"
+#include "bzlreg/chunk_queue.hh"
 #include "bzlreg/decompress.hh"
 #include "bzlreg/tar_view.hh"
+#include "bzlreg/zip_view.hh"
 #include "bzlreg/defer.hh"
 #include "bzlreg/config_types.hh"
+#include "bzlreg/bazel_version.hh"
 #include "bzlreg/module_bazel.hh"
 #include "bzlreg/util.hh"
 #include "bzlreg/gh_exec.hh"
@@ -23,6 +31,19 @@ namespace fs = std::filesystem;
 using bzlreg::util::defer;
 using json = nlohmann::json;
 
+/**
+ * Downloaded chunks waiting to be decompressed. Bounds memory when the network
+ * is faster than decompression.
+ */
+constexpr auto ADD_MODULE_MAX_QUEUED_CHUNKS = std::size_t{256};
+
+/**
+ * Connections large archives are downloaded over when the server supports
+ * byte ranges. A single stream is often throttled well below the bandwidth
+ * available.
+ */
+constexpr auto ADD_MODULE_DOWNLOAD_CONNECTIONS = 8u;
+
 constexpr auto DEFAULT_MODULE_BAZEL = R"starlark(module(
     name = "{}",
     version = "{}",
@@ -68,7 +89,6 @@ static auto infer_repository_from_url( //
 }
 
 static auto infer_module_name( //
-	bzlreg::tar_view tar_view,
 	std::string_view strip_prefix
 ) -> std::string {
 	if(!strip_prefix.empty()) {
@@ -104,8 +124,7 @@ static auto commit_date_to_version_string(std::string commit_date)
 
 static auto infer_module_version( //
 	const resolve_archive_url_result& archive_url_result,
-	bzlreg::tar_view tar_view,
-	std::string_view strip_prefix
+	std::string_view                  strip_prefix
 ) -> std::string {
 	if(!archive_url_result.github.default_branch_commit.empty()) {
 		auto commit_date = bzlreg::gh_commit_date(
@@ -133,27 +152,271 @@ static auto infer_module_version( //
 	return "";
 }
 
-static auto guess_strip_prefix(bzlreg::tar_view tar_view) -> std::string {
-	auto strip_prefix = std::string{};
-	for(bzlreg::tar_view_file f : tar_view) {
-		auto name = f.name();
+/**
+ * Everything add-module needs from the archive contents. Gathered in a single
+ * streaming pass so the decompressed archive is never held in memory.
+ */
+struct archive_scan_result {
+	/**
+	 * Top level directory shared by every entry or empty if there isn't one
+	 */
+	std::string guessed_strip_prefix;
+
+	/**
+	 * Contents of every MODULE.bazel that could be the module file keyed by
+	 * entry name
+	 */
+	std::unordered_map<std::string, std::string> module_bazel_files;
+
+	/**
+	 * Decompression stopped once the module file was found
+	 */
+	bool stopped_early = false;
+
+	/**
+	 * `false` when `guessed_strip_prefix` only covers the entries before the
+	 * scan stopped early, so a later entry outside of it may have been missed
+	 */
+	bool strip_prefix_verified = true;
+};
+
+class strip_prefix_guesser {
+	std::string _strip_prefix;
+	bool        _has_common_prefix = true;
+
+public:
+	auto add(const bzlreg::tar_entry_name& name) -> void {
+		if(!_has_common_prefix) {
+			return;
+		}
+
+		auto prefix = name.top_level_dir();
+		if(prefix.empty()) {
+			_has_common_prefix = false;
+			_strip_prefix.clear();
+			return;
+		}
+
+		if(_strip_prefix.empty()) {
+			_strip_prefix = prefix;
+		} else if(_strip_prefix != prefix) {
+			_has_common_prefix = false;
+			_strip_prefix.clear();
+		}
+	}
+
+	auto strip_prefix() const -> std::string_view {
+		return _strip_prefix;
+	}
+
+	/**
+	 * `false` once entries outside of a single top level directory were seen
+	 */
+	auto has_common_prefix() const -> bool {
+		return _has_common_prefix;
+	}
+};
+
+/**
+ * Entry name of the module file for `strip_prefix`
+ */
+static auto module_bazel_path(std::string_view strip_prefix) -> std::string {
+	if(strip_prefix.empty()) {
+		return "MODULE.bazel";
+	}
+	return std::format("{}/MODULE.bazel", strip_prefix);
+}
+
+/**
+ * Whether `name` may be the module file. With an explicit strip prefix that is
+ * only the MODULE.bazel inside of it, otherwise the one at the archive root or
+ * at the first directory level.
+ */
+static auto is_module_bazel_candidate(
+	const bzlreg::tar_entry_name& name,
+	std::string_view              strip_prefix
+) -> bool {
+	constexpr auto module_bazel_suffix = std::string_view{"/MODULE.bazel"};
+
+	if(!strip_prefix.empty()) {
+		return name == module_bazel_path(strip_prefix);
+	}
+
+	if(name == "MODULE.bazel") {
+		return true;
+	}
+
+	return name.ends_with(module_bazel_suffix) &&
+		name.size() == name.top_level_dir().size() + module_bazel_suffix.size();
+}
+
+/**
+ * Decompresses and scans compressed chunks as they are downloaded. Returns
+ * `std::nullopt` without an error message if `compressed_chunks` was
+ * cancelled since the download stage reports its own failures.
+ *
+ * Unless `full_scan` is set decompression stops once the MODULE.bazel for the
+ * strip prefix has been read. Without an explicit strip prefix the archive is
+ * assumed to keep a single top level directory once a MODULE.bazel was found
+ * in it, which holds for the source archives forges generate, and the guessed
+ * strip prefix is marked as unverified.
+ */
+static auto scan_tar_archive(
+	bzlreg::chunk_queue& compressed_chunks,
+	std::string          strip_prefix,
+	bool                 full_scan
+) -> std::optional<archive_scan_result> {
+	// Whatever the outcome nothing more is needed from the download stage
+	auto stop_download = defer([&] { compressed_chunks.cancel(); });
+
+	auto result = archive_scan_result{};
+	auto index = bzlreg::tar_index{};
+	auto module_bazel_file = static_cast<std::string*>(nullptr);
+	auto settled = false;
+
+	// Only the candidate that would be looked up if the archive ended here
+	// settles the scan. Without an explicit strip prefix that is the one in
+	// the single top level directory seen so far or the one at the root.
+	auto settles_scan = [&](const bzlreg::tar_stream_entry& entry) -> bool {
+		auto lookup_prefix = strip_prefix.empty() //
+			? index.top_level_dir()
+			: std::string_view{strip_prefix};
+		return !full_scan && entry.name == module_bazel_path(lookup_prefix);
+	};
+
+	auto tar = bzlreg::tar_stream{
+		[&](const bzlreg::tar_stream_entry& entry) {
+			if(settled) {
+				return bzlreg::tar_stream_action::stop;
+			}
+
+			index.add(entry);
+
+			if(entry.type != bzlreg::tar_entry_type::file) {
+				return bzlreg::tar_stream_action::skip;
+			}
+
+			if(!is_module_bazel_candidate(entry.name, strip_prefix)) {
+				return bzlreg::tar_stream_action::skip;
+			}
+
+			module_bazel_file = &result.module_bazel_files[entry.name.to_string()];
+			module_bazel_file->clear();
+			module_bazel_file->reserve(entry.size);
+
+			// Empty entries never reach the contents callback
+			if(entry.size == 0) {
+				settled = settled || settles_scan(entry);
+				return bzlreg::tar_stream_action::skip;
+			}
+
+			return bzlreg::tar_stream_action::read;
+		},
+		[&](
+			const bzlreg::tar_stream_entry& entry,
+			std::span<const std::byte>      chunk,
+			std::size_t                     offset
+		) {
+			module_bazel_file->append(
+				reinterpret_cast<const char*>(chunk.data()),
+				chunk.size()
+			);
+
+			if(offset + chunk.size() == entry.size) {
+				settled = settled || settles_scan(entry);
+			}
+			return true;
+		},
+	};
+
+	auto tar_status = bzlreg::tar_stream_status::ok;
+	auto tar_sink = [&](std::span<const std::byte> chunk) {
+		tar_status = tar.write(chunk);
+		return tar_status == bzlreg::tar_stream_status::ok;
+	};
+
+	auto decompressor = bzlreg::decompress_stream{};
+	auto decompress_status = bzlreg::decompress_status::ok;
+	while(decompress_status == bzlreg::decompress_status::ok) {
+		auto chunk = compressed_chunks.pop();
+		if(!chunk) {
+			if(compressed_chunks.cancelled()) {
+				return std::nullopt;
+			}
+			decompress_status = decompressor.finish(tar_sink);
+			break;
+		}
+		decompress_status = decompressor.write(*chunk, tar_sink);
+	}
+
+	if(tar_status == bzlreg::tar_stream_status::error) {
+		std::println(stderr, "ERROR: bad tar archive: {}", tar.error_message());
+		return std::nullopt;
+	}
+
+	auto stopped_early = tar_status == bzlreg::tar_stream_status::stopped;
+	if(
+		decompress_status == bzlreg::decompress_status::error ||
+		(!stopped_early && (!decompressor.finished() || !tar.finished()))
+	) {
+		std::println(stderr, "ERROR: failed to decompress archive data");
+		return std::nullopt;
+	}
+
+	// A MODULE.bazel read earlier may have been replaced by a later entry of
+	// the same name that isn't a file
+	std::erase_if(result.module_bazel_files, [&](const auto& file) {
+		auto entry = index.find(file.first);
+		return entry == nullptr || entry->type != bzlreg::tar_entry_type::file;
+	});
+
+	result.stopped_early = stopped_early;
+	result.guessed_strip_prefix = index.top_level_dir();
+	result.strip_prefix_verified = !stopped_early || !strip_prefix.empty() ||
+		result.guessed_strip_prefix.empty();
+	return result;
+}
+
+/**
+ * Same as `scan_tar_archive` but only the central directory and candidate
+ * MODULE.bazel members are read since zip archives are random access.
+ */
+static auto scan_zip_archive(
+	std::span<const std::byte> zip_data,
+	std::string_view           strip_prefix
+) -> std::optional<archive_scan_result> {
+	auto result = archive_scan_result{};
+	auto guesser = strip_prefix_guesser{};
+	auto zip = bzlreg::zip_view{zip_data};
+
+	if(!zip) {
+		std::println(stderr, "ERROR: bad zip archive: {}", zip.error_message());
+		return std::nullopt;
+	}
+
+	for(const auto& entry : zip.entries()) {
+		auto name = bzlreg::tar_entry_name{entry.name};
+		guesser.add(name);
 
-		auto slash_idx = name.find("/");
-		if(slash_idx == std::string::npos) {
-			return "";
+		if(entry.is_directory() || entry.is_symbolic_link()) {
+			continue;
 		}
-		auto prefix = name.substr(0, slash_idx);
-		if(strip_prefix.empty()) {
-			strip_prefix = prefix;
+
+		if(!is_module_bazel_candidate(name, strip_prefix)) {
 			continue;
 		}
 
-		if(strip_prefix != prefix) {
-			return "";
+		auto contents = zip.string(entry);
+		if(!contents) {
+			std::println(stderr, "ERROR: failed to inflate {}", entry.name);
+			return std::nullopt;
 		}
+
+		result.module_bazel_files[std::string{entry.name}] = std::move(*contents);
 	}
 
-	return strip_prefix;
+	result.guessed_strip_prefix = guesser.strip_prefix();
+	return result;
 }
 
 static auto resolve_archive_url(std::string_view url_str)
@@ -255,67 +518,184 @@ auto bzlreg::add_module(add_module_options options) -> int {
 	auto archive_url_result = resolve_archive_url(archive_url_str);
 	auto archive_filename =
 		fs::path{std::string{archive_url_result.url.path()}}.filename().string();
+
+	archive_url_str = archive_url_result.url.c_str();
+
+	auto repository_cache_dir = options.repository_cache_dir
+		? options.repository_cache_dir
+		: bzlreg::default_repository_cache_dir();
+	auto repository_cache = std::optional<bzlreg::repository_cache_writer>{};
+	if(repository_cache_dir) {
+		repository_cache.emplace(*repository_cache_dir);
+	}
+
+	// The archive is hashed as it is downloaded while tar archives are
+	// decompressed and scanned on another thread. Zip archives are kept in
+	// memory since their central directory is at the end. The repository
+	// cache is keyed by sha256 which is calculated in the same pass when
+	// another algorithm is asked for.
+	auto algorithms = options.algorithms;
+	if(algorithms.empty()) {
+		algorithms.emplace_back(bzlreg::integrity_algorithm::sha256);
+	}
+	auto requested_algorithm_count = algorithms.size();
+	auto sha256_index = static_cast<std::size_t>(
+		std::ranges::find(algorithms, bzlreg::integrity_algorithm::sha256) -
+		algorithms.begin()
+	);
+	if(repository_cache && sha256_index == algorithms.size()) {
+		algorithms.emplace_back(bzlreg::integrity_algorithm::sha256);
+	}
+	auto hasher = bzlreg::integrity_hasher(algorithms);
+	auto archive_format = bzlreg::archive_format::unknown;
+	auto archive_size = std::size_t{0};
+	auto archive_data = std::vector<std::byte>{};
+	auto unsupported_format = false;
+	auto compressed_chunks = bzlreg::chunk_queue{ADD_MODULE_MAX_QUEUED_CHUNKS};
+	auto tar_scan = std::future<std::optional<archive_scan_result>>{};
+	auto stop_tar_scan = defer([&] { compressed_chunks.cancel(); });
+
+	auto start_tar_scan = [&] {
+		tar_scan = std::async(
+			std::launch::async,
+			scan_tar_archive,
+			std::ref(compressed_chunks),
+			strip_prefix,
+			options.full_scan
+		);
+		compressed_chunks.push(std::move(archive_data));
+		archive_data = {};
+	};
+
+	std::print("INFO: downloading {}...", archive_url_str);
+	auto downloaded = bzlreg::download_file_stream(
+		archive_url_str,
+		[&](std::span<const std::byte> chunk) {
+			archive_size += chunk.size();
+			if(!hasher.update(chunk)) {
+				return false;
+			}
+
+			if(repository_cache) {
+				repository_cache->write(chunk);
+			}
+
+			if(tar_scan.valid()) {
+				compressed_chunks.push({chunk.begin(), chunk.end()});
+				return true;
+			}
+
+			archive_data.insert(archive_data.end(), chunk.begin(), chunk.end());
+			if(
+				archive_format == bzlreg::archive_format::unknown &&
+				archive_data.size() >= bzlreg::ARCHIVE_MAGIC_MAX_SIZE
+			) {
+				archive_format = bzlreg::detect_archive_format(archive_data);
+				if(archive_format == bzlreg::archive_format::unknown) {
+					unsupported_format = true;
+					return false;
+				}
+				if(archive_format != bzlreg::archive_format::zip) {
+					start_tar_scan();
+				}
+			}
+			return true;
+		},
+		{.connections = ADD_MODULE_DOWNLOAD_CONNECTIONS}
+	);
+
 	if(
-		!archive_filename.ends_with(".tar.gz") &&
-		!archive_filename.ends_with(".tgz")
+		downloaded != bzlreg::download_status::ok &&
+		!unsupported_format
 	) {
+		std::println("\b\b\b: FAILED");
+		std::println(stderr, "ERROR: failed to download {}", archive_url_str);
+		return 1;
+	}
+	std::println("\b\b\b: size={}", archive_size);
+
+	// Also catches archives shorter than any magic
+	if(archive_format == bzlreg::archive_format::unknown) {
 		std::println(
 			stderr,
-			"Archive {} is not supported. Only .tar.gz archives are allowed.",
+			"Archive {} is not supported. Only .tar.gz, .tar.zst, .tar.xz and "
+			".zip archives are allowed.",
 			archive_filename
 		);
 		return 1;
 	}
 
-	archive_url_str = archive_url_result.url.c_str();
-
-	std::print("INFO: downloading {}...", archive_url_str);
-	auto compressed_data = bzlreg::download_file(archive_url_str);
-	if(!compressed_data) {
-		std::println("\b\b\b: FAILED");
-		std::println(stderr, "ERROR: failed to download {}", archive_url_str);
-		return 1;
-	}
-	std::println("\b\b\b: size={}", compressed_data->size());
+	compressed_chunks.close();
 
 	std::print("INFO: integrity...");
-	auto integrity = bzlreg::calc_integrity(
-		std::as_bytes(std::span{compressed_data->data(), compressed_data->size()})
-	);
-	if(!integrity) {
+	auto integrities = hasher.finish_each();
+	if(!integrities) {
 		std::println("\b\b\b   ");
 		std::println(stderr, "ERROR: failed to calculate integrity");
 		return 1;
 	}
 
-	std::println("\b\b\b: {}", *integrity);
+	auto integrity = integrities->front();
+	std::println("\b\b\b: {}", integrity);
+	for(auto i = std::size_t{1}; i < requested_algorithm_count; ++i) {
+		std::println("INFO: integrity: {}", (*integrities)[i]);
+	}
 
-	auto decompressed_data = bzlreg::decompress_archive(*compressed_data);
-	if(decompressed_data.empty()) {
-		std::println(stderr, "ERROR: failed to decompress archive data");
+	if(
+		repository_cache &&
+		repository_cache->commit((*integrities)[sha256_index])
+	) {
+		std::println(
+			"INFO: stored archive in repository cache {}",
+			repository_cache_dir->generic_string()
+		);
+	}
+
+	auto scan_result = archive_format == bzlreg::archive_format::zip
+		? scan_zip_archive(archive_data, strip_prefix)
+		: tar_scan.get();
+	if(!scan_result) {
 		return 1;
 	}
 
+	if(scan_result->stopped_early) {
+		std::println("INFO: stopped reading archive after finding MODULE.bazel");
+	}
+
 	auto module_name = std::string{};
 	auto module_version = std::string{};
 	auto module_bzl = std::optional<bzlreg::module_bazel>{};
-	auto tar_view = bzlreg::tar_view{decompressed_data};
 
 	if(strip_prefix.empty()) {
-		std::print("INFO: guessing strip prefix...");
-		strip_prefix = guess_strip_prefix(tar_view);
-		std::println("\b\b\b: {}", strip_prefix);
+		strip_prefix = scan_result->guessed_strip_prefix;
+		std::println("INFO: guessed strip prefix: {}", strip_prefix);
+
+		if(!scan_result->strip_prefix_verified) {
+			std::println(
+				stderr,
+				"WARN: strip prefix was guessed from the entries before MODULE.bazel "
+				"only"
+			);
+			std::println(
+				stderr,
+				"WARN: pass --strip-prefix={} to confirm it or --full-scan to check "
+				"the whole archive",
+				strip_prefix
+			);
+		}
 	}
 
-	auto module_bzl_view = tar_view.file(
-		strip_prefix.empty() //
-			? "MODULE.bazel"
-			: std::string{strip_prefix} + "/MODULE.bazel"
+	auto module_bzl_contents = std::optional<std::string>{};
+	auto module_bzl_itr = scan_result->module_bazel_files.find(
+		module_bazel_path(strip_prefix)
 	);
-	if(!module_bzl_view) {
-		module_name = infer_module_name(tar_view, strip_prefix);
-		module_version =
-			infer_module_version(archive_url_result, tar_view, strip_prefix);
+	if(module_bzl_itr != scan_result->module_bazel_files.end()) {
+		module_bzl_contents = std::move(module_bzl_itr->second);
+	}
+
+	if(!module_bzl_contents) {
+		module_name = infer_module_name(strip_prefix);
+		module_version = infer_module_version(archive_url_result, strip_prefix);
 		std::println(stderr, "WARN: no MODULE.bazel file found in archive");
 		std::println(
 			stderr,
@@ -324,19 +704,24 @@ auto bzlreg::add_module(add_module_options options) -> int {
 			module_version
 		);
 	} else {
-		module_bzl = bzlreg::module_bazel::parse(module_bzl_view.string_view());
-
-		if(!module_bzl) {
-			std::println(stderr, "ERROR: failed to parse MODULE.bazel");
+		auto parsed = bzlreg::module_bazel::parse(*module_bzl_contents);
+		if(!parsed) {
+			std::println(
+				stderr,
+				"ERROR: {}",
+				parsed.error().describe(module_bazel_path(strip_prefix))
+			);
 			return 1;
 		}
 
+		module_bzl = std::move(*parsed);
+
 		module_name = module_bzl->name;
 		module_version = module_bzl->version;
 	}
 
 	auto source_config = bzlreg::source_config{
-		.integrity = *integrity,
+		.integrity = integrity,
 		.strip_prefix = std::string{strip_prefix},
 		.patch_strip = 0,
 		.patches = {},
@@ -372,7 +757,18 @@ auto bzlreg::add_module(add_module_options options) -> int {
 					return 1;
 				}
 			}
-			metadata_json["versions"].push_back(module_version);
+			auto& versions = metadata_json["versions"];
+			versions.push_back(module_version);
+
+			// Kept sorted so an older version added later isn't listed last
+			auto all_strings = std::ranges::all_of(versions, [](const json& version) {
+				return version.is_string();
+			});
+			if(all_strings) {
+				auto sorted_versions = versions.get<std::vector<std::string>>();
+				bzlreg::sort_versions(sorted_versions);
+				versions = sorted_versions;
+			}
 		} else {
 			metadata_json["versions"] = json::array({module_version});
 		}
@@ -429,9 +825,8 @@ auto bzlreg::add_module(add_module_options options) -> int {
 																												<< "\n";
 	std::ofstream{source_config_path, std::ios::binary}
 		<< json{source_config}[0].dump(4) << "\n";
-	if(module_bzl_view) {
-		std::ofstream{module_bazel_path, std::ios::binary}
-			<< module_bzl_view.string_view();
+	if(module_bzl_contents) {
+		std::ofstream{module_bazel_path, std::ios::binary} << *module_bzl_contents;
 	} else if(!archive_url_result.github.default_branch_commit.empty()) {
 		std::ofstream{module_bazel_path, std::ios::binary} << std::format(
 			GIT_COMMIT_DEFALT_MODULE_BAZEL,
@@ -1,13 +1,34 @@
 #pragma once
 
 #include <filesystem>
+#include <optional>
 #include <string_view>
+#include <vector>
+#include "bzlreg/util.hh"
 
 namespace bzlreg {
 struct add_module_options {
 	std::filesystem::path registry_dir;
 	std::string_view      archive_url;
 	std::string_view      strip_prefix;
+
+	/**
+	 * Read every archive entry instead of stopping as soon as MODULE.bazel
+	 * and the strip prefix are known.
+	 */
+	bool full_scan = false;
+
+	/**
+	 * Bazel repository cache the downloaded archive is stored in so bazel
+	 * never downloads it again. Defaults to bazel's default location.
+	 */
+	std::optional<std::filesystem::path> repository_cache_dir;
+
+	/**
+	 * Algorithms of the archive integrity, all calculated in the same pass
+	 * over the download and printed. The first is written to source.json.
+	 */
+	std::vector<integrity_algorithm> algorithms = {integrity_algorithm::sha256};
 };
 
 auto add_module(add_module_options options) -> int;
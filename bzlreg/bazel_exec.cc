@@ -6,6 +6,7 @@
 #define BOOST_PROCESS_VERSION 1
 #include <boost/process/v1.hpp>
 #include "nlohmann/json.hpp"
+#include "bzlreg/bazel_version.hh"
 #include "bzlreg/defer.hh"
 #include "bzlreg/unused.hh"
 #include "bzlreg/calc_integrity.hh"
@@ -106,8 +107,16 @@ auto bzlreg::bazel_exec(const bazel_exec_options& options) -> int {
 		metadata_config = *c;
 	}
 
-	module_version =
-		metadata_config.versions.at(metadata_config.versions.size() - 1);
+	auto latest = bzlreg::latest_version(metadata_config);
+	if(!latest) {
+		std::println( //
+			stderr,
+			"[ERROR] module '{}' has no versions that aren't yanked",
+			module_name
+		);
+		return 1;
+	}
+	module_version = *latest;
 
 	{
 		auto module_file = std::ofstream{
@@ -0,0 +1,236 @@
+#include "bzlreg/bazel_version.hh"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <numeric>
+
+/*
+ * Key layout, compared byte by byte:
+ *
+ *   release identifiers, KEY_END,
+ *   KEY_RELEASE or KEY_PRERELEASE followed by prerelease identifiers, KEY_END
+ *
+ * A numeric identifier is KEY_NUMERIC plus its digit count, its digits without
+ * leading zeros and a byte ordering numbers of equal value by their string. An
+ * alphanumeric identifier is KEY_ALPHANUMERIC, its characters and KEY_END.
+ * Numeric identifiers sort before alphanumeric ones like in bazel and a list
+ * ending sorts before any identifier so a prefix sorts first.
+ */
+constexpr auto KEY_END = std::uint8_t{0x00};
+constexpr auto KEY_PRERELEASE = std::uint8_t{0x01};
+constexpr auto KEY_RELEASE = std::uint8_t{0x02};
+constexpr auto KEY_NUMERIC = std::uint8_t{0x10};
+constexpr auto KEY_ALPHANUMERIC = std::uint8_t{0xf0};
+
+/**
+ * The empty version sorts after every other version
+ */
+constexpr auto KEY_EMPTY = std::uint8_t{0xff};
+
+/**
+ * Longest numeric identifier whose digit count fits below KEY_ALPHANUMERIC
+ */
+constexpr auto KEY_MAX_DIGITS = std::size_t{KEY_ALPHANUMERIC - KEY_NUMERIC - 1};
+
+static auto is_digit(char c) -> bool {
+	return c >= '0' && c <= '9';
+}
+
+static auto is_alpha(char c) -> bool {
+	return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static auto append_identifier( //
+	std::string&     key,
+	std::string_view identifier,
+	bool             allow_dash
+) -> bool {
+	if(identifier.empty()) {
+		return false;
+	}
+
+	auto digits_only = true;
+	for(auto c : identifier) {
+		if(is_digit(c)) {
+			continue;
+		}
+		if(!is_alpha(c) && !(allow_dash && c == '-')) {
+			return false;
+		}
+		digits_only = false;
+	}
+
+	if(!digits_only) {
+		key.push_back(static_cast<char>(KEY_ALPHANUMERIC));
+		key.append(identifier);
+		key.push_back(static_cast<char>(KEY_END));
+		return true;
+	}
+
+	// Zero keeps its last digit
+	auto zeros =
+		std::min(identifier.find_first_not_of('0'), identifier.size() - 1);
+	auto value = identifier.substr(zeros);
+	if(value.size() > KEY_MAX_DIGITS || zeros > 0xff) {
+		return false;
+	}
+
+	key.push_back(static_cast<char>(KEY_NUMERIC + value.size()));
+	key.append(value);
+
+	// Bazel orders equal numbers by their string, where "01" sorts before "1"
+	// but "0" sorts before "00"
+	key.push_back(static_cast<char>(value == "0" ? zeros : 0xff - zeros));
+	return true;
+}
+
+static auto append_identifiers( //
+	std::string&     key,
+	std::string_view identifiers,
+	bool             allow_dash
+) -> bool {
+	while(true) {
+		auto end = std::min(identifiers.find('.'), identifiers.size());
+		if(!append_identifier(key, identifiers.substr(0, end), allow_dash)) {
+			return false;
+		}
+		if(end == identifiers.size()) {
+			break;
+		}
+		identifiers.remove_prefix(end + 1);
+	}
+
+	key.push_back(static_cast<char>(KEY_END));
+	return true;
+}
+
+static auto is_valid_build(std::string_view build) -> bool {
+	return !build.empty() && std::ranges::all_of(build, [](char c) {
+		return is_digit(c) || is_alpha(c) || c == '.' || c == '-';
+	});
+}
+
+bzlreg::bazel_version::bazel_version(std::string key) : _key(std::move(key)) {
+}
+
+auto bzlreg::bazel_version::parse( //
+	std::string_view str
+) -> std::optional<bazel_version> {
+	auto key = std::string{};
+	if(str.empty()) {
+		key.push_back(static_cast<char>(KEY_EMPTY));
+		return bazel_version{std::move(key)};
+	}
+
+	if(auto plus = str.find('+'); plus != std::string_view::npos) {
+		if(!is_valid_build(str.substr(plus + 1))) {
+			return std::nullopt;
+		}
+		str = str.substr(0, plus);
+	}
+
+	auto dash = std::min(str.find('-'), str.size());
+	if(!append_identifiers(key, str.substr(0, dash), false)) {
+		return std::nullopt;
+	}
+
+	if(dash == str.size()) {
+		key.push_back(static_cast<char>(KEY_RELEASE));
+	} else {
+		key.push_back(static_cast<char>(KEY_PRERELEASE));
+		if(!append_identifiers(key, str.substr(dash + 1), true)) {
+			return std::nullopt;
+		}
+	}
+
+	return bazel_version{std::move(key)};
+}
+
+auto bzlreg::bazel_version::key() const -> std::string_view {
+	return _key;
+}
+
+auto bzlreg::bazel_version::operator<=>( //
+	const bazel_version& other
+) const -> std::strong_ordering {
+	auto size = std::min(_key.size(), other._key.size());
+	auto order = std::memcmp(_key.data(), other._key.data(), size);
+	if(order != 0) {
+		return order <=> 0;
+	}
+	return _key.size() <=> other._key.size();
+}
+
+auto bzlreg::bazel_version::operator==( //
+	const bazel_version& other
+) const -> bool {
+	return _key == other._key;
+}
+
+auto bzlreg::compare_versions( //
+	std::string_view a,
+	std::string_view b
+) -> std::strong_ordering {
+	auto a_version = bazel_version::parse(a);
+	auto b_version = bazel_version::parse(b);
+	if(a_version && b_version) {
+		return *a_version <=> *b_version;
+	}
+	if(a_version || b_version) {
+		return a_version.has_value() <=> b_version.has_value();
+	}
+	return a <=> b;
+}
+
+auto bzlreg::sort_versions(std::vector<std::string>& versions) -> void {
+	auto parsed = std::vector<std::optional<bazel_version>>{};
+	parsed.reserve(versions.size());
+	for(const auto& str : versions) {
+		parsed.emplace_back(bazel_version::parse(str));
+	}
+
+	// Indices are sorted instead of the strings so only keys are compared and
+	// every string is moved once. Stable so versions only differing in build
+	// metadata keep their order.
+	auto order = std::vector<std::size_t>(versions.size());
+	std::iota(order.begin(), order.end(), std::size_t{0});
+	std::ranges::stable_sort(order, [&](std::size_t a, std::size_t b) -> bool {
+		auto& a_version = parsed[a];
+		auto& b_version = parsed[b];
+		if(a_version && b_version) {
+			return *a_version < *b_version;
+		}
+		if(a_version || b_version) {
+			return b_version.has_value();
+		}
+		return versions[a] < versions[b];
+	});
+
+	auto sorted = std::vector<std::string>{};
+	sorted.reserve(versions.size());
+	for(auto index : order) {
+		sorted.emplace_back(std::move(versions[index]));
+	}
+	versions = std::move(sorted);
+}
+
+auto bzlreg::latest_version( //
+	const metadata_config& metadata
+) -> std::optional<std::string_view> {
+	auto latest = std::optional<bazel_version>{};
+	auto latest_str = std::optional<std::string_view>{};
+	for(const auto& str : metadata.versions) {
+		if(str.empty() || metadata.yanked_versions.contains(str)) {
+			continue;
+		}
+
+		auto version = bazel_version::parse(str);
+		if(!version || (latest && *version <= *latest)) {
+			continue;
+		}
+		latest = std::move(version);
+		latest_str = str;
+	}
+	return latest_str;
+}
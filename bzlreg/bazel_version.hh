@@ -0,0 +1,64 @@
+#pragma once
+
+#include <compare>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "bzlreg/config_types.hh"
+
+namespace bzlreg {
+/**
+ * A module version in bazel's grammar: dot separated release identifiers, an
+ * optional `-` prerelease and optional `+` build metadata. Parsed once into a
+ * key whose bytes sort in version order so comparing two versions is a single
+ * memcmp.
+ */
+class bazel_version {
+	std::string _key;
+
+	explicit bazel_version(std::string key);
+
+public:
+	/**
+	 * `std::nullopt` if `str` isn't a valid version. The empty version of
+	 * non-registry overrides is valid and sorts after every other version.
+	 */
+	static auto parse( //
+		std::string_view str
+	) -> std::optional<bazel_version>;
+
+	/**
+	 * Build metadata isn't part of the key, versions only differing in it are
+	 * equal
+	 */
+	auto key() const -> std::string_view;
+
+	auto operator<=>(const bazel_version& other) const -> std::strong_ordering;
+	auto operator==(const bazel_version& other) const -> bool;
+};
+
+/**
+ * Orders two version strings. Invalid versions sort before valid ones and
+ * among themselves by their string. Parses both, prefer bazel_version when
+ * comparing the same versions repeatedly.
+ */
+auto compare_versions( //
+	std::string_view a,
+	std::string_view b
+) -> std::strong_ordering;
+
+/**
+ * Sorts `versions` lowest first, parsing each of them once. Invalid versions
+ * come first.
+ */
+auto sort_versions(std::vector<std::string>& versions) -> void;
+
+/**
+ * Highest of `metadata.versions` that isn't yanked, regardless of the order
+ * they are listed in. Invalid versions are skipped.
+ */
+auto latest_version( //
+	const metadata_config& metadata
+) -> std::optional<std::string_view>;
+} // namespace bzlreg
@@ -1,10 +1,12 @@
 #include <filesystem>
 #include <print>
+#include <vector>
 #include "docoptexpr/docoptexpr.hh"
 #include "bzlreg/init_registry.hh"
 #include "bzlreg/bazel_exec.hh"
 #include "bzlreg/add_module.hh"
 #include "bzlreg/calc_integrity.hh"
+#include "bzlreg/util.hh"
 
 namespace fs = std::filesystem;
 using namespace docoptexpr::literals;
@@ -17,14 +19,19 @@ Usage:
 	bzlreg build <label> [--registry=<path>]
 	bzlreg test <label> [--registry=<path>]
 	bzlreg run <label> [--registry=<path>]
-	bzlreg add-module <archive-url> [--strip-prefix=<str>] [--registry=<path>]
-	bzlreg calc-integrity <module> [--strip-prefix=<str>] [--registry=<path>]
+	bzlreg add-module <archive-url> [--strip-prefix=<str>] [--registry=<path>] [--full-scan] [--repository-cache=<path>] [--digest=<algorithms>]
+	bzlreg calc-integrity <module> [--strip-prefix=<str>] [--registry=<path>] [--digest=<algorithms>]
+	bzlreg calc-integrity --all [--registry=<path>] [--digest=<algorithms>]
 	bzlreg -h | --help
 
 Options:
-	--registry=<path>     Registry directory. Defaults to current working directory.
-	--strip-prefix=<str>  Prefix stripped from archive and set in source.json.
-	-h --help             Show this screen.
+	--registry=<path>          Registry directory. Defaults to current working directory.
+	--strip-prefix=<str>       Prefix stripped from archive and set in source.json.
+	--full-scan                Read the whole archive even after MODULE.bazel is found.
+	--repository-cache=<path>  Bazel repository cache archives are stored in. Defaults to bazel's.
+	--all                      Every version of every module in the registry.
+	--digest=<algorithms>      Integrity algorithms, comma separated: sha256, sha384 or sha512. All are hashed in one pass, the first is written to source.json. Defaults to the archive's or sha256.
+	-h --help                  Show this screen.
 )"_docopt;
 
 using ArgsType = decltype(USAGE)::result_type;
@@ -45,6 +52,31 @@ static auto forward_bazel_subcommand(
 	});
 }
 
+/**
+ * `false` if --digest isn't a comma separated list of supported algorithms
+ */
+static auto digest_option(
+	const ArgsType&                           options,
+	std::vector<bzlreg::integrity_algorithm>& algorithms
+) -> bool {
+	auto digest = options.get<"--digest">();
+	if(digest.empty()) {
+		return true;
+	}
+
+	auto parsed = bzlreg::parse_integrity_algorithms(digest);
+	if(!parsed) {
+		std::println(
+			stderr,
+			"[ERROR] --digest must be a comma separated list of sha256, sha384 or "
+			"sha512"
+		);
+		return false;
+	}
+	algorithms = std::move(*parsed);
+	return true;
+}
+
 static auto calc_integrity_command(const ArgsType& options) -> int {
 	auto registry_sv = options.get<"--registry">();
 	auto registry_dir = !registry_sv.empty() //
@@ -52,9 +84,16 @@ static auto calc_integrity_command(const ArgsType& options) -> int {
 		: fs::current_path();
 	auto module = options.get<"<module>">();
 
+	auto algorithms = std::vector<bzlreg::integrity_algorithm>{};
+	if(!digest_option(options, algorithms)) {
+		return 1;
+	}
+
 	return bzlreg::calc_integrity({
 		.registry_dir = registry_dir,
 		.module_name = std::string{module},
+		.all_modules = options.get<"--all">(),
+		.algorithms = std::move(algorithms),
 	});
 }
 
@@ -107,11 +146,24 @@ auto main(int argc, char* argv[]) -> int {
 			return 1;
 		}
 
+		auto repository_cache_sv = args.get<"--repository-cache">();
+		auto repository_cache_dir = !repository_cache_sv.empty() //
+			? std::optional<fs::path>{repository_cache_sv}
+			: std::nullopt;
+
+		auto algorithms = std::vector{bzlreg::integrity_algorithm::sha256};
+		if(!digest_option(args, algorithms)) {
+			return 1;
+		}
+
 		auto archive_url = args.get<"<archive-url>">();
 		exit_code = bzlreg::add_module({
 			.registry_dir = registry_dir,
 			.archive_url = archive_url,
 			.strip_prefix = strip_prefix,
+			.full_scan = args.get<"--full-scan">(),
+			.repository_cache_dir = repository_cache_dir,
+			.algorithms = std::move(algorithms),
 		});
 	}
 
@@ -1,28 +1,166 @@
 #include "bzlreg/calc_integrity.hh"
 
+#include <algorithm>
+#include <atomic>
 #include <print>
 #include <filesystem>
+#include <span>
 #include <fstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
 #include "nlohmann/json.hpp"
-#include "bzlreg/util.hh"
+#include "bzlreg/integrity_cache.hh"
 #include "bzlreg/config_types.hh"
 
+using namespace std::string_literals;
+using namespace std::string_view_literals;
 using json = nlohmann::json;
 namespace fs = std::filesystem;
 
-auto bzlreg::calc_integrity( //
-	const calc_integrity_options& options
-) -> int {
-	if(!fs::exists(options.registry_dir / "bazel_registry.json")) {
+namespace {
+enum class source_integrity_status {
+	unchanged,
+	updated,
+	failed,
+};
+} // namespace
+
+/**
+ * Recalculates the integrity of the patches and overlay files next to
+ * `source_json_path`. The file is only rewritten when an integrity changed.
+ * Without `algorithms` the algorithm of the archive's integrity is used.
+ */
+static auto calc_source_integrity(
+	const fs::path&                              source_json_path,
+	std::span<const bzlreg::integrity_algorithm> algorithms,
+	bzlreg::integrity_cache&                     cache
+) -> source_integrity_status {
+	auto source = bzlreg::source_config{};
+	try {
+		source = json::parse(std::ifstream{source_json_path});
+	} catch(const json::exception& err) {
 		std::println(
 			stderr,
-			"bazel_registry.json file is missing. Are sure {} is a bazel registry?",
-			options.registry_dir.generic_string()
+			"[ERROR] {}: {}",
+			source_json_path.generic_string(),
+			err.what()
 		);
-		return 1;
+		return source_integrity_status::failed;
+	}
+
+	auto archive_algorithm = bzlreg::integrity_algorithm_of(source.integrity) //
+		.value_or(bzlreg::integrity_algorithm::sha256);
+	if(algorithms.empty()) {
+		algorithms = std::span{&archive_algorithm, 1};
+	}
+
+	auto module_dir = source_json_path.parent_path();
+	auto patches_dir = module_dir / "patches";
+	auto overlay_dir = module_dir / "overlay";
+	auto integrity_paths = std::unordered_map<std::string, std::string>{};
+	auto integrity_errors = std::unordered_map<std::string, std::string>{};
+
+	if(fs::exists(patches_dir)) {
+		for(auto& entry : fs::recursive_directory_iterator(patches_dir)) {
+			if(entry.is_regular_file()) {
+				auto rel_path =
+					fs::proximate(entry.path(), module_dir).generic_string();
+				integrity_paths.emplace(rel_path, ""s);
+				integrity_errors.emplace(rel_path, ""s);
+			}
+		}
+	}
+
+	if(fs::exists(overlay_dir)) {
+		for(auto& entry : fs::recursive_directory_iterator(overlay_dir)) {
+			if(entry.is_regular_file()) {
+				auto rel_path =
+					fs::proximate(entry.path(), module_dir).generic_string();
+				integrity_paths.emplace(rel_path, ""s);
+				integrity_errors.emplace(rel_path, ""s);
+			}
+		}
+	}
+
+	for(auto&& [rel_path, _] : source.patches) {
+		if(rel_path.starts_with("..")) {
+			integrity_paths.emplace(rel_path, ""s);
+			integrity_errors.emplace(rel_path, ""s);
+		}
 	}
 
-	auto module_dir = options.registry_dir / "modules" / options.module_name;
+	for(auto&& [rel_path, _] : source.overlay) {
+		if(rel_path.starts_with("..")) {
+			integrity_paths.emplace(rel_path, ""s);
+			integrity_errors.emplace(rel_path, ""s);
+		}
+	}
+
+	for(auto& [rel_path, integrity] : integrity_paths) {
+		auto ec = std::error_code{};
+		auto file_integrities =
+			cache.file_integrities(module_dir / rel_path, algorithms, ec);
+
+		if(ec) {
+			integrity_errors.at(rel_path) = ec.message();
+			continue;
+		}
+
+		if(!file_integrities) {
+			integrity_errors.at(rel_path) = "calc_integrity() failed"s;
+			continue;
+		}
+		integrity = std::move(file_integrities->front());
+	}
+
+	auto has_error = false;
+	for(auto&& [p, err] : integrity_errors) {
+		if(!err.empty()) {
+			has_error = true;
+			std::println(stderr, "[ERROR] {}: {}", p, err);
+		}
+	}
+
+	if(has_error) {
+		return source_integrity_status::failed;
+	}
+
+	auto overlay = decltype(source.overlay){};
+	auto patches = decltype(source.patches){};
+
+	for(auto&& [p, integrity] : integrity_paths) {
+		if(auto prefix = "overlay/"sv; p.starts_with(prefix)) {
+			overlay.emplace(p.substr(prefix.size()), integrity);
+		} else if(auto prefix = "patches/"sv; p.starts_with(prefix)) {
+			patches.emplace(p.substr(prefix.size()), integrity);
+		}
+	}
+
+	if(overlay == source.overlay && patches == source.patches) {
+		return source_integrity_status::unchanged;
+	}
+
+	source.overlay = std::move(overlay);
+	source.patches = std::move(patches);
+
+	std::println("updating {}", source_json_path.generic_string());
+	std::ofstream{source_json_path, std::ios_base::binary}
+		<< json{source}[0].dump(4, ' ', false);
+	return source_integrity_status::updated;
+}
+
+/**
+ * Appends the source.json path of every version listed in the metadata.json
+ * of `module_dir`
+ */
+static auto collect_source_configs(
+	const fs::path&        module_dir,
+	std::vector<fs::path>& source_config_paths
+) -> bool {
 	auto metadata_config_path = module_dir / "metadata.json";
 
 	if(!fs::exists(metadata_config_path)) {
@@ -31,16 +169,108 @@ auto bzlreg::calc_integrity( //
 			"[ERROR] {} does not exist",
 			metadata_config_path.generic_string()
 		);
-		return 1;
+		return false;
 	}
 
-	bzlreg::metadata_config metadata_config =
-		json::parse(std::ifstream{metadata_config_path});
+	auto metadata_config = bzlreg::metadata_config{};
+	try {
+		metadata_config = json::parse(std::ifstream{metadata_config_path});
+	} catch(const json::exception& err) {
+		std::println(
+			stderr,
+			"[ERROR] {}: {}",
+			metadata_config_path.generic_string(),
+			err.what()
+		);
+		return false;
+	}
 
 	for(auto version : metadata_config.versions) {
-		auto source_config_path = module_dir / version / "source.json";
-		bzlreg::calc_source_integrity(source_config_path);
+		source_config_paths.emplace_back(module_dir / version / "source.json");
+	}
+
+	return true;
+}
+
+auto bzlreg::calc_integrity( //
+	const calc_integrity_options& options
+) -> int {
+	if(!fs::exists(options.registry_dir / "bazel_registry.json")) {
+		std::println(
+			stderr,
+			"bazel_registry.json file is missing. Are sure {} is a bazel registry?",
+			options.registry_dir.generic_string()
+		);
+		return 1;
+	}
+
+	auto modules_dir = options.registry_dir / "modules";
+	auto source_config_paths = std::vector<fs::path>{};
+	auto failed = false;
+
+	if(options.all_modules) {
+		auto ec = std::error_code{};
+		for(auto& entry : fs::directory_iterator{modules_dir, ec}) {
+			if(entry.is_directory()) {
+				failed =
+					!collect_source_configs(entry.path(), source_config_paths) ||
+					failed;
+			}
+		}
+
+		if(ec) {
+			std::println(
+				stderr,
+				"[ERROR] failed to read {}: {}",
+				modules_dir.generic_string(),
+				ec.message()
+			);
+			return 1;
+		}
+	} else {
+		auto module_dir = modules_dir / options.module_name;
+		if(!collect_source_configs(module_dir, source_config_paths)) {
+			return 1;
+		}
+	}
+
+	auto updated_count = std::atomic_size_t{0};
+	auto failed_count = std::atomic_size_t{0};
+
+	// Each version is a separate task so a module with many versions doesn't
+	// keep a single thread busy
+	auto thread_count = std::max(std::thread::hardware_concurrency(), 1u);
+	auto cache = integrity_cache{options.registry_dir};
+	auto pool = boost::asio::thread_pool{thread_count};
+	for(const auto& source_config_path : source_config_paths) {
+		boost::asio::post(pool, [&] {
+			auto status = calc_source_integrity(
+				source_config_path,
+				options.algorithms,
+				cache
+			);
+			switch(status) {
+				case source_integrity_status::unchanged:
+					break;
+				case source_integrity_status::updated:
+					updated_count += 1;
+					break;
+				case source_integrity_status::failed:
+					failed_count += 1;
+					break;
+			}
+		});
+	}
+	pool.join();
+	cache.save();
+
+	if(options.all_modules) {
+		std::println(
+			"{} of {} source.json files updated",
+			updated_count.load(),
+			source_config_paths.size()
+		);
 	}
 
-	return 0;
+	return failed || failed_count > 0 ? 1 : 0;
 }
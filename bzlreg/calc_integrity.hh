@@ -1,12 +1,37 @@
 #pragma once
 
 #include <filesystem>
+#include <string>
+#include <vector>
+#include "bzlreg/util.hh"
 
 namespace bzlreg {
 struct calc_integrity_options {
 	std::filesystem::path registry_dir;
-	std::string           module_name;
+
+	/**
+	 * Ignored when `all_modules` is set
+	 */
+	std::string module_name;
+
+	/**
+	 * Every version of every module in the registry
+	 */
+	bool all_modules = false;
+
+	/**
+	 * Algorithms of the patch and overlay integrities, all calculated from a
+	 * single read of each file and kept in the integrity cache. The first is
+	 * written to source.json. Defaults to the algorithm of each version's
+	 * archive integrity.
+	 */
+	std::vector<integrity_algorithm> algorithms;
 };
 
+/**
+ * Recalculates the patch and overlay integrities in the source.json of each
+ * version. Versions are processed in parallel and only the source.json files
+ * that changed are rewritten.
+ */
 auto calc_integrity(const calc_integrity_options& options) -> int;
 } // namespace bzlreg
@@ -0,0 +1,64 @@
+#include "bzlreg/chunk_queue.hh"
+
+#include <utility>
+
+bzlreg::chunk_queue::chunk_queue(std::size_t max_chunks)
+	: _max_chunks(max_chunks) {
+}
+
+auto bzlreg::chunk_queue::push(std::vector<std::byte> chunk) -> bool {
+	{
+		auto lock = std::unique_lock{_mutex};
+		_changed.wait(lock, [&] {
+			return _closed || _chunks.size() < _max_chunks;
+		});
+
+		if(_closed) {
+			return false;
+		}
+
+		_chunks.emplace_back(std::move(chunk));
+	}
+	_changed.notify_all();
+	return true;
+}
+
+auto bzlreg::chunk_queue::pop() -> std::optional<std::vector<std::byte>> {
+	auto chunk = std::optional<std::vector<std::byte>>{};
+	{
+		auto lock = std::unique_lock{_mutex};
+		_changed.wait(lock, [&] { return _closed || !_chunks.empty(); });
+
+		if(_chunks.empty()) {
+			return std::nullopt;
+		}
+
+		chunk = std::move(_chunks.front());
+		_chunks.pop_front();
+	}
+	_changed.notify_all();
+	return chunk;
+}
+
+auto bzlreg::chunk_queue::close() -> void {
+	{
+		auto lock = std::lock_guard{_mutex};
+		_closed = true;
+	}
+	_changed.notify_all();
+}
+
+auto bzlreg::chunk_queue::cancel() -> void {
+	{
+		auto lock = std::lock_guard{_mutex};
+		_closed = true;
+		_cancelled = true;
+		_chunks.clear();
+	}
+	_changed.notify_all();
+}
+
+auto bzlreg::chunk_queue::cancelled() -> bool {
+	auto lock = std::lock_guard{_mutex};
+	return _cancelled;
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace bzlreg {
+/**
+ * Bounded single producer, single consumer queue of byte chunks connecting two
+ * pipeline stages. The producer blocks while the queue is full so a slow
+ * consumer limits how much is buffered.
+ */
+class chunk_queue {
+	std::mutex                         _mutex;
+	std::condition_variable            _changed;
+	std::deque<std::vector<std::byte>> _chunks;
+	std::size_t                        _max_chunks;
+	bool                               _closed = false;
+	bool                               _cancelled = false;
+
+public:
+	explicit chunk_queue(std::size_t max_chunks);
+
+	/**
+	 * Blocks while the queue is full. Returns `false` and drops `chunk` once
+	 * the queue was closed or cancelled.
+	 */
+	auto push(std::vector<std::byte> chunk) -> bool;
+
+	/**
+	 * Blocks until a chunk is available. `std::nullopt` once the queue is
+	 * closed and drained or was cancelled.
+	 */
+	auto pop() -> std::optional<std::vector<std::byte>>;
+
+	/**
+	 * No more chunks will be pushed. Chunks already queued can still be popped.
+	 */
+	auto close() -> void;
+
+	/**
+	 * Same as `close` but also drops queued chunks, for when either side gives
+	 * up early.
+	 */
+	auto cancel() -> void;
+
+	auto cancelled() -> bool;
+};
+} // namespace bzlreg
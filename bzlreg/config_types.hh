@@ -60,7 +60,7 @@ inline void from_json(const nlohmann::json& j, metadata_config& metadata) {
 struct source_config {
 	std::string                                  integrity;
 	std::string                                  strip_prefix;
-	int                                          patch_strip;
+	int                                          patch_strip = 0;
 	std::unordered_map<std::string, std::string> patches;
 	std::unordered_map<std::string, std::string> overlay;
 	std::string                                  url;
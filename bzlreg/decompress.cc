@@ -1,50 +1,1106 @@
 #include "bzlreg/decompress.hh"
 
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <optional>
+#include <utility>
 #include "libdeflate.h"
+#include "zlib.h"
+#include "zstd.h"
+#include "lzma.h"
+#include "bzlreg/deflate.hh"
 #include "bzlreg/defer.hh"
 #include "bzlreg/unused.hh"
 
 using bzlreg::util::defer;
 
+constexpr auto GZIP_MAGIC_0 = std::byte{0x1f};
+constexpr auto GZIP_MAGIC_1 = std::byte{0x8b};
+constexpr auto GZIP_TRAILER_SIZE = std::size_t{8};
+
+/**
+ * "PK\x03\x04" starts the first local file header and "PK\x05\x06" the end of
+ * central directory record of an empty archive.
+ */
+constexpr auto ZIP_MAGIC_0 = std::byte{'P'};
+constexpr auto ZIP_MAGIC_1 = std::byte{'K'};
+constexpr auto ZIP_LOCAL_HEADER_MAGIC = std::array{std::byte{3}, std::byte{4}};
+constexpr auto ZIP_EMPTY_ARCHIVE_MAGIC = std::array{std::byte{5}, std::byte{6}};
+
+/**
+ * Frames may also be skippable frames with a magic of 0x184D2A5? which
+ * usually carry metadata like the frame index written by pzstd.
+ * SEE: https://www.rfc-editor.org/rfc/rfc8878#section-3.1
+ */
+constexpr auto ZSTD_FRAME_MAGIC = std::uint32_t{0xfd2fb528};
+constexpr auto ZSTD_SKIPPABLE_FRAME_MAGIC = std::uint32_t{0x184d2a50};
+constexpr auto ZSTD_SKIPPABLE_FRAME_MAGIC_MASK = std::uint32_t{0xfffffff0};
+
+// SEE: https://tukaani.org/xz/xz-file-format.txt
+constexpr auto XZ_MAGIC =
+	std::array<std::uint8_t, 6>{0xfd, '7', 'z', 'X', 'Z', 0x00};
+
+static_assert(bzlreg::ARCHIVE_MAGIC_MAX_SIZE == XZ_MAGIC.size());
+
+/**
+ * Compressed bytes of gzip data each worker looks for a deflate block in and
+ * inflates from there on
+ */
+constexpr auto PARALLEL_GZIP_CHUNK_SIZE = std::size_t{1024 * 1024};
+
+/**
+ * Output buffers of a speculatively inflated gzip chunk may grow up to this
+ * size. Larger chunks are inflated on the calling thread and streamed instead.
+ */
+constexpr auto PARALLEL_GZIP_MAX_CHUNK_OUTPUT_SIZE =
+	std::size_t{32 * 1024 * 1024};
+
+/**
+ * zstd frames whose content size is larger than this are streamed
+ */
+constexpr auto PARALLEL_MAX_FRAME_SIZE = std::size_t{64 * 1024 * 1024};
+
+/**
+ * Upper bound of decompressed bytes decoded ahead of the sink, regardless of
+ * the thread count
+ */
+constexpr auto PARALLEL_MAX_IN_FLIGHT_SIZE = std::size_t{1024 * 1024 * 1024};
+
+/**
+ * zstd frames decoded per thread before results are handed to the sink in
+ * order
+ */
+constexpr auto PARALLEL_FRAMES_PER_THREAD = std::size_t{2};
+constexpr auto DECOMPRESS_STREAM_CHUNK_SIZE = std::size_t{256 * 1024};
+constexpr auto DECOMPRESS_STREAM_MAX_INPUT_SIZE = std::size_t{1024 * 1024};
+
+auto bzlreg::detect_archive_format( //
+	std::span<const std::byte> data
+) noexcept -> archive_format {
+	if(data.size() >= 2 && data[0] == GZIP_MAGIC_0 && data[1] == GZIP_MAGIC_1) {
+		return archive_format::tar_gzip;
+	}
+
+	if(data.size() >= 4) {
+		auto magic = std::uint32_t{};
+		for(auto i = 0; i < 4; ++i) {
+			magic |= std::to_integer<std::uint32_t>(data[i]) << (i * 8);
+		}
+
+		if(
+			magic == ZSTD_FRAME_MAGIC ||
+			(magic & ZSTD_SKIPPABLE_FRAME_MAGIC_MASK) == ZSTD_SKIPPABLE_FRAME_MAGIC
+		) {
+			return archive_format::tar_zstd;
+		}
+	}
+
+	if(
+		data.size() >= XZ_MAGIC.size() &&
+		std::ranges::equal(
+			data.first(XZ_MAGIC.size()),
+			XZ_MAGIC,
+			{},
+			std::to_integer<std::uint8_t>
+		)
+	) {
+		return archive_format::tar_xz;
+	}
+
+	if(data.size() >= 4 && data[0] == ZIP_MAGIC_0 && data[1] == ZIP_MAGIC_1) {
+		auto magic = data.subspan(2, 2);
+		if(
+			std::ranges::equal(magic, ZIP_LOCAL_HEADER_MAGIC) ||
+			std::ranges::equal(magic, ZIP_EMPTY_ARCHIVE_MAGIC)
+		) {
+			return archive_format::zip;
+		}
+	}
+
+	return archive_format::unknown;
+}
+
+namespace {
+/**
+ * One codec behind `decompress_stream`
+ */
+class archive_decoder {
+public:
+	virtual ~archive_decoder() = default;
+
+	virtual auto write( //
+		std::span<const std::byte>     compressed_data,
+		const bzlreg::decompress_sink& sink
+	) -> bzlreg::decompress_status = 0;
+
+	/**
+	 * Called once all input has been written. Flushes output multi-threaded
+	 * decoders may still be holding on to.
+	 */
+	virtual auto finish( //
+		const bzlreg::decompress_sink& sink
+	) -> bzlreg::decompress_status {
+		return bzlreg::decompress_status::ok;
+	}
+
+	virtual auto finished() const noexcept -> bool = 0;
+};
+
+class gzip_decoder final : public archive_decoder {
+	z_stream               _strm = {};
+	bool                   _initialized = false;
+	bool                   _member_finished = false;
+	bool                   _ignore_trailing = false;
+	std::vector<std::byte> _out_buffer;
+
+public:
+	gzip_decoder() : _out_buffer(DECOMPRESS_STREAM_CHUNK_SIZE) {
+		// 16 + MAX_WBITS only accepts the gzip wrapper
+		_initialized = inflateInit2(&_strm, 16 + MAX_WBITS) == Z_OK;
+	}
+
+	~gzip_decoder() {
+		if(_initialized) {
+			inflateEnd(&_strm);
+		}
+	}
+
+	auto write( //
+		std::span<const std::byte>     compressed_data,
+		const bzlreg::decompress_sink& sink
+	) -> bzlreg::decompress_status override {
+		if(!_initialized) {
+			return bzlreg::decompress_status::error;
+		}
+
+		if(_ignore_trailing) {
+			return bzlreg::decompress_status::ok;
+		}
+
+		while(!compressed_data.empty()) {
+			// avail_in is only 32 bits wide
+			auto input = compressed_data.first(
+				std::min(compressed_data.size(), DECOMPRESS_STREAM_MAX_INPUT_SIZE)
+			);
+			compressed_data = compressed_data.subspan(input.size());
+
+			_strm.next_in = reinterpret_cast<Bytef*>( //
+				const_cast<std::byte*>(input.data())
+			);
+			_strm.avail_in = static_cast<uInt>(input.size());
+
+			auto output_full = false;
+			while(_strm.avail_in > 0 || output_full) {
+				if(_member_finished) {
+					if(*_strm.next_in != std::to_integer<Bytef>(GZIP_MAGIC_0)) {
+						_ignore_trailing = true;
+						return bzlreg::decompress_status::ok;
+					}
+
+					inflateReset(&_strm);
+					_member_finished = false;
+				}
+
+				_strm.next_out = reinterpret_cast<Bytef*>(_out_buffer.data());
+				_strm.avail_out = static_cast<uInt>(_out_buffer.size());
+
+				auto inflate_result = inflate(&_strm, Z_NO_FLUSH);
+				auto produced_size = _out_buffer.size() - _strm.avail_out;
+				output_full = _strm.avail_out == 0;
+
+				if(produced_size > 0) {
+					auto produced = std::span{_out_buffer}.first(produced_size);
+					if(!sink(produced)) {
+						return bzlreg::decompress_status::stopped;
+					}
+				}
+
+				if(inflate_result == Z_STREAM_END) {
+					_member_finished = true;
+					output_full = false;
+					continue;
+				}
+
+				if(inflate_result == Z_BUF_ERROR) {
+					// No progress possible without more input
+					break;
+				}
+
+				if(inflate_result != Z_OK) {
+					return bzlreg::decompress_status::error;
+				}
+			}
+		}
+
+		return bzlreg::decompress_status::ok;
+	}
+
+	auto finished() const noexcept -> bool override {
+		return _member_finished;
+	}
+};
+
+class zstd_decoder final : public archive_decoder {
+	ZSTD_DStream*          _dstream;
+	bool                   _frame_finished = false;
+	std::vector<std::byte> _out_buffer;
+
+public:
+	zstd_decoder()
+		: _dstream(ZSTD_createDStream())
+		, _out_buffer(DECOMPRESS_STREAM_CHUNK_SIZE) {
+	}
+
+	~zstd_decoder() {
+		ZSTD_freeDStream(_dstream);
+	}
+
+	auto write( //
+		std::span<const std::byte>     compressed_data,
+		const bzlreg::decompress_sink& sink
+	) -> bzlreg::decompress_status override {
+		if(_dstream == nullptr) {
+			return bzlreg::decompress_status::error;
+		}
+
+		auto input = ZSTD_inBuffer{
+			.src = compressed_data.data(),
+			.size = compressed_data.size(),
+			.pos = 0,
+		};
+
+		// Consecutive frames are decoded back to back by the same stream
+		auto output_full = false;
+		while(input.pos < input.size || output_full) {
+			auto output = ZSTD_outBuffer{
+				.dst = _out_buffer.data(),
+				.size = _out_buffer.size(),
+				.pos = 0,
+			};
+
+			auto input_pos = input.pos;
+			auto result = ZSTD_decompressStream(_dstream, &output, &input);
+			if(ZSTD_isError(result)) {
+				return bzlreg::decompress_status::error;
+			}
+
+			// Draining a full output buffer after the last frame ended asks for
+			// the next frame's header without starting one
+			output_full = output.pos == output.size;
+			if(result == 0) {
+				_frame_finished = true;
+			} else if(input.pos != input_pos || output.pos > 0) {
+				_frame_finished = false;
+			}
+
+			if(output.pos > 0) {
+				auto produced = std::span{_out_buffer}.first(output.pos);
+				if(!sink(produced)) {
+					return bzlreg::decompress_status::stopped;
+				}
+			}
+		}
+
+		return bzlreg::decompress_status::ok;
+	}
+
+	auto finished() const noexcept -> bool override {
+		return _frame_finished;
+	}
+};
+
+class xz_decoder final : public archive_decoder {
+	lzma_stream            _strm = LZMA_STREAM_INIT;
+	unsigned               _thread_count;
+	bool                   _initialized = false;
+	bool                   _stream_finished = false;
+	bool                   _ignore_trailing = false;
+	std::vector<std::byte> _out_buffer;
+
+	auto init() -> bool {
+		if(_thread_count <= 1) {
+			return lzma_stream_decoder(&_strm, UINT64_MAX, 0) == LZMA_OK;
+		}
+
+		// Threads only help with streams whose block headers store their sizes
+		// (e.g. `xz -T0`). liblzma decodes anything else on one thread.
+		auto mt = lzma_mt{};
+		mt.threads = _thread_count;
+		mt.memlimit_threading = std::min<std::uint64_t>(
+			lzma_physmem() / 4,
+			PARALLEL_MAX_IN_FLIGHT_SIZE
+		);
+		mt.memlimit_stop = UINT64_MAX;
+		return lzma_stream_decoder_mt(&_strm, &mt) == LZMA_OK;
+	}
+
+	auto code( //
+		lzma_action                    action,
+		const bzlreg::decompress_sink& sink
+	) -> bzlreg::decompress_status {
+		auto output_full = false;
+		while(_strm.avail_in > 0 || output_full || action == LZMA_FINISH) {
+			if(_stream_finished) {
+				// Streams may be followed by padding and more streams
+				while(_strm.avail_in > 0 && *_strm.next_in == 0) {
+					++_strm.next_in;
+					--_strm.avail_in;
+				}
+
+				if(_strm.avail_in == 0) {
+					break;
+				}
+
+				if(*_strm.next_in != XZ_MAGIC[0]) {
+					_ignore_trailing = true;
+					break;
+				}
+
+				_stream_finished = false;
+				if(!init()) {
+					return bzlreg::decompress_status::error;
+				}
+			}
+
+			_strm.next_out = reinterpret_cast<std::uint8_t*>(_out_buffer.data());
+			_strm.avail_out = _out_buffer.size();
+
+			auto result = lzma_code(&_strm, action);
+			auto produced_size = _out_buffer.size() - _strm.avail_out;
+			output_full = _strm.avail_out == 0;
+
+			if(produced_size > 0) {
+				auto produced = std::span{_out_buffer}.first(produced_size);
+				if(!sink(produced)) {
+					return bzlreg::decompress_status::stopped;
+				}
+			}
+
+			if(result == LZMA_STREAM_END) {
+				_stream_finished = true;
+				output_full = false;
+				if(action == LZMA_FINISH && _strm.avail_in == 0) {
+					break;
+				}
+				continue;
+			}
+
+			if(result == LZMA_BUF_ERROR) {
+				if(action == LZMA_FINISH) {
+					return bzlreg::decompress_status::error;
+				}
+				break;
+			}
+
+			if(result != LZMA_OK) {
+				return bzlreg::decompress_status::error;
+			}
+		}
+
+		return bzlreg::decompress_status::ok;
+	}
+
+public:
+	xz_decoder(unsigned thread_count = 1)
+		: _thread_count(thread_count), _out_buffer(DECOMPRESS_STREAM_CHUNK_SIZE) {
+		_initialized = init();
+	}
+
+	~xz_decoder() {
+		lzma_end(&_strm);
+	}
+
+	auto write( //
+		std::span<const std::byte>     compressed_data,
+		const bzlreg::decompress_sink& sink
+	) -> bzlreg::decompress_status override {
+		if(!_initialized) {
+			return bzlreg::decompress_status::error;
+		}
+
+		if(_ignore_trailing) {
+			return bzlreg::decompress_status::ok;
+		}
+
+		_strm.next_in = reinterpret_cast<const std::uint8_t*>( //
+			compressed_data.data()
+		);
+		_strm.avail_in = compressed_data.size();
+
+		return code(LZMA_RUN, sink);
+	}
+
+	auto finish( //
+		const bzlreg::decompress_sink& sink
+	) -> bzlreg::decompress_status override {
+		if(!_initialized) {
+			return bzlreg::decompress_status::error;
+		}
+
+		if(_stream_finished || _ignore_trailing) {
+			return bzlreg::decompress_status::ok;
+		}
+
+		_strm.next_in = nullptr;
+		_strm.avail_in = 0;
+		return code(LZMA_FINISH, sink);
+	}
+
+	auto finished() const noexcept -> bool override {
+		return _stream_finished || _ignore_trailing;
+	}
+};
+
+auto make_decoder( //
+	bzlreg::archive_format format
+) -> std::unique_ptr<archive_decoder> {
+	switch(format) {
+		case bzlreg::archive_format::tar_gzip:
+			return std::make_unique<gzip_decoder>();
+		case bzlreg::archive_format::tar_zstd:
+			return std::make_unique<zstd_decoder>();
+		case bzlreg::archive_format::tar_xz:
+			return std::make_unique<xz_decoder>();
+		default:
+			return nullptr;
+	}
+}
+
+/**
+ * Writes all of `compressed_data` to `d` and checks it ended on a member or
+ * frame boundary
+ */
+auto decode_all(
+	archive_decoder&               d,
+	std::span<const std::byte>     compressed_data,
+	const bzlreg::decompress_sink& sink
+) -> bzlreg::decompress_status {
+	auto status = d.write(compressed_data, sink);
+	if(status == bzlreg::decompress_status::ok) {
+		status = d.finish(sink);
+	}
+
+	if(status != bzlreg::decompress_status::ok) {
+		return status;
+	}
+
+	if(!d.finished()) {
+		return bzlreg::decompress_status::error;
+	}
+
+	return bzlreg::decompress_status::ok;
+}
+} // namespace
+
+struct bzlreg::decompress_stream::impl {
+	std::unique_ptr<archive_decoder> decoder;
+
+	/**
+	 * Leading bytes buffered until there are enough to detect the format
+	 */
+	std::vector<std::byte> magic;
+};
+
+bzlreg::decompress_stream::decompress_stream()
+	: _impl(std::make_unique<impl>()) {
+}
+
+bzlreg::decompress_stream::decompress_stream(archive_format format)
+	: _impl(std::make_unique<impl>()) {
+	_impl->decoder = make_decoder(format);
+}
+
+bzlreg::decompress_stream::decompress_stream( //
+	decompress_stream&&
+) noexcept = default;
+
+bzlreg::decompress_stream::~decompress_stream() = default;
+
+auto bzlreg::decompress_stream::write( //
+	std::span<const std::byte> compressed_data,
+	const decompress_sink&     sink
+) -> decompress_status {
+	if(!_impl->decoder) {
+		auto magic_size = std::min(
+			compressed_data.size(),
+			ARCHIVE_MAGIC_MAX_SIZE - _impl->magic.size()
+		);
+		_impl->magic.insert(
+			_impl->magic.end(),
+			compressed_data.begin(),
+			compressed_data.begin() + magic_size
+		);
+		compressed_data = compressed_data.subspan(magic_size);
+
+		if(_impl->magic.size() < ARCHIVE_MAGIC_MAX_SIZE) {
+			return decompress_status::ok;
+		}
+
+		_impl->decoder = make_decoder(detect_archive_format(_impl->magic));
+		if(!_impl->decoder) {
+			return decompress_status::error;
+		}
+
+		auto status = _impl->decoder->write(_impl->magic, sink);
+		if(status != decompress_status::ok) {
+			return status;
+		}
+	}
+
+	return _impl->decoder->write(compressed_data, sink);
+}
+
+auto bzlreg::decompress_stream::finish( //
+	const decompress_sink& sink
+) -> decompress_status {
+	if(!_impl->decoder) {
+		return decompress_status::error;
+	}
+
+	return _impl->decoder->finish(sink);
+}
+
+auto bzlreg::decompress_stream::finished() const noexcept -> bool {
+	return _impl->decoder && _impl->decoder->finished();
+}
+
 auto bzlreg::decompress_archive( //
-	const std::vector<std::byte>& compressed_data
-) -> std::vector<std::byte> {
-	auto decomp = libdeflate_alloc_decompressor();
-	UNUSED(auto) = defer([&] { libdeflate_free_decompressor(decomp); });
-
-	auto decompressed_data = std::vector<std::byte>{};
-	auto actual_decompressed_size = size_t{};
-
-	auto guessed_decompressed_size = compressed_data.size() * 9;
-	decompressed_data.resize(guessed_decompressed_size);
-
-	auto decompress_result = libdeflate_gzip_decompress(
-		decomp,
-		compressed_data.data(),
-		compressed_data.size(),
-		decompressed_data.data(),
-		decompressed_data.size(),
-		&actual_decompressed_size
+	std::span<const std::byte> compressed_data,
+	const decompress_sink&     sink
+) -> decompress_status {
+	auto d = make_decoder(detect_archive_format(compressed_data));
+	if(!d) {
+		return decompress_status::error;
+	}
+
+	return decode_all(*d, compressed_data, sink);
+}
+
+namespace {
+/**
+ * Hands gzip output to the sink in order while checking the trailer of every
+ * member and keeping the window the next chunk may reference
+ */
+class gzip_member_output {
+	const bzlreg::decompress_sink& _sink;
+	std::uint32_t                  _crc32 = 0;
+	std::uint32_t                  _size = 0;
+	std::vector<std::byte>         _window;
+
+public:
+	gzip_member_output(const bzlreg::decompress_sink& sink) : _sink(sink) {
+	}
+
+	/**
+	 * @returns `false` if the sink asked to stop
+	 */
+	auto write(std::span<const std::byte> bytes) -> bool {
+		if(bytes.empty()) {
+			return true;
+		}
+
+		_crc32 = libdeflate_crc32(_crc32, bytes.data(), bytes.size());
+		_size += static_cast<std::uint32_t>(bytes.size());
+
+		auto tail =
+			bytes.last(std::min(bytes.size(), bzlreg::DEFLATE_WINDOW_SIZE));
+		auto keep = std::min(
+			_window.size(),
+			bzlreg::DEFLATE_WINDOW_SIZE - tail.size()
+		);
+		_window.erase(_window.begin(), _window.end() - keep);
+		_window.insert(_window.end(), tail.begin(), tail.end());
+
+		return _sink(bytes);
+	}
+
+	/**
+	 * @returns `false` if the member written doesn't match its trailer
+	 */
+	auto end_member(std::uint32_t crc32, std::uint32_t isize) -> bool {
+		auto valid = crc32 == _crc32 && isize == _size;
+		_crc32 = 0;
+		_size = 0;
+		_window.clear();
+		return valid;
+	}
+
+	auto window() const noexcept -> std::span<const std::byte> {
+		return _window;
+	}
+};
+
+struct gzip_position {
+	/**
+	 * Bit offset of the next block header
+	 */
+	std::size_t bit = 0;
+
+	/**
+	 * The last member ended and no other follows
+	 */
+	bool done = false;
+};
+} // namespace
+
+static auto read_u32_le(std::span<const std::byte> data) -> std::uint32_t {
+	auto value = std::uint32_t{};
+	for(auto i = 0; i < 4; ++i) {
+		value |= std::to_integer<std::uint32_t>(data[i]) << (i * 8);
+	}
+	return value;
+}
+
+/**
+ * Inflates from the block header at `position` up to the first block boundary
+ * at or after `target_bit` on the calling thread. zlib can start at any bit
+ * given the window, which makes this the fallback for chunks that couldn't be
+ * inflated speculatively.
+ */
+static auto inflate_gzip_until(
+	std::span<const std::byte> compressed_data,
+	gzip_position&             position,
+	std::size_t                target_bit,
+	gzip_member_output&        output
+) -> bzlreg::decompress_status {
+	auto strm = z_stream{};
+	if(inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+		return bzlreg::decompress_status::error;
+	}
+	UNUSED(auto) = defer([&] { inflateEnd(&strm); });
+
+	auto data_begin = reinterpret_cast<const Bytef*>(compressed_data.data());
+	auto data_end = data_begin + compressed_data.size();
+	auto start = [&](std::size_t bit) -> bool {
+		strm.next_in = const_cast<Bytef*>(data_begin + bit / 8);
+		if(bit % 8 != 0) {
+			auto bit_count = static_cast<int>(8 - bit % 8);
+			auto bits = *strm.next_in >> (bit % 8);
+			if(inflatePrime(&strm, bit_count, bits) != Z_OK) {
+				return false;
+			}
+			strm.next_in += 1;
+		}
+
+		auto window = output.window();
+		return window.empty() ||
+			inflateSetDictionary(
+				&strm,
+				reinterpret_cast<const Bytef*>(window.data()),
+				static_cast<uInt>(window.size())
+			) == Z_OK;
+	};
+
+	if(!start(position.bit)) {
+		return bzlreg::decompress_status::error;
+	}
+
+	auto out_buffer = std::vector<std::byte>(DECOMPRESS_STREAM_CHUNK_SIZE);
+	while(true) {
+		strm.avail_in = static_cast<uInt>(std::min<std::size_t>(
+			data_end - strm.next_in,
+			DECOMPRESS_STREAM_MAX_INPUT_SIZE
+		));
+		strm.next_out = reinterpret_cast<Bytef*>(out_buffer.data());
+		strm.avail_out = static_cast<uInt>(out_buffer.size());
+
+		auto inflate_result = inflate(&strm, Z_BLOCK);
+		auto produced_size = out_buffer.size() - strm.avail_out;
+		if(!output.write(std::span{out_buffer}.first(produced_size))) {
+			return bzlreg::decompress_status::stopped;
+		}
+
+		if(inflate_result == Z_STREAM_END) {
+			auto trailer_offset =
+				static_cast<std::size_t>(strm.next_in - data_begin);
+			if(trailer_offset + GZIP_TRAILER_SIZE > compressed_data.size()) {
+				return bzlreg::decompress_status::error;
+			}
+
+			auto trailer = compressed_data.subspan(trailer_offset);
+			auto crc32 = read_u32_le(trailer);
+			auto isize = read_u32_le(trailer.subspan(4));
+			if(!output.end_member(crc32, isize)) {
+				return bzlreg::decompress_status::error;
+			}
+
+			// Same as the single threaded path: trailing bytes that aren't
+			// another gzip member are ignored
+			auto next = trailer_offset + GZIP_TRAILER_SIZE;
+			if(
+				next == compressed_data.size() ||
+				compressed_data[next] != GZIP_MAGIC_0
+			) {
+				position = {.bit = next * 8, .done = true};
+				return bzlreg::decompress_status::ok;
+			}
+
+			auto data_offset =
+				bzlreg::gzip_member_data_offset(compressed_data, next);
+			if(!data_offset) {
+				return bzlreg::decompress_status::error;
+			}
+
+			position.bit = *data_offset * 8;
+			if(position.bit >= target_bit) {
+				return bzlreg::decompress_status::ok;
+			}
+
+			if(inflateReset(&strm) != Z_OK || !start(position.bit)) {
+				return bzlreg::decompress_status::error;
+			}
+			continue;
+		}
+
+		// Z_BUF_ERROR means no progress was possible with all the data left
+		if(inflate_result != Z_OK) {
+			return bzlreg::decompress_status::error;
+		}
+
+		// SEE: zlib's examples/zran.c
+		auto at_block_boundary =
+			(strm.data_type & 128) != 0 && (strm.data_type & 64) == 0;
+		if(at_block_boundary) {
+			position.bit = static_cast<std::size_t>(strm.next_in - data_begin) * 8 -
+				static_cast<std::size_t>(strm.data_type & 7);
+			if(position.bit >= target_bit) {
+				return bzlreg::decompress_status::ok;
+			}
+		}
+	}
+}
+
+static auto write_gzip_chunk(
+	const bzlreg::gzip_chunk& chunk,
+	gzip_member_output&       output
+) -> bzlreg::decompress_status {
+	auto marked = std::span{chunk.marked}.subspan(chunk.marked_begin);
+	auto resolved = std::vector<std::byte>(marked.size());
+	if(!bzlreg::resolve_deflate_markers(marked, output.window(), resolved)) {
+		return bzlreg::decompress_status::error;
+	}
+
+	// The chunk output is `resolved` followed by `data` and members may end
+	// anywhere in it
+	auto data = std::span{chunk.data}.subspan(chunk.data_begin);
+	auto offset = std::size_t{0};
+	auto write_until = [&](std::size_t end) -> bool {
+		while(offset < end) {
+			auto piece = offset < resolved.size()
+				? std::span{resolved}.subspan(
+						offset,
+						std::min(end, resolved.size()) - offset
+					)
+				: data.subspan(offset - resolved.size(), end - offset);
+			if(!output.write(piece)) {
+				return false;
+			}
+			offset += piece.size();
+		}
+		return true;
+	};
+
+	for(const auto& member_end : chunk.member_ends) {
+		if(!write_until(member_end.output_offset)) {
+			return bzlreg::decompress_status::stopped;
+		}
+		if(!output.end_member(member_end.crc32, member_end.isize)) {
+			return bzlreg::decompress_status::error;
+		}
+	}
+
+	if(!write_until(resolved.size() + data.size())) {
+		return bzlreg::decompress_status::stopped;
+	}
+
+	return bzlreg::decompress_status::ok;
+}
+
+/**
+ * The data is split into chunks of PARALLEL_GZIP_CHUNK_SIZE. Workers look for
+ * the first deflate block in their chunk and inflate from there to the first
+ * block boundary past it, with references to the unknown window before the
+ * block kept as markers. In order, each chunk is only used if it starts right
+ * where the previous one ended, which means the block found is an actual
+ * block and its output is exactly what inflating from the start produces.
+ * Gaps between chunks, and chunks that couldn't be inflated speculatively,
+ * are inflated with zlib from the known window. The CRC32 and size of every
+ * member are checked against their trailers.
+ */
+static auto decompress_gzip_parallel(
+	std::span<const std::byte>     compressed_data,
+	const bzlreg::decompress_sink& sink,
+	unsigned                       thread_count
+) -> bzlreg::decompress_status {
+	auto first_member = bzlreg::gzip_member_data_offset(compressed_data, 0);
+	auto chunk_count = (compressed_data.size() + PARALLEL_GZIP_CHUNK_SIZE - 1) /
+		PARALLEL_GZIP_CHUNK_SIZE;
+	if(thread_count <= 1 || chunk_count < 2 || !first_member) {
+		return bzlreg::decompress_archive(compressed_data, sink);
+	}
+
+	auto max_in_flight = std::max<std::size_t>(
+		PARALLEL_MAX_IN_FLIGHT_SIZE / PARALLEL_GZIP_MAX_CHUNK_OUTPUT_SIZE,
+		1
 	);
 
-	while(decompress_result == LIBDEFLATE_INSUFFICIENT_SPACE) {
-		guessed_decompressed_size += compressed_data.size();
-		decompressed_data.resize(guessed_decompressed_size);
-		decompress_result = libdeflate_gzip_decompress(
-			decomp,
-			compressed_data.data(),
-			compressed_data.size(),
-			decompressed_data.data(),
-			decompressed_data.size(),
-			&actual_decompressed_size
+	auto chunks = std::vector<std::optional<bzlreg::gzip_chunk>>(chunk_count);
+	auto ready = std::vector<bool>(chunk_count);
+	auto mutex = std::mutex{};
+	auto changed = std::condition_variable{};
+	auto next_chunk = std::size_t{0};
+	auto in_flight = std::size_t{0};
+	auto cancelled = false;
+
+	auto inflate_chunks = [&] {
+		while(true) {
+			auto index = std::size_t{};
+			{
+				auto lock = std::unique_lock{mutex};
+				changed.wait(lock, [&] {
+					return cancelled || next_chunk == chunk_count ||
+						in_flight < max_in_flight;
+				});
+				if(cancelled || next_chunk == chunk_count) {
+					return;
+				}
+				index = next_chunk++;
+				in_flight += 1;
+			}
+
+			auto begin = index * PARALLEL_GZIP_CHUNK_SIZE;
+			auto end =
+				std::min(begin + PARALLEL_GZIP_CHUNK_SIZE, compressed_data.size());
+			auto chunk = bzlreg::inflate_gzip_chunk(
+				compressed_data,
+				{
+					.start_bit = index == 0 ? *first_member * 8 : begin * 8,
+					.search = index != 0,
+					.stop_bit = end * 8,
+					.max_output_size = PARALLEL_GZIP_MAX_CHUNK_OUTPUT_SIZE,
+				}
+			);
+
+			{
+				auto lock = std::unique_lock{mutex};
+				chunks[index] = std::move(chunk);
+				ready[index] = true;
+			}
+			changed.notify_all();
+		}
+	};
+
+	auto output = gzip_member_output{sink};
+	auto position = gzip_position{.bit = *first_member * 8};
+	auto status = bzlreg::decompress_status::ok;
+	{
+		auto workers = std::vector<std::jthread>{};
+		UNUSED(auto) = defer([&] {
+			{
+				auto lock = std::unique_lock{mutex};
+				cancelled = true;
+			}
+			changed.notify_all();
+		});
+
+		auto worker_count =
+			std::min<std::size_t>({thread_count, max_in_flight, chunk_count});
+		for(auto i = std::size_t{0}; i < worker_count; ++i) {
+			workers.emplace_back(inflate_chunks);
+		}
+
+		for(auto index = std::size_t{0}; index < chunk_count; ++index) {
+			if(status != bzlreg::decompress_status::ok || position.done) {
+				break;
+			}
+
+			auto chunk = std::optional<bzlreg::gzip_chunk>{};
+			{
+				auto lock = std::unique_lock{mutex};
+				changed.wait(lock, [&] { return ready[index]; });
+				chunk = std::move(chunks[index]);
+				in_flight -= 1;
+			}
+			changed.notify_all();
+
+			if(!chunk || chunk->start_bit < position.bit) {
+				continue;
+			}
+
+			if(chunk->start_bit > position.bit) {
+				status = inflate_gzip_until(
+					compressed_data,
+					position,
+					chunk->start_bit,
+					output
+				);
+				if(
+					status != bzlreg::decompress_status::ok || position.done ||
+					position.bit != chunk->start_bit
+				) {
+					continue;
+				}
+			}
+
+			status = write_gzip_chunk(*chunk, output);
+			position = {.bit = chunk->end_bit, .done = chunk->last};
+		}
+	}
+
+	if(status == bzlreg::decompress_status::ok && !position.done) {
+		status = inflate_gzip_until(
+			compressed_data,
+			position,
+			compressed_data.size() * 8 + 1,
+			output
 		);
 	}
 
-	if(decompress_result != LIBDEFLATE_SUCCESS) {
-		return {};
+	return status;
+}
+
+struct zstd_frame {
+	std::span<const std::byte> compressed;
+
+	/**
+	 * 0 if the frame is streamed instead of decoded in parallel
+	 */
+	std::size_t            content_size = 0;
+	std::vector<std::byte> decompressed;
+	bool                   success = false;
+};
+
+/**
+ * zstd frames are independent and their boundaries can be found by walking
+ * block headers, so unlike gzip no speculation is needed. Frames are only
+ * decoded in parallel when their header stores the content size.
+ */
+static auto decompress_zstd_parallel(
+	std::span<const std::byte>     compressed_data,
+	const bzlreg::decompress_sink& sink,
+	unsigned                       thread_count
+) -> bzlreg::decompress_status {
+	auto frames = std::vector<zstd_frame>{};
+	for(auto remaining = compressed_data; !remaining.empty();) {
+		auto frame_size =
+			ZSTD_findFrameCompressedSize(remaining.data(), remaining.size());
+		if(ZSTD_isError(frame_size)) {
+			return bzlreg::decompress_status::error;
+		}
+
+		auto& frame = frames.emplace_back();
+		frame.compressed = remaining.first(frame_size);
+		remaining = remaining.subspan(frame_size);
+
+		auto content_size =
+			ZSTD_getFrameContentSize(frame.compressed.data(), frame_size);
+		if(
+			content_size != ZSTD_CONTENTSIZE_UNKNOWN &&
+			content_size != ZSTD_CONTENTSIZE_ERROR &&
+			content_size <= PARALLEL_MAX_FRAME_SIZE
+		) {
+			frame.content_size = static_cast<std::size_t>(content_size);
+		}
+	}
+
+	if(thread_count <= 1 || frames.size() < 2) {
+		return bzlreg::decompress_archive(compressed_data, sink);
 	}
 
-	decompressed_data.resize(actual_decompressed_size);
+	auto max_batch_size = thread_count * PARALLEL_FRAMES_PER_THREAD;
+	for(auto first = std::size_t{0}; first < frames.size();) {
+		// Batches are cut short once their output would exceed the in flight
+		// limit
+		auto batch_end = first;
+		auto batch_bytes = std::size_t{0};
+		while(
+			batch_end < frames.size() && batch_end - first < max_batch_size &&
+			(batch_end == first ||
+			 batch_bytes + frames[batch_end].content_size <=
+				 PARALLEL_MAX_IN_FLIGHT_SIZE)
+		) {
+			batch_bytes += frames[batch_end].content_size;
+			batch_end += 1;
+		}
+
+		auto batch = std::span{frames}.subspan(first, batch_end - first);
+		first = batch_end;
+
+		auto next_batch_index = std::atomic_size_t{0};
+		auto decode_batch = [&] {
+			auto dctx = ZSTD_createDCtx();
+			UNUSED(auto) = defer([&] { ZSTD_freeDCtx(dctx); });
+
+			for(auto i = next_batch_index++; i < batch.size();
+					i = next_batch_index++) {
+				auto& frame = batch[i];
+				if(frame.content_size == 0) {
+					continue;
+				}
+
+				frame.decompressed.resize(frame.content_size);
+				auto result = ZSTD_decompressDCtx(
+					dctx,
+					frame.decompressed.data(),
+					frame.decompressed.size(),
+					frame.compressed.data(),
+					frame.compressed.size()
+				);
+				frame.success =
+					!ZSTD_isError(result) && result == frame.content_size;
+			}
+		};
+
+		{
+			auto workers = std::vector<std::jthread>{};
+			auto worker_count = std::min<std::size_t>(thread_count, batch.size());
+			for(auto i = std::size_t{1}; i < worker_count; ++i) {
+				workers.emplace_back(decode_batch);
+			}
+			decode_batch();
+		}
 
-	return decompressed_data;
+		for(auto& frame : batch) {
+			auto decompressed = std::exchange(frame.decompressed, {});
+			if(!frame.success) {
+				// Too large or missing a content size so stream it instead
+				auto status = bzlreg::decompress_archive(frame.compressed, sink);
+				if(status != bzlreg::decompress_status::ok) {
+					return status;
+				}
+				continue;
+			}
+
+			if(!decompressed.empty() && !sink(decompressed)) {
+				return bzlreg::decompress_status::stopped;
+			}
+		}
+	}
+
+	return bzlreg::decompress_status::ok;
+}
+
+auto bzlreg::decompress_archive_parallel( //
+	std::span<const std::byte> compressed_data,
+	const decompress_sink&     sink,
+	unsigned                   thread_count
+) -> decompress_status {
+	switch(detect_archive_format(compressed_data)) {
+		case archive_format::tar_gzip:
+			return decompress_gzip_parallel(compressed_data, sink, thread_count);
+		case archive_format::tar_zstd:
+			return decompress_zstd_parallel(compressed_data, sink, thread_count);
+		case archive_format::tar_xz: {
+			auto d = xz_decoder{thread_count};
+			return decode_all(d, compressed_data, sink);
+		}
+		default:
+			return decompress_status::error;
+	}
 }
@@ -2,9 +2,128 @@
 
 #include <vector>
 #include <cstddef>
+#include <span>
+#include <memory>
+#include <functional>
 
 namespace bzlreg {
+enum class archive_format {
+	unknown,
+
+	/**
+	 * gzip compressed tar
+	 */
+	tar_gzip,
+
+	/**
+	 * zstd compressed tar
+	 */
+	tar_zstd,
+
+	/**
+	 * xz compressed tar
+	 */
+	tar_xz,
+
+	zip,
+};
+
+/**
+ * Enough leading bytes to tell every supported format apart
+ */
+constexpr auto ARCHIVE_MAGIC_MAX_SIZE = std::size_t{6};
+
+/**
+ * Detects the archive format from its leading magic bytes
+ */
+auto detect_archive_format( //
+	std::span<const std::byte> data
+) noexcept -> archive_format;
+
+/**
+ * Receives decompressed bytes as they are produced. Return `false` to stop
+ * decompressing.
+ */
+using decompress_sink = std::function<bool(std::span<const std::byte>)>;
+
+enum class decompress_status {
+	/**
+	 * All written input was consumed
+	 */
+	ok,
+
+	/**
+	 * The sink returned `false`
+	 */
+	stopped,
+
+	/**
+	 * Input is not valid compressed data
+	 */
+	error,
+};
+
+/**
+ * Incremental gzip, zstd or xz decompressor. Compressed bytes may be written
+ * in chunks of any size and decompressed bytes are handed to the sink in fixed
+ * size chunks so the decompressed archive is never held in memory all at once.
+ */
+class decompress_stream {
+	struct impl;
+	std::unique_ptr<impl> _impl;
+
+public:
+	/**
+	 * Detects the format from the magic bytes of the first write(s)
+	 */
+	decompress_stream();
+	decompress_stream(archive_format format);
+	decompress_stream(decompress_stream&&) noexcept;
+	~decompress_stream();
+
+	auto write( //
+		std::span<const std::byte> compressed_data,
+		const decompress_sink&     sink
+	) -> decompress_status;
+
+	/**
+	 * Call after the last `write` to flush anything the decoder held back
+	 * waiting for more input.
+	 */
+	auto finish(const decompress_sink& sink) -> decompress_status;
+
+	/**
+	 * `true` once the end of a gzip member, zstd frame or xz stream has been
+	 * reached and no partial one is pending.
+	 */
+	auto finished() const noexcept -> bool;
+};
+
+/**
+ * Streams all of `compressed_data` through a decoder picked by its magic
+ * bytes. Truncated input or an unsupported format is reported as
+ * `decompress_status::error`.
+ */
 auto decompress_archive( //
-	const std::vector<std::byte>& data
-) -> std::vector<std::byte>;
-}
\ No newline at end of file
+	std::span<const std::byte> compressed_data,
+	const decompress_sink&     sink
+) -> decompress_status;
+
+/**
+ * Same as `decompress_archive` but decodes on up to `thread_count` threads
+ * where the format allows it:
+ *  - gzip data is split into chunks whose first deflate block is found by
+ *    searching every bit offset. Chunks are inflated speculatively without
+ *    the window before them and only kept if they chain together from the
+ *    start of the data, so output is byte-identical to the single threaded
+ *    path. Everything else is inflated on the calling thread.
+ *  - zstd frames are decoded in parallel when their size is known.
+ *  - xz blocks are decoded by liblzma's threaded decoder.
+ * Output decoded ahead of the sink is bounded regardless of `thread_count`.
+ */
+auto decompress_archive_parallel( //
+	std::span<const std::byte> compressed_data,
+	const decompress_sink&     sink,
+	unsigned                   thread_count
+) -> decompress_status;
+} // namespace bzlreg
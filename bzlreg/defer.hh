@@ -1,17 +1,18 @@
 #pragma once
 
 #include <concepts>
+#include <type_traits>
 
 namespace bzlreg::util {
 auto defer(std::invocable auto&& fn) {
 	struct defer_result_t {
-		decltype(fn) _cleanup_fn;
+		std::remove_cvref_t<decltype(fn)> _cleanup_fn;
 
 		~defer_result_t() {
 			_cleanup_fn();
 		}
 	};
 
-	return defer_result_t{std::move(fn)};
+	return defer_result_t{std::forward<decltype(fn)>(fn)};
 }
 } // namespace bzlreg::util
@@ -0,0 +1,894 @@
+#include "bzlreg/deflate.hh"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstring>
+#include <memory>
+
+constexpr auto GZIP_MAGIC_0 = std::byte{0x1f};
+constexpr auto GZIP_MAGIC_1 = std::byte{0x8b};
+constexpr auto GZIP_METHOD_DEFLATE = std::byte{0x08};
+constexpr auto GZIP_FLAG_HCRC = std::byte{0x02};
+constexpr auto GZIP_FLAG_EXTRA = std::byte{0x04};
+constexpr auto GZIP_FLAG_NAME = std::byte{0x08};
+constexpr auto GZIP_FLAG_COMMENT = std::byte{0x10};
+constexpr auto GZIP_FLAGS_RESERVED_MASK = std::byte{0xe0};
+constexpr auto GZIP_HEADER_SIZE = std::size_t{10};
+constexpr auto GZIP_TRAILER_SIZE = std::size_t{8};
+
+// SEE: https://www.rfc-editor.org/rfc/rfc1951#section-3.2.3
+constexpr auto BLOCK_TYPE_STORED = 0u;
+constexpr auto BLOCK_TYPE_FIXED = 1u;
+constexpr auto BLOCK_TYPE_DYNAMIC = 2u;
+
+constexpr auto END_OF_BLOCK = 256;
+constexpr auto MAX_MATCH_LENGTH = std::size_t{258};
+constexpr auto MAX_LITERAL_LENGTH_CODES = 286u;
+constexpr auto MAX_DISTANCE_CODES = 30u;
+constexpr auto FIXED_LITERAL_LENGTH_CODES = std::size_t{288};
+constexpr auto FIXED_DISTANCE_CODES = std::size_t{32};
+
+constexpr auto LENGTH_BASE = std::array<std::uint16_t, 29>{
+	3,  4,  5,  6,  7,  8,  9,  10, 11,  13,  15,  17,  19,  23, 27,
+	31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258,
+};
+constexpr auto LENGTH_EXTRA_BITS = std::array<std::uint8_t, 29>{
+	0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2,
+	2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0,
+};
+constexpr auto DISTANCE_BASE = std::array<std::uint16_t, 30>{
+	1,    2,    3,    4,    5,    7,     9,     13,    17,  25,
+	33,   49,   65,   97,   129,  193,   257,   385,   513, 769,
+	1025, 1537, 2049, 3073, 4097, 6145,  8193,  12289, 16385, 24577,
+};
+constexpr auto DISTANCE_EXTRA_BITS = std::array<std::uint8_t, 30>{
+	0, 0, 0, 0, 1, 1, 2, 2,  3,  3,  4,  4,  5,  5,  6,
+	6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13,
+};
+
+/**
+ * Order code lengths of the code length alphabet are stored in
+ */
+constexpr auto CODE_LENGTH_ORDER = std::array<std::uint8_t, 19>{
+	16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15,
+};
+constexpr auto CODE_LENGTH_MAX_BITS = 7u;
+
+constexpr auto HUFFMAN_MAX_BITS = 15u;
+
+/**
+ * Codes up to this length are decoded with a single lookup, longer ones with
+ * a second lookup in a subtable
+ */
+constexpr auto HUFFMAN_TABLE_BITS = 10u;
+constexpr auto HUFFMAN_SUBTABLE_BITS = HUFFMAN_MAX_BITS - HUFFMAN_TABLE_BITS;
+
+/**
+ * Every symbol longer than HUFFMAN_TABLE_BITS needs at most one subtable
+ */
+constexpr auto HUFFMAN_TABLE_SIZE = (std::size_t{1} << HUFFMAN_TABLE_BITS) +
+	FIXED_LITERAL_LENGTH_CODES * (std::size_t{1} << HUFFMAN_SUBTABLE_BITS);
+
+/**
+ * Table entries hold the code length in their low bits and the symbol, or
+ * the offset of a subtable, above HUFFMAN_ENTRY_VALUE_SHIFT. A code length of
+ * 0 marks a code that isn't part of an incomplete code.
+ */
+constexpr auto HUFFMAN_ENTRY_LENGTH_MASK = std::uint32_t{0x0f};
+constexpr auto HUFFMAN_ENTRY_SUBTABLE = std::uint32_t{0x10};
+constexpr auto HUFFMAN_ENTRY_VALUE_SHIFT = 8u;
+
+/**
+ * Output buffers keep this many elements past their size so matches can be
+ * copied in whole words
+ */
+constexpr auto COPY_SLACK = std::size_t{8};
+
+/**
+ * Minimum number of bits buffered after `bit_reader::refill`. Enough for a
+ * length and a distance code with their extra bits.
+ */
+constexpr auto BIT_READER_MIN_BITS = 56u;
+
+static_assert(BIT_READER_MIN_BITS >= 2 * HUFFMAN_MAX_BITS + 5 + 13);
+
+namespace {
+/**
+ * Reads deflate's LSB first bit stream. Past the end of the data zeros are
+ * read which `overrun` reports once they were consumed.
+ */
+class bit_reader {
+	std::span<const std::byte> _data;
+	std::size_t                _next = 0;
+	std::uint64_t              _bits = 0;
+	unsigned                   _count = 0;
+	bool                       _overrun = false;
+
+public:
+	bit_reader(std::span<const std::byte> data) : _data(data) {
+	}
+
+	auto seek(std::size_t bit_offset) noexcept -> void {
+		_next = bit_offset / 8;
+		_bits = 0;
+		_count = 0;
+		_overrun = false;
+		refill();
+		consume(bit_offset % 8);
+	}
+
+	auto refill() noexcept -> void {
+		if(_next + sizeof(std::uint64_t) <= _data.size()) {
+			auto word = std::uint64_t{};
+			std::memcpy(&word, _data.data() + _next, sizeof(word));
+			if constexpr(std::endian::native == std::endian::big) {
+				word = std::byteswap(word);
+			}
+
+			// Bits past the whole bytes taken are the same bits the next refill
+			// loads again so they may stay in the buffer
+			auto byte_count = (63 - _count) / 8;
+			_bits |= word << _count;
+			_next += byte_count;
+			_count += byte_count * 8;
+			return;
+		}
+
+		_overrun = position() > _data.size() * 8;
+		while(_count <= BIT_READER_MIN_BITS) {
+			auto byte = _next < _data.size() //
+				? std::to_integer<std::uint64_t>(_data[_next])
+				: std::uint64_t{0};
+			_bits |= byte << _count;
+			_next += 1;
+			_count += 8;
+		}
+	}
+
+	auto bits() const noexcept -> std::uint64_t {
+		return _bits;
+	}
+
+	auto peek(unsigned count) const noexcept -> std::uint32_t {
+		auto mask = (std::uint64_t{1} << count) - 1;
+		return static_cast<std::uint32_t>(_bits & mask);
+	}
+
+	auto consume(unsigned count) noexcept -> void {
+		_bits >>= count;
+		_count -= count;
+	}
+
+	auto read(unsigned count) noexcept -> std::uint32_t {
+		auto value = peek(count);
+		consume(count);
+		return value;
+	}
+
+	auto align() noexcept -> void {
+		consume(_count % 8);
+	}
+
+	auto position() const noexcept -> std::size_t {
+		return _next * 8 - _count;
+	}
+
+	auto overrun() const noexcept -> bool {
+		return _overrun;
+	}
+
+	auto past_end() const noexcept -> bool {
+		return position() > _data.size() * 8;
+	}
+};
+
+class huffman_table {
+	std::array<std::uint32_t, HUFFMAN_TABLE_SIZE> _entries;
+	unsigned                                      _table_bits = 0;
+
+public:
+	/**
+	 * Builds the canonical code of `lengths`. Like zlib an incomplete code is
+	 * only accepted if `allow_incomplete` and it has a single code.
+	 */
+	auto build( //
+		std::span<const std::uint8_t> lengths,
+		unsigned                      table_bits,
+		bool                          allow_incomplete
+	) noexcept -> bool {
+		auto counts = std::array<std::uint16_t, HUFFMAN_MAX_BITS + 1>{};
+		for(auto length : lengths) {
+			counts[length] += 1;
+		}
+		counts[0] = 0;
+
+		auto left = 1;
+		auto max_length = 0u;
+		for(auto length = 1u; length <= HUFFMAN_MAX_BITS; ++length) {
+			left = left * 2 - counts[length];
+			if(left < 0) {
+				return false;
+			}
+			if(counts[length] > 0) {
+				max_length = length;
+			}
+		}
+
+		if(max_length > table_bits && table_bits != HUFFMAN_TABLE_BITS) {
+			return false;
+		}
+
+		if(left > 0 && max_length != 0 && !(allow_incomplete && max_length == 1)) {
+			return false;
+		}
+
+		_table_bits = table_bits;
+		auto table_size = std::uint32_t{1} << table_bits;
+		std::fill_n(_entries.begin(), table_size, 0);
+
+		auto next_code = std::array<std::uint32_t, HUFFMAN_MAX_BITS + 1>{};
+		auto code = std::uint32_t{0};
+		for(auto length = 1u; length <= HUFFMAN_MAX_BITS; ++length) {
+			code = (code + counts[length - 1]) << 1;
+			next_code[length] = code;
+		}
+
+		auto subtable_size = std::uint32_t{1} << HUFFMAN_SUBTABLE_BITS;
+		auto end = table_size;
+		for(auto symbol = std::uint32_t{0}; symbol < lengths.size(); ++symbol) {
+			auto length = std::uint32_t{lengths[symbol]};
+			if(length == 0) {
+				continue;
+			}
+
+			// Codes are stored most significant bit first but read least
+			// significant bit first
+			auto reversed = std::uint32_t{0};
+			for(auto c = next_code[length]++, i = 0u; i < length; ++i, c >>= 1) {
+				reversed = (reversed << 1) | (c & 1);
+			}
+
+			auto entry = (symbol << HUFFMAN_ENTRY_VALUE_SHIFT) | length;
+			if(length <= table_bits) {
+				for(auto i = reversed; i < table_size; i += 1u << length) {
+					_entries[i] = entry;
+				}
+				continue;
+			}
+
+			auto& primary = _entries[reversed & (table_size - 1)];
+			if((primary & HUFFMAN_ENTRY_SUBTABLE) == 0) {
+				std::fill_n(_entries.begin() + end, subtable_size, 0);
+				primary = (end << HUFFMAN_ENTRY_VALUE_SHIFT) | HUFFMAN_ENTRY_SUBTABLE;
+				end += subtable_size;
+			}
+
+			auto subtable = primary >> HUFFMAN_ENTRY_VALUE_SHIFT;
+			auto step = 1u << (length - table_bits);
+			for(auto i = reversed >> table_bits; i < subtable_size; i += step) {
+				_entries[subtable + i] = entry;
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	 * Decodes one symbol from at least HUFFMAN_MAX_BITS buffered bits
+	 * @returns the symbol or -1 for a code that isn't part of the table
+	 */
+	auto decode(bit_reader& reader) const noexcept -> int {
+		auto bits = reader.bits();
+		auto entry = _entries[bits & ((std::uint64_t{1} << _table_bits) - 1)];
+		if((entry & HUFFMAN_ENTRY_SUBTABLE) != 0) {
+			auto index = (bits >> _table_bits) &
+				((std::uint64_t{1} << HUFFMAN_SUBTABLE_BITS) - 1);
+			entry = _entries[(entry >> HUFFMAN_ENTRY_VALUE_SHIFT) + index];
+		}
+
+		auto length = entry & HUFFMAN_ENTRY_LENGTH_MASK;
+		if(length == 0) {
+			return -1;
+		}
+
+		reader.consume(length);
+		return static_cast<int>(entry >> HUFFMAN_ENTRY_VALUE_SHIFT);
+	}
+};
+
+enum class block_status {
+	ok,
+	error,
+	too_large,
+};
+
+/**
+ * Copies a match that may overlap its own output. Up to COPY_SLACK elements
+ * past `length` may be written.
+ */
+template<typename T>
+auto copy_match(T* out, std::size_t distance, std::size_t length) -> void {
+	constexpr auto WORD_ELEMENTS = sizeof(std::uint64_t) / sizeof(T);
+	static_assert(WORD_ELEMENTS <= COPY_SLACK);
+
+	auto src = out - distance;
+	if(distance < WORD_ELEMENTS) {
+		for(auto i = std::size_t{0}; i < length; ++i) {
+			out[i] = src[i];
+		}
+		return;
+	}
+
+	auto end = out + length;
+	do {
+		std::memcpy(out, src, sizeof(std::uint64_t));
+		out += WORD_ELEMENTS;
+		src += WORD_ELEMENTS;
+	} while(out < end);
+}
+
+class gzip_chunk_inflater {
+	std::span<const std::byte>  _data;
+	bzlreg::gzip_chunk_options  _options;
+	bzlreg::gzip_chunk          _chunk;
+	bit_reader                  _reader;
+	huffman_table               _codes;
+	huffman_table               _literal_lengths;
+	huffman_table               _distances;
+	huffman_table               _fixed_literal_lengths;
+	huffman_table               _fixed_distances;
+	std::size_t                 _marked_size = 0;
+	std::size_t                 _data_size = 0;
+	bool                        _marked_mode = false;
+
+	/**
+	 * Index into the current output buffer where the current member begins.
+	 * Matches may not reach before it.
+	 */
+	std::size_t _member_begin = 0;
+
+	auto output_bytes() const noexcept -> std::size_t {
+		return _chunk.marked.size() * sizeof(std::uint16_t) + _chunk.data.size();
+	}
+
+	auto output_size() const noexcept -> std::size_t {
+		if(_marked_mode) {
+			return _marked_size - _chunk.marked_begin;
+		}
+		return (_marked_size - _chunk.marked_begin) + //
+			(_data_size - _chunk.data_begin);
+	}
+
+	/**
+	 * Guess of the output left to inflate from `bit` on, assuming the typical
+	 * compression ratio of source archives
+	 */
+	auto initial_output_size(std::size_t bit) const noexcept -> std::size_t {
+		auto compressed_size = bit < _options.stop_bit //
+			? (_options.stop_bit - bit) / 8
+			: std::size_t{0};
+		return std::clamp(
+			compressed_size * 4,
+			bzlreg::DEFLATE_WINDOW_SIZE,
+			_options.max_output_size / 2
+		);
+	}
+
+	/**
+	 * Grows `out` so `needed` more elements fit after `size`
+	 */
+	template<typename T>
+	auto reserve( //
+		std::vector<T>& out,
+		std::size_t     size,
+		std::size_t     needed
+	) -> bool {
+		if(size + needed + COPY_SLACK <= out.size()) {
+			return true;
+		}
+
+		auto other_bytes = output_bytes() - out.size() * sizeof(T);
+		auto max_elements = _options.max_output_size > other_bytes
+			? (_options.max_output_size - other_bytes) / sizeof(T)
+			: std::size_t{0};
+		auto new_size = std::min(
+			std::max(out.size() * 2, size + needed + COPY_SLACK),
+			max_elements
+		);
+		if(new_size < size + needed + COPY_SLACK) {
+			return false;
+		}
+
+		out.resize(new_size);
+		return true;
+	}
+
+	template<typename T>
+	auto inflate_huffman_block( //
+		std::vector<T>&      out,
+		std::size_t&         size,
+		const huffman_table& literal_lengths,
+		const huffman_table& distances
+	) -> block_status {
+		while(true) {
+			if(!reserve(out, size, MAX_MATCH_LENGTH)) {
+				return block_status::too_large;
+			}
+
+			_reader.refill();
+			if(_reader.overrun()) {
+				return block_status::error;
+			}
+
+			auto symbol = literal_lengths.decode(_reader);
+			if(symbol < END_OF_BLOCK) {
+				if(symbol < 0) {
+					return block_status::error;
+				}
+				out[size++] = static_cast<T>(symbol);
+				continue;
+			}
+
+			if(symbol == END_OF_BLOCK) {
+				return block_status::ok;
+			}
+
+			auto length_code = static_cast<std::size_t>(symbol - END_OF_BLOCK - 1);
+			if(length_code >= LENGTH_BASE.size()) {
+				return block_status::error;
+			}
+			auto length = std::size_t{LENGTH_BASE[length_code]} +
+				_reader.read(LENGTH_EXTRA_BITS[length_code]);
+
+			auto distance_code = distances.decode(_reader);
+			if(distance_code < 0 || distance_code >= int{MAX_DISTANCE_CODES}) {
+				return block_status::error;
+			}
+			auto distance = std::size_t{DISTANCE_BASE[distance_code]} +
+				_reader.read(DISTANCE_EXTRA_BITS[distance_code]);
+
+			if(distance > size - _member_begin) {
+				return block_status::error;
+			}
+
+			copy_match(out.data() + size, distance, length);
+			size += length;
+		}
+	}
+
+	template<typename T>
+	auto copy_stored_block( //
+		std::vector<T>& out,
+		std::size_t&    size
+	) -> block_status {
+		_reader.align();
+		_reader.refill();
+		auto length = _reader.read(16);
+		auto length_complement = _reader.read(16);
+		if(length != (~length_complement & 0xffff)) {
+			return block_status::error;
+		}
+
+		if(!reserve(out, size, length)) {
+			return block_status::too_large;
+		}
+
+		for(auto i = 0u; i < length; ++i) {
+			_reader.refill();
+			out[size++] = static_cast<T>(_reader.read(8));
+		}
+
+		return _reader.past_end() ? block_status::error : block_status::ok;
+	}
+
+	/**
+	 * Reads the code lengths of a dynamic block following its 3 header bits
+	 */
+	auto read_dynamic_tables() noexcept -> bool {
+		_reader.refill();
+		auto literal_length_count = _reader.read(5) + 257;
+		auto distance_count = _reader.read(5) + 1;
+		auto code_length_count = _reader.read(4) + 4;
+		if(
+			literal_length_count > MAX_LITERAL_LENGTH_CODES ||
+			distance_count > MAX_DISTANCE_CODES
+		) {
+			return false;
+		}
+
+		auto code_lengths = std::array<std::uint8_t, CODE_LENGTH_ORDER.size()>{};
+		for(auto i = 0u; i < code_length_count; ++i) {
+			_reader.refill();
+			code_lengths[CODE_LENGTH_ORDER[i]] = //
+				static_cast<std::uint8_t>(_reader.read(3));
+		}
+
+		if(!_codes.build(code_lengths, CODE_LENGTH_MAX_BITS, false)) {
+			return false;
+		}
+
+		auto lengths = std::array<
+			std::uint8_t,
+			MAX_LITERAL_LENGTH_CODES + MAX_DISTANCE_CODES>{};
+		auto total = literal_length_count + distance_count;
+		for(auto i = 0u; i < total;) {
+			_reader.refill();
+			auto symbol = _codes.decode(_reader);
+			if(symbol < 0) {
+				return false;
+			}
+
+			if(symbol < 16) {
+				lengths[i++] = static_cast<std::uint8_t>(symbol);
+				continue;
+			}
+
+			auto value = std::uint8_t{0};
+			auto repeat = 0u;
+			if(symbol == 16) {
+				if(i == 0) {
+					return false;
+				}
+				value = lengths[i - 1];
+				repeat = 3 + _reader.read(2);
+			} else if(symbol == 17) {
+				repeat = 3 + _reader.read(3);
+			} else {
+				repeat = 11 + _reader.read(7);
+			}
+
+			if(i + repeat > total) {
+				return false;
+			}
+			std::fill_n(lengths.begin() + i, repeat, value);
+			i += repeat;
+		}
+
+		if(lengths[END_OF_BLOCK] == 0 || _reader.overrun()) {
+			return false;
+		}
+
+		auto all = std::span{lengths};
+		return _literal_lengths.build(
+						 all.first(literal_length_count),
+						 HUFFMAN_TABLE_BITS,
+						 true
+					 ) &&
+			_distances.build(
+				all.subspan(literal_length_count, distance_count),
+				HUFFMAN_TABLE_BITS,
+				true
+			);
+	}
+
+	/**
+	 * Inflates the block whose header was just read into the current output
+	 */
+	template<typename T>
+	auto inflate_block( //
+		unsigned        type,
+		std::vector<T>& out,
+		std::size_t&    size
+	) -> block_status {
+		switch(type) {
+			case BLOCK_TYPE_STORED:
+				return copy_stored_block(out, size);
+			case BLOCK_TYPE_FIXED:
+				return inflate_huffman_block(
+					out,
+					size,
+					_fixed_literal_lengths,
+					_fixed_distances
+				);
+			case BLOCK_TYPE_DYNAMIC:
+				if(!read_dynamic_tables()) {
+					return block_status::error;
+				}
+				return inflate_huffman_block(out, size, _literal_lengths, _distances);
+			default:
+				return block_status::error;
+		}
+	}
+
+	auto inflate_block(unsigned type) -> block_status {
+		auto status = _marked_mode
+			? inflate_block(type, _chunk.marked, _marked_size)
+			: inflate_block(type, _chunk.data, _data_size);
+		if(status == block_status::ok && _reader.past_end()) {
+			return block_status::error;
+		}
+		return status;
+	}
+
+	/**
+	 * Starts the output with a window made of markers
+	 */
+	auto reset_marked_output() -> void {
+		_marked_mode = true;
+		_member_begin = 0;
+		_marked_size = bzlreg::DEFLATE_WINDOW_SIZE;
+		_chunk.marked_begin = bzlreg::DEFLATE_WINDOW_SIZE;
+		_chunk.marked.resize(2 * bzlreg::DEFLATE_WINDOW_SIZE);
+		for(auto i = std::size_t{0}; i < bzlreg::DEFLATE_WINDOW_SIZE; ++i) {
+			_chunk.marked[i] =
+				static_cast<std::uint16_t>(bzlreg::DEFLATE_MARKER_BASE + i);
+		}
+	}
+
+	/**
+	 * Cheap check of the 3 header bits and code counts of a dynamic block that
+	 * rules out most bit offsets before reading the code lengths
+	 */
+	auto may_start_dynamic_block(std::size_t bit) const noexcept -> bool {
+		auto byte = bit / 8;
+		if(byte + sizeof(std::uint64_t) > _data.size()) {
+			return false;
+		}
+
+		auto word = std::uint64_t{};
+		std::memcpy(&word, _data.data() + byte, sizeof(word));
+		if constexpr(std::endian::native == std::endian::big) {
+			word = std::byteswap(word);
+		}
+		word >>= bit % 8;
+
+		// BFINAL 0 and BTYPE 2, final blocks are left for the previous chunk
+		if((word & 0b111) != (BLOCK_TYPE_DYNAMIC << 1)) {
+			return false;
+		}
+
+		auto literal_length_count = ((word >> 3) & 0x1f) + 257;
+		auto distance_count = ((word >> 8) & 0x1f) + 1;
+		return literal_length_count <= MAX_LITERAL_LENGTH_CODES &&
+			distance_count <= MAX_DISTANCE_CODES;
+	}
+
+	/**
+	 * Looks for the first bit offset that starts a dynamic block which
+	 * inflates without errors and inflates that block.
+	 */
+	auto find_first_block() -> bool {
+		for(auto bit = _options.start_bit; bit < _options.stop_bit; ++bit) {
+			if(!may_start_dynamic_block(bit)) {
+				continue;
+			}
+
+			_reader.seek(bit + 3);
+			_marked_size = _chunk.marked_begin;
+			auto status = inflate_block(BLOCK_TYPE_DYNAMIC);
+			if(status == block_status::ok) {
+				_chunk.start_bit = bit;
+				return true;
+			}
+
+			if(status == block_status::too_large) {
+				return false;
+			}
+		}
+
+		return false;
+	}
+
+	/**
+	 * Switches to byte output once markers can't be reached anymore
+	 */
+	auto leave_marked_mode_if_possible() -> void {
+		if(_marked_size < 2 * bzlreg::DEFLATE_WINDOW_SIZE) {
+			return;
+		}
+
+		auto window_begin = _marked_size - bzlreg::DEFLATE_WINDOW_SIZE;
+		auto window = std::span{_chunk.marked}.subspan(
+			window_begin,
+			bzlreg::DEFLATE_WINDOW_SIZE
+		);
+		auto has_marker = std::ranges::any_of(window, [](std::uint16_t value) {
+			return value >= bzlreg::DEFLATE_MARKER_BASE;
+		});
+		if(has_marker) {
+			return;
+		}
+
+		_chunk.data.resize(
+			bzlreg::DEFLATE_WINDOW_SIZE + initial_output_size(_reader.position())
+		);
+		std::ranges::transform(window, _chunk.data.begin(), [](std::uint16_t v) {
+			return static_cast<std::byte>(v);
+		});
+		_chunk.marked.resize(_marked_size);
+		_chunk.marked.shrink_to_fit();
+		_data_size = bzlreg::DEFLATE_WINDOW_SIZE;
+		_chunk.data_begin = bzlreg::DEFLATE_WINDOW_SIZE;
+		_member_begin = _member_begin > window_begin //
+			? _member_begin - window_begin
+			: 0;
+		_marked_mode = false;
+	}
+
+	/**
+	 * Reads the trailer of the member whose final block was just inflated and
+	 * the header of the member following it, if any
+	 */
+	auto end_member() -> bool {
+		_reader.align();
+		auto trailer_offset = _reader.position() / 8;
+		if(trailer_offset + GZIP_TRAILER_SIZE > _data.size()) {
+			return false;
+		}
+
+		auto read_u32 = [&](std::size_t offset) -> std::uint32_t {
+			auto value = std::uint32_t{};
+			for(auto i = 0u; i < 4; ++i) {
+				value |= std::to_integer<std::uint32_t>(_data[offset + i]) << (i * 8);
+			}
+			return value;
+		};
+
+		_chunk.member_ends.push_back({
+			.output_offset = output_size(),
+			.crc32 = read_u32(trailer_offset),
+			.isize = read_u32(trailer_offset + 4),
+		});
+
+		// Same as decompress_stream: anything after the last member that isn't
+		// another member is ignored
+		auto next = trailer_offset + GZIP_TRAILER_SIZE;
+		if(next == _data.size() || _data[next] != GZIP_MAGIC_0) {
+			_chunk.last = true;
+			return true;
+		}
+
+		auto data_offset = bzlreg::gzip_member_data_offset(_data, next);
+		if(!data_offset) {
+			return false;
+		}
+
+		_reader.seek(*data_offset * 8);
+		_member_begin = _marked_mode ? _marked_size : _data_size;
+		return true;
+	}
+
+public:
+	gzip_chunk_inflater(
+		std::span<const std::byte>        data,
+		const bzlreg::gzip_chunk_options& options
+	)
+		: _data(data), _options(options), _reader(data) {
+		auto fixed = std::array<std::uint8_t, FIXED_LITERAL_LENGTH_CODES>{};
+		std::fill(fixed.begin(), fixed.begin() + 144, 8);
+		std::fill(fixed.begin() + 144, fixed.begin() + 256, 9);
+		std::fill(fixed.begin() + 256, fixed.begin() + 280, 7);
+		std::fill(fixed.begin() + 280, fixed.end(), 8);
+		_fixed_literal_lengths.build(fixed, HUFFMAN_TABLE_BITS, false);
+
+		auto fixed_distances = std::array<std::uint8_t, FIXED_DISTANCE_CODES>{};
+		fixed_distances.fill(5);
+		_fixed_distances.build(fixed_distances, HUFFMAN_TABLE_BITS, false);
+	}
+
+	auto inflate() -> std::optional<bzlreg::gzip_chunk> {
+		if(_options.search) {
+			reset_marked_output();
+			if(!find_first_block()) {
+				return std::nullopt;
+			}
+			leave_marked_mode_if_possible();
+		} else {
+			_chunk.start_bit = _options.start_bit;
+			_chunk.data.resize(initial_output_size(_options.start_bit));
+			_reader.seek(_options.start_bit);
+		}
+
+		while(_reader.position() < _options.stop_bit) {
+			_reader.refill();
+			auto final_block = _reader.read(1) == 1;
+			auto type = _reader.read(2);
+
+			if(inflate_block(type) != block_status::ok) {
+				return std::nullopt;
+			}
+
+			if(final_block) {
+				if(!end_member()) {
+					return std::nullopt;
+				}
+				if(_chunk.last) {
+					break;
+				}
+			}
+
+			if(_marked_mode) {
+				leave_marked_mode_if_possible();
+			}
+		}
+
+		_chunk.end_bit = _reader.position();
+		_chunk.marked.resize(_marked_size);
+		_chunk.data.resize(_data_size);
+		return std::move(_chunk);
+	}
+};
+} // namespace
+
+auto bzlreg::gzip_member_data_offset( //
+	std::span<const std::byte> data,
+	std::size_t                offset
+) noexcept -> std::optional<std::size_t> {
+	if(offset + GZIP_HEADER_SIZE > data.size()) {
+		return std::nullopt;
+	}
+
+	auto header = data.subspan(offset, GZIP_HEADER_SIZE);
+	auto flags = header[3];
+	if(
+		header[0] != GZIP_MAGIC_0 || header[1] != GZIP_MAGIC_1 ||
+		header[2] != GZIP_METHOD_DEFLATE ||
+		(flags & GZIP_FLAGS_RESERVED_MASK) != std::byte{}
+	) {
+		return std::nullopt;
+	}
+
+	auto pos = offset + GZIP_HEADER_SIZE;
+	if((flags & GZIP_FLAG_EXTRA) != std::byte{}) {
+		if(pos + 2 > data.size()) {
+			return std::nullopt;
+		}
+		auto extra_size = std::to_integer<std::size_t>(data[pos]) |
+			(std::to_integer<std::size_t>(data[pos + 1]) << 8);
+		pos += 2 + extra_size;
+	}
+
+	for(auto flag : {GZIP_FLAG_NAME, GZIP_FLAG_COMMENT}) {
+		if((flags & flag) == std::byte{} || pos >= data.size()) {
+			continue;
+		}
+		auto rest = data.subspan(pos);
+		auto terminator = std::ranges::find(rest, std::byte{0});
+		if(terminator == rest.end()) {
+			return std::nullopt;
+		}
+		pos += static_cast<std::size_t>(terminator - rest.begin()) + 1;
+	}
+
+	if((flags & GZIP_FLAG_HCRC) != std::byte{}) {
+		pos += 2;
+	}
+
+	if(pos >= data.size()) {
+		return std::nullopt;
+	}
+
+	return pos;
+}
+
+auto bzlreg::inflate_gzip_chunk( //
+	std::span<const std::byte> data,
+	const gzip_chunk_options&  options
+) -> std::optional<gzip_chunk> {
+	// Tables are too large to be put on the stack of worker threads
+	auto inflater = std::make_unique<gzip_chunk_inflater>(data, options);
+	return inflater->inflate();
+}
+
+auto bzlreg::resolve_deflate_markers(
+	std::span<const std::uint16_t> marked,
+	std::span<const std::byte>     window,
+	std::span<std::byte>           out
+) noexcept -> bool {
+	for(auto i = std::size_t{0}; i < marked.size(); ++i) {
+		auto value = marked[i];
+		if(value < DEFLATE_MARKER_BASE) {
+			out[i] = static_cast<std::byte>(value);
+			continue;
+		}
+
+		auto distance = DEFLATE_WINDOW_SIZE - (value - DEFLATE_MARKER_BASE);
+		if(distance > window.size()) {
+			return false;
+		}
+		out[i] = window[window.size() - distance];
+	}
+
+	return true;
+}
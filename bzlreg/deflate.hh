@@ -0,0 +1,136 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <span>
+#include <vector>
+
+namespace bzlreg {
+/**
+ * Furthest a deflate back-reference may reach
+ * SEE: https://www.rfc-editor.org/rfc/rfc1951#section-2
+ */
+constexpr auto DEFLATE_WINDOW_SIZE = std::size_t{32 * 1024};
+
+/**
+ * Marked output at or above this value is byte `value - DEFLATE_MARKER_BASE`
+ * of the window preceding the chunk, which wasn't known while inflating it.
+ * Everything below is a literal byte.
+ */
+constexpr auto DEFLATE_MARKER_BASE = std::uint16_t{0x8000};
+
+/**
+ * End of a gzip member within the output of a `gzip_chunk`
+ */
+struct gzip_member_end {
+	/**
+	 * Offset into the chunk output just past the member's last byte
+	 */
+	std::size_t output_offset = 0;
+
+	/**
+	 * CRC32 and uncompressed size modulo 2^32 stored in the member trailer
+	 */
+	std::uint32_t crc32 = 0;
+	std::uint32_t isize = 0;
+};
+
+/**
+ * Gzip data inflated from a deflate block boundary to another one without
+ * knowing the output before it. The output is `marked` from `marked_begin`
+ * followed by `data` from `data_begin`. Whatever precedes the begin offsets
+ * is the window used while inflating and not part of the output.
+ */
+struct gzip_chunk {
+	/**
+	 * Bit offset of the first block header inflated
+	 */
+	std::size_t start_bit = 0;
+
+	/**
+	 * Bit offset of the block header following the last block inflated
+	 */
+	std::size_t end_bit = 0;
+
+	/**
+	 * Output that may reference the unknown window, see
+	 * `resolve_deflate_markers`. Empty if the chunk started at the beginning
+	 * of a member.
+	 */
+	std::vector<std::uint16_t> marked;
+	std::size_t                marked_begin = 0;
+
+	/**
+	 * Output written once the last `DEFLATE_WINDOW_SIZE` bytes of `marked`
+	 * were free of markers
+	 */
+	std::vector<std::byte> data;
+	std::size_t            data_begin = 0;
+
+	std::vector<gzip_member_end> member_ends;
+
+	/**
+	 * The chunk ended with a member that isn't followed by another one. Any
+	 * bytes after its trailer are ignored.
+	 */
+	bool last = false;
+};
+
+struct gzip_chunk_options {
+	/**
+	 * Bit offset of a block header to start inflating at
+	 */
+	std::size_t start_bit = 0;
+
+	/**
+	 * Instead of starting at `start_bit` look for the first dynamic block
+	 * header at or after it and before `stop_bit` that inflates without
+	 * errors. Such a block is very likely, but not certain, to be an actual
+	 * block of the data.
+	 */
+	bool search = false;
+
+	/**
+	 * Inflating stops at the first block boundary at or after this offset
+	 */
+	std::size_t stop_bit = 0;
+
+	/**
+	 * Bytes of output buffers after which the chunk is given up on
+	 */
+	std::size_t max_output_size = 0;
+};
+
+/**
+ * Offset of the deflate data following the gzip member header at `offset`.
+ * `std::nullopt` if the header is invalid or truncated.
+ * SEE: https://www.rfc-editor.org/rfc/rfc1952#page-5
+ */
+auto gzip_member_data_offset( //
+	std::span<const std::byte> data,
+	std::size_t                offset
+) noexcept -> std::optional<std::size_t>;
+
+/**
+ * Inflates the gzip data of `data` described by `options`. Members ending
+ * within the chunk are followed into the next one. `std::nullopt` if no block
+ * was found, the data is invalid or the output grew too large.
+ */
+auto inflate_gzip_chunk( //
+	std::span<const std::byte> data,
+	const gzip_chunk_options&  options
+) -> std::optional<gzip_chunk>;
+
+/**
+ * Replaces the markers of `marked` with bytes of `window`, the output
+ * preceding the chunk that may be shorter than `DEFLATE_WINDOW_SIZE` at the
+ * start of a member.
+ * @returns `false` if a marker reaches before the start of `window`
+ */
+auto resolve_deflate_markers(
+	std::span<const std::uint16_t> marked,
+	std::span<const std::byte>     window,
+	std::span<std::byte>           out
+) noexcept -> bool;
+} // namespace bzlreg
@@ -1,41 +1,598 @@
 #include "bzlreg/download.hh"
 
-#define BOOST_PROCESS_VERSION 1
-#include <boost/process/v1.hpp>
-#include <boost/asio.hpp>
-
+#include <algorithm>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <limits>
+#include <mutex>
+#include <random>
 #include <string>
+#include <system_error>
+#include <thread>
+#include <boost/url/parse.hpp>
+#include "bzlreg/http_client.hh"
 
-namespace bp = boost::process;
-using namespace std::string_literals;
+#ifndef _WIN32
+#	include <cerrno>
+#	include <fcntl.h>
+#	include <stdlib.h>
+#	include <unistd.h>
+#endif
 
-auto bzlreg::download_file( //
-	std::string_view url
-) -> std::optional<std::vector<std::byte>> {
-	// TODO(zaucy): replace with libcurl or libcpr
-	auto curl = bp::search_path("curl");
-	if(curl.empty()) {
+namespace fs = std::filesystem;
+using namespace std::string_view_literals;
+
+constexpr auto DOWNLOAD_FILE_CHUNK_SIZE = std::size_t{64} * 1024;
+
+/**
+ * Files smaller than this aren't worth splitting into ranges
+ */
+constexpr auto DOWNLOAD_RANGE_MIN_SIZE = std::uint64_t{16} * 1024 * 1024;
+
+/**
+ * Times a range is requested before the whole download fails. Every attempt
+ * continues where the previous one stopped.
+ */
+constexpr auto DOWNLOAD_RANGE_MAX_ATTEMPTS = 4;
+
+namespace {
+/**
+ * `end` is exclusive unlike in the Content-Range header
+ */
+struct content_range {
+	std::uint64_t begin = 0;
+	std::uint64_t end = 0;
+	std::uint64_t total = 0;
+};
+
+struct byte_range {
+	std::uint64_t begin = 0;
+	std::uint64_t end = 0;
+
+	/**
+	 * Guarded by the download's mutex
+	 */
+	std::uint64_t received = 0;
+};
+
+/**
+ * Temporary file the ranges not streamed straight to the sink are written
+ * into at their own offsets from several threads while the sink reads them
+ * back in order. Removed once closed.
+ */
+class range_file {
+#ifdef _WIN32
+	fs::path     _path;
+	std::fstream _file;
+	std::mutex   _mutex;
+#else
+	int _fd = -1;
+#endif
+
+public:
+	range_file() = default;
+	range_file(const range_file&) = delete;
+
+	~range_file() {
+#ifdef _WIN32
+		if(_file.is_open()) {
+			_file.close();
+			auto ec = std::error_code{};
+			fs::remove(_path, ec);
+		}
+#else
+		if(_fd != -1) {
+			::close(_fd);
+		}
+#endif
+	}
+
+	/**
+	 * Creates the file with room for `size` bytes so running out of disk space
+	 * fails here rather than part way through the download where possible
+	 */
+	auto open(std::uint64_t size) -> std::error_code {
+		auto ec = std::error_code{};
+		auto temp_dir = fs::temp_directory_path(ec);
+		if(ec) {
+			return ec;
+		}
+
+#ifdef _WIN32
+		_path = temp_dir /
+			std::format("bzlreg-download-{:x}", std::random_device{}());
+		_file.open(
+			_path,
+			std::ios::in | std::ios::out | std::ios::binary | std::ios::trunc
+		);
+		if(!_file) {
+			return std::make_error_code(std::errc::io_error);
+		}
+
+		fs::resize_file(_path, size, ec);
+		return ec;
+#else
+		auto path = (temp_dir / "bzlreg-download-XXXXXX").string();
+		_fd = ::mkstemp(path.data());
+		if(_fd == -1) {
+			return {errno, std::generic_category()};
+		}
+
+		// Nothing else needs the name, the file goes away once closed
+		::unlink(path.c_str());
+
+#	ifdef __linux__
+		auto result = ::posix_fallocate(_fd, 0, static_cast<off_t>(size));
+		if(result == 0) {
+			return {};
+		}
+		// File systems without fallocate support get a sparse file instead
+		if(result != EOPNOTSUPP && result != EINVAL) {
+			return {result, std::generic_category()};
+		}
+#	endif
+
+		if(::ftruncate(_fd, static_cast<off_t>(size)) == -1) {
+			return {errno, std::generic_category()};
+		}
+		return {};
+#endif
+	}
+
+	auto write( //
+		std::uint64_t              offset,
+		std::span<const std::byte> data
+	) -> std::error_code {
+#ifdef _WIN32
+		auto lock = std::scoped_lock{_mutex};
+		_file.seekp(static_cast<std::streamoff>(offset));
+		_file.write(
+			reinterpret_cast<const char*>(data.data()),
+			static_cast<std::streamsize>(data.size())
+		);
+		if(!_file) {
+			return std::make_error_code(std::errc::io_error);
+		}
+#else
+		while(!data.empty()) {
+			auto written = ::pwrite(
+				_fd,
+				data.data(),
+				data.size(),
+				static_cast<off_t>(offset)
+			);
+			if(written == -1) {
+				if(errno == EINTR) {
+					continue;
+				}
+				return {errno, std::generic_category()};
+			}
+			data = data.subspan(static_cast<std::size_t>(written));
+			offset += static_cast<std::uint64_t>(written);
+		}
+#endif
+		return {};
+	}
+
+	auto read( //
+		std::uint64_t        offset,
+		std::span<std::byte> data
+	) -> std::error_code {
+#ifdef _WIN32
+		auto lock = std::scoped_lock{_mutex};
+		_file.seekg(static_cast<std::streamoff>(offset));
+		_file.read(
+			reinterpret_cast<char*>(data.data()),
+			static_cast<std::streamsize>(data.size())
+		);
+		if(!_file) {
+			return std::make_error_code(std::errc::io_error);
+		}
+#else
+		while(!data.empty()) {
+			auto read_size = ::pread(
+				_fd,
+				data.data(),
+				data.size(),
+				static_cast<off_t>(offset)
+			);
+			if(read_size == -1) {
+				if(errno == EINTR) {
+					continue;
+				}
+				return {errno, std::generic_category()};
+			}
+			if(read_size == 0) {
+				return std::make_error_code(std::errc::io_error);
+			}
+			data = data.subspan(static_cast<std::size_t>(read_size));
+			offset += static_cast<std::uint64_t>(read_size);
+		}
+#endif
 		return {};
 	}
+};
+} // namespace
 
-	auto ioc = boost::asio::io_context{};
-	auto curl_stdout = std::future<std::vector<char>>();
-	auto curl_proc = bp::child{
-		ioc,
-		bp::exe(curl),
-		bp::args({"-sLf"s, std::string{url}}),
-		bp::std_out > curl_stdout,
-		bp::std_in.close(),
+/**
+ * Parses `bytes <first>-<last>/<total>`
+ */
+static auto parse_content_range( //
+	std::string_view value
+) -> std::optional<content_range> {
+	if(!value.starts_with("bytes "sv)) {
+		return std::nullopt;
+	}
+
+	auto first = std::uint64_t{0};
+	auto last = std::uint64_t{0};
+	auto total = std::uint64_t{0};
+	auto end = value.data() + value.size();
+
+	auto first_result = std::from_chars(value.data() + 6, end, first);
+	if(first_result.ec != std::errc{} || first_result.ptr == end) {
+		return std::nullopt;
+	}
+	if(*first_result.ptr != '-') {
+		return std::nullopt;
+	}
+
+	auto last_result = std::from_chars(first_result.ptr + 1, end, last);
+	if(last_result.ec != std::errc{} || last_result.ptr == end) {
+		return std::nullopt;
+	}
+	if(*last_result.ptr != '/') {
+		return std::nullopt;
+	}
+
+	auto total_result = std::from_chars(last_result.ptr + 1, end, total);
+	if(total_result.ec != std::errc{} || total_result.ptr != end) {
+		return std::nullopt;
+	}
+
+	if(last < first || last >= total) {
+		return std::nullopt;
+	}
+
+	return content_range{.begin = first, .end = last + 1, .total = total};
+}
+
+/**
+ * `bytes=0-` can't be satisfied for an empty file, which servers answer with
+ * 416 and the size it does have
+ */
+static auto is_empty_file_response(const bzlreg::http_response& response)
+	-> bool {
+	return response.status == 416 &&
+		response.header("Content-Range") == "bytes */0"sv;
+}
+
+static auto range_header( //
+	std::uint64_t begin,
+	std::uint64_t end
+) -> bzlreg::http_header {
+	return {"Range", std::format("bytes={}-{}", begin, end - 1)};
+}
+
+/**
+ * The first request asks for `bytes=0-`. If the server answers with a range
+ * the rest of the file is split between `options.connections` connections:
+ * the first keeps streaming the head of the file straight into `sink` while
+ * the others fill a preallocated temporary file that is handed to `sink` in
+ * order afterwards, so memory stays bounded whatever the file size. Small
+ * files, and any file when the temporary file can't be created, are resumed
+ * over the first connection only.
+ */
+static auto download_ranges(
+	std::string_view                url,
+	const bzlreg::download_sink&    sink,
+	const bzlreg::download_options& options
+) -> bzlreg::download_status {
+	using bzlreg::download_status;
+
+	auto stop_all = std::stop_source{};
+	auto forward_stop = std::stop_callback{options.stop_token, [&] {
+		stop_all.request_stop();
+	}};
+
+	auto mutex = std::mutex{};
+	auto progress = std::condition_variable_any{};
+	auto range_failed = false;
+
+	// Everything past `first_end` is split into `ranges` which are downloaded
+	// into `file`. Only written before the range downloads start.
+	auto first_end = std::numeric_limits<std::uint64_t>::max();
+	auto total_size = std::uint64_t{0};
+	auto ranges = std::vector<byte_range>{};
+	auto file = range_file{};
+	auto ranges_url = std::string{};
+	auto validator = std::string{};
+
+	auto range_request = [&](std::uint64_t begin, std::uint64_t end) {
+		auto request = bzlreg::http_request_options{
+			.headers = {range_header(begin, end)},
+			.timeout = options.timeout,
+			.stop_token = stop_all.get_token(),
+			.on_response = [=](const bzlreg::http_response& response) {
+				auto content_range =
+					response.header("Content-Range").and_then(parse_content_range);
+				return response.status == 206 && content_range &&
+					content_range->begin == begin && content_range->end == end;
+			},
+		};
+		// The file must not change between requests
+		if(!validator.empty()) {
+			request.headers.emplace_back("If-Range", validator);
+		}
+		return request;
 	};
 
-	ioc.run();
-	curl_proc.wait();
+	auto download_range = [&](std::size_t index) {
+		auto& range = ranges[index];
+		auto received = std::uint64_t{0};
+		auto write_failed = false;
+		for(auto attempt = 0; attempt < DOWNLOAD_RANGE_MAX_ATTEMPTS; ++attempt) {
+			bzlreg::default_http_client().get(
+				ranges_url,
+				[&](std::span<const std::byte> chunk) {
+					auto size = std::min<std::uint64_t>(
+						chunk.size(),
+						range.end - range.begin - received
+					);
+					if(file.write(range.begin + received, chunk.first(size))) {
+						write_failed = true;
+						return false;
+					}
+					received += size;
+
+					auto lock = std::scoped_lock{mutex};
+					range.received = received;
+					progress.notify_all();
+					return size == chunk.size();
+				},
+				range_request(range.begin + received, range.end)
+			);
 
-	if(auto exit_code = curl_proc.exit_code(); exit_code != 0) {
+			if(received == range.end - range.begin) {
+				return;
+			}
+			if(write_failed || stop_all.stop_requested()) {
+				break;
+			}
+		}
+
+		auto lock = std::scoped_lock{mutex};
+		range_failed = true;
+		progress.notify_all();
+	};
+
+	// Joined before the state above is destroyed
+	auto range_downloads = std::vector<std::jthread>{};
+
+	auto start_ranges = [&](const bzlreg::http_response& response) -> bool {
+		// Ranges aren't supported so the whole file comes in this response
+		if(response.status != 206) {
+			return true;
+		}
+
+		auto content_range =
+			response.header("Content-Range").and_then(parse_content_range);
+		if(!content_range || content_range->begin != 0) {
+			return false;
+		}
+
+		total_size = content_range->total;
+		ranges_url = response.url;
+		auto etag = response.header("ETag").value_or("");
+		validator = !etag.empty() && !etag.starts_with("W/")
+			? std::string{etag}
+			: std::string{response.header("Last-Modified").value_or("")};
+
+		// A single connection resumes the head until the end of the file
+		if(total_size < DOWNLOAD_RANGE_MIN_SIZE || file.open(total_size)) {
+			first_end = total_size;
+			return true;
+		}
+
+		auto range_count = std::uint64_t{options.connections};
+		auto range_size = (total_size + range_count - 1) / range_count;
+		first_end = std::min(range_size, content_range->end);
+
+		for(auto begin = first_end; begin < total_size; begin += range_size) {
+			ranges.emplace_back(begin, std::min(begin + range_size, total_size));
+		}
+
+		range_downloads.reserve(ranges.size());
+		for(auto index = std::size_t{0}; index < ranges.size(); ++index) {
+			range_downloads.emplace_back(download_range, index);
+		}
+		return true;
+	};
+
+	// The head of the file goes straight to `sink`
+	auto delivered = std::uint64_t{0};
+	auto sink_stopped = false;
+	auto deliver_head = [&](std::span<const std::byte> chunk) -> bool {
+		auto size = std::min<std::uint64_t>(chunk.size(), first_end - delivered);
+		if(size > 0 && !sink(chunk.first(size))) {
+			sink_stopped = true;
+			return false;
+		}
+		delivered += size;
+		// The connection is dropped at `first_end` unless that's the end anyway
+		return delivered < first_end || first_end == total_size;
+	};
+
+	auto head_request = bzlreg::http_request_options{
+		.headers = {{"Range", "bytes=0-"}},
+		.timeout = options.timeout,
+		.stop_token = stop_all.get_token(),
+		.on_response = start_ranges,
+	};
+	auto response =
+		bzlreg::default_http_client().get(url, deliver_head, head_request);
+
+	// Not a range response, so nothing can be resumed
+	if(first_end == std::numeric_limits<std::uint64_t>::max()) {
+		if(!response) {
+			return download_status::failed;
+		}
+		if(response->status == 404 || response->status == 410) {
+			return download_status::not_found;
+		}
+		if(is_empty_file_response(*response)) {
+			return download_status::ok;
+		}
+		return response->ok() ? download_status::ok : download_status::failed;
+	}
+
+	for(auto attempt = 1; delivered < first_end; ++attempt) {
+		if(
+			sink_stopped || stop_all.stop_requested() ||
+			attempt == DOWNLOAD_RANGE_MAX_ATTEMPTS
+		) {
+			stop_all.request_stop();
+			return download_status::failed;
+		}
+		bzlreg::default_http_client().get(
+			ranges_url,
+			deliver_head,
+			range_request(delivered, first_end)
+		);
+	}
+
+	auto chunk_buffer = std::vector<std::byte>(DOWNLOAD_FILE_CHUNK_SIZE);
+	for(const auto& range : ranges) {
+		auto sent = std::uint64_t{0};
+		while(sent < range.end - range.begin) {
+			auto lock = std::unique_lock{mutex};
+			progress.wait(lock, stop_all.get_token(), [&] {
+				return range.received > sent || range_failed;
+			});
+			if(range.received <= sent) {
+				stop_all.request_stop();
+				return download_status::failed;
+			}
+			auto available = range.received;
+			lock.unlock();
+
+			while(sent < available) {
+				auto chunk = std::span{chunk_buffer}.first(
+					std::min<std::uint64_t>(chunk_buffer.size(), available - sent)
+				);
+				if(file.read(range.begin + sent, chunk) || !sink(chunk)) {
+					stop_all.request_stop();
+					return download_status::failed;
+				}
+				sent += chunk.size();
+			}
+		}
+	}
+
+	return download_status::ok;
+}
+
+/**
+ * file:// URLs, such as local registries, are read from disk
+ */
+static auto read_file_url( //
+	std::string_view                url,
+	const bzlreg::download_sink&    sink,
+	const bzlreg::download_options& options
+) -> bzlreg::download_status {
+	using bzlreg::download_status;
+
+	auto parsed = boost::urls::parse_uri(url);
+	if(!parsed) {
+		return download_status::failed;
+	}
+
+	auto path = std::string{parsed->path()};
+#ifdef _WIN32
+	// file:///C:/dir has the path /C:/dir
+	if(path.size() > 2 && path[0] == '/' && path[2] == ':') {
+		path.erase(0, 1);
+	}
+#endif
+
+	auto file = std::ifstream{fs::path{path}, std::ios::binary};
+	if(!file) {
+		auto ec = std::error_code{};
+		return fs::exists(fs::path{path}, ec) || ec //
+			? download_status::failed
+			: download_status::not_found;
+	}
+
+	auto buffer = std::vector<char>(DOWNLOAD_FILE_CHUNK_SIZE);
+	while(file) {
+		if(options.stop_token.stop_requested()) {
+			return download_status::failed;
+		}
+		file.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+		auto read_size = static_cast<std::size_t>(file.gcount());
+		auto chunk = std::as_bytes(std::span{buffer}.first(read_size));
+		if(!chunk.empty() && !sink(chunk)) {
+			return download_status::failed;
+		}
+	}
+
+	return file.eof() ? download_status::ok : download_status::failed;
+}
+
+auto bzlreg::download_file( //
+	std::string_view        url,
+	const download_options& options
+) -> std::optional<std::vector<std::byte>> {
+	auto data = std::vector<std::byte>{};
+	auto downloaded = download_file_stream(
+		url,
+		[&](auto chunk) {
+			data.insert(data.end(), chunk.begin(), chunk.end());
+			return true;
+		},
+		options
+	);
+
+	if(downloaded != download_status::ok) {
 		return {};
 	}
 
-	auto data = curl_stdout.get();
-	static_assert(sizeof(decltype(data)::value_type) == sizeof(std::byte));
-	return reinterpret_cast<std::vector<std::byte>&>(data); // don't @ me
+	return data;
+}
+
+auto bzlreg::download_file_stream( //
+	std::string_view        url,
+	const download_sink&    sink,
+	const download_options& options
+) -> download_status {
+	if(url.starts_with("file://")) {
+		return read_file_url(url, sink, options);
+	}
+
+	if(options.connections > 1 && !options.accept_gzip) {
+		return download_ranges(url, sink, options);
+	}
+
+	auto response = default_http_client().get(
+		url,
+		sink,
+		{
+			.accept_gzip = options.accept_gzip,
+			.timeout = options.timeout,
+			.stop_token = options.stop_token,
+		}
+	);
+
+	if(!response) {
+		return download_status::failed;
+	}
+	if(response->status == 404 || response->status == 410) {
+		return download_status::not_found;
+	}
+	return response->ok() ? download_status::ok : download_status::failed;
 }
@@ -1,12 +1,76 @@
 #pragma once
 
+#include <chrono>
 #include <string_view>
 #include <optional>
 #include <vector>
 #include <cstddef>
+#include <span>
+#include <functional>
+#include <stop_token>
 
 namespace bzlreg {
+/**
+ * Receives downloaded bytes as they arrive. Return `false` to stop the
+ * download.
+ */
+using download_sink = std::function<bool(std::span<const std::byte>)>;
+
+struct download_options {
+	/**
+	 * Let the server gzip the response. Only for text such as registry
+	 * metadata, archives must be downloaded as is to match their integrity.
+	 */
+	bool accept_gzip = false;
+
+	/**
+	 * Abandons the download, even mid read, once a stop is requested
+	 */
+	std::stop_token stop_token;
+
+	/**
+	 * Fail once connecting or any single read takes longer than this, so a
+	 * stalled server is given up on even while it keeps the connection open
+	 */
+	std::chrono::milliseconds timeout = std::chrono::seconds{30};
+
+	/**
+	 * Split large files into byte ranges downloaded over up to this many
+	 * connections at once when the server supports ranges. The sink still
+	 * receives the body in order, ranges ahead of it wait in a temporary file.
+	 * Ranges that fail are resumed where they stopped. Ignored with
+	 * `accept_gzip`.
+	 */
+	unsigned connections = 1;
+};
+
+enum class download_status {
+	ok,
+
+	/**
+	 * The server answered 404 or 410, or the file of a file:// URL is missing
+	 */
+	not_found,
+
+	/**
+	 * Network errors, other statuses and downloads that were stopped
+	 */
+	failed,
+};
+
 auto download_file( //
-	std::string_view url
+	std::string_view        url,
+	const download_options& options = {}
 ) -> std::optional<std::vector<std::byte>>;
-}
+
+/**
+ * Same as `download_file` but hands the body to `sink` chunk by chunk while it
+ * is being received instead of buffering all of it. A download `sink` stopped
+ * has `download_status::failed`.
+ */
+auto download_file_stream( //
+	std::string_view        url,
+	const download_sink&    sink,
+	const download_options& options = {}
+) -> download_status;
+} // namespace bzlreg
@@ -0,0 +1,944 @@
+#include "bzlreg/http_client.hh"
+
+#include <array>
+#include <charconv>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <initializer_list>
+#include <mutex>
+#include <print>
+#include <stop_token>
+#include <unordered_map>
+#include <utility>
+#include <boost/asio/connect.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/ssl.hpp>
+#include <boost/asio/write.hpp>
+#include <boost/url/parse.hpp>
+#include <boost/url/url.hpp>
+#include <openssl/evp.h>
+#include "absl/strings/ascii.h"
+#include "absl/strings/match.h"
+#include "absl/strings/str_split.h"
+#include "bzlreg/decompress.hh"
+
+#ifdef _WIN32
+#	include <windows.h>
+#	include <wincrypt.h>
+#endif
+
+namespace asio = boost::asio;
+namespace fs = std::filesystem;
+using tcp = asio::ip::tcp;
+using boost::system::error_code;
+
+namespace {
+constexpr auto HTTP_MAX_HEADER_SIZE = std::size_t{64} * 1024;
+constexpr auto HTTP_READ_SIZE = std::size_t{64} * 1024;
+constexpr auto HTTP_MAX_IDLE_CONNECTIONS_PER_HOST = std::size_t{8};
+constexpr auto HTTP_USER_AGENT = std::string_view{"bzlreg"};
+
+/**
+ * CA bundles of common distributions, for TLS libraries built with a default
+ * certificate path that doesn't exist on this system
+ */
+constexpr auto CA_BUNDLE_PATHS = std::array{
+	"/etc/ssl/certs/ca-certificates.crt",
+	"/etc/pki/tls/certs/ca-bundle.crt",
+	"/etc/ssl/ca-bundle.pem",
+	"/etc/ssl/cert.pem",
+};
+
+/**
+ * Proxy from the HTTP_PROXY and HTTPS_PROXY environment variables. HTTPS is
+ * tunneled through CONNECT while plain HTTP requests are sent to the proxy
+ * with the whole URL as their target.
+ */
+struct http_proxy {
+	std::string host;
+	std::string port;
+
+	/**
+	 * Proxy-Authorization value for credentials in the proxy URL, empty if
+	 * there are none
+	 */
+	std::string authorization;
+};
+
+struct http_target {
+	bool        tls;
+	std::string host;
+	std::string port;
+	std::string host_header;
+	std::string target;
+
+	std::optional<http_proxy> proxy;
+
+	auto pool_key() const -> std::string {
+		return std::format("{}://{}:{}", tls ? "https" : "http", host, port);
+	}
+};
+
+auto parse_http_target(std::string_view url) -> std::optional<http_target> {
+	auto parsed = boost::urls::parse_uri(url);
+	if(!parsed) {
+		return std::nullopt;
+	}
+
+	auto scheme = parsed->scheme();
+	if(scheme != "https" && scheme != "http") {
+		return std::nullopt;
+	}
+
+	auto tls = scheme == "https";
+	auto target = std::string{parsed->encoded_target()};
+	if(target.empty()) {
+		target = "/";
+	}
+
+	return http_target{
+		.tls = tls,
+		.host = parsed->host_address(),
+		.port = parsed->has_port() //
+			? std::string{parsed->port()}
+			: std::string{tls ? "443" : "80"},
+		.host_header = std::string{parsed->encoded_host_and_port()},
+		.target = std::move(target),
+	};
+}
+
+auto basic_authorization(std::string_view credentials) -> std::string {
+	auto encoded = std::string(4 * ((credentials.size() + 2) / 3) + 1, '\0');
+	auto encoded_size = EVP_EncodeBlock(
+		reinterpret_cast<std::uint8_t*>(encoded.data()),
+		reinterpret_cast<const std::uint8_t*>(credentials.data()),
+		credentials.size()
+	);
+	encoded.resize(static_cast<std::size_t>(encoded_size));
+	return std::format("Basic {}", encoded);
+}
+
+/**
+ * Proxy configured in the first of `env_names` that is set. URLs without a
+ * scheme are taken as http://, other schemes aren't supported.
+ */
+auto proxy_from_env(std::initializer_list<const char*> env_names)
+	-> std::optional<http_proxy> {
+	for(auto env_name : env_names) {
+		auto value = std::getenv(env_name);
+		if(value == nullptr || *value == '\0') {
+			continue;
+		}
+
+		auto url = std::string{value};
+		if(url.find("://") == std::string::npos) {
+			url = std::format("http://{}", url);
+		}
+
+		auto parsed = boost::urls::parse_uri(url);
+		if(!parsed || parsed->scheme() != "http" || !parsed->has_authority()) {
+			std::println(
+				stderr,
+				"WARN: ignoring {}, only http:// proxies are supported",
+				env_name
+			);
+			return std::nullopt;
+		}
+
+		auto proxy = http_proxy{
+			.host = parsed->host_address(),
+			.port = parsed->has_port() //
+				? std::string{parsed->port()}
+				: std::string{"80"},
+		};
+		if(parsed->has_userinfo()) {
+			proxy.authorization = basic_authorization(
+				std::format("{}:{}", parsed->user(), parsed->password())
+			);
+		}
+		return proxy;
+	}
+
+	return std::nullopt;
+}
+
+/**
+ * Whether `host` matches an entry of NO_PROXY. Entries match the host itself
+ * and its subdomains, `*` matches every host.
+ */
+auto matches_no_proxy( //
+	std::string_view                host,
+	const std::vector<std::string>& no_proxy
+) -> bool {
+	for(const auto& entry : no_proxy) {
+		if(entry == "*") {
+			return true;
+		}
+
+		auto domain = std::string_view{entry};
+		if(domain.starts_with('.')) {
+			domain.remove_prefix(1);
+		}
+		if(absl::EqualsIgnoreCase(host, domain)) {
+			return true;
+		}
+		if(
+			host.size() > domain.size() &&
+			host[host.size() - domain.size() - 1] == '.' &&
+			absl::EndsWithIgnoreCase(host, domain)
+		) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+auto is_redirect(unsigned status) -> bool {
+	return status == 301 || status == 302 || status == 303 || status == 307 ||
+		status == 308;
+}
+
+auto is_end_of_stream(error_code ec) -> bool {
+	return ec == asio::error::eof || ec == asio::ssl::error::stream_truncated;
+}
+
+#ifdef _WIN32
+/**
+ * BoringSSL doesn't know about the Windows certificate store
+ */
+auto load_windows_root_certificates(asio::ssl::context& ssl_ctx) -> void {
+	auto store = ::CertOpenSystemStoreW(0, L"ROOT");
+	if(!store) {
+		return;
+	}
+
+	auto x509_store = ::SSL_CTX_get_cert_store(ssl_ctx.native_handle());
+	for(auto cert = ::CertEnumCertificatesInStore(store, nullptr); cert;
+			cert = ::CertEnumCertificatesInStore(store, cert)) {
+		auto der = static_cast<const unsigned char*>(cert->pbCertEncoded);
+		auto x509 =
+			::d2i_X509(nullptr, &der, static_cast<long>(cert->cbCertEncoded));
+		if(x509) {
+			::X509_STORE_add_cert(x509_store, x509);
+			::X509_free(x509);
+		}
+	}
+
+	::CertCloseStore(store, 0);
+}
+#endif
+
+auto parse_status_line(std::string_view line, bzlreg::http_response& response)
+	-> bool {
+	if(!line.starts_with("HTTP/1.") || line.size() < 12 || line[8] != ' ') {
+		return false;
+	}
+
+	auto status_str = line.substr(9, 3);
+	auto [ptr, ec] = std::from_chars(
+		status_str.data(),
+		status_str.data() + status_str.size(),
+		response.status
+	);
+	return ec == std::errc{} && ptr == status_str.data() + status_str.size();
+}
+
+/**
+ * A connection owns its io_context so a request only ever runs handlers of
+ * its own connection on the calling thread
+ */
+struct http_connection {
+	asio::io_context               ioc;
+	tcp::resolver                  resolver;
+	asio::ssl::stream<tcp::socket> stream;
+	bool                           tls;
+
+	/**
+	 * Bytes received but not consumed by the response parser yet
+	 */
+	std::string       buffered;
+	std::vector<char> read_buffer;
+
+	/**
+	 * Stops the operations of the current request
+	 */
+	std::stop_token stop_token;
+
+	http_connection(asio::ssl::context& ssl_ctx, bool tls)
+		: resolver(ioc), stream(ioc, ssl_ctx), tls(tls) {
+		read_buffer.resize(HTTP_READ_SIZE);
+	}
+
+	auto close() -> void {
+		auto ignored = error_code{};
+		resolver.cancel();
+		stream.next_layer().close(ignored);
+	}
+
+	/**
+	 * Runs the operation `start` begins until it completes, `timeout` passes or
+	 * a stop is requested. The connection is closed in the latter two cases.
+	 */
+	auto run(std::chrono::milliseconds timeout, auto&& start) -> error_code {
+		auto result = error_code{};
+		start([&](error_code ec) { result = ec; });
+
+		auto on_stop = std::stop_callback{stop_token, [this] {
+			asio::post(ioc, [this] { close(); });
+		}};
+
+		ioc.restart();
+		ioc.run_for(timeout);
+		if(!ioc.stopped()) {
+			close();
+			ioc.run();
+			return asio::error::timed_out;
+		}
+
+		return result;
+	}
+
+	auto connect(const http_target& target, std::chrono::milliseconds timeout)
+		-> error_code {
+		const auto& host = target.proxy ? target.proxy->host : target.host;
+		const auto& port = target.proxy ? target.proxy->port : target.port;
+		auto endpoints = tcp::resolver::results_type{};
+		auto ec = run(timeout, [&](auto done) {
+			resolver.async_resolve(
+				host,
+				port,
+				[&, done](error_code ec, tcp::resolver::results_type results) {
+					endpoints = std::move(results);
+					done(ec);
+				}
+			);
+		});
+		if(ec) {
+			return ec;
+		}
+
+		ec = run(timeout, [&](auto done) {
+			asio::async_connect(
+				stream.next_layer(),
+				endpoints,
+				[done](error_code ec, const tcp::endpoint&) { done(ec); }
+			);
+		});
+		if(ec) {
+			return ec;
+		}
+
+		// Requests are written in one go, nothing to coalesce
+		stream.next_layer().set_option(tcp::no_delay{true}, ec);
+		if(!tls) {
+			return {};
+		}
+
+		if(target.proxy) {
+			if(auto tunnel_ec = open_tunnel(target, timeout); tunnel_ec) {
+				return tunnel_ec;
+			}
+		}
+
+		::SSL_set_tlsext_host_name(stream.native_handle(), target.host.c_str());
+		stream.set_verify_mode(asio::ssl::verify_peer);
+		stream.set_verify_callback(
+			asio::ssl::host_name_verification{target.host}
+		);
+
+		return run(timeout, [&](auto done) {
+			stream.async_handshake(asio::ssl::stream_base::client, done);
+		});
+	}
+
+	/**
+	 * Asks the proxy for a tunnel to `target` that TLS is then spoken through
+	 */
+	auto open_tunnel(const http_target& target, std::chrono::milliseconds timeout)
+		-> error_code {
+		// IPv6 addresses are the only hosts with colons
+		auto authority = target.host.find(':') == std::string::npos
+			? std::format("{}:{}", target.host, target.port)
+			: std::format("[{}]:{}", target.host, target.port);
+		auto request = std::format(
+			"CONNECT {0} HTTP/1.1\r\n"
+			"Host: {0}\r\n"
+			"User-Agent: {1}\r\n",
+			authority,
+			HTTP_USER_AGENT
+		);
+		if(!target.proxy->authorization.empty()) {
+			request += std::format(
+				"Proxy-Authorization: {}\r\n",
+				target.proxy->authorization
+			);
+		}
+		request += "\r\n";
+
+		auto ec = run(timeout, [&](auto done) {
+			asio::async_write(
+				stream.next_layer(),
+				asio::buffer(request),
+				[done](error_code ec, std::size_t) { done(ec); }
+			);
+		});
+		if(ec) {
+			return ec;
+		}
+
+		// Nothing follows the response until the client starts the handshake
+		auto response_head = std::string{};
+		ec = run(timeout, [&](auto done) {
+			asio::async_read_until(
+				stream.next_layer(),
+				asio::dynamic_buffer(response_head, HTTP_MAX_HEADER_SIZE),
+				"\r\n\r\n",
+				[done](error_code ec, std::size_t) { done(ec); }
+			);
+		});
+		if(ec) {
+			return ec;
+		}
+
+		auto response = bzlreg::http_response{};
+		auto status_line = std::string_view{response_head};
+		status_line = status_line.substr(0, status_line.find("\r\n"));
+		if(!parse_status_line(status_line, response) || !response.ok()) {
+			return asio::error::connection_refused;
+		}
+
+		return {};
+	}
+
+	auto write(std::string_view data, std::chrono::milliseconds timeout)
+		-> error_code {
+		return run(timeout, [&](auto done) {
+			auto handler = [done](error_code ec, std::size_t) { done(ec); };
+			if(tls) {
+				asio::async_write(stream, asio::buffer(data), handler);
+			} else {
+				asio::async_write(stream.next_layer(), asio::buffer(data), handler);
+			}
+		});
+	}
+
+	/**
+	 * Appends whatever arrives next to `buffered`
+	 */
+	auto read_some(std::chrono::milliseconds timeout) -> error_code {
+		auto read_size = std::size_t{0};
+		auto ec = run(timeout, [&](auto done) {
+			auto handler = [&, done](error_code ec, std::size_t size) {
+				read_size = size;
+				done(ec);
+			};
+			if(tls) {
+				stream.async_read_some(asio::buffer(read_buffer), handler);
+			} else {
+				stream.next_layer().async_read_some(asio::buffer(read_buffer), handler);
+			}
+		});
+		buffered.append(read_buffer.data(), read_size);
+		return ec;
+	}
+
+	/**
+	 * Reads until `buffered` contains a CRLF and removes the line from it
+	 */
+	auto read_line(std::chrono::milliseconds timeout, std::string& line)
+		-> error_code {
+		auto end = buffered.find("\r\n");
+		while(end == std::string::npos) {
+			if(buffered.size() > HTTP_MAX_HEADER_SIZE) {
+				return asio::error::message_size;
+			}
+			if(auto ec = read_some(timeout); ec) {
+				return ec;
+			}
+			end = buffered.find("\r\n");
+		}
+
+		line.assign(buffered, 0, end);
+		buffered.erase(0, end + 2);
+		return {};
+	}
+};
+
+struct exchange_result {
+	/**
+	 * Empty unless the request failed
+	 */
+	std::string error;
+
+	/**
+	 * Nothing was received, which on a pooled connection means the server
+	 * closed it while it was idle
+	 */
+	bool nothing_received = false;
+
+	bool keep_alive = false;
+	bool aborted = false;
+};
+
+auto format_request(
+	const http_target&                  target,
+	const bzlreg::http_request_options& options
+) -> std::string {
+	// A proxy forwarding plain HTTP needs to know where to
+	auto via_proxy = target.proxy && !target.tls;
+	auto request = std::format(
+		"GET {}{} HTTP/1.1\r\n"
+		"Host: {}\r\n"
+		"User-Agent: {}\r\n"
+		"Accept: */*\r\n"
+		"Accept-Encoding: {}\r\n",
+		via_proxy ? std::format("http://{}", target.host_header) : std::string{},
+		target.target,
+		target.host_header,
+		HTTP_USER_AGENT,
+		options.accept_gzip ? "gzip" : "identity"
+	);
+	if(via_proxy && !target.proxy->authorization.empty()) {
+		request += std::format(
+			"Proxy-Authorization: {}\r\n",
+			target.proxy->authorization
+		);
+	}
+	for(const auto& header : options.headers) {
+		request += std::format("{}: {}\r\n", header.name, header.value);
+	}
+	request += "\r\n";
+	return request;
+}
+
+/**
+ * Sends one request on `conn` and reads its response
+ */
+auto exchange(
+	http_connection&                    conn,
+	const http_target&                  target,
+	const bzlreg::http_request_options& options,
+	const bzlreg::http_body_sink&       sink,
+	bzlreg::http_response&              response
+) -> exchange_result {
+	auto timeout = options.timeout;
+	auto failed = [&](std::string_view what, error_code ec) {
+		return exchange_result{
+			.error = std::format("{}: {}", what, ec.message()),
+		};
+	};
+
+	conn.buffered.clear();
+	if(auto ec = conn.write(format_request(target, options), timeout); ec) {
+		auto result = failed("failed to send request", ec);
+		result.nothing_received = ec != asio::error::timed_out;
+		return result;
+	}
+
+	auto line = std::string{};
+	auto http_1_0 = false;
+
+	// Interim 1xx responses are skipped
+	do {
+		response.status = 0;
+		response.headers.clear();
+
+		if(auto ec = conn.read_line(timeout, line); ec) {
+			auto result = failed("failed to read response", ec);
+			result.nothing_received = conn.buffered.empty() &&
+				(is_end_of_stream(ec) || ec == asio::error::connection_reset);
+			return result;
+		}
+
+		if(!parse_status_line(line, response)) {
+			return {.error = "malformed status line"};
+		}
+		http_1_0 = line.starts_with("HTTP/1.0");
+
+		while(true) {
+			if(auto ec = conn.read_line(timeout, line); ec) {
+				return failed("failed to read headers", ec);
+			}
+			if(line.empty()) {
+				break;
+			}
+
+			auto colon = line.find(':');
+			if(colon == std::string::npos) {
+				return {.error = "malformed header"};
+			}
+			response.headers.emplace_back(
+				std::string{absl::StripAsciiWhitespace(line.substr(0, colon))},
+				std::string{absl::StripAsciiWhitespace(line.substr(colon + 1))}
+			);
+		}
+	} while(response.status >= 100 && response.status < 200);
+
+	auto connection = response.header("Connection").value_or("");
+	auto content_encoding = response.header("Content-Encoding").value_or("");
+	auto result = exchange_result{
+		.keep_alive =
+			!http_1_0 && !absl::StrContainsIgnoreCase(connection, "close"),
+	};
+
+	if(response.ok() && options.on_response && !options.on_response(response)) {
+		result.aborted = true;
+		return result;
+	}
+
+	auto gunzip = std::optional<bzlreg::decompress_stream>{};
+	if(
+		options.accept_gzip && response.ok() &&
+		absl::EqualsIgnoreCase(content_encoding, "gzip")
+	) {
+		gunzip.emplace(bzlreg::archive_format::tar_gzip);
+	}
+
+	auto deliver = [&](std::string_view data) -> bool {
+		if(!response.ok() || data.empty()) {
+			return true;
+		}
+
+		auto bytes = std::as_bytes(std::span{data});
+		if(!gunzip) {
+			result.aborted = !sink(bytes);
+			return !result.aborted;
+		}
+
+		switch(gunzip->write(bytes, sink)) {
+			case bzlreg::decompress_status::ok:
+				return true;
+			case bzlreg::decompress_status::stopped:
+				result.aborted = true;
+				return false;
+			case bzlreg::decompress_status::error:
+				result.error = "malformed gzip body";
+				return false;
+		}
+		return false;
+	};
+
+	// Hands exactly `size` body bytes to `deliver`
+	auto read_body_bytes = [&](std::uint64_t size) -> bool {
+		while(size > 0) {
+			if(conn.buffered.empty()) {
+				if(auto ec = conn.read_some(timeout); ec) {
+					result = failed("failed to read body", ec);
+					return false;
+				}
+			}
+
+			auto chunk_size = static_cast<std::size_t>(
+				std::min<std::uint64_t>(size, conn.buffered.size())
+			);
+			if(!deliver(std::string_view{conn.buffered}.substr(0, chunk_size))) {
+				return false;
+			}
+			conn.buffered.erase(0, chunk_size);
+			size -= chunk_size;
+		}
+		return true;
+	};
+
+	auto transfer_encoding = response.header("Transfer-Encoding").value_or("");
+	auto content_length = response.header("Content-Length");
+
+	if(response.status == 204 || response.status == 304) {
+		// No body
+	} else if(absl::StrContainsIgnoreCase(transfer_encoding, "chunked")) {
+		while(true) {
+			if(auto ec = conn.read_line(timeout, line); ec) {
+				return failed("failed to read chunk size", ec);
+			}
+
+			auto chunk_size = std::uint64_t{0};
+			auto [ptr, ec] = std::from_chars(
+				line.data(),
+				line.data() + line.size(),
+				chunk_size,
+				16
+			);
+			auto line_end = line.data() + line.size();
+			if(ec != std::errc{} || (ptr != line_end && *ptr != ';')) {
+				return {.error = "malformed chunk size"};
+			}
+
+			if(chunk_size == 0) {
+				break;
+			}
+
+			if(!read_body_bytes(chunk_size)) {
+				return result;
+			}
+
+			if(auto ec = conn.read_line(timeout, line); ec || !line.empty()) {
+				return {.error = "malformed chunk"};
+			}
+		}
+
+		// Trailers
+		do {
+			if(auto ec = conn.read_line(timeout, line); ec) {
+				return failed("failed to read trailers", ec);
+			}
+		} while(!line.empty());
+	} else if(content_length) {
+		auto size = std::uint64_t{0};
+		auto [ptr, ec] = std::from_chars(
+			content_length->data(),
+			content_length->data() + content_length->size(),
+			size
+		);
+		auto content_length_end = content_length->data() + content_length->size();
+		if(ec != std::errc{} || ptr != content_length_end) {
+			return {.error = "malformed Content-Length"};
+		}
+
+		if(!read_body_bytes(size)) {
+			return result;
+		}
+	} else {
+		// Body ends when the server closes the connection
+		result.keep_alive = false;
+		while(true) {
+			if(!deliver(conn.buffered)) {
+				return result;
+			}
+			conn.buffered.clear();
+
+			auto ec = conn.read_some(timeout);
+			if(is_end_of_stream(ec)) {
+				if(!deliver(conn.buffered)) {
+					return result;
+				}
+				break;
+			}
+			if(ec) {
+				return failed("failed to read body", ec);
+			}
+		}
+	}
+
+	if(gunzip) {
+		auto status = gunzip->finish(sink);
+		if(status == bzlreg::decompress_status::stopped) {
+			result.aborted = true;
+		} else if(
+			status == bzlreg::decompress_status::error || !gunzip->finished()
+		) {
+			result.error = "malformed gzip body";
+		}
+	}
+
+	// Anything left over would be read as the next response
+	if(!conn.buffered.empty()) {
+		result.keep_alive = false;
+	}
+
+	return result;
+}
+} // namespace
+
+auto bzlreg::http_response::header( //
+	std::string_view name
+) const -> std::optional<std::string_view> {
+	for(const auto& header : headers) {
+		if(absl::EqualsIgnoreCase(header.name, name)) {
+			return header.value;
+		}
+	}
+	return std::nullopt;
+}
+
+auto bzlreg::http_response::ok() const noexcept -> bool {
+	return status >= 200 && status < 300;
+}
+
+struct bzlreg::http_client::impl {
+	asio::ssl::context ssl_ctx{asio::ssl::context::tls_client};
+
+	/**
+	 * Read from the environment once, like curl does for each invocation
+	 */
+	std::optional<http_proxy> proxy_for_http;
+	std::optional<http_proxy> proxy_for_https;
+	std::vector<std::string>  no_proxy;
+
+	std::mutex idle_mutex;
+	std::unordered_map<
+		std::string,
+		std::vector<std::unique_ptr<http_connection>>>
+		idle;
+
+	impl() {
+		auto ec = error_code{};
+		ssl_ctx.set_default_verify_paths(ec);
+		for(auto path : CA_BUNDLE_PATHS) {
+			if(!fs::exists(path)) {
+				continue;
+			}
+			ssl_ctx.load_verify_file(path, ec);
+			if(!ec) {
+				break;
+			}
+		}
+#ifdef _WIN32
+		load_windows_root_certificates(ssl_ctx);
+#endif
+
+		// Lower case first, it is what most tools read
+		proxy_for_http = proxy_from_env({"http_proxy", "HTTP_PROXY"});
+		proxy_for_https = proxy_from_env({"https_proxy", "HTTPS_PROXY"});
+		for(auto env_name : {"no_proxy", "NO_PROXY"}) {
+			auto value = std::getenv(env_name);
+			if(value != nullptr && *value != '\0') {
+				for(auto entry : absl::StrSplit(value, ',', absl::SkipWhitespace{})) {
+					no_proxy.emplace_back(absl::StripAsciiWhitespace(entry));
+				}
+				break;
+			}
+		}
+	}
+
+	auto proxy_for(const http_target& target) const
+		-> std::optional<http_proxy> {
+		if(matches_no_proxy(target.host, no_proxy)) {
+			return std::nullopt;
+		}
+		return target.tls ? proxy_for_https : proxy_for_http;
+	}
+
+	auto acquire(const std::string& key) -> std::unique_ptr<http_connection> {
+		auto lock = std::lock_guard{idle_mutex};
+		auto itr = idle.find(key);
+		if(itr == idle.end() || itr->second.empty()) {
+			return nullptr;
+		}
+
+		auto conn = std::move(itr->second.back());
+		itr->second.pop_back();
+		return conn;
+	}
+
+	auto release(const std::string& key, std::unique_ptr<http_connection> conn)
+		-> void {
+		auto lock = std::lock_guard{idle_mutex};
+		auto& connections = idle[key];
+		if(connections.size() < HTTP_MAX_IDLE_CONNECTIONS_PER_HOST) {
+			connections.emplace_back(std::move(conn));
+		}
+	}
+};
+
+bzlreg::http_client::http_client() : _impl(std::make_unique<impl>()) {
+}
+
+bzlreg::http_client::http_client(http_client&&) noexcept = default;
+
+bzlreg::http_client::~http_client() = default;
+
+auto bzlreg::http_client::get(
+	std::string_view            url,
+	const http_body_sink&       sink,
+	const http_request_options& options
+) -> std::optional<http_response> {
+	auto current_url = std::string{url};
+	auto redirect_count = 0u;
+
+	while(true) {
+		auto target = parse_http_target(current_url);
+		if(!target) {
+			std::println(stderr, "ERROR: unsupported URL {}", current_url);
+			return std::nullopt;
+		}
+		target->proxy = _impl->proxy_for(*target);
+
+		auto key = target->pool_key();
+		auto response = http_response{};
+		auto result = exchange_result{};
+
+		// A pooled connection may have been closed by the server while idle, in
+		// which case the request is retried once on a new connection
+		for(auto attempt = 0; attempt < 2; ++attempt) {
+			auto conn = _impl->acquire(key);
+			auto reused = conn != nullptr;
+			if(!conn) {
+				conn = std::make_unique<http_connection>(_impl->ssl_ctx, target->tls);
+				conn->stop_token = options.stop_token;
+				if(auto ec = conn->connect(*target, options.timeout); ec) {
+					if(options.stop_token.stop_requested()) {
+						return std::nullopt;
+					}
+					std::println(
+						stderr,
+						"ERROR: failed to connect to {}: {}",
+						key,
+						ec.message()
+					);
+					return std::nullopt;
+				}
+			}
+
+			conn->stop_token = options.stop_token;
+			response = http_response{.url = current_url};
+			result = exchange(*conn, *target, options, sink, response);
+
+			// A stop may still close the connection from its io_context
+			if(options.stop_token.stop_requested()) {
+				return std::nullopt;
+			}
+
+			if(result.error.empty() && !result.aborted && result.keep_alive) {
+				conn->stop_token = {};
+				_impl->release(key, std::move(conn));
+			}
+
+			if(!reused || !result.nothing_received) {
+				break;
+			}
+		}
+
+		if(result.aborted) {
+			return std::nullopt;
+		}
+
+		if(!result.error.empty()) {
+			std::println(stderr, "ERROR: {}: {}", current_url, result.error);
+			return std::nullopt;
+		}
+
+		auto location = response.header("Location");
+		if(!is_redirect(response.status) || !location) {
+			return response;
+		}
+
+		if(++redirect_count > options.max_redirects) {
+			std::println(stderr, "ERROR: {}: too many redirects", url);
+			return std::nullopt;
+		}
+
+		auto next_url = boost::urls::url{*boost::urls::parse_uri(current_url)};
+		auto location_ref = boost::urls::parse_uri_reference(*location);
+		if(!location_ref || !next_url.resolve(*location_ref)) {
+			std::println(
+				stderr,
+				"ERROR: {}: bad redirect location {}",
+				current_url,
+				*location
+			);
+			return std::nullopt;
+		}
+		next_url.remove_fragment();
+		current_url = next_url.buffer();
+	}
+}
+
+auto bzlreg::default_http_client() -> http_client& {
+	static auto client = http_client{};
+	return client;
+}
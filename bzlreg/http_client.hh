@@ -0,0 +1,112 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stop_token>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bzlreg {
+struct http_header {
+	std::string name;
+	std::string value;
+};
+
+struct http_response;
+
+struct http_request_options {
+	/**
+	 * Sent after the Host, User-Agent, Accept and Accept-Encoding headers
+	 */
+	std::vector<http_header> headers;
+
+	/**
+	 * Ask for gzip bodies and decode them transparently. Off by default so
+	 * archives are passed through byte for byte and keep their integrity.
+	 */
+	bool accept_gzip = false;
+
+	/**
+	 * Applies to resolving, connecting, the TLS handshake and every read and
+	 * write separately
+	 */
+	std::chrono::milliseconds timeout = std::chrono::seconds{30};
+
+	unsigned max_redirects = 10;
+
+	/**
+	 * Abandons the request, even mid read, once a stop is requested
+	 */
+	std::stop_token stop_token;
+
+	/**
+	 * Called with the status and headers of a 2xx response before its body
+	 * reaches the sink. Return `false` to abort the request.
+	 */
+	std::function<bool(const http_response&)> on_response;
+};
+
+struct http_response {
+	unsigned status = 0;
+
+	/**
+	 * URL of the final response after following redirects
+	 */
+	std::string url;
+
+	std::vector<http_header> headers;
+
+	/**
+	 * Value of the first header named `name`, compared case insensitively
+	 */
+	auto header(std::string_view name) const -> std::optional<std::string_view>;
+
+	/**
+	 * `true` for 2xx statuses
+	 */
+	auto ok() const noexcept -> bool;
+};
+
+/**
+ * Receives the body of a 2xx response as it arrives. Return `false` to abort
+ * the request.
+ */
+using http_body_sink = std::function<bool(std::span<const std::byte>)>;
+
+/**
+ * HTTP/1.1 client that keeps idle connections open per scheme, host and port
+ * so repeated requests to the same registry skip the TCP and TLS handshakes.
+ * Safe to share between threads. Each request runs on the calling thread.
+ */
+class http_client {
+	struct impl;
+	std::unique_ptr<impl> _impl;
+
+public:
+	http_client();
+	http_client(http_client&&) noexcept;
+	~http_client();
+
+	/**
+	 * GETs `url` following redirects. Bodies of non 2xx responses are
+	 * discarded. `std::nullopt` if no final response was received, `sink`
+	 * aborted the request or it was stopped. Network errors are printed to
+	 * stderr.
+	 */
+	auto get(
+		std::string_view            url,
+		const http_body_sink&       sink,
+		const http_request_options& options = {}
+	) -> std::optional<http_response>;
+};
+
+/**
+ * Client shared by the whole process
+ */
+auto default_http_client() -> http_client&;
+} // namespace bzlreg
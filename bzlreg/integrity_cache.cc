@@ -0,0 +1,281 @@
+#include "bzlreg/integrity_cache.hh"
+
+#include <algorithm>
+#include <fstream>
+#include <sys/stat.h>
+#include "nlohmann/json.hpp"
+#include "bzlreg/util.hh"
+
+namespace fs = std::filesystem;
+using json = nlohmann::json;
+
+/**
+ * Bumped whenever the meaning of a cached entry changes
+ */
+constexpr auto INTEGRITY_CACHE_VERSION = 1;
+
+static auto stat_file( //
+	const fs::path& path
+) -> std::optional<bzlreg::integrity_cache::file_stat> {
+#ifdef _WIN32
+	// No inode or sub second timestamps, size and modification time have to do
+	struct _stat64 st;
+	if(::_wstat64(path.c_str(), &st) != 0 || (st.st_mode & _S_IFREG) == 0) {
+		return std::nullopt;
+	}
+	return bzlreg::integrity_cache::file_stat{
+		.size = static_cast<std::uint64_t>(st.st_size),
+		.mtime_ns = static_cast<std::int64_t>(st.st_mtime) * 1'000'000'000,
+		.ctime_ns = static_cast<std::int64_t>(st.st_ctime) * 1'000'000'000,
+	};
+#else
+	struct ::stat st;
+	if(::stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+		return std::nullopt;
+	}
+#	if defined(__APPLE__)
+	auto mtime = st.st_mtimespec;
+	auto ctime = st.st_ctimespec;
+#	else
+	auto mtime = st.st_mtim;
+	auto ctime = st.st_ctim;
+#	endif
+	return bzlreg::integrity_cache::file_stat{
+		.size = static_cast<std::uint64_t>(st.st_size),
+		.mtime_ns = static_cast<std::int64_t>(mtime.tv_sec) * 1'000'000'000 +
+			mtime.tv_nsec,
+		.ctime_ns = static_cast<std::int64_t>(ctime.tv_sec) * 1'000'000'000 +
+			ctime.tv_nsec,
+		.inode = static_cast<std::uint64_t>(st.st_ino),
+	};
+#endif
+}
+
+/**
+ * A file whose modification time is this close to when it was hashed may be
+ * rewritten without its stat changing
+ */
+static auto is_racy(const bzlreg::integrity_cache::file_stat& stat) -> bool {
+	auto now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::system_clock::now().time_since_epoch()
+	);
+	auto window =
+		std::chrono::nanoseconds{bzlreg::INTEGRITY_CACHE_RACY_WINDOW}.count();
+	return std::max(stat.mtime_ns, stat.ctime_ns) > now.count() - window;
+}
+
+/**
+ * Integrities of an entry are stored as one string separated by spaces, the
+ * same as a subresource integrity with multiple hashes
+ */
+static auto split_integrities( //
+	std::string_view str
+) -> std::vector<std::string> {
+	auto integrities = std::vector<std::string>{};
+	while(!str.empty()) {
+		auto space = str.find(' ');
+		if(space != 0) {
+			integrities.emplace_back(str.substr(0, space));
+		}
+		if(space == std::string_view::npos) {
+			break;
+		}
+		str.remove_prefix(space + 1);
+	}
+	return integrities;
+}
+
+static auto join_integrities( //
+	const std::vector<std::string>& integrities
+) -> std::string {
+	auto result = std::string{};
+	for(const auto& integrity : integrities) {
+		if(!result.empty()) {
+			result += ' ';
+		}
+		result += integrity;
+	}
+	return result;
+}
+
+static auto find_integrity(
+	const std::vector<std::string>& integrities,
+	bzlreg::integrity_algorithm     algorithm
+) -> std::vector<std::string>::const_iterator {
+	return std::ranges::find_if(integrities, [&](const auto& integrity) {
+		return bzlreg::integrity_algorithm_of(integrity) == algorithm;
+	});
+}
+
+bzlreg::integrity_cache::integrity_cache(const fs::path& registry_dir)
+	: _path(registry_dir / ".bzlreg" / "integrity_cache.json") {
+	auto file = std::ifstream{_path, std::ios::binary};
+	if(!file) {
+		return;
+	}
+
+	try {
+		auto cache = json::parse(file);
+		if(cache.at("version").get<int>() != INTEGRITY_CACHE_VERSION) {
+			_modified = true;
+			return;
+		}
+
+		for(auto&& [path, value] : cache.at("files").items()) {
+			_entries.emplace(
+				path,
+				entry{
+					.stat =
+						{
+							.size = value.at("size").get<std::uint64_t>(),
+							.mtime_ns = value.at("mtime_ns").get<std::int64_t>(),
+							.ctime_ns = value.at("ctime_ns").get<std::int64_t>(),
+							.inode = value.at("inode").get<std::uint64_t>(),
+						},
+					.integrities = split_integrities(
+						value.at("integrity").get<std::string>()
+					),
+				}
+			);
+		}
+	} catch(const json::exception&) {
+		// Overwritten on save
+		_entries.clear();
+		_modified = true;
+	}
+}
+
+auto bzlreg::integrity_cache::file_integrities( //
+	const fs::path&                      path,
+	std::span<const integrity_algorithm> algorithms,
+	std::error_code&                     ec
+) -> std::optional<std::vector<std::string>> {
+	ec = {};
+
+	auto key = fs::absolute(path, ec).lexically_normal().generic_string();
+	if(ec) {
+		return std::nullopt;
+	}
+
+	auto stat_before = stat_file(path);
+	if(stat_before) {
+		auto lock = std::scoped_lock{_mutex};
+		auto itr = _entries.find(key);
+		if(itr != _entries.end() && itr->second.stat == *stat_before) {
+			const auto& cached = itr->second.integrities;
+			auto integrities = std::vector<std::string>{};
+			integrities.reserve(algorithms.size());
+			for(auto algorithm : algorithms) {
+				auto integrity = find_integrity(cached, algorithm);
+				if(integrity == cached.end()) {
+					break;
+				}
+				integrities.emplace_back(*integrity);
+			}
+
+			if(integrities.size() == algorithms.size()) {
+				itr->second.used = true;
+				return integrities;
+			}
+		}
+	}
+
+	auto integrities = calc_file_integrities(path, ec, algorithms);
+	if(!integrities) {
+		return std::nullopt;
+	}
+
+	// Only cache what is known to match the stat, a file rewritten while it
+	// was being read is hashed again next time
+	auto stat_after = stat_file(path);
+	auto lock = std::scoped_lock{_mutex};
+	if(
+		stat_before && stat_after && *stat_before == *stat_after &&
+		!is_racy(*stat_after)
+	) {
+		// Algorithms cached for the same stat are still valid and kept
+		auto cached = *integrities;
+		auto itr = _entries.find(key);
+		if(itr != _entries.end() && itr->second.stat == *stat_after) {
+			for(auto& integrity : itr->second.integrities) {
+				auto algorithm = integrity_algorithm_of(integrity);
+				if(algorithm && find_integrity(cached, *algorithm) == cached.end()) {
+					cached.emplace_back(std::move(integrity));
+				}
+			}
+		}
+
+		_entries.insert_or_assign(
+			key,
+			entry{
+				.stat = *stat_after,
+				.integrities = std::move(cached),
+				.used = true,
+			}
+		);
+		_modified = true;
+	} else if(_entries.erase(key) > 0) {
+		_modified = true;
+	}
+
+	return integrities;
+}
+
+auto bzlreg::integrity_cache::save() -> void {
+	auto lock = std::scoped_lock{_mutex};
+
+	for(auto itr = _entries.begin(); itr != _entries.end();) {
+		auto ec = std::error_code{};
+		if(!itr->second.used && !fs::exists(itr->first, ec) && !ec) {
+			itr = _entries.erase(itr);
+			_modified = true;
+		} else {
+			++itr;
+		}
+	}
+
+	if(!_modified) {
+		return;
+	}
+
+	auto files = json::object();
+	for(const auto& [path, entry] : _entries) {
+		// Paths that aren't valid UTF-8 can't be stored as JSON, those files are
+		// hashed every time instead
+		try {
+			static_cast<void>(json(path).dump());
+		} catch(const json::exception&) {
+			continue;
+		}
+
+		files[path] = {
+			{"size", entry.stat.size},
+			{"mtime_ns", entry.stat.mtime_ns},
+			{"ctime_ns", entry.stat.ctime_ns},
+			{"inode", entry.stat.inode},
+			{"integrity", join_integrities(entry.integrities)},
+		};
+	}
+
+	auto ec = std::error_code{};
+	auto cache_dir = _path.parent_path();
+	fs::create_directories(cache_dir, ec);
+	if(ec) {
+		return;
+	}
+
+	// Keeps the cache out of the registry's git repository
+	if(!fs::exists(cache_dir / ".gitignore", ec)) {
+		std::ofstream{cache_dir / ".gitignore", std::ios::binary} << "*\n";
+	}
+
+	auto data = json{
+		{"version", INTEGRITY_CACHE_VERSION},
+		{"files", std::move(files)},
+	}.dump();
+
+	// Renamed into place so concurrent runs never see a partially written cache
+	if(bzlreg::write_file_atomic(_path, data)) {
+		_modified = false;
+	}
+}
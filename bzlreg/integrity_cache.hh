@@ -0,0 +1,78 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <system_error>
+#include <unordered_map>
+#include <vector>
+#include "bzlreg/util.hh"
+
+namespace bzlreg {
+/**
+ * Files modified this recently aren't cached. Their modification time may
+ * not change if they are written again within the file system's timestamp
+ * granularity.
+ */
+constexpr auto INTEGRITY_CACHE_RACY_WINDOW = std::chrono::seconds{2};
+
+/**
+ * Integrity of patch and overlay files keyed by path, size, modification
+ * time, change time and inode so unchanged files aren't read and hashed
+ * again. Kept in .bzlreg/integrity_cache.json inside of the registry. Safe to
+ * use from multiple threads.
+ */
+class integrity_cache {
+public:
+	struct file_stat {
+		std::uint64_t size = 0;
+		std::int64_t  mtime_ns = 0;
+		std::int64_t  ctime_ns = 0;
+		std::uint64_t inode = 0;
+
+		auto operator==(const file_stat&) const -> bool = default;
+	};
+
+private:
+	struct entry {
+		file_stat stat;
+
+		/**
+		 * At most one integrity per algorithm
+		 */
+		std::vector<std::string> integrities;
+		bool                     used = false;
+	};
+
+	std::filesystem::path                  _path;
+	std::mutex                             _mutex;
+	std::unordered_map<std::string, entry> _entries;
+	bool                                   _modified = false;
+
+public:
+	explicit integrity_cache(const std::filesystem::path& registry_dir);
+	integrity_cache(const integrity_cache&) = delete;
+
+	/**
+	 * Integrity of the file at `path` for each of `algorithms` in the same
+	 * order. The file is read and hashed only if it changed since it was
+	 * cached or one of the algorithms wasn't cached, every algorithm is then
+	 * calculated from the same read. `ec` is set if the file couldn't be read.
+	 */
+	auto file_integrities( //
+		const std::filesystem::path&         path,
+		std::span<const integrity_algorithm> algorithms,
+		std::error_code&                     ec
+	) -> std::optional<std::vector<std::string>>;
+
+	/**
+	 * Writes the cache if anything changed, dropping entries of files that no
+	 * longer exist. Failures are ignored, the cache is only an optimization.
+	 */
+	auto save() -> void;
+};
+} // namespace bzlreg
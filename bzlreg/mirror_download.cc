@@ -0,0 +1,124 @@
+#include "bzlreg/mirror_download.hh"
+
+#include <condition_variable>
+#include <format>
+#include <mutex>
+#include <print>
+#include <stop_token>
+#include <thread>
+#include "bzlreg/download.hh"
+#include "bzlreg/util.hh"
+
+auto bzlreg::mirror_urls(
+	std::span<const std::string> mirrors,
+	std::string_view             url
+) -> std::vector<std::string> {
+	auto host_and_path = url;
+	auto scheme_end = host_and_path.find("://");
+	if(scheme_end != std::string_view::npos) {
+		host_and_path.remove_prefix(scheme_end + 3);
+	}
+	host_and_path = host_and_path.substr(0, host_and_path.find_first_of("?#"));
+
+	auto urls = std::vector<std::string>{};
+	urls.reserve(mirrors.size() + 1);
+	for(const auto& mirror : mirrors) {
+		if(mirror.empty()) {
+			continue;
+		}
+		urls.emplace_back(std::format(
+			"{}{}{}",
+			mirror,
+			mirror.ends_with('/') ? "" : "/",
+			host_and_path
+		));
+	}
+	urls.emplace_back(url);
+	return urls;
+}
+
+auto bzlreg::download_with_mirrors(
+	std::span<const std::string>   urls,
+	std::string_view               integrity,
+	const mirror_download_options& options
+) -> std::optional<std::vector<std::byte>> {
+	auto mutex = std::mutex{};
+	auto finished = std::condition_variable{};
+	auto finished_count = std::size_t{0};
+	auto result = std::optional<std::vector<std::byte>>{};
+	auto algorithm = integrity_algorithm_of(integrity) //
+		.value_or(integrity_algorithm::sha256);
+
+	// Declared after the state they share so going out of scope stops and
+	// joins the downloads that lost before that state is destroyed
+	auto downloads = std::vector<std::jthread>{};
+	downloads.reserve(urls.size());
+
+	auto start_download = [&](std::size_t index) {
+		downloads.emplace_back([&, index](std::stop_token stop_token) {
+			auto& url = urls[index];
+			auto data = std::vector<std::byte>{};
+			auto hasher = integrity_hasher{algorithm};
+			auto status = download_file_stream(
+				url,
+				[&](std::span<const std::byte> chunk) {
+					data.insert(data.end(), chunk.begin(), chunk.end());
+					return hasher.update(chunk);
+				},
+				{
+					.stop_token = stop_token,
+					.timeout = options.stall_timeout,
+				}
+			);
+
+			auto matches = false;
+			if(status == download_status::ok) {
+				matches = hasher.finish() == integrity;
+				if(!matches) {
+					std::println(
+						stderr,
+						"WARN: {} does not match integrity {}",
+						url,
+						integrity
+					);
+				}
+			}
+
+			auto lock = std::scoped_lock{mutex};
+			finished_count += 1;
+			if(matches && !result) {
+				result = std::move(data);
+			}
+			finished.notify_all();
+		});
+	};
+
+	auto lock = std::unique_lock{mutex};
+	auto started_count = std::size_t{0};
+	while(!result && finished_count < urls.size()) {
+		if(started_count == urls.size()) {
+			finished.wait(lock, [&] {
+				return result || finished_count == urls.size();
+			});
+			break;
+		}
+
+		start_download(started_count);
+		started_count += 1;
+
+		// A failure starts the next URL right away instead of after the delay
+		auto finished_before = finished_count;
+		finished.wait_for(lock, options.hedge_delay, [&] {
+			return result || finished_count > finished_before;
+		});
+	}
+
+	if(!result) {
+		std::println(stderr, "ERROR: failed to download any of:");
+		for(const auto& url : urls) {
+			std::println(stderr, "\t{}", url);
+		}
+	}
+
+	return result;
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace bzlreg {
+/**
+ * How long a download may go without finishing before the next candidate URL
+ * is raced against it
+ */
+constexpr auto MIRROR_HEDGE_DELAY = std::chrono::milliseconds{2000};
+
+/**
+ * How long a candidate may go without receiving anything before it is
+ * abandoned
+ */
+constexpr auto MIRROR_STALL_TIMEOUT = std::chrono::milliseconds{10'000};
+
+struct mirror_download_options {
+	std::chrono::milliseconds hedge_delay = MIRROR_HEDGE_DELAY;
+	std::chrono::milliseconds stall_timeout = MIRROR_STALL_TIMEOUT;
+};
+
+/**
+ * Candidate URLs for `url` the way bazel builds them from the `mirrors` of
+ * bazel_registry.json: each mirror followed by the host and path of `url`,
+ * then `url` itself.
+ */
+auto mirror_urls(
+	std::span<const std::string> mirrors,
+	std::string_view             url
+) -> std::vector<std::string>;
+
+/**
+ * Downloads the same file from `urls` in order of preference, keeping the
+ * first body that matches `integrity`. The next URL is started whenever the
+ * running ones haven't finished within `hedge_delay` or one of them fails,
+ * so a slow or stalled origin can't hold up the download. Once a body
+ * matches the remaining downloads are stopped.
+ */
+auto download_with_mirrors(
+	std::span<const std::string>   urls,
+	std::string_view               integrity,
+	const mirror_download_options& options = {}
+) -> std::optional<std::vector<std::byte>>;
+} // namespace bzlreg
@@ -1,112 +1,935 @@
 #include "bzlreg/module_bazel.hh"
 
-#include <unordered_map>
-#include <string>
-#include <string_view>
+#include <algorithm>
 #include <charconv>
-#include "absl/strings/str_split.h"
-#include "absl/strings/ascii.h"
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
 
-struct parse_call_result {
-	std::string_view                                       name;
-	std::unordered_map<std::string_view, std::string_view> attrs;
-	std::string_view                                       contents_after;
+using namespace std::string_view_literals;
+
+namespace {
+enum class token_kind {
+	end,
+	identifier,
+	integer,
+	string,
+	punctuation,
+
+	/**
+	 * Unterminated strings and characters that can't start a token
+	 */
+	invalid,
 };
 
-static auto parse_call( //
-	std::string_view contents
-) -> parse_call_result {
-	auto paren_open = contents.find('(');
-	if(paren_open == std::string::npos) {
-		return {};
+/**
+ * `text` is a view into the source, string tokens include their prefix and
+ * quotes
+ */
+struct token {
+	token_kind       kind = token_kind::end;
+	std::string_view text;
+	std::uint32_t    line = 1;
+	std::uint32_t    column = 1;
+};
+
+class lexer {
+	std::string_view _source;
+	std::size_t      _pos = 0;
+	std::size_t      _line_start = 0;
+	std::uint32_t    _line = 1;
+
+	auto at(std::size_t offset = 0) const -> char {
+		return _pos + offset < _source.size() ? _source[_pos + offset] : '\0';
 	}
-	auto paren_close = contents.find(')', paren_open);
-	if(paren_close == std::string::npos) {
-		return {};
+
+	auto newline() -> void {
+		_line += 1;
+		_line_start = _pos;
 	}
 
-	auto result = parse_call_result{};
-	result.name = absl::StripAsciiWhitespace(contents.substr(0, paren_open));
+	static auto is_identifier_start(char c) -> bool {
+		return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+	}
 
-	std::vector<std::string_view> attr_lines = absl::StrSplit(
-		contents.substr(paren_open + 1, paren_close - paren_open - 1),
-		',',
-		absl::SkipWhitespace()
-	);
+	static auto is_identifier_char(char c) -> bool {
+		return is_identifier_start(c) || (c >= '0' && c <= '9');
+	}
 
-	for(auto attr_line : attr_lines) {
-		std::vector<std::string_view> attr_line_split = absl::StrSplit(
-			attr_line,
-			absl::MaxSplits('=', 1),
-			absl::SkipWhitespace()
-		);
+	/**
+	 * Newlines aren't tokens. MODULE.bazel has no blocks so statements can be
+	 * told apart without them.
+	 */
+	auto skip_whitespace_and_comments() -> void {
+		while(_pos < _source.size()) {
+			auto c = at();
+			if(c == ' ' || c == '\t' || c == '\r' || c == '\f') {
+				_pos += 1;
+			} else if(c == '\n') {
+				_pos += 1;
+				newline();
+			} else if(c == '\\' && at(1) == '\n') {
+				_pos += 2;
+				newline();
+			} else if(c == '#') {
+				auto line_end = _source.find('\n', _pos);
+				_pos = line_end == std::string_view::npos ? _source.size() : line_end;
+			} else {
+				break;
+			}
+		}
+	}
 
-		if(attr_line_split.size() > 1) {
-			auto attr_name = absl::StripAsciiWhitespace(attr_line_split[0]);
-			auto attr_value = absl::StripAsciiWhitespace(attr_line_split[1]);
+	auto scan_string() -> token_kind {
+		auto quote = at();
+		auto triple = at(1) == quote && at(2) == quote;
+		_pos += triple ? 3 : 1;
 
-			result.attrs[attr_name] = attr_value;
+		while(_pos < _source.size()) {
+			auto c = at();
+			if(c == '\\') {
+				if(at(1) == '\n') {
+					_pos += 2;
+					newline();
+				} else {
+					_pos += 2;
+				}
+			} else if(c == quote && (!triple || (at(1) == quote && at(2) == quote))) {
+				_pos += triple ? 3 : 1;
+				return token_kind::string;
+			} else if(c == '\n') {
+				if(!triple) {
+					return token_kind::invalid;
+				}
+				_pos += 1;
+				newline();
+			} else {
+				_pos += 1;
+			}
 		}
+
+		_pos = std::min(_pos, _source.size());
+		return token_kind::invalid;
 	}
 
-	result.contents_after = contents.substr(paren_close + 1);
+public:
+	explicit lexer(std::string_view source) : _source(source) {
+	}
 
-	return result;
-}
+	auto next() -> token {
+		skip_whitespace_and_comments();
 
-static auto attr_as_string(std::string_view attr_value) -> std::string_view {
-	return attr_value.substr(1, attr_value.size() - 2);
-}
+		auto result = token{
+			.line = _line,
+			.column = static_cast<std::uint32_t>(_pos - _line_start + 1),
+		};
+		auto start = _pos;
+		auto c = at();
 
-static auto attr_as_int(std::string_view attr_value) -> int {
-	int attr_num = 0;
-	std::from_chars(
-		attr_value.data(),
-		attr_value.data() + attr_value.size(),
-		attr_num
-	);
+		if(_pos >= _source.size()) {
+			result.kind = token_kind::end;
+		} else if(is_identifier_start(c)) {
+			while(is_identifier_char(at())) {
+				_pos += 1;
+			}
+			result.kind = token_kind::identifier;
 
-	return attr_num;
-}
+			// String prefixes such as r"..."
+			auto prefix = _source.substr(start, _pos - start);
+			if(
+				(at() == '"' || at() == '\'') && prefix.size() <= 2 &&
+				prefix.find_first_not_of("rRbB") == std::string_view::npos
+			) {
+				result.kind = scan_string();
+			}
+		} else if(c >= '0' && c <= '9') {
+			while(is_identifier_char(at())) {
+				_pos += 1;
+			}
+			result.kind = token_kind::integer;
+		} else if(c == '"' || c == '\'') {
+			result.kind = scan_string();
+		} else if(std::strchr("()[]{},:=.+-;*/%<>!|&^~", c) != nullptr) {
+			_pos += 1;
+			result.kind = token_kind::punctuation;
+		} else {
+			_pos += 1;
+			result.kind = token_kind::invalid;
+		}
 
-auto bzlreg::module_bazel::parse( //
-	std::string_view contents
-) -> std::optional<module_bazel> {
-	auto result = parse_call(contents);
+		result.text = _source.substr(start, _pos - start);
+		return result;
+	}
+};
+
+enum class value_kind {
+	none,
+	boolean,
+	integer,
+	string,
+	list,
+
+	/**
+	 * Results of calls, dicts and anything else MODULE.bazel isn't read for
+	 */
+	other,
+};
+
+/**
+ * Strings and list items are views into the source or the module's arena
+ */
+struct starlark_value {
+	value_kind                      kind = value_kind::other;
+	bool                            boolean = false;
+	std::int64_t                    integer = 0;
+	std::string_view                string;
+	std::span<const starlark_value> items;
+};
+
+static_assert(std::is_trivially_copyable_v<starlark_value>);
+static_assert(std::is_trivially_destructible_v<starlark_value>);
+
+struct argument {
+	std::string_view keyword;
+	starlark_value   value;
+
+	/**
+	 * Text of the value expression in the source
+	 */
+	std::string_view source;
+};
+
+class parser {
+	lexer                                                _lexer;
+	token                                                _token;
+	std::pmr::memory_resource&                           _arena;
+	bzlreg::module_bazel&                                _module;
+	std::unordered_map<std::string_view, starlark_value> _globals;
+	bzlreg::module_bazel_parse_error                     _error;
+	bool                                                 _module_called = false;
+
+	/**
+	 * End of the last consumed token so parsed constructs can be mapped back
+	 * to their source text
+	 */
+	const char* _previous_end = nullptr;
+
+	auto advance() -> void {
+		_previous_end = _token.text.data() + _token.text.size();
+		_token = _lexer.next();
+	}
+
+	auto source_since(const char* start) const -> std::string_view {
+		return {start, static_cast<std::size_t>(_previous_end - start)};
+	}
+
+	/**
+	 * Token after the current one without consuming either
+	 */
+	auto peek() const -> token {
+		auto lookahead = _lexer;
+		return lookahead.next();
+	}
+
+	auto is_punctuation(char c) const -> bool {
+		return _token.kind == token_kind::punctuation && _token.text[0] == c;
+	}
 
-	if(result.name != "module") {
-		// TODO(zaucy): report this error
+	auto fail(std::string_view message) -> std::nullopt_t {
+		if(_error.message.empty()) {
+			_error = {
+				.line = _token.line,
+				.column = _token.column,
+				.message = std::string{message},
+			};
+		}
 		return std::nullopt;
 	}
 
-	auto mod = module_bazel{};
-	mod.name = attr_as_string(result.attrs.at("name"));
-	if(result.attrs.contains("version")) {
-		mod.version = attr_as_string(result.attrs.at("version"));
+	auto expect(char c) -> bool {
+		if(!is_punctuation(c)) {
+			fail(std::format("expected '{}' but found '{}'", c, _token.text));
+			return false;
+		}
+		advance();
+		return true;
 	}
-	if(result.attrs.contains("compatibility_level")) {
-		mod.compatibility_level =
-			attr_as_int(result.attrs.at("compatibility_level"));
-	} else {
-		mod.compatibility_level = 1;
+
+	auto allocate_chars(std::size_t size) -> char* {
+		return static_cast<char*>(_arena.allocate(size, alignof(char)));
+	}
+
+	template<typename T>
+	auto allocate_array(std::span<const T> items) -> std::span<const T> {
+		if(items.empty()) {
+			return {};
+		}
+		auto data =
+			static_cast<T*>(_arena.allocate(sizeof(T) * items.size(), alignof(T)));
+		std::uninitialized_copy(items.begin(), items.end(), data);
+		return {data, items.size()};
 	}
 
-	while(!absl::StripAsciiWhitespace(result.contents_after).empty()) {
-		result = parse_call(result.contents_after);
+	static auto append_utf8(char*& out, std::uint32_t code_point) -> void {
+		if(code_point < 0x80) {
+			*out++ = static_cast<char>(code_point);
+		} else if(code_point < 0x800) {
+			*out++ = static_cast<char>(0xC0 | (code_point >> 6));
+			*out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+		} else if(code_point < 0x10000) {
+			*out++ = static_cast<char>(0xE0 | (code_point >> 12));
+			*out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+			*out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+		} else {
+			*out++ = static_cast<char>(0xF0 | (code_point >> 18));
+			*out++ = static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+			*out++ = static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+			*out++ = static_cast<char>(0x80 | (code_point & 0x3F));
+		}
+	}
+
+	/**
+	 * Contents of a string literal. Only strings with escapes are copied, an
+	 * escape is never shorter than what it stands for.
+	 */
+	auto string_literal(std::string_view text) -> std::string_view {
+		auto prefix_size = text.find_first_of("\"'");
+		auto raw = text.substr(0, prefix_size).find_first_of("rR") !=
+			std::string_view::npos;
+		auto quote = text[prefix_size];
+		auto quote_size = text.size() - prefix_size >= 6 &&
+				text[prefix_size + 1] == quote && text[prefix_size + 2] == quote
+			? std::size_t{3}
+			: std::size_t{1};
+		auto body = text.substr(
+			prefix_size + quote_size,
+			text.size() - prefix_size - quote_size * 2
+		);
+
+		if(raw || body.find('\\') == std::string_view::npos) {
+			return body;
+		}
 
-		if(result.name == "bazel_dep") {
-			if(!result.attrs.contains("name")) {
+		auto data = allocate_chars(body.size());
+		auto out = data;
+		for(auto i = std::size_t{0}; i < body.size(); ++i) {
+			if(body[i] != '\\' || i + 1 == body.size()) {
+				*out++ = body[i];
 				continue;
 			}
-			if(!result.attrs.contains("version")) {
-				continue;
+
+			auto escaped = body[++i];
+			switch(escaped) {
+				case '\n':
+					break;
+				case 'n':
+					*out++ = '\n';
+					break;
+				case 't':
+					*out++ = '\t';
+					break;
+				case 'r':
+					*out++ = '\r';
+					break;
+				case 'a':
+					*out++ = '\a';
+					break;
+				case 'b':
+					*out++ = '\b';
+					break;
+				case 'f':
+					*out++ = '\f';
+					break;
+				case 'v':
+					*out++ = '\v';
+					break;
+				case '\\':
+				case '\'':
+				case '"':
+					*out++ = escaped;
+					break;
+				case 'x':
+				case 'u':
+				case 'U': {
+					auto digit_count = escaped == 'x' ? 2 : escaped == 'u' ? 4 : 8;
+					auto code_point = std::uint32_t{0};
+					auto digits = body.substr(i + 1, digit_count);
+					auto [end, ec] = std::from_chars(
+						digits.data(),
+						digits.data() + digits.size(),
+						code_point,
+						16
+					);
+					if(ec != std::errc{} || end != digits.data() + digit_count) {
+						*out++ = '\\';
+						*out++ = escaped;
+						break;
+					}
+					if(escaped == 'x') {
+						*out++ = static_cast<char>(code_point);
+					} else {
+						append_utf8(out, code_point);
+					}
+					i += digit_count;
+					break;
+				}
+				default:
+					if(escaped >= '0' && escaped <= '7') {
+						auto code = 0;
+						auto digit_count = 0;
+						for(; digit_count < 3 && i < body.size(); ++digit_count, ++i) {
+							if(body[i] < '0' || body[i] > '7') {
+								break;
+							}
+							code = code * 8 + (body[i] - '0');
+						}
+						i -= 1;
+						*out++ = static_cast<char>(code);
+					} else {
+						// Unknown escapes are kept as written
+						*out++ = '\\';
+						*out++ = escaped;
+					}
+					break;
 			}
+		}
 
-			mod.bazel_deps.emplace_back(
-				std::string{attr_as_string(result.attrs.at("name"))},
-				std::string{attr_as_string(result.attrs.at("version"))}
+		return {data, static_cast<std::size_t>(out - data)};
+	}
+
+	auto integer_literal(std::string_view text) -> std::optional<std::int64_t> {
+		auto base = 10;
+		if(text.size() > 2 && text[0] == '0') {
+			if(text[1] == 'x' || text[1] == 'X') {
+				base = 16;
+			} else if(text[1] == 'o' || text[1] == 'O') {
+				base = 8;
+			} else if(text[1] == 'b' || text[1] == 'B') {
+				base = 2;
+			}
+		}
+		if(base != 10) {
+			text.remove_prefix(2);
+		}
+
+		auto result = std::int64_t{0};
+		auto [end, ec] =
+			std::from_chars(text.data(), text.data() + text.size(), result, base);
+		if(ec != std::errc{} || end != text.data() + text.size()) {
+			return std::nullopt;
+		}
+		return result;
+	}
+
+	/**
+	 * Items of a comma separated sequence up to `close`. Trailing commas are
+	 * allowed.
+	 */
+	auto parse_sequence( //
+		char close
+	) -> std::optional<std::vector<starlark_value>> {
+		auto items = std::vector<starlark_value>{};
+		while(!is_punctuation(close)) {
+			auto item = parse_expression();
+			if(!item) {
+				return std::nullopt;
+			}
+			items.emplace_back(*item);
+
+			if(!is_punctuation(',')) {
+				break;
+			}
+			advance();
+		}
+
+		if(!expect(close)) {
+			return std::nullopt;
+		}
+		return items;
+	}
+
+	auto parse_dict() -> std::optional<starlark_value> {
+		while(!is_punctuation('}')) {
+			if(!parse_expression() || !expect(':') || !parse_expression()) {
+				return std::nullopt;
+			}
+			if(!is_punctuation(',')) {
+				break;
+			}
+			advance();
+		}
+
+		if(!expect('}')) {
+			return std::nullopt;
+		}
+		return starlark_value{};
+	}
+
+	auto parse_primary() -> std::optional<starlark_value> {
+		auto current = _token;
+		switch(current.kind) {
+			case token_kind::string:
+				advance();
+				return starlark_value{
+					.kind = value_kind::string,
+					.string = string_literal(current.text),
+				};
+			case token_kind::integer: {
+				auto integer = integer_literal(current.text);
+				if(!integer) {
+					return fail(std::format("invalid integer '{}'", current.text));
+				}
+				advance();
+				return starlark_value{.kind = value_kind::integer, .integer = *integer};
+			}
+			case token_kind::identifier: {
+				advance();
+				if(current.text == "True"sv || current.text == "False"sv) {
+					return starlark_value{
+						.kind = value_kind::boolean,
+						.boolean = current.text == "True"sv,
+					};
+				}
+				if(current.text == "None"sv) {
+					return starlark_value{.kind = value_kind::none};
+				}
+				auto global = _globals.find(current.text);
+				return global != _globals.end() ? global->second : starlark_value{};
+			}
+			case token_kind::punctuation:
+				break;
+			case token_kind::end:
+				return fail("unexpected end of file");
+			case token_kind::invalid:
+				if(current.text.find_first_of("\"'") != std::string_view::npos) {
+					return fail("unterminated string");
+				}
+				return fail(std::format("unexpected '{}'", current.text));
+		}
+
+		if(is_punctuation('[')) {
+			advance();
+			auto items = parse_sequence(']');
+			if(!items) {
+				return std::nullopt;
+			}
+			return starlark_value{
+				.kind = value_kind::list,
+				.items = allocate_array(std::span<const starlark_value>{*items}),
+			};
+		}
+
+		if(is_punctuation('{')) {
+			advance();
+			return parse_dict();
+		}
+
+		if(is_punctuation('(')) {
+			advance();
+			auto items = parse_sequence(')');
+			if(!items) {
+				return std::nullopt;
+			}
+			// Parentheses around a single expression, anything else is a tuple
+			if(items->size() == 1) {
+				return items->front();
+			}
+			return starlark_value{
+				.kind = value_kind::list,
+				.items = allocate_array(std::span<const starlark_value>{*items}),
+			};
+		}
+
+		return fail(std::format("unexpected '{}'", current.text));
+	}
+
+	/**
+	 * Calls, attribute access and indexing. Only calls of plain names can be
+	 * MODULE.bazel directives, `callee` is empty for anything else.
+	 */
+	auto parse_postfix() -> std::optional<starlark_value> {
+		auto callee = _token.kind == token_kind::identifier //
+			? _token.text
+			: std::string_view{};
+		auto start = _token.text.data();
+
+		auto result = parse_primary();
+		while(result) {
+			if(is_punctuation('(')) {
+				advance();
+				result = parse_call(callee, start);
+			} else if(is_punctuation('.')) {
+				advance();
+				if(_token.kind != token_kind::identifier) {
+					return fail("expected attribute name");
+				}
+				advance();
+				result = starlark_value{};
+			} else if(is_punctuation('[')) {
+				advance();
+				if(!parse_expression() || !expect(']')) {
+					return std::nullopt;
+				}
+				result = starlark_value{};
+			} else {
+				break;
+			}
+			callee = {};
+		}
+
+		return result;
+	}
+
+	auto parse_unary() -> std::optional<starlark_value> {
+		if(is_punctuation('-')) {
+			advance();
+			auto operand = parse_unary();
+			if(operand && operand->kind == value_kind::integer) {
+				operand->integer = -operand->integer;
+			}
+			return operand;
+		}
+		return parse_postfix();
+	}
+
+	auto concat( //
+		const starlark_value& lhs,
+		const starlark_value& rhs
+	) -> starlark_value {
+		if(lhs.kind == value_kind::integer && rhs.kind == value_kind::integer) {
+			return {
+				.kind = value_kind::integer,
+				.integer = lhs.integer + rhs.integer,
+			};
+		}
+
+		if(lhs.kind == value_kind::string && rhs.kind == value_kind::string) {
+			auto size = lhs.string.size() + rhs.string.size();
+			auto data = allocate_chars(size);
+			std::ranges::copy(lhs.string, data);
+			std::ranges::copy(rhs.string, data + lhs.string.size());
+			return {.kind = value_kind::string, .string = {data, size}};
+		}
+
+		if(lhs.kind == value_kind::list && rhs.kind == value_kind::list) {
+			auto items = std::vector<starlark_value>{};
+			items.reserve(lhs.items.size() + rhs.items.size());
+			items.insert(items.end(), lhs.items.begin(), lhs.items.end());
+			items.insert(items.end(), rhs.items.begin(), rhs.items.end());
+			return {
+				.kind = value_kind::list,
+				.items = allocate_array(std::span<const starlark_value>{items}),
+			};
+		}
+
+		return {};
+	}
+
+	auto is_keyword(std::string_view keyword) const -> bool {
+		return _token.kind == token_kind::identifier && _token.text == keyword;
+	}
+
+	auto parse_sum() -> std::optional<starlark_value> {
+		auto result = parse_unary();
+		while(result && is_punctuation('+')) {
+			advance();
+			auto rhs = parse_unary();
+			if(!rhs) {
+				return std::nullopt;
+			}
+			result = concat(*result, *rhs);
+		}
+		return result;
+	}
+
+	/**
+	 * Sums and `a if condition else b`
+	 */
+	auto parse_expression() -> std::optional<starlark_value> {
+		auto result = parse_sum();
+		if(!result || !is_keyword("if")) {
+			return result;
+		}
+
+		advance();
+		auto condition = parse_sum();
+		if(!condition) {
+			return std::nullopt;
+		}
+		if(!is_keyword("else")) {
+			return fail(std::format("expected 'else' but found '{}'", _token.text));
+		}
+		advance();
+		auto otherwise = parse_expression();
+		if(!otherwise) {
+			return std::nullopt;
+		}
+
+		if(condition->kind == value_kind::boolean) {
+			return condition->boolean ? result : otherwise;
+		}
+		return starlark_value{};
+	}
+
+	static auto find_argument( //
+		std::span<const argument> arguments,
+		std::string_view          keyword
+	) -> const starlark_value* {
+		for(const auto& argument : arguments) {
+			if(argument.keyword == keyword) {
+				return &argument.value;
+			}
+		}
+		return nullptr;
+	}
+
+	static auto argument_source( //
+		std::span<const argument> arguments,
+		std::string_view          keyword
+	) -> std::string_view {
+		for(const auto& argument : arguments) {
+			if(argument.keyword == keyword) {
+				return argument.source;
+			}
+		}
+		return {};
+	}
+
+	auto string_argument( //
+		std::span<const argument> arguments,
+		std::string_view          keyword
+	) -> std::string_view {
+		auto arg = find_argument(arguments, keyword);
+		return arg && arg->kind == value_kind::string //
+			? arg->string
+			: std::string_view{};
+	}
+
+	auto int_argument( //
+		std::span<const argument> arguments,
+		std::string_view          keyword,
+		int                       default_value
+	) -> int {
+		auto arg = find_argument(arguments, keyword);
+		return arg && arg->kind == value_kind::integer //
+			? static_cast<int>(arg->integer)
+			: default_value;
+	}
+
+	auto bool_argument( //
+		std::span<const argument> arguments,
+		std::string_view          keyword
+	) -> bool {
+		auto arg = find_argument(arguments, keyword);
+		return arg && arg->kind == value_kind::boolean && arg->boolean;
+	}
+
+	auto string_list_argument( //
+		std::span<const argument> arguments,
+		std::string_view          keyword
+	) -> std::span<const std::string_view> {
+		auto arg = find_argument(arguments, keyword);
+		if(!arg || arg->kind != value_kind::list) {
+			return {};
+		}
+
+		auto strings = std::vector<std::string_view>{};
+		strings.reserve(arg->items.size());
+		for(const auto& item : arg->items) {
+			if(item.kind == value_kind::string) {
+				strings.emplace_back(item.string);
+			}
+		}
+		return allocate_array(std::span<const std::string_view>{strings});
+	}
+
+	/**
+	 * Records the MODULE.bazel directives bzlreg reads
+	 */
+	auto apply_call( //
+		std::string_view          callee,
+		std::string_view          call,
+		std::span<const argument> arguments
+	) -> bool {
+		if(callee == "module"sv) {
+			if(_module_called) {
+				fail("module() can only be called once");
+				return false;
+			}
+			_module_called = true;
+			_module.module_call = call;
+			_module.name = string_argument(arguments, "name");
+			_module.version = string_argument(arguments, "version");
+			_module.repo_name = string_argument(arguments, "repo_name");
+			_module.compatibility_level =
+				int_argument(arguments, "compatibility_level", 0);
+		} else if(callee == "bazel_dep"sv) {
+			auto name = string_argument(arguments, "name");
+			if(name.empty()) {
+				fail("bazel_dep() is missing a name");
+				return false;
+			}
+			_module.bazel_deps.emplace_back(bzlreg::bazel_dep{
+				.name = name,
+				.version = string_argument(arguments, "version"),
+				.repo_name = string_argument(arguments, "repo_name"),
+				.dev_dependency = bool_argument(arguments, "dev_dependency"),
+				.call = call,
+				.name_source = argument_source(arguments, "name"),
+				.version_source = argument_source(arguments, "version"),
+			});
+		} else if(callee == "single_version_override"sv) {
+			_module.single_version_overrides.emplace_back(
+				bzlreg::single_version_override{
+					.module_name = string_argument(arguments, "module_name"),
+					.version = string_argument(arguments, "version"),
+					.registry = string_argument(arguments, "registry"),
+					.patches = string_list_argument(arguments, "patches"),
+					.patch_strip = int_argument(arguments, "patch_strip", 0),
+				}
 			);
+		} else if(callee == "git_override"sv) {
+			_module.git_overrides.emplace_back(bzlreg::git_override{
+				.module_name = string_argument(arguments, "module_name"),
+				.remote = string_argument(arguments, "remote"),
+				.commit = string_argument(arguments, "commit"),
+				.tag = string_argument(arguments, "tag"),
+				.branch = string_argument(arguments, "branch"),
+				.strip_prefix = string_argument(arguments, "strip_prefix"),
+				.patches = string_list_argument(arguments, "patches"),
+				.patch_strip = int_argument(arguments, "patch_strip", 0),
+				.init_submodules = bool_argument(arguments, "init_submodules"),
+			});
+		} else if(callee == "include"sv) {
+			auto label = string_argument(arguments, "label");
+			if(
+				label.empty() && !arguments.empty() &&
+				arguments[0].keyword.empty() &&
+				arguments[0].value.kind == value_kind::string
+			) {
+				label = arguments[0].value.string;
+			}
+			_module.includes.emplace_back(label);
+		}
+
+		return true;
+	}
+
+	auto parse_call( //
+		std::string_view callee,
+		const char*      call_start
+	) -> std::optional<starlark_value> {
+		auto arguments = std::vector<argument>{};
+		while(!is_punctuation(')')) {
+			auto keyword = std::string_view{};
+			if(_token.kind == token_kind::identifier) {
+				auto next = peek();
+				if(next.kind == token_kind::punctuation && next.text == "="sv) {
+					keyword = _token.text;
+					advance();
+					advance();
+				}
+			}
+
+			auto value_start = _token.text.data();
+			auto arg = parse_expression();
+			if(!arg) {
+				return std::nullopt;
+			}
+			arguments.emplace_back(keyword, *arg, source_since(value_start));
+
+			if(!is_punctuation(',')) {
+				break;
+			}
+			advance();
 		}
+
+		if(!expect(')')) {
+			return std::nullopt;
+		}
+
+		auto call = source_since(call_start);
+		if(!callee.empty() && !apply_call(callee, call, arguments)) {
+			return std::nullopt;
+		}
+		return starlark_value{};
+	}
+
+	/**
+	 * Expressions and assignments to plain names, which later expressions
+	 * can refer to
+	 */
+	auto parse_statement() -> bool {
+		auto target = std::string_view{};
+		if(_token.kind == token_kind::identifier) {
+			auto next = peek();
+			if(next.kind == token_kind::punctuation && next.text == "="sv) {
+				target = _token.text;
+				advance();
+				advance();
+			}
+		}
+
+		auto result = parse_expression();
+		if(!result) {
+			return false;
+		}
+
+		if(!target.empty()) {
+			_globals.insert_or_assign(target, *result);
+		}
+
+		if(is_punctuation(';')) {
+			advance();
+		}
+		return true;
+	}
+
+public:
+	parser(
+		std::string_view           source,
+		std::pmr::memory_resource& arena,
+		bzlreg::module_bazel&      module
+	)
+		: _lexer(source), _arena(arena), _module(module) {
+		advance();
+	}
+
+	auto parse_file() -> bool {
+		while(_token.kind != token_kind::end) {
+			if(!parse_statement()) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	auto error() const -> const bzlreg::module_bazel_parse_error& {
+		return _error;
+	}
+};
+} // namespace
+
+auto bzlreg::module_bazel_parse_error::describe( //
+	std::string_view path
+) const -> std::string {
+	return std::format("{}:{}:{}: {}", path, line, column, message);
+}
+
+auto bzlreg::module_bazel::parse( //
+	std::string_view contents
+) -> std::expected<module_bazel, module_bazel_parse_error> {
+	auto mod = module_bazel{};
+	mod._arena = std::make_unique<std::pmr::monotonic_buffer_resource>();
+
+	auto module_parser = parser{contents, *mod._arena, mod};
+	if(!module_parser.parse_file()) {
+		return std::unexpected{module_parser.error()};
 	}
 
 	return mod;
@@ -1,24 +1,102 @@
 #pragma once
 
-#include <optional>
-#include <vector>
+#include <cstdint>
+#include <expected>
+#include <memory>
+#include <memory_resource>
+#include <span>
 #include <string>
+#include <string_view>
+#include <vector>
 
 namespace bzlreg {
 struct bazel_dep {
 	std::string_view name;
 	std::string_view version;
+	std::string_view repo_name;
+	bool             dev_dependency = false;
+
+	/**
+	 * Source text of the whole call and of the name and version values, views
+	 * into the parsed contents for editing them in place. `version_source` is
+	 * empty when no version is given.
+	 */
+	std::string_view call;
+	std::string_view name_source;
+	std::string_view version_source;
+};
+
+struct single_version_override {
+	std::string_view                  module_name;
+	std::string_view                  version;
+	std::string_view                  registry;
+	std::span<const std::string_view> patches;
+	int                               patch_strip = 0;
+};
+
+struct git_override {
+	std::string_view                  module_name;
+	std::string_view                  remote;
+	std::string_view                  commit;
+	std::string_view                  tag;
+	std::string_view                  branch;
+	std::string_view                  strip_prefix;
+	std::span<const std::string_view> patches;
+	int                               patch_strip = 0;
+	bool                              init_submodules = false;
 };
 
+struct module_bazel_parse_error {
+	std::uint32_t line = 0;
+	std::uint32_t column = 0;
+	std::string   message;
+
+	/**
+	 * `<path>:<line>:<column>: <message>` with `path` being wherever the
+	 * contents came from
+	 */
+	auto describe(std::string_view path) const -> std::string;
+};
+
+/**
+ * The parts of a MODULE.bazel bzlreg cares about. Strings are views into the
+ * parsed contents, which must outlive the module, or into the module's own
+ * arena when they had to be unescaped or concatenated.
+ */
 struct module_bazel {
+	/**
+	 * Parses the Starlark subset MODULE.bazel files are written in, in a
+	 * single pass without copying the contents. Calls other than the ones
+	 * below, such as use_extension and use_repo, are parsed and skipped.
+	 * The first error is returned with its line and column for the caller to
+	 * print, since only it knows where the contents came from.
+	 */
 	static auto parse( //
 		std::string_view contents
-	) -> std::optional<module_bazel>;
+	) -> std::expected<module_bazel, module_bazel_parse_error>;
 
+private:
+	// Declared first so it outlives every view into it
+	std::unique_ptr<std::pmr::monotonic_buffer_resource> _arena;
+
+public:
 	std::string_view name;
 	std::string_view version;
-	int              compatibility_level;
+	std::string_view repo_name;
+	int              compatibility_level = 0;
+
+	/**
+	 * Source text of the module() call, empty without one
+	 */
+	std::string_view module_call;
+
+	std::vector<bazel_dep>               bazel_deps;
+	std::vector<single_version_override> single_version_overrides;
+	std::vector<git_override>            git_overrides;
 
-	std::vector<bazel_dep> bazel_deps;
+	/**
+	 * Labels of include() calls
+	 */
+	std::vector<std::string_view> includes;
 };
 } // namespace bzlreg
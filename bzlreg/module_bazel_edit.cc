@@ -0,0 +1,122 @@
+#include "bzlreg/module_bazel_edit.hh"
+
+#include <algorithm>
+#include <format>
+#include <vector>
+
+namespace {
+/**
+ * Replaces `size` characters at `offset`, or inserts when `size` is 0
+ */
+struct text_edit {
+	std::size_t offset = 0;
+	std::size_t size = 0;
+	std::string replacement;
+};
+} // namespace
+
+static auto offset_of( //
+	std::string_view contents,
+	std::string_view part
+) -> std::size_t {
+	return static_cast<std::size_t>(part.data() - contents.data());
+}
+
+static auto quoted_version( //
+	std::string_view version,
+	std::string_view previous_source
+) -> std::string {
+	// Keeps the quote style of the version being replaced
+	auto quote = previous_source.starts_with('\'') ? '\'' : '"';
+	return std::format("{}{}{}", quote, version, quote);
+}
+
+auto bzlreg::set_bazel_dep_versions(
+	std::string_view                   contents,
+	const module_bazel&                module,
+	std::span<const bazel_dep_version> versions
+) -> std::string {
+	auto edits = std::vector<text_edit>{};
+	auto new_deps = std::string{};
+
+	for(const auto& [name, version] : versions) {
+		auto found = false;
+		for(const auto& dep : module.bazel_deps) {
+			if(dep.name != name) {
+				continue;
+			}
+			found = true;
+
+			if(dep.version == version) {
+				continue;
+			}
+
+			if(!dep.version_source.empty()) {
+				edits.emplace_back(
+					offset_of(contents, dep.version_source),
+					dep.version_source.size(),
+					quoted_version(version, dep.version_source)
+				);
+			} else {
+				edits.emplace_back(
+					offset_of(contents, dep.name_source) + dep.name_source.size(),
+					0,
+					std::format(
+						", version = {}",
+						quoted_version(version, dep.name_source)
+					)
+				);
+			}
+		}
+
+		if(!found) {
+			new_deps += std::format(
+				"\nbazel_dep(name = \"{}\", version = \"{}\")",
+				name,
+				version
+			);
+		}
+	}
+
+	if(!new_deps.empty()) {
+		// After the last bazel_dep, or module() when there are none yet
+		auto anchor = !module.bazel_deps.empty()
+			? module.bazel_deps.back().call
+			: module.module_call;
+		if(anchor.empty()) {
+			// Appended at the end, every entry already starts on its own line
+			if(contents.empty() || contents.ends_with('\n')) {
+				new_deps.erase(0, 1);
+			}
+			new_deps += '\n';
+			edits.emplace_back(contents.size(), 0, std::move(new_deps));
+		} else {
+			if(module.bazel_deps.empty()) {
+				new_deps.insert(0, "\n");
+			}
+			edits.emplace_back(
+				offset_of(contents, anchor) + anchor.size(),
+				0,
+				std::move(new_deps)
+			);
+		}
+	}
+
+	std::ranges::stable_sort(edits, {}, &text_edit::offset);
+
+	auto result = std::string{};
+	result.reserve(contents.size() + 64 * edits.size());
+	auto position = std::size_t{0};
+	for(const auto& edit : edits) {
+		// A name given twice edits the same text, the first one wins
+		if(edit.offset < position) {
+			continue;
+		}
+		result.append(contents.substr(position, edit.offset - position));
+		result.append(edit.replacement);
+		position = edit.offset + edit.size;
+	}
+	result.append(contents.substr(position));
+
+	return result;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <span>
+#include <string>
+#include <string_view>
+#include "bzlreg/module_bazel.hh"
+
+namespace bzlreg {
+struct bazel_dep_version {
+	std::string_view name;
+	std::string_view version;
+};
+
+/**
+ * `contents` with the version of each bazel_dep in `versions` set, adding a
+ * bazel_dep after the last one for names that don't have one yet. `module`
+ * must be parsed from `contents`. Every change is applied in one pass and
+ * everything else, including comments and formatting, is kept as is.
+ */
+auto set_bazel_dep_versions(
+	std::string_view                   contents,
+	const module_bazel&                module,
+	std::span<const bazel_dep_version> versions
+) -> std::string;
+} // namespace bzlreg
@@ -0,0 +1,220 @@
+#include "bzlreg/repository_cache.hh"
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <random>
+#include <string>
+#include <openssl/evp.h>
+#include "bzlreg/util.hh"
+
+namespace fs = std::filesystem;
+
+constexpr auto SHA256_INTEGRITY_PREFIX = std::string_view{"sha256-"};
+constexpr auto SHA256_DIGEST_SIZE = std::size_t{32};
+
+static auto sha256_hex_digest( //
+	std::string_view integrity
+) -> std::optional<std::string> {
+	if(!integrity.starts_with(SHA256_INTEGRITY_PREFIX)) {
+		return std::nullopt;
+	}
+
+	auto b64 = integrity.substr(SHA256_INTEGRITY_PREFIX.size());
+	// 32 bytes are 44 base64 characters with one padding character
+	if(b64.size() != 44) {
+		return std::nullopt;
+	}
+
+	auto digest = std::array<std::uint8_t, 33>{};
+	auto decoded_size = EVP_DecodeBlock(
+		digest.data(),
+		reinterpret_cast<const std::uint8_t*>(b64.data()),
+		b64.size()
+	);
+	if(decoded_size != 33) {
+		return std::nullopt;
+	}
+
+	auto hex = std::string{};
+	hex.reserve(SHA256_DIGEST_SIZE * 2);
+	for(auto i = std::size_t{0}; i < SHA256_DIGEST_SIZE; ++i) {
+		hex += std::format("{:02x}", digest[i]);
+	}
+	return hex;
+}
+
+static auto content_addressable_dir(const fs::path& cache_dir) -> fs::path {
+	return cache_dir / "content_addressable" / "sha256";
+}
+
+auto bzlreg::default_repository_cache_dir() -> std::optional<fs::path> {
+#if defined(_WIN32)
+	auto user_profile = std::getenv("USERPROFILE");
+	auto user_name = std::getenv("USERNAME");
+	if(
+		user_profile == nullptr || *user_profile == '\0' ||
+		user_name == nullptr || *user_name == '\0'
+	) {
+		return std::nullopt;
+	}
+	auto output_user_root =
+		fs::path{user_profile} / std::format("_bazel_{}", user_name);
+#else
+	auto user_name = std::getenv("USER");
+	if(user_name == nullptr || *user_name == '\0') {
+		user_name = std::getenv("LOGNAME");
+	}
+	if(user_name == nullptr || *user_name == '\0') {
+		return std::nullopt;
+	}
+#	if defined(__APPLE__)
+	auto output_user_root =
+		fs::path{"/private/var/tmp"} / std::format("_bazel_{}", user_name);
+#	else
+	auto home_dir = std::getenv("HOME");
+	if(home_dir == nullptr || *home_dir == '\0') {
+		return std::nullopt;
+	}
+	auto output_user_root = fs::path{home_dir} / ".cache" / "bazel" /
+		std::format("_bazel_{}", user_name);
+#	endif
+#endif
+	return output_user_root / "cache" / "repos" / "v1";
+}
+
+auto bzlreg::repository_cache_file_path(
+	const fs::path&  cache_dir,
+	std::string_view integrity
+) -> std::optional<fs::path> {
+	auto hex_digest = sha256_hex_digest(integrity);
+	if(!hex_digest) {
+		return std::nullopt;
+	}
+	return content_addressable_dir(cache_dir) / *hex_digest / "file";
+}
+
+auto bzlreg::read_repository_cache(
+	const fs::path&  cache_dir,
+	std::string_view integrity
+) -> std::optional<std::vector<std::byte>> {
+	auto path = repository_cache_file_path(cache_dir, integrity);
+	if(!path) {
+		return std::nullopt;
+	}
+
+	auto ec = std::error_code{};
+	auto file_size = fs::file_size(*path, ec);
+	if(ec) {
+		return std::nullopt;
+	}
+
+	auto data = std::vector<std::byte>(file_size);
+	auto file = std::ifstream{*path, std::ios::binary};
+	file.read(
+		reinterpret_cast<char*>(data.data()),
+		static_cast<std::streamsize>(data.size())
+	);
+	if(!file || file.gcount() != static_cast<std::streamsize>(data.size())) {
+		return std::nullopt;
+	}
+
+	if(calc_integrity(data) != integrity) {
+		return std::nullopt;
+	}
+
+	return data;
+}
+
+bzlreg::repository_cache_writer::repository_cache_writer(fs::path cache_dir)
+	: _cache_dir(std::move(cache_dir)) {
+	auto cas_dir = content_addressable_dir(_cache_dir);
+	auto ec = std::error_code{};
+	fs::create_directories(cas_dir, ec);
+	if(ec) {
+		return;
+	}
+
+	auto random_device = std::random_device{};
+	_tmp_path = cas_dir /
+		std::format("tmp-{:08x}{:08x}", random_device(), random_device());
+	_file.open(_tmp_path, std::ios::binary);
+}
+
+bzlreg::repository_cache_writer::~repository_cache_writer() {
+	if(!_tmp_path.empty()) {
+		_file.close();
+		auto ec = std::error_code{};
+		fs::remove(_tmp_path, ec);
+	}
+}
+
+auto bzlreg::repository_cache_writer::write( //
+	std::span<const std::byte> data
+) -> void {
+	if(_file.is_open()) {
+		_file.write(
+			reinterpret_cast<const char*>(data.data()),
+			static_cast<std::streamsize>(data.size())
+		);
+	}
+}
+
+auto bzlreg::repository_cache_writer::commit( //
+	std::string_view integrity
+) -> bool {
+	auto path = repository_cache_file_path(_cache_dir, integrity);
+	if(!path || !_file.is_open()) {
+		return false;
+	}
+
+	_file.close();
+	if(!_file) {
+		return false;
+	}
+
+	auto ec = std::error_code{};
+	fs::create_directories(path->parent_path(), ec);
+	if(ec) {
+		return false;
+	}
+
+	// Entries are content addressed so replacing one never changes it
+	fs::rename(_tmp_path, *path, ec);
+	if(ec) {
+		return false;
+	}
+
+	_tmp_path.clear();
+	return true;
+}
+
+auto bzlreg::write_repository_cache(
+	const fs::path&            cache_dir,
+	std::string_view           integrity,
+	std::span<const std::byte> data
+) -> bool {
+	auto algorithm = integrity_algorithm_of(integrity);
+	if(!algorithm) {
+		return false;
+	}
+
+	// Entries are keyed by sha256 whatever algorithm `integrity` uses, both are
+	// calculated in the same pass
+	auto hasher = *algorithm == integrity_algorithm::sha256
+		? integrity_hasher{integrity_algorithm::sha256}
+		: integrity_hasher{*algorithm, integrity_algorithm::sha256};
+	if(!hasher.update(data)) {
+		return false;
+	}
+
+	auto integrities = hasher.finish_each();
+	if(!integrities || integrities->front() != integrity) {
+		return false;
+	}
+
+	auto writer = repository_cache_writer{cache_dir};
+	writer.write(data);
+	return writer.commit(integrities->back());
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <vector>
+
+namespace bzlreg {
+/**
+ * Where bazel keeps its repository cache when --repository_cache isn't given:
+ * cache/repos/v1 inside of the default output user root. `std::nullopt` if
+ * the home directory or user name is unknown.
+ */
+auto default_repository_cache_dir() -> std::optional<std::filesystem::path>;
+
+/**
+ * content_addressable/sha256/<hex digest>/file inside of `cache_dir`, the
+ * same layout bazel uses. `std::nullopt` unless `integrity` is a sha256
+ * integrity string.
+ */
+auto repository_cache_file_path(
+	const std::filesystem::path& cache_dir,
+	std::string_view             integrity
+) -> std::optional<std::filesystem::path>;
+
+/**
+ * Archive with `integrity` from the repository cache. The contents are hashed
+ * again so a corrupt entry is treated as missing. Only sha256 integrities can
+ * be looked up since that is what entries are keyed by.
+ */
+auto read_repository_cache(
+	const std::filesystem::path& cache_dir,
+	std::string_view             integrity
+) -> std::optional<std::vector<std::byte>>;
+
+/**
+ * Streams a download into the repository cache. Data goes to a temporary file
+ * that `commit` moves to its content addressed path once the integrity is
+ * known. The temporary file is removed if it is never committed. Failures
+ * only disable caching, they are not reported.
+ */
+class repository_cache_writer {
+	std::filesystem::path _cache_dir;
+	std::filesystem::path _tmp_path;
+	std::ofstream         _file;
+
+public:
+	explicit repository_cache_writer(std::filesystem::path cache_dir);
+	repository_cache_writer(const repository_cache_writer&) = delete;
+	~repository_cache_writer();
+
+	auto write(std::span<const std::byte> data) -> void;
+
+	/**
+	 * `integrity` must be the integrity of everything passed to `write`
+	 */
+	auto commit(std::string_view integrity) -> bool;
+};
+
+/**
+ * Stores `data` in the repository cache under its sha256. Nothing is stored
+ * unless `data` matches `integrity`, which may use any algorithm.
+ */
+auto write_repository_cache(
+	const std::filesystem::path& cache_dir,
+	std::string_view             integrity,
+	std::span<const std::byte>   data
+) -> bool;
+} // namespace bzlreg
@@ -0,0 +1,721 @@
+#include "bzlreg/tar_extract.hh"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <print>
+#include <ranges>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+#include <boost/asio/post.hpp>
+#include <boost/asio/thread_pool.hpp>
+#include "absl/container/flat_hash_set.h"
+#include "bzlreg/decompress.hh"
+#include "bzlreg/defer.hh"
+#include "bzlreg/tar_view.hh"
+#include "bzlreg/zip_view.hh"
+
+#ifndef _WIN32
+#	include <cerrno>
+#	include <fcntl.h>
+#	include <unistd.h>
+#endif
+
+namespace fs = std::filesystem;
+using bzlreg::util::defer;
+
+namespace {
+/**
+ * Upper bound of file contents buffered for the worker threads. Decoding
+ * waits for writes to finish once it is reached.
+ */
+constexpr auto EXTRACT_MAX_PENDING_BYTES = std::size_t{256} * 1024 * 1024;
+
+/**
+ * Entries at least this large are written straight to their file by the
+ * decoding thread instead of being buffered whole for the worker threads
+ */
+constexpr auto TAR_EXTRACT_STREAM_MIN_SIZE = std::size_t{32} * 1024 * 1024;
+
+/**
+ * One in this many threads writes files, the rest decompress
+ */
+constexpr auto TAR_EXTRACT_WRITE_THREAD_DIVISOR = 4u;
+
+struct pending_link {
+	fs::path path;
+	fs::path target;
+};
+
+/**
+ * Normalized archive relative path of `name`. `std::nullopt` if `name` is
+ * absolute or refers to something outside of the archive root.
+ */
+auto safe_relative_path(std::string_view name) -> std::optional<fs::path> {
+	auto path = fs::path{name}.lexically_normal();
+	if(path.has_root_name() || path.has_root_directory()) {
+		return std::nullopt;
+	}
+
+	if(!path.empty() && !path.has_filename()) {
+		path = path.parent_path();
+	}
+
+	if(path == ".") {
+		return fs::path{};
+	}
+
+	if(!path.empty() && *path.begin() == "..") {
+		return std::nullopt;
+	}
+
+	return path;
+}
+
+/**
+ * Whether the symbolic link `path` to `target` stays inside of the archive
+ * root. Only leading `..` components are allowed since the parent directories
+ * of a link are never links themselves, while a `..` after a component that
+ * may be another link could climb out of wherever that link points.
+ */
+auto safe_symbolic_link(const fs::path& path, const fs::path& target) -> bool {
+	if(target.empty() || target.has_root_name() || target.has_root_directory()) {
+		return false;
+	}
+
+	auto leading = true;
+	for(const auto& component : target) {
+		if(component == "..") {
+			if(!leading) {
+				return false;
+			}
+		} else if(component != ".") {
+			leading = false;
+		}
+	}
+
+	return safe_relative_path((path.parent_path() / target).generic_string())
+		.has_value();
+}
+
+/**
+ * File written in pieces. Closed on destruction if `close` wasn't called.
+ */
+class output_file {
+#ifdef _WIN32
+	std::ofstream _file;
+#else
+	int _fd = -1;
+#endif
+
+public:
+	output_file() = default;
+	output_file(const output_file&) = delete;
+
+	~output_file() {
+		close();
+	}
+
+	/**
+	 * `size` is how large the file is going to be, used as a layout hint
+	 */
+	auto open( //
+		const fs::path& path,
+		std::uint32_t   mode,
+		std::size_t     size
+	) -> std::error_code {
+		close();
+#ifdef _WIN32
+		static_cast<void>(mode);
+		static_cast<void>(size);
+		_file.open(path, std::ios::binary | std::ios::trunc);
+		if(!_file) {
+			return std::make_error_code(std::errc::io_error);
+		}
+#else
+		// Group and other permissions are left to the umask, the owner can always
+		// read and write
+		_fd = ::open(
+			path.c_str(),
+			O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+			static_cast<mode_t>((mode & 0777) | 0600)
+		);
+		if(_fd == -1) {
+			return {errno, std::generic_category()};
+		}
+
+#	ifdef __linux__
+		// Best effort, lets the file system lay out the file in one extent
+		if(size > 0) {
+			::posix_fallocate(_fd, 0, static_cast<off_t>(size));
+		}
+#	else
+		static_cast<void>(size);
+#	endif
+#endif
+		return {};
+	}
+
+	auto write(std::span<const std::byte> contents) -> std::error_code {
+#ifdef _WIN32
+		_file.write(
+			reinterpret_cast<const char*>(contents.data()),
+			static_cast<std::streamsize>(contents.size())
+		);
+		if(!_file) {
+			return std::make_error_code(std::errc::io_error);
+		}
+#else
+		while(!contents.empty()) {
+			auto written = ::write(_fd, contents.data(), contents.size());
+			if(written == -1) {
+				if(errno == EINTR) {
+					continue;
+				}
+				return {errno, std::generic_category()};
+			}
+			contents = contents.subspan(static_cast<std::size_t>(written));
+		}
+#endif
+		return {};
+	}
+
+	auto close() -> std::error_code {
+#ifdef _WIN32
+		if(!_file.is_open()) {
+			return {};
+		}
+		_file.close();
+		if(!_file) {
+			return std::make_error_code(std::errc::io_error);
+		}
+#else
+		if(_fd == -1) {
+			return {};
+		}
+		auto result = ::close(std::exchange(_fd, -1));
+		if(result == -1) {
+			return {errno, std::generic_category()};
+		}
+#endif
+		return {};
+	}
+};
+
+auto write_file(
+	const fs::path&            path,
+	std::span<const std::byte> contents,
+	std::uint32_t              mode
+) -> std::error_code {
+	auto file = output_file{};
+	if(auto ec = file.open(path, mode, contents.size()); ec) {
+		return ec;
+	}
+	if(auto ec = file.write(contents); ec) {
+		return ec;
+	}
+	return file.close();
+}
+
+/**
+ * Whether a parent directory of `path` below `dest_dir` is a symbolic link, in
+ * which case creating `path` would escape the directory the archive intended
+ */
+auto inside_symbolic_link(const fs::path& dest_dir, const fs::path& path)
+	-> bool {
+	auto ec = std::error_code{};
+	for(auto parent = path.parent_path(); !parent.empty();
+			parent = parent.parent_path()) {
+		if(fs::is_symlink(dest_dir / parent, ec)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/**
+ * Creates `links` below `dest_dir` once everything else was extracted so no
+ * file is ever written through a symbolic link
+ */
+auto create_symbolic_links(
+	const fs::path&               dest_dir,
+	std::span<const pending_link> links
+) -> bool {
+	auto ec = std::error_code{};
+	for(const auto& link : links) {
+		if(inside_symbolic_link(dest_dir, link.path)) {
+			std::println(
+				stderr,
+				"ERROR: symbolic link {} is inside of a symbolic link",
+				link.path.generic_string()
+			);
+			return false;
+		}
+
+		fs::remove(dest_dir / link.path, ec);
+		fs::create_symlink(link.target, dest_dir / link.path, ec);
+		if(ec) {
+			std::println(
+				stderr,
+				"ERROR: failed to create symbolic link {}: {}",
+				link.path.generic_string(),
+				ec.message()
+			);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+auto create_dest_dir(const fs::path& dest_dir) -> bool {
+	auto ec = std::error_code{};
+	fs::create_directories(dest_dir, ec);
+	if(ec) {
+		std::println(
+			stderr,
+			"ERROR: failed to create {}: {}",
+			dest_dir.generic_string(),
+			ec.message()
+		);
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Bookkeeping for file writes handed to the worker threads
+ */
+class pending_writes {
+	std::mutex              _mutex;
+	std::condition_variable _done;
+	std::size_t             _count = 0;
+	std::size_t             _bytes = 0;
+	std::string             _error_message;
+
+public:
+	/**
+	 * Blocks until no more than `max_bytes` are pending and reserves `bytes`
+	 */
+	auto reserve(std::size_t bytes, std::size_t max_bytes) -> void {
+		auto lock = std::unique_lock{_mutex};
+		_done.wait(lock, [&] {
+			return _count == 0 || _bytes + bytes <= max_bytes;
+		});
+		_count += 1;
+		_bytes += bytes;
+	}
+
+	auto release(std::size_t bytes, std::string error_message) -> void {
+		{
+			auto lock = std::lock_guard{_mutex};
+			_count -= 1;
+			_bytes -= bytes;
+			if(_error_message.empty()) {
+				_error_message = std::move(error_message);
+			}
+		}
+		_done.notify_all();
+	}
+
+	/**
+	 * Blocks until every reserved write was released
+	 */
+	auto wait_all() -> void {
+		auto lock = std::unique_lock{_mutex};
+		_done.wait(lock, [&] { return _count == 0; });
+	}
+
+	auto error_message() -> std::string {
+		auto lock = std::lock_guard{_mutex};
+		return _error_message;
+	}
+};
+} // namespace
+
+auto bzlreg::extract_tar_archive(
+	std::span<const std::byte> compressed_data,
+	const tar_extract_options& options
+) -> bool {
+	const auto& dest_dir = options.dest_dir;
+	if(!create_dest_dir(dest_dir)) {
+		return false;
+	}
+
+	// The threads are split between decompressing and writing so together
+	// they don't use more than asked for
+	auto thread_count = std::max(options.thread_count, 1u);
+	auto write_thread_count =
+		std::max(thread_count / TAR_EXTRACT_WRITE_THREAD_DIVISOR, 1u);
+	auto decompress_thread_count =
+		std::max(thread_count - write_thread_count, 1u);
+	auto pool = boost::asio::thread_pool{write_thread_count};
+	auto writes = pending_writes{};
+	auto join_pool = defer([&] { pool.join(); });
+
+	auto created_dirs = absl::flat_hash_set<std::string>{};
+	auto written_files = absl::flat_hash_set<std::string>{};
+	auto hard_links = std::vector<pending_link>{};
+	auto symbolic_links = std::vector<pending_link>{};
+	auto error_message = std::string{};
+
+	// Each directory is created once, outermost first
+	auto ensure_directory = [&](const fs::path& path) -> bool {
+		auto missing = std::vector<fs::path>{};
+		for(auto dir = path; !dir.empty(); dir = dir.parent_path()) {
+			if(created_dirs.contains(dir.generic_string())) {
+				break;
+			}
+			missing.emplace_back(dir);
+		}
+
+		for(const auto& dir : missing | std::views::reverse) {
+			auto dir_ec = std::error_code{};
+			fs::create_directory(dest_dir / dir, dir_ec);
+			if(
+				dir_ec || fs::is_symlink(dest_dir / dir, dir_ec) ||
+				!fs::is_directory(dest_dir / dir, dir_ec)
+			) {
+				error_message = std::format(
+					"failed to create directory {}",
+					dir.generic_string()
+				);
+				return false;
+			}
+			created_dirs.insert(dir.generic_string());
+		}
+
+		return true;
+	};
+
+	auto file_path = fs::path{};
+	auto file_mode = std::uint32_t{};
+	auto file_contents = std::vector<std::byte>{};
+	auto streamed_file = output_file{};
+	auto streaming = false;
+
+	// Tar allows later entries to replace earlier ones. Two writers of the
+	// same path must not race.
+	auto claim_file_path = [&] {
+		if(!written_files.insert(file_path.generic_string()).second) {
+			writes.wait_all();
+		}
+	};
+
+	auto submit_file = [&] {
+		claim_file_path();
+
+		auto bytes = file_contents.size();
+		writes.reserve(bytes, EXTRACT_MAX_PENDING_BYTES);
+		boost::asio::post(
+			pool,
+			[&,
+			 path = dest_dir / file_path,
+			 contents = std::move(file_contents),
+			 mode = file_mode] {
+				auto write_error = std::string{};
+				if(auto write_ec = write_file(path, contents, mode); write_ec) {
+					write_error = std::format(
+						"failed to write {}: {}",
+						path.generic_string(),
+						write_ec.message()
+					);
+				}
+				writes.release(contents.size(), std::move(write_error));
+			}
+		);
+		file_contents = {};
+	};
+
+	auto tar = bzlreg::tar_stream{
+		[&](const bzlreg::tar_stream_entry& entry) {
+			auto path = safe_relative_path(entry.name.to_string());
+			if(!path) {
+				error_message = std::format(
+					"entry {} is outside of the archive root",
+					entry.name.to_string()
+				);
+				return bzlreg::tar_stream_action::stop;
+			}
+
+			if(path->empty()) {
+				return bzlreg::tar_stream_action::skip;
+			}
+
+			switch(entry.type) {
+				case bzlreg::tar_entry_type::directory:
+					return ensure_directory(*path) //
+						? bzlreg::tar_stream_action::skip
+						: bzlreg::tar_stream_action::stop;
+				case bzlreg::tar_entry_type::file:
+					break;
+				case bzlreg::tar_entry_type::symbolic_link: {
+					auto target = fs::path{entry.link_name};
+					if(!safe_symbolic_link(*path, target)) {
+						error_message = std::format(
+							"symbolic link {} points outside of the archive root",
+							path->generic_string()
+						);
+						return bzlreg::tar_stream_action::stop;
+					}
+					symbolic_links.emplace_back(*path, target);
+					return ensure_directory(path->parent_path())
+						? bzlreg::tar_stream_action::skip
+						: bzlreg::tar_stream_action::stop;
+				}
+				case bzlreg::tar_entry_type::hard_link: {
+					auto target = safe_relative_path(entry.link_name);
+					if(!target || target->empty()) {
+						error_message = std::format(
+							"hard link {} points outside of the archive root",
+							path->generic_string()
+						);
+						return bzlreg::tar_stream_action::stop;
+					}
+					hard_links.emplace_back(*path, *target);
+					return ensure_directory(path->parent_path())
+						? bzlreg::tar_stream_action::skip
+						: bzlreg::tar_stream_action::stop;
+				}
+				case bzlreg::tar_entry_type::other:
+					return bzlreg::tar_stream_action::skip;
+			}
+
+			if(!ensure_directory(path->parent_path())) {
+				return bzlreg::tar_stream_action::stop;
+			}
+
+			file_path = std::move(*path);
+			file_mode = entry.mode;
+			streaming = entry.size >= TAR_EXTRACT_STREAM_MIN_SIZE;
+			if(streaming) {
+				claim_file_path();
+				auto open_ec = streamed_file.open( //
+					dest_dir / file_path,
+					file_mode,
+					entry.size
+				);
+				if(open_ec) {
+					error_message = std::format(
+						"failed to write {}: {}",
+						file_path.generic_string(),
+						open_ec.message()
+					);
+					return bzlreg::tar_stream_action::stop;
+				}
+				return bzlreg::tar_stream_action::read;
+			}
+
+			file_contents.reserve(entry.size);
+
+			// Empty entries never reach the contents callback
+			if(entry.size == 0) {
+				submit_file();
+				return bzlreg::tar_stream_action::skip;
+			}
+
+			return bzlreg::tar_stream_action::read;
+		},
+		[&](
+			const bzlreg::tar_stream_entry& entry,
+			std::span<const std::byte>      chunk,
+			std::size_t                     offset
+		) {
+			auto last_chunk = offset + chunk.size() == entry.size;
+			if(streaming) {
+				auto write_ec = streamed_file.write(chunk);
+				if(!write_ec && last_chunk) {
+					write_ec = streamed_file.close();
+				}
+				if(write_ec) {
+					error_message = std::format(
+						"failed to write {}: {}",
+						file_path.generic_string(),
+						write_ec.message()
+					);
+					return false;
+				}
+				return true;
+			}
+
+			file_contents.insert(file_contents.end(), chunk.begin(), chunk.end());
+			if(last_chunk) {
+				submit_file();
+			}
+			return true;
+		},
+	};
+
+	auto tar_status = bzlreg::tar_stream_status::ok;
+	auto decompress_status = bzlreg::decompress_archive_parallel(
+		compressed_data,
+		[&](std::span<const std::byte> chunk) {
+			tar_status = tar.write(chunk);
+			return tar_status == bzlreg::tar_stream_status::ok;
+		},
+		decompress_thread_count
+	);
+
+	writes.wait_all();
+
+	if(tar_status == bzlreg::tar_stream_status::error) {
+		std::println(stderr, "ERROR: bad tar archive: {}", tar.error_message());
+		return false;
+	}
+
+	if(!error_message.empty()) {
+		std::println(stderr, "ERROR: {}", error_message);
+		return false;
+	}
+
+	if(
+		decompress_status == bzlreg::decompress_status::error ||
+		!tar.finished()
+	) {
+		std::println(stderr, "ERROR: failed to decompress archive data");
+		return false;
+	}
+
+	if(auto write_error = writes.error_message(); !write_error.empty()) {
+		std::println(stderr, "ERROR: {}", write_error);
+		return false;
+	}
+
+	// Links are created last so no file is ever written through a symbolic
+	// link and hard link targets are complete. Symbolic links come first so
+	// hard links to them can be created, which also links the link itself.
+	if(!create_symbolic_links(dest_dir, symbolic_links)) {
+		return false;
+	}
+
+	auto ec = std::error_code{};
+	for(const auto& link : hard_links) {
+		if(
+			inside_symbolic_link(dest_dir, link.path) ||
+			inside_symbolic_link(dest_dir, link.target)
+		) {
+			std::println(
+				stderr,
+				"ERROR: hard link {} is inside of a symbolic link",
+				link.path.generic_string()
+			);
+			return false;
+		}
+
+		fs::remove(dest_dir / link.path, ec);
+		fs::create_hard_link(dest_dir / link.target, dest_dir / link.path, ec);
+		if(ec) {
+			std::println(
+				stderr,
+				"ERROR: failed to create hard link {}: {}",
+				link.path.generic_string(),
+				ec.message()
+			);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+auto bzlreg::extract_zip_archive(
+	std::span<const std::byte> zip_data,
+	const tar_extract_options& options
+) -> bool {
+	const auto& dest_dir = options.dest_dir;
+	if(!create_dest_dir(dest_dir)) {
+		return false;
+	}
+
+	auto zip = bzlreg::zip_view{zip_data};
+	if(!zip) {
+		std::println(stderr, "ERROR: bad zip archive: {}", zip.error_message());
+		return false;
+	}
+
+	auto symbolic_links = std::vector<pending_link>{};
+	auto contents = std::vector<std::byte>{};
+	for(const auto& entry : zip.entries()) {
+		auto path = safe_relative_path(entry.name);
+		if(!path) {
+			std::println(
+				stderr,
+				"ERROR: entry {} is outside of the archive root",
+				entry.name
+			);
+			return false;
+		}
+
+		if(path->empty()) {
+			continue;
+		}
+
+		auto ec = std::error_code{};
+		auto dir = entry.is_directory() ? *path : path->parent_path();
+		fs::create_directories(dest_dir / dir, ec);
+		if(ec) {
+			std::println(
+				stderr,
+				"ERROR: failed to create directory {}",
+				dir.generic_string()
+			);
+			return false;
+		}
+
+		if(entry.is_directory()) {
+			continue;
+		}
+
+		// Zip stores the target of a symbolic link as its contents
+		if(entry.is_symbolic_link()) {
+			auto target = zip.string(entry).transform([](std::string target) {
+				return fs::path{std::move(target)};
+			});
+			if(!target || !safe_symbolic_link(*path, *target)) {
+				std::println(
+					stderr,
+					"ERROR: symbolic link {} points outside of the archive root",
+					path->generic_string()
+				);
+				return false;
+			}
+			symbolic_links.emplace_back(*path, std::move(*target));
+			continue;
+		}
+
+		contents.resize(entry.uncompressed_size);
+		if(!zip.read(entry, contents)) {
+			std::println(stderr, "ERROR: failed to inflate {}", entry.name);
+			return false;
+		}
+
+		auto write_ec = write_file(dest_dir / *path, contents, entry.mode());
+		if(write_ec) {
+			std::println(
+				stderr,
+				"ERROR: failed to write {}: {}",
+				path->generic_string(),
+				write_ec.message()
+			);
+			return false;
+		}
+	}
+
+	return create_symbolic_links(dest_dir, symbolic_links);
+}
+
+auto bzlreg::extract_archive(
+	std::span<const std::byte> archive_data,
+	const tar_extract_options& options
+) -> bool {
+	if(detect_archive_format(archive_data) == archive_format::zip) {
+		return extract_zip_archive(archive_data, options);
+	}
+	return extract_tar_archive(archive_data, options);
+}
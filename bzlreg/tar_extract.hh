@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <span>
+#include <thread>
+
+namespace bzlreg {
+struct tar_extract_options {
+	/**
+	 * Directory the archive entries are extracted into. Created if missing.
+	 */
+	std::filesystem::path dest_dir;
+
+	/**
+	 * Number of threads decompressing the archive and writing file contents,
+	 * split between the two
+	 */
+	unsigned thread_count = std::thread::hardware_concurrency();
+};
+
+/**
+ * Extracts a gzip, zstd or xz compressed tar archive. Directories are created
+ * once each on the decoding thread while file contents are written on a pool
+ * of worker threads, except for large files which the decoding thread writes
+ * as they arrive. Symbolic and then hard links are created after all files
+ * have been written and, like every entry name, may not point outside of
+ * `dest_dir`. Errors are printed to stderr.
+ */
+auto extract_tar_archive(
+	std::span<const std::byte> compressed_data,
+	const tar_extract_options& options
+) -> bool;
+
+/**
+ * Extracts a zip archive one member at a time. Only `options.dest_dir` is used.
+ * Symbolic links are created last and checked like in `extract_tar_archive`.
+ */
+auto extract_zip_archive(
+	std::span<const std::byte> zip_data,
+	const tar_extract_options& options
+) -> bool;
+
+/**
+ * Extracts a zip archive or a compressed tar archive depending on its magic
+ */
+auto extract_archive(
+	std::span<const std::byte> archive_data,
+	const tar_extract_options& options
+) -> bool;
+} // namespace bzlreg
@@ -0,0 +1,214 @@
+#include "bzlreg/tar_header.hh"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#	include <emmintrin.h>
+#	define BZLREG_TAR_HEADER_SSE2
+#endif
+
+namespace {
+constexpr auto SWAR_ONES = std::uint64_t{0x0101010101010101};
+constexpr auto SWAR_HIGH_BITS = std::uint64_t{0x8080808080808080};
+
+/**
+ * Loads up to 8 bytes little endian. Missing bytes are zero, which reads as a
+ * NUL terminator to the octal parser.
+ */
+auto load_u64(std::span<const std::byte> bytes) noexcept -> std::uint64_t {
+	auto value = std::uint64_t{0};
+	std::memcpy(&value, bytes.data(), std::min(bytes.size(), sizeof(value)));
+	if constexpr(std::endian::native == std::endian::big) {
+		value = std::byteswap(value);
+	}
+	return value;
+}
+
+/**
+ * Number of leading bytes (in memory order) that are ASCII '0' to '7'
+ */
+auto octal_digit_count(std::uint64_t chunk) noexcept -> int {
+	// Octal digits are exactly the bytes whose top 5 bits are 00110
+	auto t = (chunk & (SWAR_ONES * 0xf8)) ^ (SWAR_ONES * '0');
+	auto non_digits =
+		(((t & (SWAR_ONES * 0x7f)) + (SWAR_ONES * 0x7f)) | t) & SWAR_HIGH_BITS;
+	return std::countr_zero(non_digits) / 8;
+}
+
+/**
+ * Converts 8 octal digits, most significant digit first in memory, by
+ * combining neighbouring lanes of doubling width.
+ */
+auto octal_digits_value(std::uint64_t digits) noexcept -> std::uint64_t {
+	digits = ((digits * 8) + (digits >> 8)) & 0x00ff00ff00ff00ff;
+	digits = ((digits * 64) + (digits >> 16)) & 0x0000ffff0000ffff;
+	digits = ((digits * 4096) + (digits >> 32)) & 0x00000000ffffffff;
+	return digits;
+}
+
+auto parse_base256(std::span<const std::byte> field) noexcept
+	-> std::optional<std::uint64_t> {
+	auto value = std::uint64_t{
+		std::to_integer<unsigned char>(field[0]) & 0x7fu,
+	};
+	for(auto byte : field.subspan(1)) {
+		if(value > (UINT64_MAX >> 8)) {
+			return std::nullopt;
+		}
+		value = (value << 8) | std::to_integer<std::uint64_t>(byte);
+	}
+	return value;
+}
+
+struct block_sum {
+	std::uint64_t sum;
+	std::uint64_t high_byte_count;
+};
+
+/**
+ * Sum of all bytes as unsigned values and the number of bytes with the high
+ * bit set, which is enough to derive the signed sum as well.
+ */
+auto sum_block(bzlreg::tar_block block) noexcept -> block_sum {
+#ifdef BZLREG_TAR_HEADER_SSE2
+	auto sum = _mm_setzero_si128();
+	auto high_byte_count = std::uint64_t{0};
+	for(auto i = std::size_t{0}; i < block.size(); i += 16) {
+		auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&block[i]));
+		sum = _mm_add_epi64(sum, _mm_sad_epu8(v, _mm_setzero_si128()));
+		high_byte_count += std::popcount(
+			static_cast<unsigned>(_mm_movemask_epi8(v))
+		);
+	}
+	sum = _mm_add_epi64(sum, _mm_unpackhi_epi64(sum, sum));
+	return {
+		static_cast<std::uint64_t>(_mm_cvtsi128_si64(sum)),
+		high_byte_count,
+	};
+#else
+	// 16 bit lanes can't overflow: 64 words * 2 bytes * 255 < 65536
+	auto lanes = std::uint64_t{0};
+	auto high_byte_count = std::uint64_t{0};
+	for(auto i = std::size_t{0}; i < block.size(); i += 8) {
+		auto word = load_u64(block.subspan(i, 8));
+		lanes += (word & 0x00ff00ff00ff00ff) + ((word >> 8) & 0x00ff00ff00ff00ff);
+		high_byte_count += std::popcount(word & SWAR_HIGH_BITS);
+	}
+	return {(lanes * 0x0001000100010001) >> 48, high_byte_count};
+#endif
+}
+} // namespace
+
+auto bzlreg::tar_block_is_zero(tar_block block) noexcept -> bool {
+#ifdef BZLREG_TAR_HEADER_SSE2
+	auto any = _mm_setzero_si128();
+	for(auto i = std::size_t{0}; i < block.size(); i += 16) {
+		any = _mm_or_si128(
+			any,
+			_mm_loadu_si128(reinterpret_cast<const __m128i*>(&block[i]))
+		);
+	}
+	return _mm_movemask_epi8(_mm_cmpeq_epi8(any, _mm_setzero_si128())) ==
+		0xffff;
+#else
+	auto any = std::uint64_t{0};
+	for(auto i = std::size_t{0}; i < block.size(); i += 8) {
+		any |= load_u64(block.subspan(i, 8));
+	}
+	return any == 0;
+#endif
+}
+
+auto bzlreg::parse_tar_number( //
+	std::span<const std::byte> field
+) noexcept -> std::optional<std::uint64_t> {
+	if(field.empty()) {
+		return std::nullopt;
+	}
+
+	if((std::to_integer<unsigned char>(field[0]) & 0x80) != 0) {
+		return parse_base256(field);
+	}
+
+	while(!field.empty() && field[0] == std::byte{' '}) {
+		field = field.subspan(1);
+	}
+
+	auto value = std::uint64_t{0};
+	while(!field.empty()) {
+		auto chunk = load_u64(field);
+		auto digit_count = octal_digit_count(chunk);
+		if(digit_count == 0) {
+			break;
+		}
+
+		if(value > (UINT64_MAX >> (3 * digit_count))) {
+			return std::nullopt;
+		}
+
+		// Shift the digits to the end of the chunk so the digits missing
+		// from a partial chunk become leading zeros
+		auto digits = chunk & (SWAR_ONES * 0x07);
+		if(digit_count < 8) {
+			digits <<= 8 * (8 - digit_count);
+		}
+
+		value = (value << (3 * digit_count)) | octal_digits_value(digits);
+		field = field.subspan(digit_count);
+
+		if(digit_count < 8) {
+			break;
+		}
+	}
+
+	// Only spaces may follow the digits up to the terminating NUL
+	for(auto byte : field) {
+		if(byte == std::byte{'\0'}) {
+			break;
+		}
+		if(byte != std::byte{' '}) {
+			return std::nullopt;
+		}
+	}
+
+	return value;
+}
+
+auto bzlreg::tar_header_checksum_valid(tar_block header) noexcept -> bool {
+	auto stored = parse_tar_number(
+		tar_header_field_bytes(header, TAR_HEADER_CHECKSUM)
+	);
+	if(!stored) {
+		return false;
+	}
+
+	auto [sum, high_byte_count] = sum_block(header);
+	for(auto byte : tar_header_field_bytes(header, TAR_HEADER_CHECKSUM)) {
+		auto c = std::to_integer<unsigned char>(byte);
+		sum = sum - c + ' ';
+		high_byte_count -= c >> 7;
+	}
+
+	auto signed_sum = static_cast<std::int64_t>(sum) -
+		256 * static_cast<std::int64_t>(high_byte_count);
+	return *stored == sum || std::cmp_equal(*stored, signed_sum);
+}
+
+auto bzlreg::find_bad_tar_header(
+	std::span<const std::byte>   tar_bytes,
+	std::span<const std::size_t> header_offsets
+) noexcept -> std::size_t {
+	for(auto i = std::size_t{0}; i < header_offsets.size(); ++i) {
+		assert(header_offsets[i] + TAR_BLOCK_SIZE <= tar_bytes.size());
+		auto header = tar_bytes.subspan(header_offsets[i]).first<TAR_BLOCK_SIZE>();
+		if(!tar_header_checksum_valid(header)) {
+			return i;
+		}
+	}
+
+	return header_offsets.size();
+}
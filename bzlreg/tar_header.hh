@@ -0,0 +1,77 @@
+#pragma once
+
+#include <span>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace bzlreg {
+// https://en.wikipedia.org/wiki/Tar_(computing)
+constexpr auto TAR_BLOCK_SIZE = std::size_t{512};
+
+struct tar_header_field {
+	std::size_t offset;
+	std::size_t length;
+};
+
+constexpr auto TAR_HEADER_FILE_NAME = tar_header_field{0, 100};
+constexpr auto TAR_HEADER_FILE_MODE = tar_header_field{100, 8};
+constexpr auto TAR_HEADER_OWNER_ID = tar_header_field{108, 8};
+constexpr auto TAR_HEADER_GROUP_ID = tar_header_field{116, 8};
+constexpr auto TAR_HEADER_FILE_SIZE = tar_header_field{124, 12};
+constexpr auto TAR_HEADER_MTIME = tar_header_field{136, 12};
+constexpr auto TAR_HEADER_CHECKSUM = tar_header_field{148, 8};
+constexpr auto TAR_HEADER_TYPE_FLAG = tar_header_field{156, 1};
+constexpr auto TAR_HEADER_LINK_NAME = tar_header_field{157, 100};
+constexpr auto USTAR_HEADER_MAGIC = tar_header_field{257, 6};
+constexpr auto USTAR_HEADER_VERSION = tar_header_field{263, 2};
+constexpr auto USTAR_HEADER_FILE_NAME_PREFIX = tar_header_field{345, 155};
+
+static_assert(
+	USTAR_HEADER_FILE_NAME_PREFIX.offset + USTAR_HEADER_FILE_NAME_PREFIX.length <=
+	TAR_BLOCK_SIZE
+);
+
+using tar_block = std::span<const std::byte, TAR_BLOCK_SIZE>;
+
+constexpr auto tar_header_field_bytes(
+	tar_block        header,
+	tar_header_field field
+) noexcept -> std::span<const std::byte> {
+	return header.subspan(field.offset, field.length);
+}
+
+/**
+ * `true` if every byte of `block` is zero. Two of these in a row mark the end
+ * of an archive.
+ */
+auto tar_block_is_zero(tar_block block) noexcept -> bool;
+
+/**
+ * Parses a numeric header field. Octal fields may be padded with leading
+ * spaces and are terminated by a NUL or space. Fields too small for their
+ * value may instead use the GNU base-256 encoding signaled by the high bit of
+ * the first byte.
+ */
+auto parse_tar_number( //
+	std::span<const std::byte> field
+) noexcept -> std::optional<std::uint64_t>;
+
+/**
+ * Checks the header checksum. The sum is over all header bytes with the
+ * checksum field counted as spaces. Some old archivers summed signed bytes so
+ * either sum is accepted.
+ */
+auto tar_header_checksum_valid(tar_block header) noexcept -> bool;
+
+/**
+ * Checks the checksum of every header starting at `header_offsets` within
+ * `tar_bytes`.
+ * @returns index of the first bad header or `header_offsets.size()` if they
+ *          are all valid
+ */
+auto find_bad_tar_header(
+	std::span<const std::byte>   tar_bytes,
+	std::span<const std::size_t> header_offsets
+) noexcept -> std::size_t;
+} // namespace bzlreg
@@ -1,20 +1,33 @@
 #include "bzlreg/tar_view.hh"
 
 #include <string>
-#include <format>
 #include <string_view>
-#include <print>
 #include <cassert>
 #include <charconv>
-#include <system_error>
+#include <format>
+#include <cstring>
+#include <algorithm>
+
+using bzlreg::TAR_BLOCK_SIZE;
+using bzlreg::TAR_HEADER_FILE_MODE;
+using bzlreg::TAR_HEADER_FILE_NAME;
+using bzlreg::TAR_HEADER_FILE_SIZE;
+using bzlreg::TAR_HEADER_LINK_NAME;
+using bzlreg::TAR_HEADER_TYPE_FLAG;
+using bzlreg::USTAR_HEADER_FILE_NAME_PREFIX;
+using bzlreg::USTAR_HEADER_MAGIC;
 
-// https://en.wikipedia.org/wiki/Tar_(computing)
-constexpr auto TAR_HEADER_SIZE = 512;
-constexpr auto TAR_HEADER_FILE_NAME_MAX_LENGTH = 100;
-constexpr auto TAR_HEADER_FILE_SIZE_OFFSET = 124;
-constexpr auto TAR_HEADER_FILE_SIZE_LENGTH = 12;
-constexpr auto TAR_HEADER_TYPE_FLAG_OFFSET = 156;
-constexpr auto USTAR_HEADER_FILE_NAME_PREFIX_MAX_LENGTH = 155;
+/**
+ * Upper bound for buffered PAX and GNU long name headers. Real headers are a
+ * few hundred bytes at most.
+ */
+constexpr auto TAR_STREAM_MAX_EXTENDED_HEADER_SIZE = std::size_t{1024 * 1024};
+
+/**
+ * Headers of a written chunk `tar_stream` verifies together at most. Small
+ * enough that the batch is still in cache when the headers are processed.
+ */
+constexpr auto TAR_STREAM_CHECKSUM_BATCH_SIZE = std::size_t{64};
 
 namespace {
 enum class typeflag_enum : char {
@@ -48,6 +61,16 @@ enum class typeflag_enum : char {
 	 * (POSIX.1-2001)
 	 */
 	extended_header = 'x',
+
+	/**
+	 * GNU extension: the data is the name of the next file in the archive
+	 */
+	gnu_long_name = 'L',
+
+	/**
+	 * GNU extension: the data is the link name of the next file in the archive
+	 */
+	gnu_long_link_name = 'K',
 };
 
 constexpr auto typeflag_is_normal_file(typeflag_enum v) -> bool {
@@ -55,44 +78,114 @@ constexpr auto typeflag_is_normal_file(typeflag_enum v) -> bool {
 		v == typeflag_enum::normal_file_zero;
 }
 
-constexpr auto get_typeflag(std::span<const std::byte> bytes) -> typeflag_enum {
-	return static_cast<typeflag_enum>(bytes[TAR_HEADER_TYPE_FLAG_OFFSET]);
+constexpr auto get_typeflag(bzlreg::tar_block header) -> typeflag_enum {
+	return static_cast<typeflag_enum>(header[TAR_HEADER_TYPE_FLAG.offset]);
+}
+
+auto parse_header_number(
+	bzlreg::tar_block        header,
+	bzlreg::tar_header_field field
+) -> std::optional<std::uint64_t> {
+	return bzlreg::parse_tar_number(
+		bzlreg::tar_header_field_bytes(header, field)
+	);
+}
+
+auto header_field_string(
+	bzlreg::tar_block        header,
+	bzlreg::tar_header_field field
+) -> std::string_view {
+	auto str = reinterpret_cast<const char*>(header.data() + field.offset);
+	return std::string_view{str, ::strnlen(str, field.length)};
+}
+
+auto is_ustar_header(bzlreg::tar_block header) -> bool {
+	auto magic = reinterpret_cast<const char*>( //
+		header.data() + USTAR_HEADER_MAGIC.offset
+	);
+	return std::strncmp(magic, "ustar", 5) == 0 &&
+		(magic[5] == '\0' || magic[5] == ' ');
 }
 
 /**
- * Gets the 'file size' from the tar 512 byte header. This may be the actual
- * file size _or_ its the extended header size depending onn the typeflag.
+ * The entry name stored directly in a header including the ustar prefix if
+ * there is one.
  */
-auto get_tar_header_file_size(std::span<const std::byte> bytes) -> std::size_t {
-	auto size = std::size_t{0};
-	auto [_, ec] = std::from_chars(
-		reinterpret_cast<const char*>(bytes.data() + TAR_HEADER_FILE_SIZE_OFFSET),
-		reinterpret_cast<const char*>(
-			bytes.data() + TAR_HEADER_FILE_SIZE_OFFSET + TAR_HEADER_FILE_SIZE_LENGTH
-		),
-		size,
-		8
-	);
+auto header_entry_name(bzlreg::tar_block header) -> bzlreg::tar_entry_name {
+	auto name = header_field_string(header, TAR_HEADER_FILE_NAME);
 
-	if(ec != std::errc{}) {
-		std::println(
-			stderr,
-			"ERROR: bad tar header file size: {}",
-			std::make_error_code(ec).message()
-		);
-		std::abort();
+	if(is_ustar_header(header)) {
+		auto prefix = header_field_string(header, USTAR_HEADER_FILE_NAME_PREFIX);
+		return bzlreg::tar_entry_name{prefix, name};
 	}
 
-	return size;
+	return bzlreg::tar_entry_name{name};
 }
 
-auto is_all0(std::span<const std::byte> bytes) -> std::size_t {
-	for(const std::byte byte : bytes) {
-		if(byte != std::byte{}) {
-			return false;
+/**
+ * Calls `fn(key, value)` for each `<length> <key>=<value>\n` record of a PAX
+ * extended header.
+ * @returns an error message or an empty string on success
+ */
+auto parse_pax_records(std::string_view extended_header, auto&& fn)
+	-> std::string_view {
+	while(!extended_header.empty()) {
+		auto length_sep_index = extended_header.find(' ');
+		if(length_sep_index == std::string::npos) {
+			return "bad extended header length separator";
+		}
+
+		auto length = std::size_t{};
+		auto [_, ec] = std::from_chars(
+			extended_header.data(),
+			extended_header.data() + length_sep_index,
+			length
+		);
+
+		if(ec != std::errc{}) {
+			return "bad extended header length";
 		}
+
+		auto key_value_sep_index = extended_header.find('=', length_sep_index);
+		if(
+			key_value_sep_index == std::string::npos ||
+			key_value_sep_index + 1 >= length || length > extended_header.size()
+		) {
+			return "bad extended header key value pair separator";
+		}
+
+		auto key = extended_header.substr(
+			length_sep_index + 1,
+			key_value_sep_index - length_sep_index - 1
+		);
+		auto value = extended_header.substr(
+			key_value_sep_index + 1,
+			length - key_value_sep_index - 2
+		);
+
+		fn(key, value);
+
+		extended_header = extended_header.substr(length);
+	}
+
+	return {};
+}
+
+auto to_entry_type(typeflag_enum typeflag) -> bzlreg::tar_entry_type {
+	switch(typeflag) {
+		case typeflag_enum::normal_file_nul:
+		case typeflag_enum::normal_file_zero:
+		case typeflag_enum::contiguous_file:
+			return bzlreg::tar_entry_type::file;
+		case typeflag_enum::directory:
+			return bzlreg::tar_entry_type::directory;
+		case typeflag_enum::symbolic_link:
+			return bzlreg::tar_entry_type::symbolic_link;
+		case typeflag_enum::hard_link:
+			return bzlreg::tar_entry_type::hard_link;
+		default:
+			return bzlreg::tar_entry_type::other;
 	}
-	return true;
 }
 } // namespace
 
@@ -101,6 +194,14 @@ bzlreg::tar_view::tar_view(const tar_view&) = default;
 bzlreg::tar_view_file::tar_view_file(tar_view_file&&) noexcept = default;
 bzlreg::tar_view_file::tar_view_file(const tar_view_file&) noexcept = default;
 
+auto bzlreg::tar_view_file::operator=( //
+	tar_view_file&&
+) noexcept -> tar_view_file& = default;
+
+auto bzlreg::tar_view_file::operator=( //
+	const tar_view_file&
+) noexcept -> tar_view_file& = default;
+
 bzlreg::tar_view::tar_view(std::span<std::byte> tar_bytes)
 	: _tar_bytes(tar_bytes) {
 }
@@ -117,12 +218,12 @@ static size_t round_up_to_multiple( //
 }
 
 auto bzlreg::tar_view::begin() -> iterator {
+	_error_message.clear();
+
 	auto itr = iterator{};
+	itr._view = this;
 	itr._data = _tar_bytes;
-
-	while(get_typeflag(itr._data) == typeflag_enum::global_extended_header) {
-		++itr;
-	}
+	itr.load();
 
 	return itr;
 }
@@ -131,77 +232,78 @@ auto bzlreg::tar_view::end() const noexcept -> sentinel {
 	return {};
 }
 
-auto bzlreg::tar_view::iterator::operator!=(sentinel) const -> bool {
-	if(_data.empty()) {
-		return false;
-	}
-
-	auto name = operator*().name();
-	return !name.empty();
+auto bzlreg::tar_view::error_message() const noexcept -> std::string_view {
+	return _error_message;
 }
 
-auto bzlreg::tar_view::iterator::operator++() -> iterator& {
-	assert(!_data.empty());
-	auto file_size = operator*().size();
-	auto header_size = operator*().header_byte_size();
-	auto file_size_rounded = round_up_to_multiple(file_size, 512);
-
-	if(header_size + file_size_rounded < _data.size()) {
-		_data = _data.subspan(header_size + file_size_rounded);
-		if(is_all0(_data.subspan(0, TAR_HEADER_SIZE))) {
-			_data = _data.subspan(TAR_HEADER_SIZE);
-
-			if(is_all0(_data.subspan(0, TAR_HEADER_SIZE))) {
-				_data = {};
-			}
-		}
-	} else {
-		_data = {};
-	}
-
-	return *this;
-}
-
-auto bzlreg::tar_view::iterator::operator*() const -> tar_view_file {
-	return tar_view_file{_data};
-}
-
-auto bzlreg::tar_view::file( //
-	std::string_view find_filename
-) -> tar_view_file {
-	auto offset = size_t{0};
+auto bzlreg::tar_view::iterator::load() -> void {
 	auto consecutive_all0 = 0;
+	_file = {};
 
-	while(offset < _tar_bytes.size()) {
-		auto tar_header_bytes = _tar_bytes.subspan(offset, TAR_HEADER_SIZE);
+	while(!_data.empty()) {
+		if(_data.size() < TAR_BLOCK_SIZE) {
+			_view->_error_message = "truncated tar header";
+			break;
+		}
 
-		if(is_all0(tar_header_bytes)) {
-			offset += TAR_HEADER_SIZE;
+		if(tar_block_is_zero(_data.first<TAR_BLOCK_SIZE>())) {
 			consecutive_all0 += 1;
-
 			if(consecutive_all0 >= 2) {
 				// The end of an archive is marked by at least two consecutive
 				// zero-filled records. SEE:
 				// https://en.wikipedia.org/wiki/Tar_(computing)
 				break;
 			}
+			_data = _data.subspan(TAR_BLOCK_SIZE);
 			continue;
 		}
 
 		consecutive_all0 = 0;
 
-		auto file = tar_view_file{_tar_bytes.subspan(offset)};
-		auto file_size = file.size();
-		auto file_name = file.name();
+		auto file = tar_view_file{_data};
+		if(!file) {
+			_view->_error_message = file._error;
+			break;
+		}
 
-		if(file_name == find_filename) {
-			return file;
+		// Global headers only carry metadata we have no use for
+		if(
+			get_typeflag(file.entry_header()) ==
+			typeflag_enum::global_extended_header
+		) {
+			_data = _data.subspan(std::min(
+				file.header_byte_size() +
+					round_up_to_multiple(file.size(), TAR_BLOCK_SIZE),
+				_data.size()
+			));
+			continue;
 		}
 
-		offset += file.header_byte_size() + round_up_to_multiple(file_size, 512);
+		_file = file;
+		return;
 	}
 
-	return tar_view_file{};
+	_data = {};
+}
+
+auto bzlreg::tar_view::iterator::operator!=(sentinel) const -> bool {
+	return static_cast<bool>(_file);
+}
+
+auto bzlreg::tar_view::iterator::operator++() -> iterator& {
+	assert(_file);
+	auto entry_byte_size = _file.header_byte_size() +
+		round_up_to_multiple(_file.size(), TAR_BLOCK_SIZE);
+
+	// Archives may omit the padding after the last entry
+	_data = _data.subspan(std::min(entry_byte_size, _data.size()));
+	load();
+
+	return *this;
+}
+
+auto bzlreg::tar_view::iterator::operator*() const -> tar_view_file {
+	return _file;
 }
 
 bzlreg::tar_view_file::tar_view_file( //
@@ -212,70 +314,111 @@ bzlreg::tar_view_file::tar_view_file( //
 		return;
 	}
 
-	const auto typeflag = get_typeflag(_data);
+	_error = parse();
+	if(!_error.empty()) {
+		_data = {};
+	}
+}
+
+auto bzlreg::tar_view_file::parse() noexcept -> std::string_view {
+	if(_data.size() < TAR_BLOCK_SIZE) {
+		return "truncated tar header";
+	}
+
+	const auto header = std::span<const std::byte>{_data}.first<TAR_BLOCK_SIZE>();
+	if(!tar_header_checksum_valid(header)) {
+		return "bad tar header checksum";
+	}
+
+	const auto header_file_size =
+		parse_header_number(header, TAR_HEADER_FILE_SIZE);
+	if(!header_file_size) {
+		return "bad tar header file size";
+	}
+
+	if(get_typeflag(header) != typeflag_enum::extended_header) {
+		_header_byte_size = TAR_BLOCK_SIZE;
+		_size = *header_file_size;
+	} else {
+		if(*header_file_size > _data.size()) {
+			return "truncated tar extended header";
+		}
+
+		_header_byte_size = TAR_BLOCK_SIZE +
+			round_up_to_multiple(*header_file_size, TAR_BLOCK_SIZE) +
+			TAR_BLOCK_SIZE;
+		if(_header_byte_size > _data.size()) {
+			return "truncated tar extended header";
+		}
 
-	if(typeflag == typeflag_enum::extended_header) {
 		auto extended_header = std::string_view{
-			reinterpret_cast<const char*>(_data.data() + TAR_HEADER_SIZE),
-			static_cast<std::size_t>(get_tar_header_file_size(_data)),
+			reinterpret_cast<const char*>(_data.data() + TAR_BLOCK_SIZE),
+			static_cast<std::size_t>(*header_file_size),
 		};
-		while(!extended_header.empty()) {
-			auto length_sep_index = extended_header.find(' ');
-			if(length_sep_index == std::string::npos) {
-				std::println(stderr, "ERROR: bad extended header length separator");
-				std::abort();
+		auto err = parse_pax_records(
+			extended_header,
+			[this](std::string_view key, std::string_view value) {
+				auto value_span = std::span{
+					reinterpret_cast<const std::byte*>(value.data()),
+					static_cast<std::size_t>(value.size()),
+				};
+
+				if(key == "path") {
+					_extended_header_path = value_span;
+				} else if(key == "linkpath") {
+					_extended_header_linkpath = value_span;
+				} else if(key == "size") {
+					_extended_header_size = value_span;
+				}
 			}
+		);
 
-			auto length = std::size_t{};
-			auto [_, ec] = std::from_chars(
-				extended_header.data(),
-				extended_header.data() + length_sep_index,
-				length
-			);
+		if(!err.empty()) {
+			return err;
+		}
 
-			if(ec != std::errc{}) {
-				std::println(
-					stderr,
-					"ERROR: bad extended header length: {}",
-					std::make_error_code(ec).message()
-				);
-				std::abort();
-			}
+		const auto next_header = entry_header();
+		if(!tar_header_checksum_valid(next_header)) {
+			return "bad tar header checksum";
+		}
 
-			auto key_value_sep_index = extended_header.find('=', length_sep_index);
-			if(key_value_sep_index == std::string::npos) {
-				std::println(
-					stderr,
-					"ERROR: bad extended header key value pair separator"
-				);
-				std::abort();
-			}
+		switch(get_typeflag(next_header)) {
+			case typeflag_enum::extended_header:
+			case typeflag_enum::global_extended_header:
+				return "unexpected typeflag after extended header";
+			default:
+				break;
+		}
 
-			auto key = extended_header.substr(
-				length_sep_index + 1,
-				key_value_sep_index - length_sep_index - 1
+		if(!_extended_header_size.empty()) {
+			auto size_str = reinterpret_cast<const char*>(
+				_extended_header_size.data()
 			);
-			auto value = extended_header.substr(
-				key_value_sep_index + 1,
-				length - key_value_sep_index - 2
+			auto [ptr, ec] = std::from_chars(
+				size_str,
+				size_str + _extended_header_size.size(),
+				_size
 			);
-
-			auto value_span = std::span{
-				reinterpret_cast<const std::byte*>(value.data()),
-				static_cast<std::size_t>(value.size()),
-			};
-
-			if(key == "path") {
-				_extended_header_path = value_span;
-			} else if(key == "linkpath") {
-				_extended_header_linkpath = value_span;
-			} else if(key == "size") {
-				_extended_header_size = value_span;
+			if(
+				ec != std::errc{} || ptr != size_str + _extended_header_size.size()
+			) {
+				return "bad extended header file size";
 			}
-
-			extended_header = extended_header.substr(length);
+		} else {
+			auto next_header_file_size =
+				parse_header_number(next_header, TAR_HEADER_FILE_SIZE);
+			if(!next_header_file_size) {
+				return "bad tar header file size";
+			}
+			_size = *next_header_file_size;
 		}
 	}
+
+	if(_size > _data.size() - _header_byte_size) {
+		return "truncated tar entry";
+	}
+
+	return {};
 }
 
 bzlreg::tar_view_file::tar_view_file() : _data{} {
@@ -287,107 +430,40 @@ bzlreg::tar_view_file::operator bool() const noexcept {
 
 auto bzlreg::tar_view_file::header_byte_size() const -> size_t {
 	assert(*this);
-
-	const auto typeflag = get_typeflag(_data);
-
-	if(typeflag == typeflag_enum::extended_header) {
-		return TAR_HEADER_SIZE +
-			round_up_to_multiple(get_tar_header_file_size(_data), 512) +
-			TAR_HEADER_SIZE;
-	} else {
-		return TAR_HEADER_SIZE;
-	}
+	return _header_byte_size;
 }
 
 auto bzlreg::tar_view_file::name() const noexcept -> std::string {
-	assert(*this);
+	return entry_name().to_string();
+}
 
-	const auto typeflag = get_typeflag(_data);
-	auto       name_str = std::string{};
+auto bzlreg::tar_view_file::entry_name() const noexcept -> tar_entry_name {
+	assert(*this);
 
 	if(!_extended_header_path.empty()) {
-		return std::string{
+		return tar_entry_name{std::string_view{
 			reinterpret_cast<const char*>(_extended_header_path.data()),
 			_extended_header_path.size(),
-		};
-	} else {
-		auto name_cstr = reinterpret_cast<const char*>(_data.data());
-		auto name_len = name_cstr[TAR_HEADER_FILE_NAME_MAX_LENGTH - 1] == '\0' //
-			? std::strlen(name_cstr)
-			: TAR_HEADER_FILE_NAME_MAX_LENGTH;
-		name_str = std::string{name_cstr, name_len};
-		auto maybe_ustar = name_cstr + 257;
-
-		const auto is_ustar = strncmp(maybe_ustar, "ustar", 5) == 0 &&
-			(maybe_ustar[5] == '\0' || maybe_ustar[5] == ' ');
-
-		if(is_ustar) {
-			auto name_prefix_cstr = name_cstr + 345;
-			auto name_prefix_len = std::size_t{
-				strnlen(name_prefix_cstr, USTAR_HEADER_FILE_NAME_PREFIX_MAX_LENGTH)
-			};
-			if(name_prefix_len > 0) {
-				name_str = std::format(
-					"{}/{}",
-					std::string_view{name_prefix_cstr, name_prefix_len},
-					name_str
-				);
-			} else {
-			}
-		}
+		}};
 	}
 
-	return name_str;
+	return header_entry_name(entry_header());
 }
 
 auto bzlreg::tar_view_file::size() const noexcept -> size_t {
 	assert(*this);
+	return _size;
+}
 
-	const auto typeflag = get_typeflag(_data);
-	auto       file_size = std::size_t{};
-
-	if(typeflag == typeflag_enum::extended_header) {
-		if(!_extended_header_size.empty()) {
-			auto [_, ec] = std::from_chars(
-				reinterpret_cast<const char*>(_extended_header_size.data()),
-				reinterpret_cast<const char*>(_extended_header_size.data()) +
-					_extended_header_size.size(),
-				file_size
-			);
-			if(ec != std::errc{}) {
-				std::println(
-					stderr,
-					"ERROR: extended header file size: {}",
-					std::make_error_code(ec).message()
-				);
-				std::abort();
-			}
-		} else {
-			auto next_entry = _data.subspan(
-				TAR_HEADER_SIZE +
-				round_up_to_multiple(get_tar_header_file_size(_data), 512)
-			);
-			auto next_typeflag = get_typeflag(next_entry);
-			switch(next_typeflag) {
-				case typeflag_enum::extended_header:
-				case typeflag_enum::global_extended_header:
-					std::println(
-						stderr,
-						"ERROR: unexpected typeflag: {}",
-						static_cast<char>(next_typeflag)
-					);
-					std::abort();
-					break;
-				default:
-					break;
-			}
-			file_size = get_tar_header_file_size(next_entry);
-		}
-	} else {
-		file_size = get_tar_header_file_size(_data);
-	}
+auto bzlreg::tar_view_file::type() const noexcept -> tar_entry_type {
+	assert(*this);
+	return to_entry_type(get_typeflag(entry_header()));
+}
 
-	return file_size;
+auto bzlreg::tar_view_file::entry_header() const noexcept -> tar_block {
+	return std::span<const std::byte>{_data}
+		.subspan(_header_byte_size - TAR_BLOCK_SIZE)
+		.first<TAR_BLOCK_SIZE>();
 }
 
 auto bzlreg::tar_view_file::contents() const noexcept -> std::span<std::byte> {
@@ -407,3 +483,474 @@ auto bzlreg::tar_view_file::string_view() const noexcept -> std::string_view {
 		size(),
 	};
 }
+
+bzlreg::tar_stream::tar_stream(entry_fn on_entry, contents_fn on_contents)
+	: _on_entry(std::move(on_entry)), _on_contents(std::move(on_contents)) {
+}
+
+auto bzlreg::tar_stream::fail(std::string message) -> tar_stream_status {
+	_state = state::error;
+	_error_message = std::move(message);
+	return tar_stream_status::error;
+}
+
+auto bzlreg::tar_stream::write( //
+	std::span<const std::byte> data
+) -> tar_stream_status {
+	while(!data.empty()) {
+		switch(_state) {
+			case state::header: {
+				if(_header_size == 0 && !_entry_header_offset) {
+					_entry_header_offset = _offset;
+				}
+
+				if(
+					_header_size == 0 &&
+					_verified_header_index == _verified_headers.size() &&
+					data.size() >= 2 * TAR_BLOCK_SIZE
+				) {
+					verify_headers_ahead(data);
+				}
+
+				auto n = std::min(data.size(), TAR_BLOCK_SIZE - _header_size);
+				std::memcpy(_header.data() + _header_size, data.data(), n);
+				_header_size += n;
+				_offset += n;
+				data = data.subspan(n);
+
+				if(_header_size == TAR_BLOCK_SIZE) {
+					_header_size = 0;
+					auto status = process_header();
+					if(status != tar_stream_status::ok) {
+						return status;
+					}
+				}
+				break;
+			}
+			case state::extended_header: {
+				auto n = std::min(data.size(), _extended_header_remaining);
+				_extended_header.append(
+					reinterpret_cast<const char*>(data.data()),
+					n
+				);
+				_extended_header_remaining -= n;
+				_offset += n;
+				data = data.subspan(n);
+
+				if(_extended_header_remaining == 0) {
+					auto status = process_extended_header();
+					if(status != tar_stream_status::ok) {
+						return status;
+					}
+				}
+				break;
+			}
+			case state::contents: {
+				auto n = std::min(data.size(), _entry.size - _contents_offset);
+				if(_entry_read && _on_contents) {
+					if(!_on_contents(_entry, data.first(n), _contents_offset)) {
+						_state = state::stopped;
+						return tar_stream_status::stopped;
+					}
+				}
+				_contents_offset += n;
+				_offset += n;
+				data = data.subspan(n);
+
+				if(_contents_offset == _entry.size) {
+					_state = _padding_remaining > 0 ? state::padding : state::header;
+				}
+				break;
+			}
+			case state::padding: {
+				auto n = std::min(data.size(), _padding_remaining);
+				_padding_remaining -= n;
+				_offset += n;
+				data = data.subspan(n);
+
+				if(_padding_remaining == 0) {
+					_state = state::header;
+				}
+				break;
+			}
+			case state::end:
+				return tar_stream_status::end;
+			case state::stopped:
+				return tar_stream_status::stopped;
+			case state::error:
+				return tar_stream_status::error;
+		}
+	}
+
+	if(_state == state::end) {
+		return tar_stream_status::end;
+	}
+
+	return tar_stream_status::ok;
+}
+
+auto bzlreg::tar_stream::verify_headers_ahead( //
+	std::span<const std::byte> data
+) -> void {
+	auto header_offsets =
+		std::array<std::size_t, TAR_STREAM_CHECKSUM_BATCH_SIZE>{};
+	auto header_count = std::size_t{0};
+	auto offset = std::size_t{0};
+
+	// Walks the headers that are whole in `data` the same way they will be
+	// processed. Anything this doesn't predict, such as an entry whose size
+	// comes from an extended header, ends the batch.
+	while(
+		header_count < header_offsets.size() &&
+		offset + TAR_BLOCK_SIZE <= data.size()
+	) {
+		auto header = data.subspan(offset).first<TAR_BLOCK_SIZE>();
+		if(tar_block_is_zero(header)) {
+			break;
+		}
+
+		auto size = parse_header_number(header, TAR_HEADER_FILE_SIZE);
+		if(!size) {
+			break;
+		}
+
+		header_offsets[header_count] = offset;
+		header_count += 1;
+
+		auto typeflag = get_typeflag(header);
+		if(
+			typeflag == typeflag_enum::extended_header ||
+			typeflag == typeflag_enum::gnu_long_name ||
+			typeflag == typeflag_enum::gnu_long_link_name ||
+			*size >= data.size()
+		) {
+			break;
+		}
+
+		offset += TAR_BLOCK_SIZE + round_up_to_multiple(*size, TAR_BLOCK_SIZE);
+	}
+
+	_verified_headers.clear();
+	_verified_header_index = 0;
+
+	// A lone header is checked when it is processed
+	if(header_count < 2) {
+		return;
+	}
+
+	auto batch = std::span{header_offsets}.first(header_count);
+	auto bad = find_bad_tar_header(data, batch);
+	for(auto header_offset : batch.first(bad)) {
+		_verified_headers.push_back(_offset + header_offset);
+	}
+}
+
+auto bzlreg::tar_stream::header_verified(std::size_t header_offset) -> bool {
+	while(
+		_verified_header_index < _verified_headers.size() &&
+		_verified_headers[_verified_header_index] < header_offset
+	) {
+		_verified_header_index += 1;
+	}
+
+	if(
+		_verified_header_index < _verified_headers.size() &&
+		_verified_headers[_verified_header_index] == header_offset
+	) {
+		_verified_header_index += 1;
+		return true;
+	}
+
+	return false;
+}
+
+auto bzlreg::tar_stream::process_header() -> tar_stream_status {
+	if(tar_block_is_zero(_header)) {
+		_entry_header_offset.reset();
+		_consecutive_all0 += 1;
+		if(_consecutive_all0 >= 2) {
+			// The end of an archive is marked by at least two consecutive
+			// zero-filled records. SEE:
+			// https://en.wikipedia.org/wiki/Tar_(computing)
+			_state = state::end;
+			return tar_stream_status::end;
+		}
+		return tar_stream_status::ok;
+	}
+
+	_consecutive_all0 = 0;
+
+	const auto header = tar_block{_header};
+	if(
+		!header_verified(_offset - TAR_BLOCK_SIZE) &&
+		!tar_header_checksum_valid(header)
+	) {
+		return fail("bad tar header checksum");
+	}
+
+	const auto typeflag = get_typeflag(header);
+	const auto header_file_size =
+		parse_header_number(header, TAR_HEADER_FILE_SIZE);
+
+	if(!header_file_size) {
+		return fail("bad tar header file size");
+	}
+
+	switch(typeflag) {
+		case typeflag_enum::extended_header:
+		case typeflag_enum::gnu_long_name:
+		case typeflag_enum::gnu_long_link_name:
+			if(*header_file_size > TAR_STREAM_MAX_EXTENDED_HEADER_SIZE) {
+				return fail(std::format(
+					"extended header too large ({} bytes)",
+					*header_file_size
+				));
+			}
+
+			_extended_header.clear();
+			_extended_header_typeflag = static_cast<char>(typeflag);
+			_extended_header_remaining = *header_file_size;
+			_padding_remaining =
+				round_up_to_multiple(*header_file_size, TAR_BLOCK_SIZE) -
+				*header_file_size;
+			_state = state::extended_header;
+
+			if(_extended_header_remaining == 0) {
+				return process_extended_header();
+			}
+			return tar_stream_status::ok;
+		case typeflag_enum::global_extended_header:
+			// Global headers only carry metadata we have no use for
+			_entry = {};
+			_entry.size = *header_file_size;
+			_entry_read = false;
+			_entry_header_offset.reset();
+			break;
+		default:
+			auto entry_name = tar_entry_name{};
+			auto entry_link_name = std::string_view{};
+
+			// Swapping keeps both buffers' capacity around for the next entry
+			if(!_pending_path.empty()) {
+				_entry_name.swap(_pending_path);
+				entry_name = tar_entry_name{_entry_name};
+			} else {
+				entry_name = header_entry_name(header);
+			}
+
+			if(!_pending_link_path.empty()) {
+				_entry_link_name.swap(_pending_link_path);
+				entry_link_name = _entry_link_name;
+			} else {
+				entry_link_name = header_field_string(header, TAR_HEADER_LINK_NAME);
+			}
+
+			_entry = tar_stream_entry{
+				.name = entry_name,
+				.link_name = entry_link_name,
+				.type = to_entry_type(typeflag),
+				.size = _pending_size.value_or(*header_file_size),
+				.mode = static_cast<std::uint32_t>(
+					parse_header_number(header, TAR_HEADER_FILE_MODE).value_or(0)
+				),
+				.header_offset = *_entry_header_offset,
+				.contents_offset = _offset,
+			};
+
+			_entry_header_offset.reset();
+			_pending_path.clear();
+			_pending_link_path.clear();
+			_pending_size.reset();
+
+			switch(_on_entry(_entry)) {
+				case tar_stream_action::skip:
+					_entry_read = false;
+					break;
+				case tar_stream_action::read:
+					_entry_read = true;
+					break;
+				case tar_stream_action::stop:
+					_state = state::stopped;
+					return tar_stream_status::stopped;
+			}
+			break;
+	}
+
+	_contents_offset = 0;
+	_padding_remaining =
+		round_up_to_multiple(_entry.size, TAR_BLOCK_SIZE) - _entry.size;
+	if(_entry.size > 0) {
+		_state = state::contents;
+	} else {
+		_state = state::header;
+	}
+
+	return tar_stream_status::ok;
+}
+
+auto bzlreg::tar_stream::process_extended_header() -> tar_stream_status {
+	switch(static_cast<typeflag_enum>(_extended_header_typeflag)) {
+		case typeflag_enum::extended_header: {
+			auto err = parse_pax_records(
+				_extended_header,
+				[this](std::string_view key, std::string_view value) {
+					if(key == "path") {
+						_pending_path.assign(value);
+					} else if(key == "linkpath") {
+						_pending_link_path.assign(value);
+					} else if(key == "size") {
+						auto size = std::size_t{};
+						auto [_, ec] = std::from_chars(
+							value.data(),
+							value.data() + value.size(),
+							size
+						);
+						if(ec == std::errc{}) {
+							_pending_size = size;
+						}
+					}
+				}
+			);
+			if(!err.empty()) {
+				return fail(std::string{err});
+			}
+			break;
+		}
+		case typeflag_enum::gnu_long_name:
+			_pending_path.assign(
+				std::string_view{_extended_header}.substr(
+					0,
+					_extended_header.find('\0')
+				)
+			);
+			break;
+		case typeflag_enum::gnu_long_link_name:
+			_pending_link_path.assign(
+				std::string_view{_extended_header}.substr(
+					0,
+					_extended_header.find('\0')
+				)
+			);
+			break;
+		default:
+			break;
+	}
+
+	_state = _padding_remaining > 0 ? state::padding : state::header;
+	return tar_stream_status::ok;
+}
+
+auto bzlreg::tar_stream::finished() const noexcept -> bool {
+	return _state == state::end || (_state == state::header && _header_size == 0);
+}
+
+auto bzlreg::tar_stream::error_message() const noexcept -> std::string_view {
+	return _error_message;
+}
+
+bzlreg::tar_index::tar_index() = default;
+bzlreg::tar_index::tar_index(tar_index&&) noexcept = default;
+bzlreg::tar_index::~tar_index() = default;
+
+auto bzlreg::tar_index::operator=( //
+	tar_index&&
+) noexcept -> tar_index& = default;
+
+bzlreg::tar_index::tar_index(tar_view view) : _tar_bytes(view._tar_bytes) {
+	for(auto file : view) {
+		auto name = file.entry_name();
+		auto header_offset =
+			static_cast<std::size_t>(file._data.data() - _tar_bytes.data());
+
+		// Names without a ustar prefix already are stable views into the archive
+		insert(entry{
+			.name = name.prefix().empty() ? name : tar_entry_name{copy_name(name)},
+			.header_offset = header_offset,
+			.contents_offset = header_offset + file._header_byte_size,
+			.size = file._size,
+			.type = file.type(),
+		});
+	}
+
+	_error_message = view.error_message();
+	if(!_error_message.empty()) {
+		_entries.clear();
+		_entry_by_name.clear();
+		_top_level_dir.reset();
+	}
+}
+
+auto bzlreg::tar_index::add(const tar_stream_entry& entry) -> void {
+	insert({
+		.name = tar_entry_name{copy_name(entry.name)},
+		.header_offset = entry.header_offset,
+		.contents_offset = entry.contents_offset,
+		.size = entry.size,
+		.type = entry.type,
+	});
+}
+
+auto bzlreg::tar_index::copy_name(tar_entry_name name) -> std::string_view {
+	if(!_arena) {
+		_arena = std::make_unique<std::pmr::monotonic_buffer_resource>();
+	}
+
+	auto data = static_cast<char*>(_arena->allocate(name.size(), alignof(char)));
+	auto out = data;
+	if(!name.prefix().empty()) {
+		out = std::ranges::copy(name.prefix(), out).out;
+		*out++ = '/';
+	}
+	std::ranges::copy(name.name(), out);
+
+	return std::string_view{data, name.size()};
+}
+
+auto bzlreg::tar_index::insert(entry e) -> void {
+	auto dir = e.name.top_level_dir();
+	if(!_top_level_dir) {
+		_top_level_dir = dir;
+	} else if(*_top_level_dir != dir) {
+		_top_level_dir = std::string_view{};
+	}
+
+	// Every indexed name is whole so it can be used as the key as is
+	_entry_by_name.insert_or_assign(
+		e.name.name(),
+		static_cast<std::uint32_t>(_entries.size())
+	);
+	_entries.push_back(e);
+}
+
+auto bzlreg::tar_index::entries() const noexcept -> std::span<const entry> {
+	return _entries;
+}
+
+auto bzlreg::tar_index::find( //
+	std::string_view name
+) const noexcept -> const entry* {
+	auto itr = _entry_by_name.find(name);
+	if(itr == _entry_by_name.end()) {
+		return nullptr;
+	}
+
+	return &_entries[itr->second];
+}
+
+auto bzlreg::tar_index::top_level_dir() const noexcept -> std::string_view {
+	return _top_level_dir.value_or(std::string_view{});
+}
+
+auto bzlreg::tar_index::contents( //
+	const entry& e
+) const noexcept -> std::span<std::byte> {
+	if(_tar_bytes.empty()) {
+		return {};
+	}
+
+	return _tar_bytes.subspan(e.contents_offset, e.size);
+}
+
+auto bzlreg::tar_index::error_message() const noexcept -> std::string_view {
+	return _error_message;
+}
@@ -5,19 +5,172 @@
 #include <string_view>
 #include <string>
 #include <array>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <vector>
+#include "absl/container/flat_hash_map.h"
+#include "bzlreg/tar_header.hh"
 
 namespace bzlreg {
 class tar_view;
+class tar_index;
+
+enum class tar_entry_type {
+	file,
+	directory,
+	symbolic_link,
+	hard_link,
+	other,
+};
+
+
+/**
+ * Name of a tar entry viewed in place. ustar headers may split a name into a
+ * prefix and a name which are logically joined by a '/'. Nothing here
+ * allocates except `to_string()`.
+ */
+class tar_entry_name {
+	std::string_view _prefix;
+	std::string_view _name;
+
+public:
+	constexpr tar_entry_name() = default;
+
+	constexpr tar_entry_name(std::string_view name) : _name(name) {
+	}
+
+	constexpr tar_entry_name(std::string_view prefix, std::string_view name)
+		: _prefix(prefix), _name(name) {
+	}
+
+	constexpr auto prefix() const noexcept -> std::string_view {
+		return _prefix;
+	}
+
+	constexpr auto name() const noexcept -> std::string_view {
+		return _name;
+	}
+
+	constexpr auto size() const noexcept -> std::size_t {
+		return _prefix.empty() ? _name.size() : _prefix.size() + 1 + _name.size();
+	}
+
+	constexpr auto empty() const noexcept -> bool {
+		return _prefix.empty() && _name.empty();
+	}
+
+	constexpr auto equals(std::string_view other) const noexcept -> bool {
+		if(_prefix.empty()) {
+			return _name == other;
+		}
+
+		return other.size() == size() && other.starts_with(_prefix) &&
+			other[_prefix.size()] == '/' && other.ends_with(_name);
+	}
+
+	constexpr auto starts_with(std::string_view other) const noexcept -> bool {
+		if(_prefix.empty()) {
+			return _name.starts_with(other);
+		}
+
+		if(other.size() <= _prefix.size()) {
+			return _prefix.starts_with(other);
+		}
+
+		return other.starts_with(_prefix) && other[_prefix.size()] == '/' &&
+			_name.starts_with(other.substr(_prefix.size() + 1));
+	}
+
+	constexpr auto ends_with(std::string_view other) const noexcept -> bool {
+		if(_prefix.empty() || other.size() <= _name.size()) {
+			return _name.ends_with(other);
+		}
+
+		return other.ends_with(_name) &&
+			other[other.size() - _name.size() - 1] == '/' &&
+			_prefix.ends_with(other.substr(0, other.size() - _name.size() - 1));
+	}
+
+	constexpr auto ends_with(char c) const noexcept -> bool {
+		return _name.empty() ? !_prefix.empty() && c == '/' : _name.ends_with(c);
+	}
+
+	/**
+	 * First path segment if the name has more than one or an empty view for
+	 * entries at the root of the archive.
+	 */
+	constexpr auto top_level_dir() const noexcept -> std::string_view {
+		if(!_prefix.empty()) {
+			return _prefix.substr(0, _prefix.find('/'));
+		}
+
+		auto slash_idx = _name.find('/');
+		if(slash_idx == std::string_view::npos) {
+			return {};
+		}
+
+		return _name.substr(0, slash_idx);
+	}
+
+	auto append_to(std::string& out) const -> void {
+		if(!_prefix.empty()) {
+			out += _prefix;
+			out += '/';
+		}
+		out += _name;
+	}
+
+	auto to_string() const -> std::string {
+		auto str = std::string{};
+		str.reserve(size());
+		append_to(str);
+		return str;
+	}
+
+	constexpr friend auto operator==(
+		const tar_entry_name& a,
+		std::string_view      b
+	) noexcept -> bool {
+		return a.equals(b);
+	}
+};
 
 class tar_view_file {
 	friend tar_view;
+	friend tar_index;
 	std::span<std::byte>       _data;
 	std::span<const std::byte> _extended_header_path = {};
 	std::span<const std::byte> _extended_header_linkpath = {};
 	std::span<const std::byte> _extended_header_size = {};
 
+	/**
+	 * Parsed once on construction. Both are read several times per entry while
+	 * iterating.
+	 */
+	std::size_t _size = 0;
+	std::size_t _header_byte_size = 0;
+
+	/**
+	 * Why the entry couldn't be parsed. The file is empty when this is set.
+	 */
+	std::string_view _error = {};
+
 	tar_view_file(std::span<std::byte> data) noexcept;
 
+	/**
+	 * @returns an error message or an empty string on success
+	 */
+	auto parse() noexcept -> std::string_view;
+
+	/**
+	 * The header describing the entry itself. Differs from the start of `_data`
+	 * when the entry is preceded by a PAX extended header.
+	 */
+	auto entry_header() const noexcept -> tar_block;
+
 	/**
 	 * As small as 1 tar header (512 bytes) and as large as 1 tar header + PAX
 	 * header + the following tar header.
@@ -28,17 +181,23 @@ public:
 	tar_view_file();
 	tar_view_file(tar_view_file&&) noexcept;
 	tar_view_file(const tar_view_file&) noexcept;
+	auto operator=(tar_view_file&&) noexcept -> tar_view_file&;
+	auto operator=(const tar_view_file&) noexcept -> tar_view_file&;
 
 	operator bool() const noexcept;
 
 	auto name() const noexcept -> std::string;
+	auto entry_name() const noexcept -> tar_entry_name;
 	auto size() const noexcept -> size_t;
+	auto type() const noexcept -> tar_entry_type;
 	auto contents() const noexcept -> std::span<std::byte>;
 	auto string_view() const noexcept -> std::string_view;
 };
 
 class tar_view {
+	friend tar_index;
 	std::span<std::byte> _tar_bytes;
+	std::string          _error_message;
 
 public:
 	class sentinel {
@@ -54,12 +213,21 @@ public:
 	class iterator {
 		friend tar_view;
 
+		tar_view*            _view = nullptr;
 		std::span<std::byte> _data = {};
+		tar_view_file        _file = {};
 
 		iterator() = default;
 		iterator(const iterator&) = default;
 		iterator(iterator&&) = default;
 
+		/**
+		 * Parses the entry at the start of `_data` into `_file`. Iteration ends
+		 * with an empty `_file` at the end of the archive or on a malformed
+		 * entry.
+		 */
+		auto load() -> void;
+
 	public:
 		auto operator!=(sentinel) const -> bool;
 		auto operator++() -> iterator&;
@@ -74,6 +242,225 @@ public:
 	auto begin() -> iterator;
 	auto end() const noexcept -> sentinel;
 
-	auto file(std::string_view filename) -> tar_view_file;
+	/**
+	 * Set when the last iteration stopped early because the archive is
+	 * malformed (e.g. a bad header checksum).
+	 */
+	auto error_message() const noexcept -> std::string_view;
+};
+
+/**
+ * Entry header decoded by `tar_stream`. Views are only valid for the duration
+ * of the callback the entry was passed to.
+ */
+struct tar_stream_entry {
+	tar_entry_name   name;
+	std::string_view link_name;
+	tar_entry_type   type;
+	std::size_t      size;
+	std::uint32_t    mode;
+
+	/**
+	 * Positions within the archive of the first header describing the entry,
+	 * which may be an extended header, and of its contents
+	 */
+	std::size_t header_offset;
+	std::size_t contents_offset;
+};
+
+/**
+ * Flat table of every entry in a tar archive built in a single pass, either
+ * over a `tar_view` or entry by entry as a `tar_stream` decodes them. Names
+ * are kept in the index's own arena unless they already are a stable view
+ * into a `tar_view`, so lookups by name are O(1) and iterating entries doesn't
+ * allocate. When an archive contains the same name more than once the last
+ * entry wins, same as extracting it would.
+ */
+class tar_index {
+public:
+	struct entry {
+		tar_entry_name name;
+		std::size_t    header_offset;
+		std::size_t    contents_offset;
+		std::size_t    size;
+		tar_entry_type type;
+	};
+
+private:
+	// Declared first so it outlives every view into it
+	std::unique_ptr<std::pmr::monotonic_buffer_resource> _arena;
+	std::span<std::byte>                                 _tar_bytes;
+	std::vector<entry>                                   _entries;
+	absl::flat_hash_map<std::string_view, std::uint32_t> _entry_by_name;
+	std::optional<std::string_view>                      _top_level_dir;
+	std::string                                          _error_message;
+
+	auto copy_name(tar_entry_name name) -> std::string_view;
+	auto insert(entry e) -> void;
+
+public:
+	tar_index();
+
+	/**
+	 * Indexes every entry of `view`. A malformed archive leaves the index empty
+	 * with `error_message()` set.
+	 */
+	tar_index(tar_view view);
+
+	tar_index(tar_index&&) noexcept;
+	tar_index(const tar_index&) = delete;
+	auto operator=(tar_index&&) noexcept -> tar_index&;
+	~tar_index();
+
+	/**
+	 * Adds an entry while a `tar_stream` decodes the archive. Its name is copied
+	 * since stream entries only live for the duration of the callback.
+	 */
+	auto add(const tar_stream_entry& entry) -> void;
+
+	auto entries() const noexcept -> std::span<const entry>;
+	auto find(std::string_view name) const noexcept -> const entry*;
+
+	/**
+	 * Top level directory shared by every entry so far, empty if there isn't
+	 * one
+	 */
+	auto top_level_dir() const noexcept -> std::string_view;
+
+	/**
+	 * Contents of `e` for an index built over a `tar_view`. Empty for an index
+	 * built from a stream, which never holds the archive.
+	 */
+	auto contents(const entry& e) const noexcept -> std::span<std::byte>;
+
+	auto error_message() const noexcept -> std::string_view;
+};
+
+enum class tar_stream_action {
+	/**
+	 * Skip over the entry contents
+	 */
+	skip,
+
+	/**
+	 * Pass the entry contents to the contents callback
+	 */
+	read,
+
+	/**
+	 * Stop reading the archive
+	 */
+	stop,
+};
+
+enum class tar_stream_status {
+	/**
+	 * All written bytes were consumed and more are expected
+	 */
+	ok,
+
+	/**
+	 * A callback asked to stop reading
+	 */
+	stopped,
+
+	/**
+	 * The end of archive marker was reached
+	 */
+	end,
+
+	/**
+	 * The archive is malformed. See `tar_stream::error_message()`.
+	 */
+	error,
+};
+
+/**
+ * Incremental version of `tar_view`. Bytes are written in chunks of any size
+ * (e.g. straight out of a `decompress_stream`) and only the current header is
+ * buffered, so memory stays bounded regardless of archive size. Checksums of
+ * the headers a written chunk holds are verified together as a batch.
+ */
+class tar_stream {
+public:
+	using entry_fn = std::function<tar_stream_action(const tar_stream_entry&)>;
+
+	/**
+	 * Called one or more times with consecutive chunks of an entry that was
+	 * read. `offset` is the position of `chunk` within the entry contents.
+	 * Return `false` to stop reading the archive.
+	 */
+	using contents_fn = std::function<bool(
+		const tar_stream_entry&    entry,
+		std::span<const std::byte> chunk,
+		std::size_t                offset
+	)>;
+
+private:
+	enum class state {
+		header,
+		extended_header,
+		contents,
+		padding,
+		end,
+		stopped,
+		error,
+	};
+
+	entry_fn    _on_entry;
+	contents_fn _on_contents;
+
+	state       _state = state::header;
+	std::size_t _consecutive_all0 = 0;
+
+	std::array<std::byte, 512> _header = {};
+	std::size_t                _header_size = 0;
+
+	/** buffered PAX or GNU long name header data */
+	std::string _extended_header;
+	std::size_t _extended_header_remaining = 0;
+	char        _extended_header_typeflag = 0;
+
+	/** values carried over from an extended header to the next entry */
+	std::string                _pending_path;
+	std::string                _pending_link_path;
+	std::optional<std::size_t> _pending_size;
+
+	/** owns PAX or GNU long names of the current entry */
+	std::string      _entry_name;
+	std::string      _entry_link_name;
+	tar_stream_entry _entry = {};
+	bool             _entry_read = false;
+	std::size_t      _contents_offset = 0;
+	std::size_t      _padding_remaining = 0;
+
+	/** bytes of the archive consumed so far */
+	std::size_t                _offset = 0;
+	std::optional<std::size_t> _entry_header_offset;
+
+	/** offsets of headers ahead whose checksums were verified as a batch */
+	std::vector<std::size_t> _verified_headers;
+	std::size_t              _verified_header_index = 0;
+
+	std::string _error_message;
+
+	auto fail(std::string message) -> tar_stream_status;
+	auto verify_headers_ahead(std::span<const std::byte> data) -> void;
+	auto header_verified(std::size_t header_offset) -> bool;
+	auto process_header() -> tar_stream_status;
+	auto process_extended_header() -> tar_stream_status;
+
+public:
+	tar_stream(entry_fn on_entry, contents_fn on_contents = {});
+
+	auto write(std::span<const std::byte> data) -> tar_stream_status;
+
+	/**
+	 * `true` if the stream ended on an entry boundary. Archives missing the
+	 * end of archive marker are accepted.
+	 */
+	auto finished() const noexcept -> bool;
+
+	auto error_message() const noexcept -> std::string_view;
 };
 } // namespace bzlreg
@@ -1,51 +1,52 @@
 #include "bzlreg/util.hh"
 
-#include <print>
-#include <execution>
-#include <unordered_map>
-#include <string>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstdio>
+#include <format>
 #include <fstream>
+#include <random>
+#include <string>
+#include <vector>
 #include <openssl/evp.h>
-#include "bzlreg/defer.hh"
-#include "bzlreg/config_types.hh"
-#include "bzlreg/unused.hh"
-#include "nlohmann/json.hpp"
-
-using bzlreg::util::defer;
-using namespace std::string_literals;
-using namespace std::string_view_literals;
-namespace fs = std::filesystem;
-using json = nlohmann::json;
 
-auto bzlreg::calc_integrity( //
-	std::span<const std::byte> data
-) -> std::optional<std::string> {
-	auto* ctx = EVP_MD_CTX_new();
+/**
+ * Size of the reads `calc_file_integrity` hashes a file in
+ */
+constexpr auto FILE_INTEGRITY_CHUNK_SIZE = std::size_t{256} * 1024;
 
-	if(!ctx) {
-		return std::nullopt;
+static auto integrity_prefix( //
+	bzlreg::integrity_algorithm algorithm
+) -> std::string_view {
+	switch(algorithm) {
+		case bzlreg::integrity_algorithm::sha256:
+			return "sha256";
+		case bzlreg::integrity_algorithm::sha384:
+			return "sha384";
+		case bzlreg::integrity_algorithm::sha512:
+			return "sha512";
 	}
+	return {};
+}
 
-	UNUSED(auto) = defer([ctx] {
-		// TODO: figure out why this crashes
-		// EVP_MD_CTX_free(ctx);
-	});
-
-	if(!EVP_DigestInit_ex(ctx, EVP_sha256(), nullptr)) {
-		return std::nullopt;
-	}
-
-	if(!EVP_DigestUpdate(ctx, data.data(), data.size())) {
-		return std::nullopt;
-	}
-
-	uint8_t      hash[EVP_MAX_MD_SIZE];
-	unsigned int hash_length = 0;
-
-	if(!EVP_DigestFinal_ex(ctx, hash, &hash_length)) {
-		return std::nullopt;
+static auto evp_md(bzlreg::integrity_algorithm algorithm) -> const EVP_MD* {
+	switch(algorithm) {
+		case bzlreg::integrity_algorithm::sha256:
+			return EVP_sha256();
+		case bzlreg::integrity_algorithm::sha384:
+			return EVP_sha384();
+		case bzlreg::integrity_algorithm::sha512:
+			return EVP_sha512();
 	}
+	return nullptr;
+}
 
+static auto integrity_string( //
+	bzlreg::integrity_algorithm algorithm,
+	const uint8_t*              hash,
+	unsigned int                hash_length
+) -> std::string {
 	auto b64_str = std::string{};
 	b64_str.resize(hash_length * 4);
 
@@ -56,110 +57,251 @@ auto bzlreg::calc_integrity( //
 	);
 	b64_str.resize(b64_encode_size);
 
-	return std::format("sha256-{}", b64_str);
+	return std::format("{}-{}", integrity_prefix(algorithm), b64_str);
 }
 
-auto bzlreg::calc_source_integrity( //
-	std::filesystem::path source_json_path
-) -> void {
-	bzlreg::source_config source = json::parse(std::ifstream{source_json_path});
-
-	auto module_dir = source_json_path.parent_path();
-	auto patches_dir = module_dir / "patches";
-	auto overlay_dir = module_dir / "overlay";
-	auto integrity_paths = std::unordered_map<std::string, std::string>{};
-	auto integrity_errors = std::unordered_map<std::string, std::string>{};
+auto bzlreg::parse_integrity_algorithm( //
+	std::string_view name
+) -> std::optional<integrity_algorithm> {
+	constexpr auto algorithms = std::array{
+		integrity_algorithm::sha256,
+		integrity_algorithm::sha384,
+		integrity_algorithm::sha512,
+	};
+	for(auto algorithm : algorithms) {
+		if(name == integrity_prefix(algorithm)) {
+			return algorithm;
+		}
+	}
+	return std::nullopt;
+}
 
-	if(fs::exists(patches_dir)) {
-		for(auto& entry : fs::recursive_directory_iterator(patches_dir)) {
-			if(entry.is_regular_file()) {
-				auto rel_path =
-					fs::proximate(entry.path(), module_dir).generic_string();
-				integrity_paths.emplace(rel_path, ""s);
-				integrity_errors.emplace(rel_path, ""s);
-			}
+auto bzlreg::parse_integrity_algorithms( //
+	std::string_view names
+) -> std::optional<std::vector<integrity_algorithm>> {
+	auto algorithms = std::vector<integrity_algorithm>{};
+	for(;;) {
+		auto comma = names.find(',');
+		auto algorithm = parse_integrity_algorithm(names.substr(0, comma));
+		if(!algorithm) {
+			return std::nullopt;
+		}
+		if(std::ranges::find(algorithms, *algorithm) == algorithms.end()) {
+			algorithms.emplace_back(*algorithm);
 		}
+		if(comma == std::string_view::npos) {
+			break;
+		}
+		names.remove_prefix(comma + 1);
+	}
+	return algorithms;
+}
+
+auto bzlreg::integrity_algorithm_of( //
+	std::string_view integrity
+) -> std::optional<integrity_algorithm> {
+	auto dash = integrity.find('-');
+	if(dash == std::string_view::npos) {
+		return std::nullopt;
 	}
+	return parse_integrity_algorithm(integrity.substr(0, dash));
+}
+
+struct bzlreg::integrity_hasher::impl {
+	struct digest {
+		integrity_algorithm algorithm;
+		EVP_MD_CTX*         ctx;
+	};
 
-	if(fs::exists(overlay_dir)) {
-		for(auto& entry : fs::recursive_directory_iterator(overlay_dir)) {
-			if(entry.is_regular_file()) {
-				auto rel_path =
-					fs::proximate(entry.path(), module_dir).generic_string();
-				integrity_paths.emplace(rel_path, ""s);
-				integrity_errors.emplace(rel_path, ""s);
-			}
+	std::vector<digest> digests;
+	bool                ok = true;
+
+	explicit impl(std::span<const integrity_algorithm> algorithms) {
+		digests.reserve(algorithms.size());
+		for(auto algorithm : algorithms) {
+			auto ctx = EVP_MD_CTX_new();
+			ok = ok && ctx && EVP_DigestInit_ex(ctx, evp_md(algorithm), nullptr);
+			digests.emplace_back(algorithm, ctx);
 		}
 	}
 
-	for(auto&& [rel_path, _] : source.patches) {
-		if(rel_path.starts_with("..")) {
-			integrity_paths.emplace(rel_path, ""s);
-			integrity_errors.emplace(rel_path, ""s);
+	~impl() {
+		for(auto& digest : digests) {
+			EVP_MD_CTX_free(digest.ctx);
 		}
 	}
+};
+
+bzlreg::integrity_hasher::integrity_hasher()
+	: integrity_hasher({integrity_algorithm::sha256}) {
+}
+
+bzlreg::integrity_hasher::integrity_hasher(
+	std::initializer_list<integrity_algorithm> algorithms
+)
+	: integrity_hasher(std::span{algorithms.begin(), algorithms.size()}) {
+}
+
+bzlreg::integrity_hasher::integrity_hasher(
+	std::span<const integrity_algorithm> algorithms
+)
+	: _impl(std::make_unique<impl>(algorithms)) {
+}
+
+bzlreg::integrity_hasher::integrity_hasher(integrity_hasher&&) noexcept =
+	default;
+
+bzlreg::integrity_hasher::~integrity_hasher() = default;
+
+auto bzlreg::integrity_hasher::update(std::span<const std::byte> data)
+	-> bool {
+	for(auto& digest : _impl->digests) {
+		_impl->ok = _impl->ok &&
+			EVP_DigestUpdate(digest.ctx, data.data(), data.size());
+	}
+	return _impl->ok;
+}
+
+auto bzlreg::integrity_hasher::finish() -> std::optional<std::string> {
+	auto integrities = finish_each();
+	if(!integrities) {
+		return std::nullopt;
+	}
 
-	for(auto&& [rel_path, _] : source.overlay) {
-		if(rel_path.starts_with("..")) {
-			integrity_paths.emplace(rel_path, ""s);
-			integrity_errors.emplace(rel_path, ""s);
+	auto result = std::string{};
+	for(const auto& integrity : *integrities) {
+		if(!result.empty()) {
+			result += ' ';
 		}
+		result += integrity;
 	}
+	return result;
+}
 
-	std::for_each(
-		std::execution::seq,
-		integrity_paths.begin(),
-		integrity_paths.end(),
-		[&](std::pair<const std::string, std::string>& pair) {
-			auto file_path = module_dir / pair.first;
-			auto file_content = std::vector<std::byte>{};
-			auto ec = std::error_code{};
-
-			read_file_contents(file_path, file_content, ec);
-
-			if(ec) {
-				integrity_errors.at(pair.first) = ec.message();
-				return;
-			}
-
-			auto integrity = calc_integrity(
-				std::span{
-					file_content.data(),
-					file_content.size(),
-				}
-			);
-			if(!integrity) {
-				integrity_errors.at(pair.first) = "calc_integrity() failed"s;
-				return;
-			}
-			pair.second = *integrity;
+auto bzlreg::integrity_hasher::finish_each()
+	-> std::optional<std::vector<std::string>> {
+	if(!_impl->ok) {
+		return std::nullopt;
+	}
+	_impl->ok = false;
+
+	auto integrities = std::vector<std::string>{};
+	integrities.reserve(_impl->digests.size());
+	for(auto& digest : _impl->digests) {
+		uint8_t      hash[EVP_MAX_MD_SIZE];
+		unsigned int hash_length = 0;
+
+		if(!EVP_DigestFinal_ex(digest.ctx, hash, &hash_length)) {
+			return std::nullopt;
 		}
-	);
+		integrities.emplace_back(
+			integrity_string(digest.algorithm, hash, hash_length)
+		);
+	}
+
+	return integrities;
+}
+
+auto bzlreg::calc_integrity( //
+	std::span<const std::byte> data,
+	integrity_algorithm        algorithm
+) -> std::optional<std::string> {
+	// EVP_DigestInit_ex resets the context so it's allocated once per thread
+	thread_local auto ctx = std::unique_ptr<EVP_MD_CTX, void (*)(EVP_MD_CTX*)>{
+		EVP_MD_CTX_new(),
+		EVP_MD_CTX_free,
+	};
 
-	auto has_error = false;
-	for(auto&& [p, err] : integrity_errors) {
-		if(!err.empty()) {
-			has_error = true;
-			std::println(stderr, "[ERROR] {}: {}", p, err);
+	uint8_t      hash[EVP_MAX_MD_SIZE];
+	unsigned int hash_length = 0;
+
+	if(
+		!ctx || !EVP_DigestInit_ex(ctx.get(), evp_md(algorithm), nullptr) ||
+		!EVP_DigestUpdate(ctx.get(), data.data(), data.size()) ||
+		!EVP_DigestFinal_ex(ctx.get(), hash, &hash_length)
+	) {
+		return std::nullopt;
+	}
+
+	return integrity_string(algorithm, hash, hash_length);
+}
+
+auto bzlreg::calc_file_integrity( //
+	const std::filesystem::path& path,
+	std::error_code&             ec,
+	integrity_algorithm          algorithm
+) -> std::optional<std::string> {
+	auto integrities = calc_file_integrities(path, ec, std::span{&algorithm, 1});
+	if(!integrities) {
+		return std::nullopt;
+	}
+	return std::move(integrities->front());
+}
+
+auto bzlreg::calc_file_integrities( //
+	const std::filesystem::path&         path,
+	std::error_code&                     ec,
+	std::span<const integrity_algorithm> algorithms
+) -> std::optional<std::vector<std::string>> {
+	ec = {};
+
+	auto path_str = path.generic_string();
+	auto fp = std::unique_ptr<::FILE, int (*)(::FILE*)>{
+		::fopen(path_str.c_str(), "rb"),
+		::fclose,
+	};
+	if(!fp) {
+		ec = std::error_code{errno, std::generic_category()};
+		return std::nullopt;
+	}
+
+	auto hasher = integrity_hasher(algorithms);
+	auto buffer = std::vector<std::byte>(FILE_INTEGRITY_CHUNK_SIZE);
+	for(;;) {
+		auto read_size = ::fread(buffer.data(), 1, buffer.size(), fp.get());
+		if(read_size > 0 && !hasher.update(std::span{buffer}.first(read_size))) {
+			return std::nullopt;
+		}
+		if(read_size < buffer.size()) {
+			break;
 		}
 	}
 
-	if(has_error) {
-		return;
+	if(::ferror(fp.get())) {
+		ec = make_error_code(std::errc::io_error);
+		return std::nullopt;
 	}
 
-	source.overlay.clear();
-	source.patches.clear();
+	return hasher.finish_each();
+}
+
+auto bzlreg::write_file_atomic( //
+	const std::filesystem::path& path,
+	std::string_view             contents
+) -> bool {
+	auto tmp_path = path;
+	tmp_path += std::format(".{:x}.tmp", std::random_device{}());
 
-	for(auto&& [p, integrity] : integrity_paths) {
-		if(auto prefix = "overlay/"sv; p.starts_with(prefix)) {
-			source.overlay.emplace(p.substr(prefix.size()), integrity);
-		} else if(auto prefix = "patches/"sv; p.starts_with(prefix)) {
-			source.patches.emplace(p.substr(prefix.size()), integrity);
+	auto ec = std::error_code{};
+	{
+		auto file = std::ofstream{tmp_path, std::ios::binary};
+		file.write(contents.data(), static_cast<std::streamsize>(contents.size()));
+		file.close();
+		if(!file) {
+			std::filesystem::remove(tmp_path, ec);
+			return false;
 		}
 	}
 
-	std::println("updating {}", source_json_path.generic_string());
-	std::ofstream{source_json_path, std::ios_base::binary}
-		<< json{source}[0].dump(4, ' ', false);
+	auto status = std::filesystem::status(path, ec);
+	if(!ec) {
+		std::filesystem::permissions(tmp_path, status.permissions(), ec);
+	}
+
+	std::filesystem::rename(tmp_path, path, ec);
+	if(ec) {
+		std::filesystem::remove(tmp_path, ec);
+		return false;
+	}
+	return true;
 }
@@ -1,17 +1,123 @@
 #pragma once
 
+#include <cerrno>
+#include <cstdio>
 #include <filesystem>
+#include <initializer_list>
 #include <string>
+#include <string_view>
 #include <system_error>
 #include <optional>
 #include <span>
+#include <memory>
+#include <vector>
 
 namespace bzlreg {
+enum class integrity_algorithm {
+	sha256,
+	sha384,
+	sha512,
+};
+
+/**
+ * `sha256`, `sha384` or `sha512`
+ */
+auto parse_integrity_algorithm( //
+	std::string_view name
+) -> std::optional<integrity_algorithm>;
+
+/**
+ * Comma separated `parse_integrity_algorithm` names such as `sha384,sha512`.
+ * Repeated algorithms are only listed once.
+ */
+auto parse_integrity_algorithms( //
+	std::string_view names
+) -> std::optional<std::vector<integrity_algorithm>>;
+
+/**
+ * Algorithm of an integrity string going by its prefix, such as `sha384-`
+ */
+auto integrity_algorithm_of( //
+	std::string_view integrity
+) -> std::optional<integrity_algorithm>;
+
+/**
+ * Integrity string of `data`. Reuses a digest context owned by the calling
+ * thread instead of allocating one per call.
+ */
 auto calc_integrity( //
-	std::span<const std::byte> data
+	std::span<const std::byte> data,
+	integrity_algorithm        algorithm = integrity_algorithm::sha256
+) -> std::optional<std::string>;
+
+/**
+ * Incremental `calc_integrity` for data that arrives in chunks. Any number of
+ * algorithms are calculated in the same pass, each chunk is fed to every
+ * digest while it is still in cache.
+ */
+class integrity_hasher {
+	struct impl;
+	std::unique_ptr<impl> _impl;
+
+public:
+	integrity_hasher();
+	explicit integrity_hasher(
+		std::initializer_list<integrity_algorithm> algorithms
+	);
+	explicit integrity_hasher(std::span<const integrity_algorithm> algorithms);
+	integrity_hasher(integrity_hasher&&) noexcept;
+	~integrity_hasher();
+
+	/**
+	 * `false` if a digest couldn't be initialized or updated
+	 */
+	auto update(std::span<const std::byte> data) -> bool;
+
+	/**
+	 * Integrity string of everything passed to `update`, the integrity of
+	 * every algorithm separated by spaces when there are multiple. The hasher
+	 * can't be updated afterwards.
+	 */
+	auto finish() -> std::optional<std::string>;
+
+	/**
+	 * Same as `finish` but with each integrity separately in the order the
+	 * algorithms were given in
+	 */
+	auto finish_each() -> std::optional<std::vector<std::string>>;
+};
+
+/**
+ * `calc_integrity` of the file at `path`. The file is read and hashed in
+ * fixed size chunks so memory use doesn't grow with the file. `ec` is set if
+ * the file couldn't be read.
+ */
+auto calc_file_integrity( //
+	const std::filesystem::path& path,
+	std::error_code&             ec,
+	integrity_algorithm          algorithm = integrity_algorithm::sha256
 ) -> std::optional<std::string>;
 
-auto calc_source_integrity(std::filesystem::path source_json) -> void;
+/**
+ * Same as `calc_file_integrity` but with the integrity of every algorithm in
+ * `algorithms` calculated from a single read of the file, in the same order
+ */
+auto calc_file_integrities( //
+	const std::filesystem::path&         path,
+	std::error_code&                     ec,
+	std::span<const integrity_algorithm> algorithms
+) -> std::optional<std::vector<std::string>>;
+
+/**
+ * Writes `contents` to a temporary file beside `path` and renames it over
+ * `path`, so readers only ever see the old or the new contents. A replaced
+ * file keeps its permissions. `false` if anything failed, in which case `path`
+ * wasn't touched.
+ */
+auto write_file_atomic( //
+	const std::filesystem::path& path,
+	std::string_view             contents
+) -> bool;
 
 template<typename CharContainer>
 auto read_file_contents(
@@ -23,27 +129,38 @@ auto read_file_contents(
 
 	ec = {};
 
-	auto    path_str = path.generic_string();
-	::FILE* fp = ::fopen(path_str.c_str(), "rb");
+	auto path_str = path.generic_string();
+	auto fp = std::unique_ptr<::FILE, int (*)(::FILE*)>{
+		::fopen(path_str.c_str(), "rb"),
+		::fclose,
+	};
 	if(!fp) {
-		ec = make_error_code(std::errc::no_such_file_or_directory);
+		ec = std::error_code{errno, std::generic_category()};
 		return;
 	}
-	::fseek(fp, 0, SEEK_END);
-	auto sz = ::ftell(fp);
-	if(sz == 0) {
-		ec = make_error_code(std::errc::io_error);
+	::fseek(fp.get(), 0, SEEK_END);
+	auto sz = ::ftell(fp.get());
+	if(sz < 0) {
+		ec = std::error_code{errno, std::generic_category()};
 		return;
 	}
 	out_container.resize(static_cast<size_type>(sz));
-	if(sz) {
-		::rewind(fp);
-		sz = ::fread(std::data(out_container), 1, std::size(out_container), fp);
-		if(sz == 0) {
-			ec = make_error_code(std::errc::io_error);
+	if(sz > 0) {
+		::rewind(fp.get());
+		errno = 0;
+		auto read_size = ::fread( //
+			std::data(out_container),
+			1,
+			std::size(out_container),
+			fp.get()
+		);
+		if(read_size != std::size(out_container)) {
+			// Without a read error the file shrank while it was being read
+			ec = ::ferror(fp.get()) && errno != 0
+				? std::error_code{errno, std::generic_category()}
+				: make_error_code(std::errc::io_error);
 			return;
 		}
 	}
-	::fclose(fp);
 }
 } // namespace bzlreg
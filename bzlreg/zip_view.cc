@@ -0,0 +1,367 @@
+#include "bzlreg/zip_view.hh"
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include "libdeflate.h"
+#include "bzlreg/defer.hh"
+#include "bzlreg/unused.hh"
+
+using bzlreg::util::defer;
+
+// https://pkware.cachefly.net/webdocs/casestudies/APPNOTE.TXT
+constexpr auto ZIP_EOCD_SIGNATURE = std::uint32_t{0x06054b50};
+constexpr auto ZIP_EOCD_SIZE = std::size_t{22};
+constexpr auto ZIP_EOCD_MAX_COMMENT_SIZE = std::size_t{0xffff};
+constexpr auto ZIP64_EOCD_LOCATOR_SIGNATURE = std::uint32_t{0x07064b50};
+constexpr auto ZIP64_EOCD_LOCATOR_SIZE = std::size_t{20};
+constexpr auto ZIP64_EOCD_SIGNATURE = std::uint32_t{0x06064b50};
+constexpr auto ZIP64_EOCD_SIZE = std::size_t{56};
+constexpr auto ZIP64_EXTRA_FIELD_ID = std::uint16_t{0x0001};
+constexpr auto ZIP_CENTRAL_HEADER_SIGNATURE = std::uint32_t{0x02014b50};
+constexpr auto ZIP_CENTRAL_HEADER_SIZE = std::size_t{46};
+constexpr auto ZIP_LOCAL_HEADER_SIGNATURE = std::uint32_t{0x04034b50};
+constexpr auto ZIP_LOCAL_HEADER_SIZE = std::size_t{30};
+
+constexpr auto ZIP_FLAG_ENCRYPTED = std::uint16_t{0x0001};
+constexpr auto ZIP_METHOD_STORED = std::uint16_t{0};
+constexpr auto ZIP_METHOD_DEFLATE = std::uint16_t{8};
+
+/**
+ * Deflate can't expand a single byte to more than this many bytes, so
+ * anything larger than its compressed size times this is a lie
+ */
+constexpr auto DEFLATE_MAX_EXPANSION = std::uint64_t{1032};
+
+/**
+ * Members read into a string are small files such as MODULE.bazel
+ */
+constexpr auto ZIP_MAX_STRING_SIZE = std::uint64_t{64} * 1024 * 1024;
+
+/**
+ * Upper byte of 'version made by'. Only unix archivers store a file mode in
+ * the upper half of the external attributes.
+ */
+constexpr auto ZIP_HOST_UNIX = std::uint16_t{3};
+constexpr auto UNIX_FILE_TYPE_MASK = std::uint32_t{0170000};
+constexpr auto UNIX_FILE_TYPE_SYMLINK = std::uint32_t{0120000};
+constexpr auto UNIX_FILE_TYPE_DIRECTORY = std::uint32_t{0040000};
+
+namespace {
+template<typename T>
+auto load_le(std::span<const std::byte> bytes, std::size_t offset) -> T {
+	auto value = T{0};
+	for(auto i = sizeof(T); i > 0; --i) {
+		value = static_cast<T>(
+			(value << 8) | std::to_integer<T>(bytes[offset + i - 1])
+		);
+	}
+	return value;
+}
+
+auto find_eocd(std::span<const std::byte> zip_bytes)
+	-> std::optional<std::size_t> {
+	if(zip_bytes.size() < ZIP_EOCD_SIZE) {
+		return std::nullopt;
+	}
+
+	// The record is at the very end unless the archive has a comment
+	auto last = zip_bytes.size() - ZIP_EOCD_SIZE;
+	auto first = last - std::min(last, ZIP_EOCD_MAX_COMMENT_SIZE);
+	for(auto offset = last + 1; offset > first; --offset) {
+		auto candidate = offset - 1;
+		if(load_le<std::uint32_t>(zip_bytes, candidate) != ZIP_EOCD_SIGNATURE) {
+			continue;
+		}
+
+		auto comment_size = load_le<std::uint16_t>(zip_bytes, candidate + 20);
+		if(candidate + ZIP_EOCD_SIZE + comment_size == zip_bytes.size()) {
+			return candidate;
+		}
+	}
+
+	return std::nullopt;
+}
+} // namespace
+
+auto bzlreg::zip_view::entry::is_directory() const noexcept -> bool {
+	if(name.ends_with('/')) {
+		return true;
+	}
+
+	return (version_made_by >> 8) == ZIP_HOST_UNIX &&
+		((external_attributes >> 16) & UNIX_FILE_TYPE_MASK) ==
+		UNIX_FILE_TYPE_DIRECTORY;
+}
+
+auto bzlreg::zip_view::entry::is_symbolic_link() const noexcept -> bool {
+	return (version_made_by >> 8) == ZIP_HOST_UNIX &&
+		((external_attributes >> 16) & UNIX_FILE_TYPE_MASK) ==
+		UNIX_FILE_TYPE_SYMLINK;
+}
+
+auto bzlreg::zip_view::entry::mode() const noexcept -> std::uint32_t {
+	auto mode = (version_made_by >> 8) == ZIP_HOST_UNIX
+		? (external_attributes >> 16) & 0777
+		: 0u;
+	return mode != 0 ? mode : 0644;
+}
+
+bzlreg::zip_view::zip_view(std::span<const std::byte> zip_bytes)
+	: _zip_bytes(zip_bytes) {
+	auto err = parse();
+	if(!err.empty()) {
+		_error_message = err;
+		_entries.clear();
+	}
+}
+
+bzlreg::zip_view::zip_view(zip_view&&) noexcept = default;
+bzlreg::zip_view::~zip_view() = default;
+
+auto bzlreg::zip_view::parse() -> std::string_view {
+	auto eocd_offset = find_eocd(_zip_bytes);
+	if(!eocd_offset) {
+		return "missing zip end of central directory record";
+	}
+
+	auto eocd = _zip_bytes.subspan(*eocd_offset);
+	auto entry_count = std::uint64_t{load_le<std::uint16_t>(eocd, 10)};
+	auto central_dir_size = std::uint64_t{load_le<std::uint32_t>(eocd, 12)};
+	auto central_dir_offset = std::uint64_t{load_le<std::uint32_t>(eocd, 16)};
+
+	// A zip64 locator right before the record means the real values are in the
+	// zip64 record. Saturated values without one are taken at face value.
+	auto locator_offset = *eocd_offset - ZIP64_EOCD_LOCATOR_SIZE;
+	auto is_zip64 = *eocd_offset >= ZIP64_EOCD_LOCATOR_SIZE &&
+		load_le<std::uint32_t>(_zip_bytes, locator_offset) ==
+			ZIP64_EOCD_LOCATOR_SIGNATURE;
+	if(is_zip64) {
+		auto zip64_eocd_offset =
+			load_le<std::uint64_t>(_zip_bytes, locator_offset + 8);
+		if(
+			zip64_eocd_offset > locator_offset ||
+			locator_offset - zip64_eocd_offset < ZIP64_EOCD_SIZE ||
+			load_le<std::uint32_t>(_zip_bytes, zip64_eocd_offset) !=
+				ZIP64_EOCD_SIGNATURE
+		) {
+			return "bad zip64 end of central directory record";
+		}
+
+		auto zip64_eocd = _zip_bytes.subspan(zip64_eocd_offset);
+		entry_count = load_le<std::uint64_t>(zip64_eocd, 32);
+		central_dir_size = load_le<std::uint64_t>(zip64_eocd, 40);
+		central_dir_offset = load_le<std::uint64_t>(zip64_eocd, 48);
+	}
+
+	if(
+		central_dir_offset > _zip_bytes.size() ||
+		central_dir_size > _zip_bytes.size() - central_dir_offset
+	) {
+		return "zip central directory out of bounds";
+	}
+
+	auto central_dir = _zip_bytes.subspan(central_dir_offset, central_dir_size);
+
+	// Every entry takes at least a fixed size header which bounds the reserve
+	// for archives lying about their entry count
+	_entries.reserve(
+		std::min(entry_count, central_dir.size() / ZIP_CENTRAL_HEADER_SIZE)
+	);
+
+	for(auto i = std::uint64_t{0}; i < entry_count; ++i) {
+		if(central_dir.size() < ZIP_CENTRAL_HEADER_SIZE) {
+			return "truncated zip central directory";
+		}
+
+		if(
+			load_le<std::uint32_t>(central_dir, 0) != ZIP_CENTRAL_HEADER_SIGNATURE
+		) {
+			return "bad zip central directory header signature";
+		}
+
+		auto name_size = load_le<std::uint16_t>(central_dir, 28);
+		auto extra_size = load_le<std::uint16_t>(central_dir, 30);
+		auto comment_size = load_le<std::uint16_t>(central_dir, 32);
+		auto header_size =
+			ZIP_CENTRAL_HEADER_SIZE + name_size + extra_size + comment_size;
+		if(central_dir.size() < header_size) {
+			return "truncated zip central directory";
+		}
+
+		auto e = entry{
+			.name = std::string_view{
+				reinterpret_cast<const char*>(
+					central_dir.data() + ZIP_CENTRAL_HEADER_SIZE
+				),
+				name_size,
+			},
+			.compressed_size = load_le<std::uint32_t>(central_dir, 20),
+			.uncompressed_size = load_le<std::uint32_t>(central_dir, 24),
+			.local_header_offset = load_le<std::uint32_t>(central_dir, 42),
+			.crc32 = load_le<std::uint32_t>(central_dir, 16),
+			.external_attributes = load_le<std::uint32_t>(central_dir, 38),
+			.version_made_by = load_le<std::uint16_t>(central_dir, 4),
+			.compression_method = load_le<std::uint16_t>(central_dir, 10),
+			.flags = load_le<std::uint16_t>(central_dir, 8),
+		};
+
+		// Sizes and offsets that don't fit in 32 bits are in the zip64 extra
+		// field in this order and only if their 32 bit field is saturated
+		auto extra = central_dir.subspan(
+			ZIP_CENTRAL_HEADER_SIZE + name_size,
+			extra_size
+		);
+		while(extra.size() >= 4) {
+			auto field_id = load_le<std::uint16_t>(extra, 0);
+			auto field_size = load_le<std::uint16_t>(extra, 2);
+			if(extra.size() - 4 < field_size) {
+				return "bad zip extra field";
+			}
+
+			auto field = extra.subspan(4, field_size);
+			if(field_id == ZIP64_EXTRA_FIELD_ID) {
+				auto field_offset = std::size_t{0};
+				auto zip64_values = std::array{
+					&e.uncompressed_size,
+					&e.compressed_size,
+					&e.local_header_offset,
+				};
+				for(auto value : zip64_values) {
+					if(*value != 0xffffffff) {
+						continue;
+					}
+					if(field.size() < field_offset + 8) {
+						return "bad zip64 extra field";
+					}
+					*value = load_le<std::uint64_t>(field, field_offset);
+					field_offset += 8;
+				}
+			}
+
+			extra = extra.subspan(4 + field_size);
+		}
+
+		// Checked here so nothing is allocated for sizes that can't be real
+		if(e.compressed_size > _zip_bytes.size()) {
+			return "zip entry larger than the archive";
+		}
+		if(e.uncompressed_size > e.compressed_size * DEFLATE_MAX_EXPANSION) {
+			return "zip entry size larger than its compressed data can hold";
+		}
+
+		_entries.push_back(e);
+		central_dir = central_dir.subspan(header_size);
+	}
+
+	return {};
+}
+
+bzlreg::zip_view::operator bool() const noexcept {
+	return _error_message.empty();
+}
+
+auto bzlreg::zip_view::entries() const noexcept -> std::span<const entry> {
+	return _entries;
+}
+
+auto bzlreg::zip_view::find( //
+	std::string_view name
+) const noexcept -> const entry* {
+	auto itr = std::ranges::find(_entries, name, &entry::name);
+	if(itr == _entries.end()) {
+		return nullptr;
+	}
+
+	return &*itr;
+}
+
+auto bzlreg::zip_view::read( //
+	const entry&         e,
+	std::span<std::byte> out
+) const -> bool {
+	if(out.size() != e.uncompressed_size) {
+		return false;
+	}
+
+	if((e.flags & ZIP_FLAG_ENCRYPTED) != 0) {
+		return false;
+	}
+
+	// The local header repeats the name and may have a different extra field
+	// so only the central directory sizes are trusted
+	if(
+		e.local_header_offset > _zip_bytes.size() ||
+		_zip_bytes.size() - e.local_header_offset < ZIP_LOCAL_HEADER_SIZE
+	) {
+		return false;
+	}
+
+	auto local_header = _zip_bytes.subspan(e.local_header_offset);
+	if(load_le<std::uint32_t>(local_header, 0) != ZIP_LOCAL_HEADER_SIGNATURE) {
+		return false;
+	}
+
+	auto data_offset = ZIP_LOCAL_HEADER_SIZE +
+		load_le<std::uint16_t>(local_header, 26) +
+		load_le<std::uint16_t>(local_header, 28);
+	if(
+		data_offset > local_header.size() ||
+		e.compressed_size > local_header.size() - data_offset
+	) {
+		return false;
+	}
+
+	auto compressed = local_header.subspan(data_offset, e.compressed_size);
+
+	switch(e.compression_method) {
+		case ZIP_METHOD_STORED:
+			if(compressed.size() != out.size()) {
+				return false;
+			}
+			std::ranges::copy(compressed, out.begin());
+			break;
+		case ZIP_METHOD_DEFLATE: {
+			auto decomp = libdeflate_alloc_decompressor();
+			UNUSED(auto) = defer([&] { libdeflate_free_decompressor(decomp); });
+
+			auto result = libdeflate_deflate_decompress(
+				decomp,
+				compressed.data(),
+				compressed.size(),
+				out.data(),
+				out.size(),
+				nullptr
+			);
+			if(result != LIBDEFLATE_SUCCESS) {
+				return false;
+			}
+			break;
+		}
+		default:
+			return false;
+	}
+
+	return libdeflate_crc32(0, out.data(), out.size()) == e.crc32;
+}
+
+auto bzlreg::zip_view::string( //
+	const entry& e
+) const -> std::optional<std::string> {
+	if(e.uncompressed_size > ZIP_MAX_STRING_SIZE) {
+		return std::nullopt;
+	}
+
+	auto str = std::string{};
+	str.resize(e.uncompressed_size);
+
+	if(!read(e, std::as_writable_bytes(std::span{str}))) {
+		return std::nullopt;
+	}
+
+	return str;
+}
+
+auto bzlreg::zip_view::error_message() const noexcept -> std::string_view {
+	return _error_message;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <span>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <optional>
+#include <vector>
+
+namespace bzlreg {
+/**
+ * Random access view of a zip archive. Only the end of central directory
+ * record and the central directory are read up front. Members are inflated
+ * one at a time on demand.
+ */
+class zip_view {
+public:
+	struct entry {
+		/**
+		 * Views into the central directory of the archive
+		 */
+		std::string_view name;
+		std::uint64_t    compressed_size;
+		std::uint64_t    uncompressed_size;
+		std::uint64_t    local_header_offset;
+		std::uint32_t    crc32;
+		std::uint32_t    external_attributes;
+		std::uint16_t    version_made_by;
+		std::uint16_t    compression_method;
+		std::uint16_t    flags;
+
+		auto is_directory() const noexcept -> bool;
+		auto is_symbolic_link() const noexcept -> bool;
+
+		/**
+		 * Permission bits stored by unix archivers, 0644 if there are none
+		 */
+		auto mode() const noexcept -> std::uint32_t;
+	};
+
+private:
+	std::span<const std::byte> _zip_bytes;
+	std::vector<entry>         _entries;
+	std::string                _error_message;
+
+	auto parse() -> std::string_view;
+
+public:
+	zip_view(std::span<const std::byte> zip_bytes);
+	zip_view(zip_view&&) noexcept;
+	zip_view(const zip_view&) = delete;
+	~zip_view();
+
+	/**
+	 * `false` if the central directory couldn't be read. See
+	 * `error_message()`.
+	 */
+	operator bool() const noexcept;
+
+	auto entries() const noexcept -> std::span<const entry>;
+
+	/**
+	 * Linear scan of the central directory for `name`
+	 */
+	auto find(std::string_view name) const noexcept -> const entry*;
+
+	/**
+	 * Inflates `e` into `out` and checks its CRC-32. `out` must be exactly
+	 * `e.uncompressed_size` bytes.
+	 */
+	auto read(const entry& e, std::span<std::byte> out) const -> bool;
+
+	/**
+	 * Inflates `e` into a string. `std::nullopt` for members too large to be
+	 * the small text files this is meant for.
+	 */
+	auto string(const entry& e) const -> std::optional<std::string>;
+
+	auto error_message() const noexcept -> std::string_view;
+};
+} // namespace bzlreg
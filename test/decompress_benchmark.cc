@@ -0,0 +1,338 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <memory>
+#include <print>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "lzma.h"
+#include "zlib.h"
+#include "zstd.h"
+#include "bzlreg/decompress.hh"
+
+/**
+ * Uncompressed size of the generated archive unless given on the command
+ * line
+ */
+constexpr auto DEFAULT_SIZE_MIB = std::size_t{128};
+constexpr auto BENCHMARK_RUNS = 3;
+
+/**
+ * Fast presets since the fixtures are compressed on every run
+ */
+constexpr auto ZSTD_FIXTURE_LEVEL = 3;
+constexpr auto XZ_FIXTURE_PRESET = std::uint32_t{1};
+
+/**
+ * Independent frames and blocks, the way `zstd -T0` and `xz -T0` split their
+ * output, so they can be decoded in parallel
+ */
+constexpr auto ZSTD_FIXTURE_FRAME_COUNT = std::size_t{16};
+constexpr auto XZ_FIXTURE_BLOCK_SIZE = std::uint64_t{8} * 1024 * 1024;
+
+/**
+ * Source-like text that compresses to roughly a quarter like the archives in
+ * a registry do
+ */
+static auto generate_data(std::size_t size) -> std::vector<std::byte> {
+	constexpr auto WORDS = std::array<std::string_view, 24>{
+		"auto",     "const",  "return", "std::string_view", "if",    "for",
+		"bzlreg",   "module", "name",   "version",          "=",     "(",
+		")",        "{",      "}",      ";",                "\n\t",  "\n",
+		"registry", "// ",    "0",      "1",                "->",    "::",
+	};
+
+	auto rng = std::mt19937_64{42};
+	auto data = std::vector<std::byte>{};
+	data.reserve(size + 64);
+	while(data.size() < size) {
+		// Mostly common words with some noise so not everything is a match
+		auto word = WORDS[std::min(rng() % 32, rng() % 32) % WORDS.size()];
+		for(auto c : word) {
+			data.push_back(static_cast<std::byte>(c));
+		}
+		if(rng() % 4 == 0) {
+			data.push_back(static_cast<std::byte>('a' + rng() % 26));
+		}
+		data.push_back(std::byte{' '});
+	}
+	data.resize(size);
+	return data;
+}
+
+/**
+ * Compresses `data` into one gzip member per part the way `gzip -6` does
+ */
+static auto gzip_compress( //
+	std::span<const std::byte> data,
+	std::size_t                member_count = 1
+) -> std::vector<std::byte> {
+	auto compressed = std::vector<std::byte>{};
+	auto part_size = (data.size() + member_count - 1) / member_count;
+	for(auto offset = std::size_t{0}; offset < data.size(); offset += part_size) {
+		auto part = data.subspan(offset, std::min(part_size, data.size() - offset));
+
+		auto strm = z_stream{};
+		deflateInit2(&strm, 6, Z_DEFLATED, 16 + MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+		auto begin = compressed.size();
+		compressed.resize(begin + deflateBound(&strm, part.size()));
+		strm.next_in = reinterpret_cast<Bytef*>( //
+			const_cast<std::byte*>(part.data())
+		);
+		strm.avail_in = static_cast<uInt>(part.size());
+		strm.next_out = reinterpret_cast<Bytef*>(compressed.data() + begin);
+		strm.avail_out = static_cast<uInt>(compressed.size() - begin);
+		deflate(&strm, Z_FINISH);
+		compressed.resize(begin + strm.total_out);
+		deflateEnd(&strm);
+	}
+	return compressed;
+}
+
+/**
+ * Compresses `data` into one zstd frame per part. Frames only record their
+ * decompressed size when `with_sizes` is set.
+ */
+static auto zstd_compress( //
+	std::span<const std::byte> data,
+	std::size_t                frame_count,
+	bool                       with_sizes = true
+) -> std::vector<std::byte> {
+	auto cctx = std::unique_ptr<ZSTD_CCtx, decltype(&ZSTD_freeCCtx)>{
+		ZSTD_createCCtx(),
+		ZSTD_freeCCtx,
+	};
+	auto ctx = cctx.get();
+	ZSTD_CCtx_setParameter(ctx, ZSTD_c_compressionLevel, ZSTD_FIXTURE_LEVEL);
+	ZSTD_CCtx_setParameter(ctx, ZSTD_c_contentSizeFlag, with_sizes);
+	ZSTD_CCtx_setParameter(ctx, ZSTD_c_checksumFlag, 1);
+
+	auto compressed = std::vector<std::byte>{};
+	auto part_size = (data.size() + frame_count - 1) / frame_count;
+	for(auto offset = std::size_t{0}; offset < data.size(); offset += part_size) {
+		auto part = data.subspan(offset, std::min(part_size, data.size() - offset));
+		auto begin = compressed.size();
+		compressed.resize(begin + ZSTD_compressBound(part.size()));
+		auto size = ZSTD_compress2(
+			cctx.get(),
+			compressed.data() + begin,
+			compressed.size() - begin,
+			part.data(),
+			part.size()
+		);
+		compressed.resize(begin + size);
+	}
+	return compressed;
+}
+
+/**
+ * Compresses `data` into one xz stream. With `block_size` the data is split
+ * into blocks of that size which record their sizes, letting the threaded
+ * decoder work on several at once. Otherwise everything is one block.
+ */
+static auto xz_compress( //
+	std::span<const std::byte> data,
+	std::uint64_t              block_size = 0
+) -> std::vector<std::byte> {
+	auto strm = lzma_stream LZMA_STREAM_INIT;
+	auto mt = lzma_mt{
+		.threads = std::max(std::thread::hardware_concurrency(), 1u),
+		.block_size = block_size,
+		.preset = XZ_FIXTURE_PRESET,
+		.check = LZMA_CHECK_CRC64,
+	};
+	auto ret = block_size > 0
+		? lzma_stream_encoder_mt(&strm, &mt)
+		: lzma_easy_encoder(&strm, XZ_FIXTURE_PRESET, LZMA_CHECK_CRC64);
+	if(ret != LZMA_OK) {
+		return {};
+	}
+
+	auto compressed =
+		std::vector<std::byte>(lzma_stream_buffer_bound(data.size()));
+	strm.next_in = reinterpret_cast<const std::uint8_t*>(data.data());
+	strm.avail_in = data.size();
+	strm.next_out = reinterpret_cast<std::uint8_t*>(compressed.data());
+	strm.avail_out = compressed.size();
+	while(ret == LZMA_OK) {
+		ret = lzma_code(&strm, LZMA_FINISH);
+	}
+	compressed.resize(ret == LZMA_STREAM_END ? strm.total_out : 0);
+	lzma_end(&strm);
+	return compressed;
+}
+
+static auto decompress( //
+	std::span<const std::byte> compressed,
+	unsigned                   thread_count,
+	std::vector<std::byte>&    out
+) -> bzlreg::decompress_status {
+	out.clear();
+	auto sink = [&](std::span<const std::byte> chunk) {
+		out.insert(out.end(), chunk.begin(), chunk.end());
+		return true;
+	};
+	if(thread_count == 0) {
+		return bzlreg::decompress_archive(compressed, sink);
+	}
+	return bzlreg::decompress_archive_parallel(compressed, sink, thread_count);
+}
+
+/**
+ * Checks the parallel path against the single threaded one, including when
+ * both are expected to fail
+ */
+static auto check( //
+	std::string_view           name,
+	std::span<const std::byte> compressed,
+	unsigned                   thread_count,
+	std::span<const std::byte> data = {}
+) -> bool {
+	auto expected = std::vector<std::byte>{};
+	auto actual = std::vector<std::byte>{};
+	auto expected_status = decompress(compressed, 0, expected);
+	auto actual_status = decompress(compressed, thread_count, actual);
+
+	if(actual_status != expected_status) {
+		std::println(stderr, "FAIL: {} returned a different status", name);
+		return false;
+	}
+
+	if(expected_status == bzlreg::decompress_status::ok && actual != expected) {
+		std::println(stderr, "FAIL: {} output differs", name);
+		return false;
+	}
+
+	if(!data.empty() && !std::ranges::equal(expected, data)) {
+		std::println(stderr, "FAIL: {} doesn't round trip", name);
+		return false;
+	}
+
+	std::println("ok: {}", name);
+	return true;
+}
+
+/**
+ * Checks a truncated and a corrupted copy of `compressed` too
+ */
+static auto check_damaged( //
+	std::string_view           format,
+	std::span<const std::byte> compressed,
+	unsigned                   thread_count
+) -> bool {
+	auto passed = true;
+
+	auto truncated = compressed.first(compressed.size() * 3 / 4);
+	passed &= check(std::format("{} truncated", format), truncated, thread_count);
+
+	auto corrupted = std::vector(compressed.begin(), compressed.end());
+	corrupted[corrupted.size() / 2] ^= std::byte{0x55};
+	passed &= check(std::format("{} corrupted", format), corrupted, thread_count);
+
+	return passed;
+}
+
+static auto benchmark( //
+	std::string_view           name,
+	std::span<const std::byte> compressed,
+	std::size_t                data_size,
+	unsigned                   max_threads
+) -> void {
+	std::println(
+		"{}: {} MiB compressed to {} MiB",
+		name,
+		data_size / (1024 * 1024),
+		compressed.size() / (1024 * 1024)
+	);
+
+	auto out = std::vector<std::byte>{};
+	out.reserve(data_size);
+	auto baseline = 0.0;
+	std::println("{:>8} {:>10} {:>8}", "threads", "MiB/s", "speedup");
+	for(auto thread_count = 0u; thread_count <= max_threads;
+			thread_count = thread_count == 0 ? 2 : thread_count * 2) {
+		auto best = std::chrono::duration<double>::max();
+		for(auto run = 0; run < BENCHMARK_RUNS; ++run) {
+			auto start = std::chrono::steady_clock::now();
+			decompress(compressed, thread_count, out);
+			best = std::min<std::chrono::duration<double>>(
+				best,
+				std::chrono::steady_clock::now() - start
+			);
+		}
+
+		auto throughput = static_cast<double>(data_size) / (1024 * 1024) /
+			best.count();
+		if(thread_count == 0) {
+			baseline = throughput;
+		}
+		std::println(
+			"{:>8} {:>10.1f} {:>7.2f}x",
+			thread_count == 0 ? std::string{"serial"} : std::to_string(thread_count),
+			throughput,
+			throughput / baseline
+		);
+	}
+}
+
+auto main(int argc, char* argv[]) -> int {
+	auto size_mib = argc > 1 //
+		? static_cast<std::size_t>(std::strtoull(argv[1], nullptr, 10))
+		: DEFAULT_SIZE_MIB;
+	auto data = generate_data(size_mib * 1024 * 1024);
+	auto max_threads = std::max(std::thread::hardware_concurrency(), 2u);
+	auto passed = true;
+
+	// Fixtures are generated on every run so no archives are checked in
+	auto gzip = gzip_compress(data);
+	passed &= check("gzip single member", gzip, max_threads, data);
+	passed &= check(
+		"gzip multiple members",
+		gzip_compress(data, 5),
+		max_threads,
+		data
+	);
+
+	auto trailing = gzip;
+	trailing.insert(trailing.end(), 4096, std::byte{0});
+	passed &= check("gzip trailing zeros", trailing, max_threads);
+	passed &= check_damaged("gzip", gzip, max_threads);
+
+	auto zstd = zstd_compress(data, ZSTD_FIXTURE_FRAME_COUNT);
+	passed &= check(
+		"zstd single frame",
+		zstd_compress(data, 1),
+		max_threads,
+		data
+	);
+	passed &= check("zstd multiple frames", zstd, max_threads, data);
+	passed &= check(
+		"zstd frames without sizes",
+		zstd_compress(data, ZSTD_FIXTURE_FRAME_COUNT, false),
+		max_threads,
+		data
+	);
+	passed &= check_damaged("zstd", zstd, max_threads);
+
+	auto xz = xz_compress(data, XZ_FIXTURE_BLOCK_SIZE);
+	passed &= check("xz single block", xz_compress(data), max_threads, data);
+	passed &= check("xz multiple blocks", xz, max_threads, data);
+	passed &= check_damaged("xz", xz, max_threads);
+
+	if(!passed) {
+		return 1;
+	}
+
+	benchmark("gzip", gzip, data.size(), max_threads);
+	benchmark("zstd", zstd, data.size(), max_threads);
+	benchmark("xz", xz, data.size(), max_threads);
+
+	return 0;
+}
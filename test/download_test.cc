@@ -0,0 +1,161 @@
+#include <chrono>
+#include <cstddef>
+#include <print>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "bzlreg/download.hh"
+#include "test/http_test_server.hh"
+
+/**
+ * Large enough to be split into ranges
+ */
+constexpr auto RANGED_FILE_SIZE = std::size_t{20 * 1024 * 1024};
+constexpr auto SMALL_FILE_SIZE = std::size_t{4 * 1024 * 1024};
+constexpr auto DROP_AFTER_SIZE = std::size_t{1024 * 1024};
+constexpr auto DOWNLOAD_CONNECTIONS = 4u;
+
+static auto generate_body(std::size_t size, std::uint64_t seed)
+	-> std::string {
+	auto rng = std::mt19937_64{seed};
+	auto body = std::string(size, '\0');
+	for(auto& c : body) {
+		c = static_cast<char>(rng());
+	}
+	return body;
+}
+
+struct download_result {
+	bzlreg::download_status status;
+	std::string             body;
+};
+
+static auto download(const bzlreg::http_test_server& server) //
+	-> download_result {
+	auto result = download_result{};
+	result.status = bzlreg::download_file_stream(
+		server.url("/file"),
+		[&](std::span<const std::byte> chunk) {
+			result.body.append(
+				reinterpret_cast<const char*>(chunk.data()),
+				chunk.size()
+			);
+			return true;
+		},
+		{
+			.timeout = std::chrono::seconds{10},
+			.connections = DOWNLOAD_CONNECTIONS,
+		}
+	);
+	return result;
+}
+
+static auto check( //
+	std::string_view        name,
+	const download_result&  result,
+	bzlreg::download_status expected_status,
+	std::string_view        expected_body
+) -> bool {
+	if(result.status != expected_status) {
+		std::println(stderr, "FAIL: {} returned a different status", name);
+		return false;
+	}
+
+	if(result.body != expected_body) {
+		std::println(stderr, "FAIL: {} body differs", name);
+		return false;
+	}
+
+	std::println("ok: {}", name);
+	return true;
+}
+
+auto main() -> int {
+	using bzlreg::download_status;
+
+	auto passed = true;
+	auto ranged = generate_body(RANGED_FILE_SIZE, 1);
+	auto small = generate_body(SMALL_FILE_SIZE, 2);
+
+	{
+		auto server = bzlreg::http_test_server{};
+		server.set_file("/file", {.body = ranged, .etag = "\"1\""});
+		passed &= check("ranges", download(server), download_status::ok, ranged);
+	}
+
+	{
+		auto server = bzlreg::http_test_server{};
+		server.set_file("/file", {.body = ranged, .etag = "\"1\""});
+		server.drop_responses(DOWNLOAD_CONNECTIONS - 1, DROP_AFTER_SIZE);
+		passed &= check(
+			"ranges resumed after failures",
+			download(server),
+			download_status::ok,
+			ranged
+		);
+	}
+
+	{
+		auto server = bzlreg::http_test_server{};
+		server.set_file("/file", {.body = small, .etag = "\"1\""});
+		server.drop_responses(2, DROP_AFTER_SIZE);
+		passed &= check(
+			"single connection resumed after failures",
+			download(server),
+			download_status::ok,
+			small
+		);
+	}
+
+	{
+		// The file changes once the first response has been sent, so only its
+		// head may reach the sink
+		auto changed = generate_body(RANGED_FILE_SIZE, 3);
+		auto server = bzlreg::http_test_server{};
+		server.set_file("/file", {.body = ranged, .etag = "\"1\""});
+		server.on_request([&](const bzlreg::http_test_request& request) {
+			if(request.index > 0) {
+				server.set_file("/file", {.body = changed, .etag = "\"2\""});
+			}
+		});
+
+		auto result = download(server);
+		passed &= check(
+			"mismatched If-Range",
+			result,
+			download_status::failed,
+			std::string_view{ranged}.substr(0, result.body.size())
+		);
+	}
+
+	{
+		auto server = bzlreg::http_test_server{};
+		server.set_file("/file", {});
+		passed &= check("empty file", download(server), download_status::ok, "");
+	}
+
+	{
+		auto server = bzlreg::http_test_server{};
+		server.set_file("/file", {.body = ranged, .ranges = false});
+		passed &= check(
+			"no range support",
+			download(server),
+			download_status::ok,
+			ranged
+		);
+	}
+
+	{
+		auto server = bzlreg::http_test_server{};
+		passed &= check(
+			"not found",
+			download(server),
+			download_status::not_found,
+			""
+		);
+	}
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+#include <array>
+#include <cstdlib>
+#include <format>
+#include <mutex>
+#include <print>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "bzlreg/http_client.hh"
+#include "test/http_test_server.hh"
+
+/**
+ * `Basic` credentials of user:pass
+ */
+constexpr auto PROXY_AUTHORIZATION = std::string_view{"Basic dXNlcjpwYXNz"};
+
+constexpr auto PROXY_ENV_NAMES = std::array{
+	"http_proxy",
+	"HTTP_PROXY",
+	"https_proxy",
+	"HTTPS_PROXY",
+	"no_proxy",
+	"NO_PROXY",
+};
+
+/**
+ * Unsets `name` when `value` is empty
+ */
+static auto set_env(const char* name, std::string_view value) -> void {
+	auto value_str = std::string{value};
+#ifdef _WIN32
+	_putenv_s(name, value_str.c_str());
+#else
+	if(value_str.empty()) {
+		unsetenv(name);
+	} else {
+		setenv(name, value_str.c_str(), 1);
+	}
+#endif
+}
+
+/**
+ * Requests seen by a server, recorded from its connection threads
+ */
+class request_log {
+	std::mutex               _mutex;
+	std::vector<std::string> _requests;
+
+public:
+	auto record(bzlreg::http_test_server& server) -> void {
+		server.on_request([this](const bzlreg::http_test_request& request) {
+			auto lock = std::scoped_lock{_mutex};
+			_requests.emplace_back(std::format(
+				"{} {} {}",
+				request.method,
+				request.target,
+				request.proxy_authorization
+			));
+		});
+	}
+
+	auto requests() -> std::vector<std::string> {
+		auto lock = std::scoped_lock{_mutex};
+		return _requests;
+	}
+};
+
+struct get_result {
+	unsigned    status = 0;
+	std::string body;
+};
+
+/**
+ * Proxies are read when a client is created, so every request gets its own
+ */
+static auto get(std::string_view url) -> get_result {
+	auto client = bzlreg::http_client{};
+	auto result = get_result{};
+	auto response = client.get(url, [&](std::span<const std::byte> chunk) {
+		result.body.append(
+			reinterpret_cast<const char*>(chunk.data()),
+			chunk.size()
+		);
+		return true;
+	});
+	if(response) {
+		result.status = response->status;
+	}
+	return result;
+}
+
+static auto check(std::string_view name, bool passed) -> bool {
+	if(!passed) {
+		std::println(stderr, "FAIL: {}", name);
+		return false;
+	}
+
+	std::println("ok: {}", name);
+	return true;
+}
+
+auto main() -> int {
+	for(auto env_name : PROXY_ENV_NAMES) {
+		set_env(env_name, "");
+	}
+
+	auto passed = true;
+	auto origin = bzlreg::http_test_server{};
+	auto proxy = bzlreg::http_test_server{};
+	auto proxy_log = request_log{};
+	origin.set_file("/file", {.body = "origin"});
+	proxy.set_file("/file", {.body = "proxy"});
+	proxy_log.record(proxy);
+
+	{
+		auto result = get(origin.url("/file"));
+		passed &= check("get", result.status == 200 && result.body == "origin");
+	}
+
+	{
+		auto result = get(origin.url("/missing"));
+		passed &= check(
+			"error bodies are discarded",
+			result.status == 404 && result.body.empty()
+		);
+	}
+
+	auto proxy_url = proxy.url("");
+	auto proxy_host = std::string_view{proxy_url}.substr(7);
+	set_env("http_proxy", std::format("http://user:pass@{}", proxy_host));
+	set_env("https_proxy", proxy_url);
+
+	{
+		auto result = get("http://example.invalid/file");
+		auto requests = proxy_log.requests();
+		passed &= check(
+			"http through a proxy",
+			result.status == 200 && result.body == "proxy" &&
+				requests.size() == 1 &&
+				requests[0] ==
+					std::format("GET http://example.invalid/file {}", PROXY_AUTHORIZATION)
+		);
+	}
+
+	{
+		// The proxy closes the tunnel, so only the CONNECT can be checked
+		get("https://example.invalid/file");
+		auto requests = proxy_log.requests();
+		passed &= check(
+			"https through a proxy tunnel",
+			requests.size() == 2 && requests[1] == "CONNECT example.invalid:443 "
+		);
+	}
+
+	set_env("no_proxy", "example.invalid,127.0.0.1");
+
+	{
+		auto result = get(origin.url("/file"));
+		passed &= check(
+			"no_proxy",
+			result.status == 200 && result.body == "origin" &&
+				proxy_log.requests().size() == 2
+		);
+	}
+
+	return passed ? 0 : 1;
+}
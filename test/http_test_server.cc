@@ -0,0 +1,303 @@
+#include "test/http_test_server.hh"
+
+#include <algorithm>
+#include <charconv>
+#include <format>
+#include <optional>
+#include <boost/asio/read_until.hpp>
+#include <boost/asio/streambuf.hpp>
+#include <boost/asio/write.hpp>
+
+namespace asio = boost::asio;
+using tcp = asio::ip::tcp;
+using boost::system::error_code;
+
+namespace {
+struct parsed_request {
+	std::string method;
+	std::string target;
+	std::string path;
+	std::string range;
+	std::string if_range;
+	std::string proxy_authorization;
+};
+
+struct byte_range {
+	std::size_t begin;
+	std::size_t end;
+};
+
+auto lowercase(std::string_view str) -> std::string {
+	auto result = std::string{str};
+	std::ranges::transform(result, result.begin(), [](unsigned char c) {
+		return static_cast<char>(c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c);
+	});
+	return result;
+}
+
+auto parse_request(std::string_view head) -> std::optional<parsed_request> {
+	auto line_end = head.find("\r\n");
+	auto request_line = head.substr(0, line_end);
+	auto method_end = request_line.find(' ');
+	if(method_end == std::string_view::npos) {
+		return std::nullopt;
+	}
+	auto target_end = request_line.find(' ', method_end + 1);
+	if(target_end == std::string_view::npos) {
+		return std::nullopt;
+	}
+
+	auto request = parsed_request{
+		.method = std::string{request_line.substr(0, method_end)},
+		.target = std::string{
+			request_line.substr(method_end + 1, target_end - method_end - 1)
+		},
+	};
+
+	// Proxies get the whole URL as the target
+	request.path = request.target;
+	auto scheme_end = request.path.find("://");
+	if(scheme_end != std::string::npos) {
+		auto path_begin = request.path.find('/', scheme_end + 3);
+		request.path = path_begin == std::string::npos
+			? std::string{"/"}
+			: request.path.substr(path_begin);
+	}
+
+	while(line_end != std::string_view::npos) {
+		head.remove_prefix(line_end + 2);
+		line_end = head.find("\r\n");
+		auto line = head.substr(0, line_end);
+		auto colon = line.find(':');
+		if(colon == std::string_view::npos) {
+			continue;
+		}
+
+		auto name = lowercase(line.substr(0, colon));
+		auto value = line.substr(colon + 1);
+		value.remove_prefix(std::min(value.find_first_not_of(' '), value.size()));
+		if(name == "range") {
+			request.range = value;
+		} else if(name == "if-range") {
+			request.if_range = value;
+		} else if(name == "proxy-authorization") {
+			request.proxy_authorization = value;
+		}
+	}
+
+	return request;
+}
+
+/**
+ * Parses `bytes=<first>-` and `bytes=<first>-<last>`. The end is clamped to
+ * `size` and `begin` may be past it.
+ */
+auto parse_range(std::string_view range, std::size_t size)
+	-> std::optional<byte_range> {
+	if(!range.starts_with("bytes=")) {
+		return std::nullopt;
+	}
+	range.remove_prefix(6);
+
+	auto result = byte_range{.end = size};
+	auto end = range.data() + range.size();
+	auto [first_end, first_ec] = std::from_chars(range.data(), end, result.begin);
+	if(first_ec != std::errc{} || first_end == end || *first_end != '-') {
+		return std::nullopt;
+	}
+
+	if(first_end + 1 != end) {
+		auto last = std::size_t{0};
+		auto [last_end, last_ec] = std::from_chars(first_end + 1, end, last);
+		if(last_ec != std::errc{} || last_end != end || last < result.begin) {
+			return std::nullopt;
+		}
+		result.end = std::min(last + 1, size);
+	}
+
+	return result;
+}
+} // namespace
+
+bzlreg::http_test_server::http_test_server()
+	: _acceptor(_ioc, tcp::endpoint{asio::ip::address_v4::loopback(), 0}) {
+	_accept_thread = std::jthread{[this] { accept_loop(); }};
+}
+
+bzlreg::http_test_server::~http_test_server() {
+	{
+		auto lock = std::scoped_lock{_mutex};
+		_stopping = true;
+	}
+
+	// Wakes up the blocking accept so it sees `_stopping`
+	auto wake = tcp::socket{_ioc};
+	auto ignored = error_code{};
+	wake.connect(_acceptor.local_endpoint(), ignored);
+	_accept_thread.join();
+
+	// Connections are only added by the accept thread
+	_connections.clear();
+}
+
+auto bzlreg::http_test_server::url(std::string_view path) const
+	-> std::string {
+	return std::format(
+		"http://127.0.0.1:{}{}",
+		_acceptor.local_endpoint().port(),
+		path
+	);
+}
+
+auto bzlreg::http_test_server::set_file( //
+	std::string    path,
+	http_test_file file
+) -> void {
+	auto lock = std::scoped_lock{_mutex};
+	_files.insert_or_assign(std::move(path), std::move(file));
+}
+
+auto bzlreg::http_test_server::on_request(request_hook hook) -> void {
+	auto lock = std::scoped_lock{_mutex};
+	_on_request = std::move(hook);
+}
+
+auto bzlreg::http_test_server::drop_responses( //
+	unsigned    count,
+	std::size_t after_size
+) -> void {
+	auto lock = std::scoped_lock{_mutex};
+	_drop_count = count;
+	_drop_after_size = after_size;
+}
+
+auto bzlreg::http_test_server::accept_loop() -> void {
+	while(true) {
+		auto socket = tcp::socket{_ioc};
+		auto ec = error_code{};
+		_acceptor.accept(socket, ec);
+
+		auto lock = std::scoped_lock{_mutex};
+		if(_stopping) {
+			return;
+		}
+		if(!ec) {
+			_connections.emplace_back([this, socket = std::move(socket)]() mutable {
+				serve(std::move(socket));
+			});
+		}
+	}
+}
+
+auto bzlreg::http_test_server::serve(tcp::socket socket) -> void {
+	auto ec = error_code{};
+	auto buffer = asio::streambuf{};
+	auto head_size = asio::read_until(socket, buffer, "\r\n\r\n", ec);
+	if(ec) {
+		return;
+	}
+
+	auto head = std::string_view{
+		static_cast<const char*>(buffer.data().data()),
+		head_size,
+	};
+	auto request = parse_request(head);
+	if(!request) {
+		return;
+	}
+
+	auto hook = request_hook{};
+	auto index = 0u;
+	{
+		auto lock = std::scoped_lock{_mutex};
+		index = _request_count++;
+		hook = _on_request;
+	}
+
+	if(hook) {
+		hook(http_test_request{
+			.index = index,
+			.method = request->method,
+			.target = request->target,
+			.path = request->path,
+			.range = request->range,
+			.if_range = request->if_range,
+			.proxy_authorization = request->proxy_authorization,
+		});
+	}
+
+	// Nothing is tunneled, a client asking is all tests look for
+	if(request->method == "CONNECT") {
+		constexpr auto established =
+			std::string_view{"HTTP/1.1 200 Connection established\r\n\r\n"};
+		asio::write(socket, asio::buffer(established), ec);
+		socket.shutdown(tcp::socket::shutdown_both, ec);
+		return;
+	}
+
+	auto file = std::optional<http_test_file>{};
+	auto drop_after_size = std::optional<std::size_t>{};
+	{
+		auto lock = std::scoped_lock{_mutex};
+		if(auto itr = _files.find(request->path); itr != _files.end()) {
+			file = itr->second;
+		}
+		if(file && _drop_count > 0) {
+			_drop_count -= 1;
+			drop_after_size = _drop_after_size;
+		}
+	}
+
+	auto status = std::string_view{"200 OK"};
+	auto headers = std::string{};
+	auto body = std::string_view{};
+
+	if(!file) {
+		status = "404 Not Found";
+	} else {
+		body = file->body;
+		if(!file->etag.empty()) {
+			headers += std::format("ETag: {}\r\n", file->etag);
+		}
+
+		// A validator that doesn't match asks for the whole new file
+		auto range = file->ranges && !request->range.empty() &&
+				(request->if_range.empty() || request->if_range == file->etag)
+			? parse_range(request->range, body.size())
+			: std::nullopt;
+		if(range && range->begin >= body.size()) {
+			status = "416 Range Not Satisfiable";
+			headers += std::format("Content-Range: bytes */{}\r\n", body.size());
+			body = {};
+		} else if(range) {
+			status = "206 Partial Content";
+			headers += std::format(
+				"Content-Range: bytes {}-{}/{}\r\n",
+				range->begin,
+				range->end - 1,
+				body.size()
+			);
+			body = body.substr(range->begin, range->end - range->begin);
+		}
+	}
+
+	auto response_head = std::format(
+		"HTTP/1.1 {}\r\n"
+		"Content-Length: {}\r\n"
+		"Connection: close\r\n"
+		"{}\r\n",
+		status,
+		body.size(),
+		headers
+	);
+	if(drop_after_size) {
+		body = body.substr(0, std::min(*drop_after_size, body.size()));
+	}
+
+	// The client may hang up early, which isn't an error here
+	asio::write(socket, asio::buffer(response_head), ec);
+	if(!ec) {
+		asio::write(socket, asio::buffer(body), ec);
+	}
+	socket.shutdown(tcp::socket::shutdown_both, ec);
+}
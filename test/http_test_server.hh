@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+
+namespace bzlreg {
+struct http_test_file {
+	std::string body;
+
+	/**
+	 * Sent as the ETag header and compared against If-Range. No ETag is sent
+	 * when empty.
+	 */
+	std::string etag;
+
+	/**
+	 * Answer Range requests with 206, otherwise the whole body is sent with 200
+	 */
+	bool ranges = true;
+};
+
+struct http_test_request {
+	/**
+	 * Counts requests from 0 in the order they were received
+	 */
+	unsigned         index;
+	std::string_view method;
+
+	/**
+	 * Request target as sent. A URL when the server is used as a proxy, in
+	 * which case `path` is its path.
+	 */
+	std::string_view target;
+	std::string_view path;
+	std::string_view range;
+	std::string_view if_range;
+	std::string_view proxy_authorization;
+};
+
+/**
+ * HTTP/1.1 server on a random port of 127.0.0.1 serving files from memory.
+ * Every connection is answered on its own thread and closed after one
+ * response. Tests use it to check the client against ranges, validators and
+ * failures a real server may produce. It also acts as a forward proxy for
+ * plain HTTP, serving its own files for any host, and accepts CONNECT
+ * without tunneling anything.
+ */
+class http_test_server {
+public:
+	using request_hook = std::function<void(const http_test_request&)>;
+
+private:
+	boost::asio::io_context        _ioc;
+	boost::asio::ip::tcp::acceptor _acceptor;
+
+	std::mutex                                      _mutex;
+	std::unordered_map<std::string, http_test_file> _files;
+	request_hook                                    _on_request;
+	unsigned                                        _request_count = 0;
+	unsigned                                        _drop_count = 0;
+	std::size_t                                     _drop_after_size = 0;
+	bool                                            _stopping = false;
+	std::vector<std::jthread>                       _connections;
+
+	std::jthread _accept_thread;
+
+	auto accept_loop() -> void;
+	auto serve(boost::asio::ip::tcp::socket socket) -> void;
+
+public:
+	http_test_server();
+	http_test_server(const http_test_server&) = delete;
+	~http_test_server();
+
+	/**
+	 * `http://127.0.0.1:<port><path>`
+	 */
+	auto url(std::string_view path) const -> std::string;
+
+	auto set_file(std::string path, http_test_file file) -> void;
+
+	/**
+	 * Called on the connection's thread before a request is answered, so files
+	 * it sets are what that request gets
+	 */
+	auto on_request(request_hook hook) -> void;
+
+	/**
+	 * Closes the connection after `after_size` body bytes for the next `count`
+	 * responses with a body, as if the network failed mid transfer
+	 */
+	auto drop_responses(unsigned count, std::size_t after_size) -> void;
+};
+} // namespace bzlreg
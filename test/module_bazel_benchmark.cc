@@ -0,0 +1,121 @@
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <print>
+#include <string>
+#include <system_error>
+#include <vector>
+#include "bzlreg/module_bazel.hh"
+#include "bzlreg/util.hh"
+
+namespace fs = std::filesystem;
+
+constexpr auto BENCHMARK_RUNS = 5;
+
+struct module_bazel_file {
+	fs::path    path;
+	std::string contents;
+};
+
+/**
+ * Every `modules/<name>/<version>/MODULE.bazel` of the registry, read up front
+ * so only parsing is timed
+ */
+static auto read_registry(const fs::path& registry_dir)
+	-> std::vector<module_bazel_file> {
+	auto files = std::vector<module_bazel_file>{};
+	auto ec = std::error_code{};
+	for(auto itr = fs::recursive_directory_iterator{registry_dir / "modules", ec};
+			!ec && itr != fs::recursive_directory_iterator{};
+			itr.increment(ec)) {
+		if(itr->path().filename() != "MODULE.bazel") {
+			continue;
+		}
+
+		auto& file = files.emplace_back(itr->path());
+		auto read_ec = std::error_code{};
+		bzlreg::read_file_contents(file.path, file.contents, read_ec);
+		if(read_ec) {
+			std::println(
+				stderr,
+				"FAIL: unable to read {}: {}",
+				file.path.generic_string(),
+				read_ec.message()
+			);
+			files.pop_back();
+		}
+	}
+	return files;
+}
+
+/**
+ * Parses every MODULE.bazel of a registry, such as a checkout of the Bazel
+ * Central Registry, and reports the parser's throughput. Every file has to
+ * parse for the run to pass.
+ */
+auto main(int argc, char* argv[]) -> int {
+	if(argc < 2) {
+		std::println(stderr, "usage: module_bazel_benchmark <registry-dir>");
+		return 1;
+	}
+
+	auto files = read_registry(argv[1]);
+	if(files.empty()) {
+		std::println(stderr, "FAIL: no MODULE.bazel files in {}", argv[1]);
+		return 1;
+	}
+
+	auto total_size = std::size_t{0};
+	auto failures = 0;
+	for(const auto& file : files) {
+		total_size += file.contents.size();
+		auto module = bzlreg::module_bazel::parse(file.contents);
+		if(!module) {
+			std::println(
+				stderr,
+				"FAIL: {}",
+				module.error().describe(file.path.generic_string())
+			);
+			failures += 1;
+		}
+	}
+
+	if(failures > 0) {
+		std::println(
+			stderr,
+			"FAIL: {} of {} MODULE.bazel files didn't parse",
+			failures,
+			files.size()
+		);
+		return 1;
+	}
+	std::println("ok: parsed {} MODULE.bazel files", files.size());
+
+	auto best = std::chrono::duration<double>::max();
+	auto dep_count = std::size_t{0};
+	for(auto run = 0; run < BENCHMARK_RUNS; ++run) {
+		dep_count = 0;
+		auto start = std::chrono::steady_clock::now();
+		for(const auto& file : files) {
+			auto module = bzlreg::module_bazel::parse(file.contents);
+			dep_count += module->bazel_deps.size();
+		}
+		best = std::min<std::chrono::duration<double>>(
+			best,
+			std::chrono::steady_clock::now() - start
+		);
+	}
+
+	std::println(
+		"{} files, {:.2f} MiB and {} bazel_deps in {:.2f} ms: {:.1f} MiB/s, "
+		"{:.0f} files/s",
+		files.size(),
+		static_cast<double>(total_size) / (1024 * 1024),
+		dep_count,
+		best.count() * 1000,
+		static_cast<double>(total_size) / (1024 * 1024) / best.count(),
+		static_cast<double>(files.size()) / best.count()
+	);
+
+	return 0;
+}
@@ -0,0 +1,247 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <optional>
+#include <print>
+#include <random>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <boost/process/v1.hpp>
+#include "bzlreg/defer.hh"
+#include "bzlreg/module_bazel.hh"
+#include "bzlreg/module_bazel_edit.hh"
+#include "bzlreg/util.hh"
+
+namespace fs = std::filesystem;
+namespace bp = boost::process;
+using bzlreg::util::defer;
+
+/**
+ * bazel_deps in the generated MODULE.bazel unless given on the command line
+ */
+constexpr auto DEFAULT_DEP_COUNT = std::size_t{80};
+/**
+ * Runs of each edit, the fastest of which is reported
+ */
+constexpr auto BENCHMARK_RUNS = 3;
+
+/**
+ * Version every bazel_dep starts at and is updated to
+ */
+constexpr auto OLD_VERSION = std::string_view{"1.0.0"};
+constexpr auto NEW_VERSION = std::string_view{"2.0.0"};
+
+/**
+ * MODULE.bazel with a bazel_dep at `version` for each name, along with
+ * comments and other calls the edit has to keep
+ */
+static auto generate_module_bazel( //
+	std::span<const std::string> dep_names,
+	std::string_view             version
+) -> std::string {
+	auto contents =
+		std::string{"module(name = \"benchmark\", version = \"1.0.0\")\n\n"};
+	for(const auto& name : dep_names) {
+		contents += std::format(
+			"# {} is needed by something\n"
+			"bazel_dep(name = \"{}\", version = \"{}\")\n",
+			name,
+			name,
+			version
+		);
+	}
+	contents +=
+		"\next = use_extension(\"//:ext.bzl\", \"ext\")\n"
+		"use_repo(ext, \"repo\")\n";
+	return contents;
+}
+
+/**
+ * Whether every bazel_dep of the MODULE.bazel at `path` is at `version` and
+ * none were added or lost
+ */
+static auto has_versions( //
+	const fs::path&  path,
+	std::size_t      dep_count,
+	std::string_view version
+) -> bool {
+	auto contents = std::string{};
+	auto ec = std::error_code{};
+	bzlreg::read_file_contents(path, contents, ec);
+	if(ec) {
+		return false;
+	}
+
+	auto module = bzlreg::module_bazel::parse(contents);
+	if(!module || module->bazel_deps.size() != dep_count) {
+		return false;
+	}
+
+	return std::ranges::all_of(module->bazel_deps, [&](const auto& dep) {
+		return dep.version == version;
+	});
+}
+
+/**
+ * What `bzlmod update` does now
+ */
+static auto edit_in_process( //
+	const fs::path&                            path,
+	std::span<const bzlreg::bazel_dep_version> versions
+) -> bool {
+	auto contents = std::string{};
+	auto ec = std::error_code{};
+	bzlreg::read_file_contents(path, contents, ec);
+	if(ec) {
+		return false;
+	}
+
+	auto module = bzlreg::module_bazel::parse(contents);
+	if(!module) {
+		return false;
+	}
+
+	return bzlreg::write_file_atomic(
+		path,
+		bzlreg::set_bazel_dep_versions(contents, *module, versions)
+	);
+}
+
+/**
+ * What `bzlmod update` did before editing in process: one buildozer run to
+ * print the deps, then a `new bazel_dep` and a `set version` run per dep
+ */
+static auto edit_with_buildozer( //
+	const fs::path&                            buildozer,
+	const fs::path&                            dir,
+	std::span<const bzlreg::bazel_dep_version> versions
+) -> bool {
+	auto run = [&](std::vector<std::string> args) -> int {
+		return bp::system(
+			bp::exe(buildozer.string()),
+			bp::args(std::move(args)),
+			bp::start_dir(dir.string()),
+			bp::std_out > bp::null,
+			bp::std_err > bp::null
+		);
+	};
+
+	run({"print name version", "//MODULE.bazel:%bazel_dep"});
+	for(const auto& dep : versions) {
+		// Fails for deps that exist already, which is all of them here
+		run({std::format("new bazel_dep {}", dep.name), "//MODULE.bazel:all"});
+
+		auto exit_code = run({
+			std::format("set version {}", dep.version),
+			std::format("//MODULE.bazel:{}", dep.name),
+		});
+		if(exit_code != 0) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/**
+ * Best time of `edit` over a fresh copy of `original` each run. `std::nullopt`
+ * if an edit failed or left the wrong versions behind.
+ */
+static auto time_edit( //
+	const fs::path&              path,
+	std::string_view             original,
+	std::size_t                  dep_count,
+	const std::function<bool()>& edit
+) -> std::optional<std::chrono::duration<double>> {
+	auto best = std::chrono::duration<double>::max();
+	for(auto run = 0; run < BENCHMARK_RUNS; ++run) {
+		if(!bzlreg::write_file_atomic(path, original)) {
+			return std::nullopt;
+		}
+
+		auto start = std::chrono::steady_clock::now();
+		auto edited = edit();
+		best = std::min<std::chrono::duration<double>>(
+			best,
+			std::chrono::steady_clock::now() - start
+		);
+
+		if(!edited || !has_versions(path, dep_count, NEW_VERSION)) {
+			return std::nullopt;
+		}
+	}
+	return best;
+}
+
+/**
+ * Compares updating every bazel_dep of a generated MODULE.bazel in process
+ * with the buildozer runs it replaced. Set BUILDOZER or put buildozer on the
+ * PATH for the comparison, otherwise only the in process edit is checked.
+ */
+auto main(int argc, char* argv[]) -> int {
+	auto dep_count = argc > 1 //
+		? static_cast<std::size_t>(std::strtoull(argv[1], nullptr, 10))
+		: DEFAULT_DEP_COUNT;
+
+	auto dep_names = std::vector<std::string>{};
+	auto versions = std::vector<bzlreg::bazel_dep_version>{};
+	dep_names.reserve(dep_count);
+	for(auto i = std::size_t{0}; i < dep_count; ++i) {
+		auto& name = dep_names.emplace_back(std::format("dep_{}", i));
+		versions.emplace_back(name, NEW_VERSION);
+	}
+
+	auto dir = fs::temp_directory_path() /
+		std::format("module_bazel_edit_benchmark-{:x}", std::random_device{}());
+	fs::create_directories(dir);
+	auto remove_dir = defer([&] {
+		auto ec = std::error_code{};
+		fs::remove_all(dir, ec);
+	});
+
+	auto path = dir / "MODULE.bazel";
+	auto original = generate_module_bazel(dep_names, OLD_VERSION);
+
+	auto in_process = time_edit(path, original, dep_count, [&] {
+		return edit_in_process(path, versions);
+	});
+	if(!in_process) {
+		std::println(stderr, "FAIL: in process edit");
+		return 1;
+	}
+	std::println("ok: in process edit");
+
+	auto buildozer_env = std::getenv("BUILDOZER");
+	auto buildozer = buildozer_env != nullptr //
+		? fs::path{buildozer_env}
+		: fs::path{bp::search_path("buildozer").string()};
+	if(buildozer.empty()) {
+		std::println(
+			"{} deps in process: {:.2f} ms, buildozer not found to compare with",
+			dep_count,
+			in_process->count() * 1000
+		);
+		return 0;
+	}
+
+	auto with_buildozer = time_edit(path, original, dep_count, [&] {
+		return edit_with_buildozer(buildozer, dir, versions);
+	});
+	if(!with_buildozer) {
+		std::println(stderr, "FAIL: buildozer edit");
+		return 1;
+	}
+
+	std::println(
+		"{} deps in process: {:.2f} ms, with buildozer: {:.2f} ms, {:.0f}x faster",
+		dep_count,
+		in_process->count() * 1000,
+		with_buildozer->count() * 1000,
+		*with_buildozer / *in_process
+	);
+	return 0;
+}
@@ -8,6 +8,11 @@ BAZEL_BIN=$(bazelisk info bazel-bin)
 
 BZLREG="${BZLREG:-$BAZEL_BIN/bzlreg/bzlreg}"
 BZLMOD="${BZLMOD:-$BAZEL_BIN/bzlmod/bzlmod}"
+DECOMPRESS_BENCHMARK="${DECOMPRESS_BENCHMARK:-$BAZEL_BIN/test/decompress_benchmark}"
+DOWNLOAD_TEST="${DOWNLOAD_TEST:-$BAZEL_BIN/test/download_test}"
+HTTP_CLIENT_TEST="${HTTP_CLIENT_TEST:-$BAZEL_BIN/test/http_client_test}"
+MODULE_BAZEL_BENCHMARK="${MODULE_BAZEL_BENCHMARK:-$BAZEL_BIN/test/module_bazel_benchmark}"
+MODULE_BAZEL_EDIT_BENCHMARK="${MODULE_BAZEL_EDIT_BENCHMARK:-$BAZEL_BIN/test/module_bazel_edit_benchmark}"
 
 TEST_REG_DIR="$PWD/$SCRIPT_DIR/reg"
 TEST_MODULE_DIR="$PWD/$SCRIPT_DIR/module"
@@ -15,6 +20,15 @@ TEST_MODULE_DIR="$PWD/$SCRIPT_DIR/module"
 rm -rf $TEST_REG_DIR
 rm -rf $TEST_MODULE_DIR
 
+echo checking and benchmarking gzip, zstd and xz decompression
+$DECOMPRESS_BENCHMARK
+
+echo checking range downloads against a local server
+$DOWNLOAD_TEST
+
+echo checking http client and proxies against a local server
+$HTTP_CLIENT_TEST
+
 echo initializing test registry
 $BZLREG init $TEST_REG_DIR
 echo adding rules_cc to test registry
@@ -23,6 +37,15 @@ $BZLREG add-module https://github.com/bazelbuild/rules_cc/releases/download/0.0.
 echo adding known problem-some archive
 $BZLREG add-module https://github.com/ecsact-dev/ecsact_lang_cpp/releases/download/0.3.4/ecsact_lang_cpp-0.3.4.tar.gz --registry=$TEST_REG_DIR
 
+# Point BENCHMARK_REGISTRY_DIR at a checkout of a large registry, such as the
+# Bazel Central Registry, for meaningful numbers
+echo checking and benchmarking MODULE.bazel parsing
+$MODULE_BAZEL_BENCHMARK "${BENCHMARK_REGISTRY_DIR:-$TEST_REG_DIR}"
+
+# Set BUILDOZER or put buildozer on the PATH to compare with it
+echo checking and benchmarking MODULE.bazel edits
+$MODULE_BAZEL_EDIT_BENCHMARK
+
 echo initializing test module
 $BZLMOD init $TEST_MODULE_DIR
 